@@ -0,0 +1,22 @@
+# Find the FUSE 3 library.
+
+# FUSE3_INCLUDE_DIRS - where to find <fuse.h>.
+# FUSE3_LIBRARIES - List of libraries when using libfuse3.
+# FUSE3_FOUND - True if libfuse3 found.
+
+if(FUSE3_INCLUDE_DIRS)
+	# Already in cache, be silent
+	set(FUSE3_FIND_QUIETLY YES)
+endif()
+
+find_path(FUSE3_INCLUDE_DIRS fuse.h PATH_SUFFIXES fuse3)
+find_library(FUSE3_LIBRARY NAMES fuse3 libfuse3)
+
+# handle the QUIETLY and REQUIRED arguments and set FUSE3_FOUND to TRUE if
+# all listed variables are TRUE
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(FUSE3 DEFAULT_MSG FUSE3_LIBRARY FUSE3_INCLUDE_DIRS)
+
+if(FUSE3_FOUND)
+	set(FUSE3_LIBRARIES ${FUSE3_LIBRARY})
+endif()
@@ -7,6 +7,29 @@ ELSE()
 	SET(ENABLE_UDEV OFF CACHE INTERNAL "Enable UDEV for the 'query' command." FORCE)
 ENDIF()
 
+# Enable io_uring on Linux.
+IF(CMAKE_SYSTEM_NAME STREQUAL "Linux")
+	OPTION(ENABLE_IO_URING "Enable io_uring for extracting and importing banks." ON)
+ELSE()
+	SET(ENABLE_IO_URING OFF CACHE INTERNAL "Enable io_uring for extracting and importing banks." FORCE)
+ENDIF()
+
+# Build the FUSE file system. (requires libfuse3)
+IF(UNIX)
+	OPTION(ENABLE_FUSE "Build rvthfuse, which mounts RVT-H banks using FUSE." ON)
+ELSE()
+	SET(ENABLE_FUSE OFF CACHE INTERNAL "Build rvthfuse, which mounts RVT-H banks using FUSE." FORCE)
+ENDIF()
+
+# Enable hardware-accelerated AES and SHA-1 on x86 and x86_64.
+STRING(TOLOWER "${CMAKE_SYSTEM_PROCESSOR}" arch)
+IF(arch MATCHES "^(i.|x)86$|^x86_64$|^amd64$")
+	OPTION(ENABLE_X86_SIMD "Enable AES-NI, VAES, SHA-NI, and SIMD SHA-1 on x86." ON)
+ELSE()
+	SET(ENABLE_X86_SIMD OFF CACHE INTERNAL "Enable AES-NI, VAES, SHA-NI, and SIMD SHA-1 on x86." FORCE)
+ENDIF()
+UNSET(arch)
+
 # Enable D-Bus for DockManager / Unity API.
 IF(UNIX AND NOT APPLE)
 	OPTION(ENABLE_DBUS	"Enable D-Bus support for DockManager / Unity API." 1)
@@ -0,0 +1,349 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * DigestQueue.cpp: Compute CRC32, MD5, and SHA-1 in background threads.  *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "DigestQueue.hpp"
+#include "rvth.hpp"
+#include "aligned_malloc.h"
+
+// Nettle
+#include <nettle/md5.h>
+#include <nettle/sha1.h>
+
+// C includes. (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+// C++ includes.
+#include <system_error>
+using std::lock_guard;
+using std::mutex;
+using std::unique_lock;
+
+// Zero buffer for updateZero().
+static const uint8_t zero_buf[4096] = {0};
+
+/**
+ * CRC32 lookup tables for slicing-by-8.
+ * Polynomial 0xEDB88320 (reflected), as used by zlib and Redump.
+ */
+class Crc32Table
+{
+	public:
+		Crc32Table()
+		{
+			for (unsigned int i = 0; i < 256; i++) {
+				uint32_t crc = i;
+				for (unsigned int j = 0; j < 8; j++) {
+					crc = (crc >> 1) ^ (0xEDB88320U & (0U - (crc & 1)));
+				}
+				t[0][i] = crc;
+			}
+			for (unsigned int i = 0; i < 256; i++) {
+				for (unsigned int k = 1; k < 8; k++) {
+					t[k][i] = (t[k-1][i] >> 8) ^ t[0][t[k-1][i] & 0xFF];
+				}
+			}
+		}
+
+		uint32_t t[8][256];
+};
+
+/**
+ * Create a digest queue.
+ * Call start() to start the worker threads.
+ * @param buf_size	[in] Buffer size, in bytes.
+ * @param depth		[in] Number of buffers.
+ */
+DigestQueue::DigestQueue(size_t buf_size, unsigned int depth)
+	: m_buf_size(buf_size)
+	, m_depth(depth >= 2 ? depth : 2)
+	, m_head(0)
+	, m_finish(false)
+	, m_size(0)
+	, m_crc32(0)
+{
+	assert(buf_size > 0);
+	memset(m_tail, 0, sizeof(m_tail));
+	memset(m_md5, 0, sizeof(m_md5));
+	memset(m_sha1, 0, sizeof(m_sha1));
+}
+
+DigestQueue::~DigestQueue()
+{
+	stop();
+	for (auto iter = m_bufs.begin(); iter != m_bufs.end(); ++iter) {
+		aligned_free(iter->data);
+	}
+}
+
+/**
+ * Allocate the buffers and start the worker threads.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int DigestQueue::start(void)
+{
+	assert(m_bufs.empty());
+	if (!m_bufs.empty()) {
+		// Already started.
+		return -EBUSY;
+	}
+
+	m_bufs.resize(m_depth);
+	for (unsigned int i = 0; i < m_depth; i++) {
+		Buffer *const buf = &m_bufs[i];
+		buf->data = static_cast<uint8_t*>(aligned_malloc(RVTH_PAGE_SIZE, m_buf_size));
+		buf->size = 0;
+		buf->zero = false;
+		if (!buf->data) {
+			// Error allocating memory.
+			return -ENOMEM;
+		}
+	}
+
+	// Start the worker threads.
+	for (unsigned int i = 0; i < ALGO_MAX; i++) {
+		try {
+			m_threads[i] = std::thread(&DigestQueue::run, this, static_cast<Algorithm>(i));
+		} catch (const std::system_error &e) {
+			// Unable to create the thread.
+			int err = e.code().value();
+			return (err > 0 ? -err : -EAGAIN);
+		}
+	}
+	return 0;
+}
+
+/**
+ * Worker thread function.
+ * @param algo	[in] Algorithm.
+ */
+void DigestQueue::run(Algorithm algo)
+{
+	uint32_t crc = 0;
+	struct md5_ctx md5;
+	struct sha1_ctx sha1;
+	uint64_t size = 0;
+
+	switch (algo) {
+		case ALGO_MD5:
+			md5_init(&md5);
+			break;
+		case ALGO_SHA1:
+			sha1_init(&sha1);
+			break;
+		default:
+			break;
+	}
+
+	for (;;) {
+		// Wait for a buffer.
+		const Buffer *buf;
+		{
+			unique_lock<mutex> lock(m_mutex);
+			m_cond.wait(lock, [this, algo] { return m_finish || m_tail[algo] < m_head; });
+			if (m_tail[algo] == m_head) {
+				// No more buffers.
+				break;
+			}
+			buf = &m_bufs[m_tail[algo] % m_depth];
+		}
+
+		// Hash the buffer.
+		uint64_t left = buf->size;
+		const uint8_t *data = buf->data;
+		while (left > 0) {
+			size_t len;
+			if (buf->zero) {
+				len = (left > sizeof(zero_buf) ? sizeof(zero_buf) : static_cast<size_t>(left));
+				data = zero_buf;
+			} else {
+				len = static_cast<size_t>(left);
+			}
+
+			switch (algo) {
+				case ALGO_CRC32:
+					crc = crc32(crc, data, len);
+					break;
+				case ALGO_MD5:
+					md5_update(&md5, len, data);
+					break;
+				case ALGO_SHA1:
+					sha1_update(&sha1, len, data);
+					break;
+				default:
+					assert(!"Invalid algorithm.");
+					break;
+			}
+			left -= len;
+		}
+		size += buf->size;
+
+		// Buffer is done.
+		{
+			lock_guard<mutex> lock(m_mutex);
+			m_tail[algo]++;
+		}
+		m_cond.notify_all();
+	}
+
+	// Save the result.
+	// NOTE: Each worker only writes its own result.
+	switch (algo) {
+		case ALGO_CRC32:
+			m_crc32 = crc;
+			m_size = size;
+			break;
+		case ALGO_MD5:
+			md5_digest(&md5, sizeof(m_md5), m_md5);
+			break;
+		case ALGO_SHA1:
+			sha1_digest(&sha1, sizeof(m_sha1), m_sha1);
+			break;
+		default:
+			break;
+	}
+}
+
+/**
+ * Stop the worker threads.
+ */
+void DigestQueue::stop(void)
+{
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_finish = true;
+	}
+	m_cond.notify_all();
+	for (unsigned int i = 0; i < ALGO_MAX; i++) {
+		if (m_threads[i].joinable()) {
+			m_threads[i].join();
+		}
+	}
+}
+
+/**
+ * Get a free buffer.
+ * This blocks until all workers are done with the oldest buffer.
+ * @return Buffer index.
+ */
+unsigned int DigestQueue::acquire(void)
+{
+	unique_lock<mutex> lock(m_mutex);
+	m_cond.wait(lock, [this] {
+		for (unsigned int i = 0; i < ALGO_MAX; i++) {
+			if (m_head - m_tail[i] >= m_depth) {
+				return false;
+			}
+		}
+		return true;
+	});
+	return static_cast<unsigned int>(m_head % m_depth);
+}
+
+/**
+ * Submit the buffer acquired by acquire().
+ * @param size	[in] Size of the data, in bytes.
+ * @param zero	[in] If true, the data is all zeroes and wasn't copied.
+ */
+void DigestQueue::submit(size_t size, bool zero)
+{
+	{
+		lock_guard<mutex> lock(m_mutex);
+		Buffer *const buf = &m_bufs[m_head % m_depth];
+		buf->size = size;
+		buf->zero = zero;
+		m_head++;
+	}
+	m_cond.notify_all();
+}
+
+/**
+ * Add data to the stream.
+ * @param data	[in] Data.
+ * @param size	[in] Size, in bytes.
+ */
+void DigestQueue::update(const void *data, size_t size)
+{
+	assert(!m_bufs.empty());
+	assert(!m_finish);
+	const uint8_t *data8 = static_cast<const uint8_t*>(data);
+	while (size > 0) {
+		const size_t len = (size > m_buf_size ? m_buf_size : size);
+		const unsigned int idx = acquire();
+		memcpy(m_bufs[idx].data, data8, len);
+		submit(len, false);
+		data8 += len;
+		size -= len;
+	}
+}
+
+/**
+ * Add zero bytes to the stream.
+ * @param size	[in] Number of zero bytes.
+ */
+void DigestQueue::updateZero(uint64_t size)
+{
+	assert(!m_bufs.empty());
+	assert(!m_finish);
+	while (size > 0) {
+		const size_t len = (size > m_buf_size ? m_buf_size : static_cast<size_t>(size));
+		acquire();
+		submit(len, true);
+		size -= len;
+	}
+}
+
+/**
+ * Wait for the worker threads to finish and get the digests.
+ * No more data can be added afterwards.
+ * @param digests	[out] Digests.
+ */
+void DigestQueue::finish(RvtH_Digests *digests)
+{
+	stop();
+	digests->size = m_size;
+	digests->crc32 = m_crc32;
+	memcpy(digests->md5, m_md5, sizeof(digests->md5));
+	memcpy(digests->sha1, m_sha1, sizeof(digests->sha1));
+}
+
+/**
+ * Compute the CRC32 of a buffer.
+ * @param crc	[in] Previous CRC32. (0 for the first buffer)
+ * @param data	[in] Data.
+ * @param size	[in] Size, in bytes.
+ * @return Updated CRC32.
+ */
+uint32_t DigestQueue::crc32(uint32_t crc, const uint8_t *data, size_t size)
+{
+	static const Crc32Table table;
+	const uint32_t (*const t)[256] = table.t;
+
+	crc = ~crc;
+
+	// Process 8 bytes at a time.
+	while (size >= 8) {
+		const uint32_t lo = crc ^ (data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24));
+		crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^
+		      t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+		      t[3][data[4]] ^ t[2][data[5]] ^
+		      t[1][data[6]] ^ t[0][data[7]];
+		data += 8;
+		size -= 8;
+	}
+
+	// Remaining bytes.
+	while (size > 0) {
+		crc = (crc >> 8) ^ t[0][(crc ^ *data) & 0xFF];
+		data++;
+		size--;
+	}
+
+	return ~crc;
+}
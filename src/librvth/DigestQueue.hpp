@@ -0,0 +1,152 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * DigestQueue.hpp: Compute CRC32, MD5, and SHA-1 in background threads.  *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_DIGESTQUEUE_HPP__
+#define __RVTHTOOL_LIBRVTH_DIGESTQUEUE_HPP__
+
+#include "libwiicrypto/common.h"
+
+// C includes.
+#include <stddef.h>
+#include <stdint.h>
+
+// C++ includes.
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct _RvtH_Digests;
+
+/**
+ * Computes the CRC32, MD5, and SHA-1 digests of a data stream,
+ * e.g. a disc image as it's being extracted.
+ *
+ * Data passed to update() is copied into a bounded ring of buffers,
+ * and each digest is computed by its own worker thread, so hashing
+ * overlaps with the caller's I/O. update() only blocks if all
+ * buffers are still being hashed.
+ *
+ * Zero-filled areas, e.g. holes in sparse images, can be added
+ * using updateZero() without copying anything.
+ */
+class DigestQueue
+{
+	public:
+		/**
+		 * Create a digest queue.
+		 * Call start() to start the worker threads.
+		 * @param buf_size	[in] Buffer size, in bytes.
+		 * @param depth		[in] Number of buffers.
+		 */
+		explicit DigestQueue(size_t buf_size = 1048576, unsigned int depth = 4);
+		~DigestQueue();
+
+	private:
+		DISABLE_COPY(DigestQueue)
+
+	public:
+		/**
+		 * Allocate the buffers and start the worker threads.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int start(void);
+
+		/**
+		 * Add data to the stream.
+		 * @param data	[in] Data.
+		 * @param size	[in] Size, in bytes.
+		 */
+		void update(const void *data, size_t size);
+
+		/**
+		 * Add zero bytes to the stream.
+		 * @param size	[in] Number of zero bytes.
+		 */
+		void updateZero(uint64_t size);
+
+		/**
+		 * Wait for the worker threads to finish and get the digests.
+		 * No more data can be added afterwards.
+		 * @param digests	[out] Digests.
+		 */
+		void finish(struct _RvtH_Digests *digests);
+
+		/**
+		 * Compute the CRC32 of a buffer.
+		 * @param crc	[in] Previous CRC32. (0 for the first buffer)
+		 * @param data	[in] Data.
+		 * @param size	[in] Size, in bytes.
+		 * @return Updated CRC32.
+		 */
+		static uint32_t crc32(uint32_t crc, const uint8_t *data, size_t size);
+
+	private:
+		// Digest algorithms. (one worker thread each)
+		enum Algorithm {
+			ALGO_CRC32,
+			ALGO_MD5,
+			ALGO_SHA1,
+
+			ALGO_MAX
+		};
+
+		/**
+		 * Worker thread function.
+		 * @param algo	[in] Algorithm.
+		 */
+		void run(Algorithm algo);
+
+		/**
+		 * Stop the worker threads.
+		 */
+		void stop(void);
+
+		/**
+		 * Get a free buffer.
+		 * This blocks until all workers are done with the oldest buffer.
+		 * @return Buffer index.
+		 */
+		unsigned int acquire(void);
+
+		/**
+		 * Submit the buffer acquired by acquire().
+		 * @param size	[in] Size of the data, in bytes.
+		 * @param zero	[in] If true, the data is all zeroes and wasn't copied.
+		 */
+		void submit(size_t size, bool zero);
+
+	private:
+		struct Buffer {
+			uint8_t *data;	// Buffer data. (page-aligned)
+			size_t size;	// Size of the data, in bytes.
+			bool zero;	// If true, the data is all zeroes. (data is not used)
+		};
+
+		const size_t m_buf_size;
+		const unsigned int m_depth;
+		std::vector<Buffer> m_bufs;
+
+		// Buffer sequence numbers.
+		// Buffer n is stored in m_bufs[n % m_depth].
+		uint64_t m_head;		// Number of buffers submitted.
+		uint64_t m_tail[ALGO_MAX];	// Number of buffers hashed by each worker.
+
+		std::mutex m_mutex;
+		std::condition_variable m_cond;
+		std::thread m_threads[ALGO_MAX];
+		bool m_finish;	// Set when no more buffers will be submitted.
+
+		// Results. (written by the worker threads)
+		uint64_t m_size;
+		uint32_t m_crc32;
+		uint8_t m_md5[16];
+		uint8_t m_sha1[20];
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_DIGESTQUEUE_HPP__ */
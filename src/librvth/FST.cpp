@@ -0,0 +1,462 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * FST.cpp: GameCube/Wii file system table.                                *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "FST.hpp"
+#include "ptbl.h"
+#include "rvth_error.h"
+#include "reader/WiiPartitionReader.hpp"
+
+// libwiicrypto
+#include "libwiicrypto/byteswap.h"
+
+// C includes. (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+// C++ includes.
+#include <string>
+#include <vector>
+using std::string;
+using std::vector;
+
+// Maximum FST size.
+// Official discs have FSTs well under 1 MB.
+#define FST_SIZE_MAX (16U*1024U*1024U)
+
+// System file addresses.
+#define BOOT_BIN_SIZE		0x440
+#define BI2_BIN_ADDRESS		0x440
+#define BI2_BIN_SIZE		0x2000
+#define APPLOADER_ADDRESS	0x2440
+
+/**
+ * Parse a file system table.
+ * Check isOpen() after constructing the object.
+ * @param fst		[in] FST data.
+ * @param size		[in] Size of the FST data, in bytes.
+ * @param offsetShift	[in] File offset shift. (0 for GameCube; 2 for Wii)
+ */
+FST::FST(const void *fst, uint32_t size, unsigned int offsetShift)
+	: m_offsetShift(offsetShift)
+	, m_reader(nullptr)
+{
+	assert(fst != nullptr);
+	if (size < sizeof(GCN_FST_Entry)) {
+		// Too small for the root directory.
+		return;
+	}
+
+	// The root directory's size field is the number of entries.
+	const GCN_FST_Entry *const fst_entries = static_cast<const GCN_FST_Entry*>(fst);
+	const uint32_t count = be32_to_cpu(fst_entries[0].dir.last_entry_idx);
+	if ((be32_to_cpu(fst_entries[0].file_type_name_offset) >> 24) != 1 ||
+	    count == 0 || count > size / sizeof(GCN_FST_Entry))
+	{
+		// Root directory is invalid.
+		return;
+	}
+
+	// The string table follows the last entry.
+	// A NULL terminator is appended in case the last name isn't terminated.
+	// This is also used as the root directory's name.
+	const char *const strtbl = reinterpret_cast<const char*>(&fst_entries[count]);
+	const uint32_t strtbl_size = size - (count * sizeof(GCN_FST_Entry));
+	m_strings.assign(strtbl, strtbl + strtbl_size);
+	m_strings.push_back('\0');
+
+	vector<Entry> entries(count);
+	Entry *entry = &entries[0];
+	entry->name = strtbl_size;
+	entry->parent = 0;
+	entry->next = count;
+	entry->offset = 0;
+	entry->size = 0;
+	entry->isDir = true;
+
+	// Directories containing the current entry.
+	vector<uint32_t> dirs;
+	dirs.push_back(0);
+
+	for (uint32_t i = 1; i < count; i++) {
+		// Leave directories that end before this entry.
+		// NOTE: The root directory contains all entries.
+		while (i >= entries[dirs.back()].next) {
+			dirs.pop_back();
+		}
+
+		const uint32_t type_name = be32_to_cpu(fst_entries[i].file_type_name_offset);
+		entry = &entries[i];
+		entry->name = type_name & 0xFFFFFF;
+		if (entry->name >= strtbl_size) {
+			// Name is out of range.
+			m_strings.clear();
+			return;
+		}
+
+		// NOTE: The stored parent directory index isn't checked.
+		// The directory ranges are used instead.
+		entry->parent = dirs.back();
+		switch (type_name >> 24) {
+			case 0:
+				// File.
+				entry->next = i + 1;
+				entry->offset = (int64_t)be32_to_cpu(fst_entries[i].file.offset) << offsetShift;
+				entry->size = be32_to_cpu(fst_entries[i].file.size);
+				entry->isDir = false;
+				break;
+
+			case 1:
+				// Directory.
+				// It must end within its parent directory.
+				entry->next = be32_to_cpu(fst_entries[i].dir.last_entry_idx);
+				if (entry->next <= i || entry->next > entries[entry->parent].next) {
+					// Directory range is invalid.
+					m_strings.clear();
+					return;
+				}
+				entry->offset = 0;
+				entry->size = 0;
+				entry->isDir = true;
+				dirs.push_back(i);
+				break;
+
+			default:
+				// Invalid entry type.
+				m_strings.clear();
+				return;
+		}
+	}
+
+	m_entries.swap(entries);
+}
+
+FST::~FST()
+{
+	delete m_reader;
+}
+
+/**
+ * Load the file system table from a GameCube disc or a Wii game partition.
+ *
+ * The returned FST owns the partition reader, but not the disc image
+ * reader, which must remain valid until the FST is deleted.
+ *
+ * @param reader	[in] Disc image reader.
+ * @param pte		[in,opt] Wii game partition table entry. (NULL for GameCube)
+ * @param encrypted	[in] If true, the Wii partition is encrypted.
+ * @param pErr		[out,opt] Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ * @return FST*, or NULL on error.
+ */
+FST *FST::open(Reader *reader, const pt_entry_t *pte, bool encrypted, int *pErr)
+{
+	WiiPartitionReader *wpr = nullptr;
+	unsigned int shift;
+	GCN_Boot_Block bb2;
+
+	// FST data.
+	int64_t fst_offset, fst_size;
+	vector<uint8_t> fst_data;
+	FST *fst;
+
+	// System file sizes.
+	uint32_t apl_hdr[8];
+	uint32_t apl_size = 0;
+	DOL_Header dol;
+	uint32_t dol_size = 0;
+
+	int ret;	// errno or RvtH_Errors
+
+	assert(reader != nullptr);
+
+	if (pte) {
+		// Wii game partition.
+		wpr = WiiPartitionReader::open(reader, pte, encrypted, &ret);
+		if (!wpr) {
+			// Error opening the game partition.
+			goto fail;
+		}
+		shift = 2;
+	} else {
+		// GameCube discs don't have partitions, so the
+		// entire disc image is read as unencrypted user data.
+		wpr = new WiiPartitionReader(reader, 0, reader->lba_len(), nullptr);
+		if (!wpr->isOpen()) {
+			// Error initializing the reader.
+			ret = -errno;
+			if (ret == 0) {
+				ret = -EIO;
+			}
+			goto fail;
+		}
+		shift = 0;
+	}
+
+	// Only a few small reads are needed to load the FST.
+	wpr->setPrefetch(false);
+
+	// Read the boot block.
+	if (wpr->pread(&bb2, sizeof(bb2), GCN_Boot_Block_ADDRESS) != sizeof(bb2)) {
+		// Error reading the boot block.
+		ret = -EIO;
+		goto fail;
+	}
+
+	// Load the FST.
+	fst_offset = (int64_t)be32_to_cpu(bb2.FSTPosition) << shift;
+	fst_size = (int64_t)be32_to_cpu(bb2.FSTLength) << shift;
+	if (fst_size < (int64_t)sizeof(GCN_FST_Entry) || fst_size > FST_SIZE_MAX ||
+	    fst_offset <= 0 || fst_offset + fst_size > wpr->dataSize())
+	{
+		// FST is out of range.
+		ret = RVTH_ERROR_FST_CORRUPTED;
+		goto fail;
+	}
+	fst_data.resize(static_cast<size_t>(fst_size));
+	if (wpr->pread(fst_data.data(), fst_data.size(), fst_offset) != fst_data.size()) {
+		// Error reading the FST.
+		ret = -EIO;
+		goto fail;
+	}
+
+	fst = new FST(fst_data.data(), static_cast<uint32_t>(fst_size), shift);
+	if (!fst->isOpen()) {
+		// FST is corrupted.
+		delete fst;
+		ret = RVTH_ERROR_FST_CORRUPTED;
+		goto fail;
+	}
+
+	// Get the apploader size from the apploader header.
+	// Reference: http://www.gc-forever.com/wiki/index.php?title=Apploader
+	if (wpr->pread(apl_hdr, sizeof(apl_hdr), APPLOADER_ADDRESS) == sizeof(apl_hdr)) {
+		const uint32_t size = be32_to_cpu(apl_hdr[5]);
+		const uint32_t trailer = be32_to_cpu(apl_hdr[6]);
+		if (size < FST_SIZE_MAX && trailer < FST_SIZE_MAX) {
+			apl_size = sizeof(apl_hdr) + size + trailer;
+		}
+	}
+
+	// Get the DOL size from the section table.
+	if (wpr->pread(&dol, sizeof(dol), (int64_t)be32_to_cpu(bb2.bootFilePosition) << shift) == sizeof(dol)) {
+		dol_size = sizeof(dol);
+		for (unsigned int i = 0; i < ARRAY_SIZE(dol.textData); i++) {
+			const uint32_t end = be32_to_cpu(dol.textData[i]) + be32_to_cpu(dol.textLen[i]);
+			if (dol.textLen[i] != 0 && end > dol_size) {
+				dol_size = end;
+			}
+		}
+		for (unsigned int i = 0; i < ARRAY_SIZE(dol.dataData); i++) {
+			const uint32_t end = be32_to_cpu(dol.dataData[i]) + be32_to_cpu(dol.dataLen[i]);
+			if (dol.dataLen[i] != 0 && end > dol_size) {
+				dol_size = end;
+			}
+		}
+	}
+
+	fst->m_reader = wpr;
+	fst->addSystemFiles(&bb2, apl_size, dol_size);
+	if (pErr) {
+		*pErr = 0;
+	}
+	return fst;
+
+fail:
+	delete wpr;
+	if (pErr) {
+		*pErr = ret;
+	}
+	errno = (ret < 0 ? -ret : EIO);
+	return nullptr;
+}
+
+/**
+ * Get the full path of an entry.
+ * @param idx	[in] Entry index.
+ * @return Path, starting with '/'. Directories end with '/'.
+ */
+string FST::path(unsigned int idx) const
+{
+	assert(idx < m_entries.size());
+	string path;
+	if (idx >= m_entries.size()) {
+		return path;
+	}
+
+	if (m_entries[idx].isDir && idx != 0) {
+		path = "/";
+	}
+	for (; idx != 0; idx = m_entries[idx].parent) {
+		path.insert(0, name(idx));
+		path.insert(0, 1, '/');
+	}
+	if (path.empty()) {
+		// Root directory.
+		path = "/";
+	}
+	return path;
+}
+
+/**
+ * Find an entry by path.
+ * Path components are separated by '/'; a leading '/' is optional.
+ * @param path	[in] Path.
+ * @return Entry index, or negative POSIX error code on error.
+ */
+int FST::find(const char *path) const
+{
+	assert(path != nullptr);
+	if (m_entries.empty()) {
+		return -ENOENT;
+	}
+
+	unsigned int idx = 0;
+	for (;;) {
+		while (*path == '/') {
+			path++;
+		}
+		if (*path == '\0') {
+			// Found the entry.
+			break;
+		}
+		if (!m_entries[idx].isDir) {
+			// Can't look for a file within a file.
+			return -ENOTDIR;
+		}
+
+		const char *const slash = strchr(path, '/');
+		const size_t len = (slash ? static_cast<size_t>(slash - path) : strlen(path));
+
+		// Search this directory's entries.
+		// NOTE: Names are case-insensitive, like the DVD library.
+		unsigned int found = 0;
+		for (unsigned int i = idx + 1; i < m_entries[idx].next; i = m_entries[i].next) {
+			const char *const name = &m_strings[m_entries[i].name];
+			if (!strncasecmp(name, path, len) && name[len] == '\0') {
+				found = i;
+				break;
+			}
+		}
+		if (found == 0) {
+			// Not found.
+			return -ENOENT;
+		}
+
+		idx = found;
+		path += len;
+	}
+
+	return static_cast<int>(idx);
+}
+
+/**
+ * Read data from a file.
+ * The FST must have been loaded using open().
+ * @param idx		[in] Entry index.
+ * @param ptr		[out] Read buffer.
+ * @param size		[in] Number of bytes to read.
+ * @param offset	[in] Offset within the file, in bytes.
+ * @return Number of bytes read. (May be short on error or at the end of the file.)
+ */
+size_t FST::readFile(unsigned int idx, void *ptr, size_t size, int64_t offset)
+{
+	assert(m_reader != nullptr);
+	assert(idx < m_entries.size());
+	if (!m_reader || idx >= m_entries.size() || m_entries[idx].isDir) {
+		// Not a file.
+		errno = EINVAL;
+		return 0;
+	}
+
+	const Entry &entry = m_entries[idx];
+	if (offset < 0 || offset >= entry.size) {
+		// Out of range.
+		return 0;
+	}
+	if (static_cast<int64_t>(size) > entry.size - offset) {
+		size = static_cast<size_t>(entry.size - offset);
+	}
+	return m_reader->pread(ptr, size, entry.offset + offset);
+}
+
+/**
+ * Add an entry to the string table.
+ * @param name	[in] Name.
+ * @return Offset of the name within the string table.
+ */
+uint32_t FST::addString(const char *name)
+{
+	const uint32_t offset = static_cast<uint32_t>(m_strings.size());
+	m_strings.insert(m_strings.end(), name, name + strlen(name) + 1);
+	return offset;
+}
+
+/**
+ * Add the system files in a "sys" directory.
+ * Nothing is added if the root directory already has a "sys" entry.
+ * @param bb2		[in] Boot block.
+ * @param apl_size	[in] Size of apploader.img, in bytes. (0 if unknown)
+ * @param dol_size	[in] Size of main.dol, in bytes. (0 if unknown)
+ */
+void FST::addSystemFiles(const GCN_Boot_Block *bb2, uint32_t apl_size, uint32_t dol_size)
+{
+	if (find("sys") >= 0) {
+		// The disc already has a "sys" entry.
+		return;
+	}
+
+	// NOTE: The new entries are appended to the end of the root directory,
+	// so the indexes of the FST's own entries don't change.
+	Entry entry;
+	const uint32_t sys_idx = static_cast<uint32_t>(m_entries.size());
+	entry.name = addString("sys");
+	entry.parent = 0;
+	entry.next = 0;	// updated later
+	entry.offset = 0;
+	entry.size = 0;
+	entry.isDir = true;
+	m_entries.push_back(entry);
+
+	entry.parent = sys_idx;
+	entry.isDir = false;
+	static const struct {
+		const char *name;
+		uint32_t offset;
+		uint32_t size;
+	} fixed_files[] = {
+		{"boot.bin", 0, BOOT_BIN_SIZE},
+		{"bi2.bin", BI2_BIN_ADDRESS, BI2_BIN_SIZE},
+		{"apploader.img", APPLOADER_ADDRESS, 0},
+	};
+	for (unsigned int i = 0; i < ARRAY_SIZE(fixed_files); i++) {
+		entry.name = addString(fixed_files[i].name);
+		entry.offset = fixed_files[i].offset;
+		entry.size = (fixed_files[i].size != 0 ? fixed_files[i].size : apl_size);
+		if (entry.size == 0) {
+			continue;
+		}
+		entry.next = static_cast<uint32_t>(m_entries.size()) + 1;
+		m_entries.push_back(entry);
+	}
+	if (dol_size != 0) {
+		entry.name = addString("main.dol");
+		entry.offset = (int64_t)be32_to_cpu(bb2->bootFilePosition) << m_offsetShift;
+		entry.size = dol_size;
+		entry.next = static_cast<uint32_t>(m_entries.size()) + 1;
+		m_entries.push_back(entry);
+	}
+	entry.name = addString("fst.bin");
+	entry.offset = (int64_t)be32_to_cpu(bb2->FSTPosition) << m_offsetShift;
+	entry.size = static_cast<uint32_t>(be32_to_cpu(bb2->FSTLength) << m_offsetShift);
+	entry.next = static_cast<uint32_t>(m_entries.size()) + 1;
+	m_entries.push_back(entry);
+
+	// The root directory and "sys" end after the last system file.
+	m_entries[sys_idx].next = static_cast<uint32_t>(m_entries.size());
+	m_entries[0].next = static_cast<uint32_t>(m_entries.size());
+}
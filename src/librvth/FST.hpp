@@ -0,0 +1,220 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * FST.hpp: GameCube/Wii file system table.                                *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_FST_HPP__
+#define __RVTHTOOL_LIBRVTH_FST_HPP__
+
+#include "libwiicrypto/common.h"
+#include "libwiicrypto/gcn_structs.h"
+
+// C includes.
+#include <stdint.h>
+
+// C++ includes.
+#include <string>
+#include <vector>
+
+class Reader;
+class WiiPartitionReader;
+struct _pt_entry_t;
+
+/**
+ * File system table of a GameCube disc or a Wii game partition.
+ *
+ * Entry 0 is the root directory. The entries of a directory are
+ * stored immediately after it, up to nextIndex(), so a directory's
+ * contents can be iterated without building a tree.
+ *
+ * If the FST was loaded using open(), the system files (boot.bin,
+ * bi2.bin, apploader.img, main.dol, and fst.bin) are appended to
+ * the root directory in a "sys" directory, and files can be read
+ * using readFile(). Only the groups containing the requested data
+ * are read and decrypted.
+ */
+class FST
+{
+	public:
+		/**
+		 * Parse a file system table.
+		 * Check isOpen() after constructing the object.
+		 * @param fst		[in] FST data.
+		 * @param size		[in] Size of the FST data, in bytes.
+		 * @param offsetShift	[in] File offset shift. (0 for GameCube; 2 for Wii)
+		 */
+		FST(const void *fst, uint32_t size, unsigned int offsetShift);
+		~FST();
+
+	private:
+		DISABLE_COPY(FST)
+
+	public:
+		/**
+		 * Load the file system table from a GameCube disc or a Wii game partition.
+		 *
+		 * The returned FST owns the partition reader, but not the disc image
+		 * reader, which must remain valid until the FST is deleted.
+		 *
+		 * @param reader	[in] Disc image reader.
+		 * @param pte		[in,opt] Wii game partition table entry. (NULL for GameCube)
+		 * @param encrypted	[in] If true, the Wii partition is encrypted.
+		 * @param pErr		[out,opt] Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 * @return FST*, or NULL on error.
+		 */
+		static FST *open(Reader *reader, const struct _pt_entry_t *pte,
+			bool encrypted, int *pErr = nullptr);
+
+	public:
+		/**
+		 * Was the FST parsed successfully?
+		 * @return True if valid; false if not.
+		 */
+		inline bool isOpen(void) const
+		{
+			return !m_entries.empty();
+		}
+
+		/**
+		 * Get the number of entries, including the root directory.
+		 * @return Number of entries.
+		 */
+		inline unsigned int count(void) const
+		{
+			return static_cast<unsigned int>(m_entries.size());
+		}
+
+		/**
+		 * Is an entry a directory?
+		 * @param idx	[in] Entry index.
+		 * @return True if this entry is a directory; false if it's a file.
+		 */
+		inline bool isDir(unsigned int idx) const
+		{
+			return m_entries[idx].isDir;
+		}
+
+		/**
+		 * Get an entry's name.
+		 * @param idx	[in] Entry index.
+		 * @return Name. (Empty string for the root directory.)
+		 */
+		inline const char *name(unsigned int idx) const
+		{
+			return &m_strings[m_entries[idx].name];
+		}
+
+		/**
+		 * Get an entry's parent directory.
+		 * @param idx	[in] Entry index.
+		 * @return Parent directory index. (0 for the root directory.)
+		 */
+		inline unsigned int parent(unsigned int idx) const
+		{
+			return m_entries[idx].parent;
+		}
+
+		/**
+		 * Get the index of the first entry after this one.
+		 * For directories, this skips the directory's contents.
+		 * @param idx	[in] Entry index.
+		 * @return Next entry index.
+		 */
+		inline unsigned int nextIndex(unsigned int idx) const
+		{
+			return m_entries[idx].next;
+		}
+
+		/**
+		 * Get a file's offset within the partition's user data.
+		 * @param idx	[in] Entry index.
+		 * @return File offset, in bytes. (0 for directories.)
+		 */
+		inline int64_t fileOffset(unsigned int idx) const
+		{
+			return m_entries[idx].offset;
+		}
+
+		/**
+		 * Get a file's size.
+		 * @param idx	[in] Entry index.
+		 * @return File size, in bytes. (0 for directories.)
+		 */
+		inline uint32_t fileSize(unsigned int idx) const
+		{
+			return m_entries[idx].size;
+		}
+
+		/**
+		 * Get the full path of an entry.
+		 * @param idx	[in] Entry index.
+		 * @return Path, starting with '/'. Directories end with '/'.
+		 */
+		std::string path(unsigned int idx) const;
+
+		/**
+		 * Find an entry by path.
+		 * Path components are separated by '/'; a leading '/' is optional.
+		 * @param path	[in] Path.
+		 * @return Entry index, or negative POSIX error code on error.
+		 */
+		int find(const char *path) const;
+
+		/**
+		 * Get the partition reader.
+		 * @return WiiPartitionReader*, or nullptr if the FST wasn't loaded using open().
+		 */
+		inline WiiPartitionReader *reader(void) const
+		{
+			return m_reader;
+		}
+
+		/**
+		 * Read data from a file.
+		 * The FST must have been loaded using open().
+		 * @param idx		[in] Entry index.
+		 * @param ptr		[out] Read buffer.
+		 * @param size		[in] Number of bytes to read.
+		 * @param offset	[in] Offset within the file, in bytes.
+		 * @return Number of bytes read. (May be short on error or at the end of the file.)
+		 */
+		size_t readFile(unsigned int idx, void *ptr, size_t size, int64_t offset);
+
+	private:
+		/**
+		 * Add an entry to the string table.
+		 * @param name	[in] Name.
+		 * @return Offset of the name within the string table.
+		 */
+		uint32_t addString(const char *name);
+
+		/**
+		 * Add the system files in a "sys" directory.
+		 * Nothing is added if the root directory already has a "sys" entry.
+		 * @param bb2		[in] Boot block.
+		 * @param apl_size	[in] Size of apploader.img, in bytes. (0 if unknown)
+		 * @param dol_size	[in] Size of main.dol, in bytes. (0 if unknown)
+		 */
+		void addSystemFiles(const GCN_Boot_Block *bb2, uint32_t apl_size, uint32_t dol_size);
+
+	private:
+		// Parsed FST entry.
+		struct Entry {
+			uint32_t name;		// Offset of the name in m_strings.
+			uint32_t parent;	// Parent directory index.
+			uint32_t next;		// Index of the first entry after this one.
+			int64_t offset;		// File offset, in bytes.
+			uint32_t size;		// File size, in bytes.
+			bool isDir;
+		};
+		std::vector<Entry> m_entries;
+		std::vector<char> m_strings;	// NULL-terminated names.
+
+		unsigned int m_offsetShift;
+		WiiPartitionReader *m_reader;	// Partition reader. (owned)
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_FST_HPP__ */
@@ -0,0 +1,237 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * GroupQueue.cpp: Process Wii disc groups using a pool of worker threads. *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "GroupQueue.hpp"
+#include "aligned_malloc.h"
+
+// C includes. (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+// C++ includes.
+#include <system_error>
+using std::lock_guard;
+using std::mutex;
+using std::unique_lock;
+
+// Maximum number of worker threads.
+#define GROUPQUEUE_MAX_THREADS 64
+
+/**
+ * Create a group queue.
+ * Call start() to start the worker threads.
+ * @param in_size	[in] Input buffer size, in bytes.
+ * @param out_size	[in] Output buffer size, in bytes.
+ * @param threads	[in] Number of worker threads. (0 for defaultThreadCount())
+ */
+GroupQueue::GroupQueue(size_t in_size, size_t out_size, unsigned int threads)
+	: m_in_size(in_size)
+	, m_out_size(out_size)
+	, m_threadCount(threads > 0
+		? (threads <= GROUPQUEUE_MAX_THREADS ? threads : GROUPQUEUE_MAX_THREADS)
+		: defaultThreadCount())
+	, m_cancel(false)
+{
+	assert(in_size > 0);
+	assert(out_size > 0);
+}
+
+GroupQueue::~GroupQueue()
+{
+	cancel();
+	for (auto iter = m_jobs.begin(); iter != m_jobs.end(); ++iter) {
+		aligned_free(iter->in);
+		aligned_free(iter->out);
+	}
+}
+
+/**
+ * Get the default number of worker threads.
+ * This is the number of logical CPUs.
+ * @return Default number of worker threads.
+ */
+unsigned int GroupQueue::defaultThreadCount(void)
+{
+	unsigned int threads = std::thread::hardware_concurrency();
+	if (threads == 0) {
+		// Unknown CPU count.
+		threads = 1;
+	} else if (threads > GROUPQUEUE_MAX_THREADS) {
+		threads = GROUPQUEUE_MAX_THREADS;
+	}
+	return threads;
+}
+
+/**
+ * Allocate the buffers and start the worker threads.
+ * @param func	[in] Job function.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int GroupQueue::start(const JobFunc &func)
+{
+	assert(m_jobs.empty());
+	if (!m_jobs.empty()) {
+		// Already started.
+		return -EBUSY;
+	}
+	m_func = func;
+
+	// Allocate the job buffers.
+	// Two extra jobs are allocated so the caller can read
+	// and write while all of the worker threads are busy.
+	// NOTE: Page-aligned for direct I/O.
+	const unsigned int jobCount = m_threadCount + 2;
+	m_jobs.resize(jobCount);
+	for (unsigned int i = 0; i < jobCount; i++) {
+		Job *const job = &m_jobs[i];
+		memset(job, 0, sizeof(*job));
+		job->in = static_cast<uint8_t*>(aligned_malloc(RVTH_PAGE_SIZE, m_in_size));
+		job->out = static_cast<uint8_t*>(aligned_malloc(RVTH_PAGE_SIZE, m_out_size));
+		if (!job->in || !job->out) {
+			// Error allocating memory.
+			return -ENOMEM;
+		}
+		m_free.push_back(job);
+	}
+
+	// Start the worker threads.
+	m_threads.reserve(m_threadCount);
+	for (unsigned int i = 0; i < m_threadCount; i++) {
+		try {
+			m_threads.emplace_back(&GroupQueue::run, this, i);
+		} catch (const std::system_error &e) {
+			// Unable to create the thread.
+			int err = e.code().value();
+			return (err > 0 ? -err : -EAGAIN);
+		}
+	}
+	return 0;
+}
+
+/**
+ * Worker thread function.
+ * @param worker Worker index.
+ */
+void GroupQueue::run(unsigned int worker)
+{
+	for (;;) {
+		// Wait for a job.
+		Job *job;
+		{
+			unique_lock<mutex> lock(m_mutex);
+			m_cond.wait(lock, [this] { return m_cancel || !m_pending.empty(); });
+			if (m_cancel) {
+				break;
+			}
+			job = m_pending.front();
+			m_pending.pop_front();
+		}
+
+		// Process the job.
+		job->ret = m_func(worker, job);
+
+		// Job is done.
+		{
+			lock_guard<mutex> lock(m_mutex);
+			job->done = true;
+		}
+		m_cond.notify_all();
+	}
+}
+
+/**
+ * Get a free job.
+ * If all jobs are in use, the caller must retrieve
+ * a processed job using next() first.
+ * @return Free job, or nullptr if none are available.
+ */
+GroupQueue::Job *GroupQueue::acquire(void)
+{
+	lock_guard<mutex> lock(m_mutex);
+	if (m_free.empty()) {
+		return nullptr;
+	}
+	Job *const job = m_free.front();
+	m_free.pop_front();
+	return job;
+}
+
+/**
+ * Submit a job for processing.
+ * job->src and job->index must be set.
+ * @param job Job returned by acquire().
+ */
+void GroupQueue::submit(Job *job)
+{
+	assert(job != nullptr);
+	assert(job->src != nullptr);
+	{
+		lock_guard<mutex> lock(m_mutex);
+		job->ret = 0;
+		job->done = false;
+		m_pending.push_back(job);
+		m_order.push_back(job);
+	}
+	m_cond.notify_all();
+}
+
+/**
+ * Get the next processed job, in submission order.
+ * This will block until the job has been processed.
+ * The job must be returned using release().
+ * @return Next job, or nullptr if no jobs were submitted.
+ */
+GroupQueue::Job *GroupQueue::next(void)
+{
+	unique_lock<mutex> lock(m_mutex);
+	if (m_order.empty()) {
+		return nullptr;
+	}
+	Job *const job = m_order.front();
+	m_cond.wait(lock, [job] { return job->done; });
+	m_order.pop_front();
+	return job;
+}
+
+/**
+ * Release a job so it can be reused.
+ * @param job Job returned by next().
+ */
+void GroupQueue::release(Job *job)
+{
+	assert(job != nullptr);
+	lock_guard<mutex> lock(m_mutex);
+	job->src = nullptr;
+	m_free.push_back(job);
+}
+
+/**
+ * Stop the worker threads.
+ * Jobs that haven't been started are discarded.
+ * This is called automatically by the destructor.
+ */
+void GroupQueue::cancel(void)
+{
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_cancel = true;
+	}
+	m_cond.notify_all();
+	for (auto iter = m_threads.begin(); iter != m_threads.end(); ++iter) {
+		if (iter->joinable()) {
+			iter->join();
+		}
+	}
+	m_threads.clear();
+
+	// Discard any remaining jobs.
+	lock_guard<mutex> lock(m_mutex);
+	m_pending.clear();
+	m_order.clear();
+}
@@ -0,0 +1,158 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * GroupQueue.hpp: Process Wii disc groups using a pool of worker threads. *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_GROUPQUEUE_HPP__
+#define __RVTHTOOL_LIBRVTH_GROUPQUEUE_HPP__
+
+#include "libwiicrypto/common.h"
+
+// C includes.
+#include <stddef.h>
+#include <stdint.h>
+
+// C++ includes.
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Processes independent jobs, e.g. 2 MB Wii disc groups,
+ * using a pool of worker threads.
+ *
+ * The caller reads the input data for each job and submits it.
+ * Jobs are processed in parallel, but next() always returns them
+ * in the order they were submitted, so the output can be written
+ * sequentially.
+ *
+ * Each job has a fixed-size input and output buffer. The job function
+ * receives the worker index, which can be used to select per-thread
+ * state, e.g. an AES context.
+ */
+class GroupQueue
+{
+	public:
+		struct Job {
+			uint8_t *in;		// Input buffer. (page-aligned)
+			uint8_t *out;		// Output buffer. (page-aligned)
+			const uint8_t *src;	// Input data. (either in or zero-copy data from a Reader)
+			uint32_t index;		// Job index. (set by the caller, e.g. group number)
+			int ret;		// Return value from the job function.
+
+			// Internal state.
+			bool done;		// Has the job been processed?
+		};
+
+		/**
+		 * Job function.
+		 * @param worker	[in] Worker index. (0 to threadCount()-1)
+		 * @param job		[in/out] Job.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		typedef std::function<int(unsigned int worker, Job *job)> JobFunc;
+
+		/**
+		 * Create a group queue.
+		 * Call start() to start the worker threads.
+		 * @param in_size	[in] Input buffer size, in bytes.
+		 * @param out_size	[in] Output buffer size, in bytes.
+		 * @param threads	[in] Number of worker threads. (0 for defaultThreadCount())
+		 */
+		GroupQueue(size_t in_size, size_t out_size, unsigned int threads = 0);
+		~GroupQueue();
+
+	private:
+		DISABLE_COPY(GroupQueue)
+
+	public:
+		/**
+		 * Get the default number of worker threads.
+		 * This is the number of logical CPUs.
+		 * @return Default number of worker threads.
+		 */
+		static unsigned int defaultThreadCount(void);
+
+		/**
+		 * Get the number of worker threads.
+		 * @return Number of worker threads.
+		 */
+		inline unsigned int threadCount(void) const
+		{
+			return m_threadCount;
+		}
+
+		/**
+		 * Allocate the buffers and start the worker threads.
+		 * @param func	[in] Job function.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int start(const JobFunc &func);
+
+		/**
+		 * Get a free job.
+		 * If all jobs are in use, the caller must retrieve
+		 * a processed job using next() first.
+		 * @return Free job, or nullptr if none are available.
+		 */
+		Job *acquire(void);
+
+		/**
+		 * Submit a job for processing.
+		 * job->src and job->index must be set.
+		 * @param job Job returned by acquire().
+		 */
+		void submit(Job *job);
+
+		/**
+		 * Get the next processed job, in submission order.
+		 * This will block until the job has been processed.
+		 * The job must be returned using release().
+		 * @return Next job, or nullptr if no jobs were submitted.
+		 */
+		Job *next(void);
+
+		/**
+		 * Release a job so it can be reused.
+		 * @param job Job returned by next().
+		 */
+		void release(Job *job);
+
+		/**
+		 * Stop the worker threads.
+		 * Jobs that haven't been started are discarded.
+		 * This is called automatically by the destructor.
+		 */
+		void cancel(void);
+
+	private:
+		/**
+		 * Worker thread function.
+		 * @param worker Worker index.
+		 */
+		void run(unsigned int worker);
+
+	private:
+		const size_t m_in_size;
+		const size_t m_out_size;
+		const unsigned int m_threadCount;
+		JobFunc m_func;
+
+		std::vector<Job> m_jobs;
+		std::deque<Job*> m_free;	// Jobs available for use.
+		std::deque<Job*> m_pending;	// Jobs waiting for a worker thread.
+		std::deque<Job*> m_order;	// Submitted jobs, in order.
+
+		std::mutex m_mutex;
+		std::condition_variable m_cond;
+		std::vector<std::thread> m_threads;
+		bool m_cancel;	// Set by the caller to stop the worker threads.
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_GROUPQUEUE_HPP__ */
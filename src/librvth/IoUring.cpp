@@ -0,0 +1,381 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * IoUring.cpp: Minimal Linux io_uring wrapper.                            *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "config.librvth.h"
+#include "IoUring.hpp"
+
+// C includes. (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+#ifdef HAVE_IO_URING
+# include <linux/io_uring.h>
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# include <sys/uio.h>
+# include <unistd.h>
+
+// C++ includes.
+# include <vector>
+
+// Ring indexes are shared with the kernel.
+# define LOAD_ACQUIRE(p)	__atomic_load_n((p), __ATOMIC_ACQUIRE)
+# define STORE_RELEASE(p, v)	__atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+static inline int sys_io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static inline int sys_io_uring_enter(int fd, unsigned int to_submit,
+	unsigned int min_complete, unsigned int flags)
+{
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static inline int sys_io_uring_register(int fd, unsigned int opcode, const void *arg, unsigned int nr_args)
+{
+	return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+#endif /* HAVE_IO_URING */
+
+/**
+ * Create an io_uring instance.
+ * Check isOpen() afterwards.
+ * @param entries Number of submission queue entries.
+ */
+IoUring::IoUring(unsigned int entries)
+	: m_ringFd(-1)
+	, m_lastError(0)
+	, m_sqEntries(0)
+	, m_toSubmit(0)
+	, m_sqRing(nullptr)
+	, m_sqRingSize(0)
+	, m_cqRing(nullptr)
+	, m_cqRingSize(0)
+	, m_sqes(nullptr)
+	, m_sqesSize(0)
+	, m_sqHead(nullptr)
+	, m_sqTail(nullptr)
+	, m_sqMask(nullptr)
+	, m_sqArray(nullptr)
+	, m_cqHead(nullptr)
+	, m_cqTail(nullptr)
+	, m_cqMask(nullptr)
+	, m_cqes(nullptr)
+{
+#ifdef HAVE_IO_URING
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	int fd = sys_io_uring_setup(entries, &p);
+	if (fd < 0) {
+		// io_uring isn't available. (ENOSYS, or blocked by seccomp)
+		m_lastError = errno;
+		if (m_lastError == 0) {
+			m_lastError = ENOSYS;
+		}
+		return;
+	}
+
+	// Map the rings.
+	m_sqRingSize = p.sq_off.array + (p.sq_entries * sizeof(unsigned int));
+	m_cqRingSize = p.cq_off.cqes + (p.cq_entries * sizeof(struct io_uring_cqe));
+	const bool singleMmap = !!(p.features & IORING_FEAT_SINGLE_MMAP);
+	if (singleMmap) {
+		if (m_cqRingSize > m_sqRingSize) {
+			m_sqRingSize = m_cqRingSize;
+		}
+		m_cqRingSize = m_sqRingSize;
+	}
+
+	m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (m_sqRing == MAP_FAILED) {
+		m_sqRing = nullptr;
+		goto fail;
+	}
+	if (singleMmap) {
+		m_cqRing = m_sqRing;
+	} else {
+		m_cqRing = mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if (m_cqRing == MAP_FAILED) {
+			m_cqRing = nullptr;
+			goto fail;
+		}
+	}
+
+	m_sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+	m_sqes = mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (m_sqes == MAP_FAILED) {
+		m_sqes = nullptr;
+		goto fail;
+	}
+
+	{
+		uint8_t *const sq = static_cast<uint8_t*>(m_sqRing);
+		m_sqHead	= reinterpret_cast<unsigned int*>(sq + p.sq_off.head);
+		m_sqTail	= reinterpret_cast<unsigned int*>(sq + p.sq_off.tail);
+		m_sqMask	= reinterpret_cast<unsigned int*>(sq + p.sq_off.ring_mask);
+		m_sqArray	= reinterpret_cast<unsigned int*>(sq + p.sq_off.array);
+
+		uint8_t *const cq = static_cast<uint8_t*>(m_cqRing);
+		m_cqHead	= reinterpret_cast<unsigned int*>(cq + p.cq_off.head);
+		m_cqTail	= reinterpret_cast<unsigned int*>(cq + p.cq_off.tail);
+		m_cqMask	= reinterpret_cast<unsigned int*>(cq + p.cq_off.ring_mask);
+		m_cqes		= cq + p.cq_off.cqes;
+	}
+
+	m_sqEntries = p.sq_entries;
+	m_ringFd = fd;
+	return;
+
+fail:
+	m_lastError = errno;
+	if (m_lastError == 0) {
+		m_lastError = ENOMEM;
+	}
+	if (m_sqes) {
+		munmap(m_sqes, m_sqesSize);
+		m_sqes = nullptr;
+	}
+	if (m_cqRing && m_cqRing != m_sqRing) {
+		munmap(m_cqRing, m_cqRingSize);
+	}
+	m_cqRing = nullptr;
+	if (m_sqRing) {
+		munmap(m_sqRing, m_sqRingSize);
+		m_sqRing = nullptr;
+	}
+	close(fd);
+#else /* !HAVE_IO_URING */
+	UNUSED(entries);
+	m_lastError = ENOSYS;
+#endif /* HAVE_IO_URING */
+}
+
+IoUring::~IoUring()
+{
+#ifdef HAVE_IO_URING
+	if (m_ringFd < 0)
+		return;
+
+	// NOTE: The caller must wait for all requests to
+	// complete before deleting this object.
+	munmap(m_sqes, m_sqesSize);
+	if (m_cqRing != m_sqRing) {
+		munmap(m_cqRing, m_cqRingSize);
+	}
+	munmap(m_sqRing, m_sqRingSize);
+	close(m_ringFd);
+#endif /* HAVE_IO_URING */
+}
+
+/**
+ * Register buffers for use with readFixed() and writeFixed().
+ * All buffers must have the same size.
+ * @param bufs		[in] Buffers.
+ * @param count		[in] Number of buffers.
+ * @param size		[in] Size of each buffer, in bytes.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int IoUring::registerBuffers(uint8_t *const *bufs, unsigned int count, size_t size)
+{
+#ifdef HAVE_IO_URING
+	if (m_ringFd < 0) {
+		return -EBADF;
+	}
+
+	std::vector<struct iovec> iov(count);
+	for (unsigned int i = 0; i < count; i++) {
+		iov[i].iov_base = bufs[i];
+		iov[i].iov_len = size;
+	}
+
+	int ret = sys_io_uring_register(m_ringFd, IORING_REGISTER_BUFFERS, iov.data(), count);
+	if (ret < 0) {
+		// NOTE: This may fail with ENOMEM if RLIMIT_MEMLOCK is too low.
+		m_lastError = errno;
+		return -m_lastError;
+	}
+	return 0;
+#else /* !HAVE_IO_URING */
+	UNUSED(bufs);
+	UNUSED(count);
+	UNUSED(size);
+	return -ENOSYS;
+#endif /* HAVE_IO_URING */
+}
+
+/**
+ * Queue a fixed-buffer request.
+ * @param opcode	[in] IORING_OP_*
+ * @return 0 on success; -EBUSY if the submission queue is full.
+ */
+int IoUring::prep(uint8_t opcode, int fd, const void *buf, uint32_t len,
+	int64_t offset, unsigned int buf_index, uint64_t user_data)
+{
+#ifdef HAVE_IO_URING
+	assert(m_ringFd >= 0);
+	const unsigned int head = LOAD_ACQUIRE(m_sqHead);
+	const unsigned int tail = *m_sqTail;
+	if (tail - head >= m_sqEntries) {
+		// Submission queue is full.
+		return -EBUSY;
+	}
+
+	const unsigned int idx = tail & *m_sqMask;
+	struct io_uring_sqe *const sqe = static_cast<struct io_uring_sqe*>(m_sqes) + idx;
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->addr = reinterpret_cast<uint64_t>(buf);
+	sqe->len = len;
+	sqe->off = static_cast<uint64_t>(offset);
+	sqe->buf_index = static_cast<uint16_t>(buf_index);
+	sqe->user_data = user_data;
+
+	m_sqArray[idx] = idx;
+	STORE_RELEASE(m_sqTail, tail + 1);
+	m_toSubmit++;
+	return 0;
+#else /* !HAVE_IO_URING */
+	UNUSED(opcode);
+	UNUSED(fd);
+	UNUSED(buf);
+	UNUSED(len);
+	UNUSED(offset);
+	UNUSED(buf_index);
+	UNUSED(user_data);
+	return -ENOSYS;
+#endif /* HAVE_IO_URING */
+}
+
+/**
+ * Queue a read into a registered buffer.
+ * The request is not submitted until submit() is called.
+ * @param fd		[in] File descriptor.
+ * @param buf		[in] Destination address. (within a registered buffer)
+ * @param len		[in] Length, in bytes.
+ * @param offset	[in] File offset, in bytes.
+ * @param buf_index	[in] Registered buffer index.
+ * @param user_data	[in] User data for the completion.
+ * @return 0 on success; -EBUSY if the submission queue is full.
+ */
+int IoUring::readFixed(int fd, void *buf, uint32_t len, int64_t offset,
+	unsigned int buf_index, uint64_t user_data)
+{
+#ifdef HAVE_IO_URING
+	return prep(IORING_OP_READ_FIXED, fd, buf, len, offset, buf_index, user_data);
+#else /* !HAVE_IO_URING */
+	return prep(0, fd, buf, len, offset, buf_index, user_data);
+#endif /* HAVE_IO_URING */
+}
+
+/**
+ * Queue a write from a registered buffer.
+ * The request is not submitted until submit() is called.
+ * @param fd		[in] File descriptor.
+ * @param buf		[in] Source address. (within a registered buffer)
+ * @param len		[in] Length, in bytes.
+ * @param offset	[in] File offset, in bytes.
+ * @param buf_index	[in] Registered buffer index.
+ * @param user_data	[in] User data for the completion.
+ * @return 0 on success; -EBUSY if the submission queue is full.
+ */
+int IoUring::writeFixed(int fd, const void *buf, uint32_t len, int64_t offset,
+	unsigned int buf_index, uint64_t user_data)
+{
+#ifdef HAVE_IO_URING
+	return prep(IORING_OP_WRITE_FIXED, fd, buf, len, offset, buf_index, user_data);
+#else /* !HAVE_IO_URING */
+	return prep(0, fd, buf, len, offset, buf_index, user_data);
+#endif /* HAVE_IO_URING */
+}
+
+/**
+ * Submit all queued requests.
+ * @return Number of requests submitted, or negative POSIX error code on error.
+ */
+int IoUring::submit(void)
+{
+#ifdef HAVE_IO_URING
+	assert(m_ringFd >= 0);
+	int submitted = 0;
+	while (m_toSubmit > 0) {
+		int ret = sys_io_uring_enter(m_ringFd, m_toSubmit, 0, 0);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			m_lastError = errno;
+			return -m_lastError;
+		} else if (ret == 0) {
+			// No requests were accepted. Don't spin here;
+			// the caller can fall back to synchronous I/O.
+			m_lastError = EAGAIN;
+			return -EAGAIN;
+		}
+		m_toSubmit -= ret;
+		submitted += ret;
+	}
+	return submitted;
+#else /* !HAVE_IO_URING */
+	return -ENOSYS;
+#endif /* HAVE_IO_URING */
+}
+
+/**
+ * Get the next completion.
+ * Queued requests are submitted first.
+ * @param pUserData	[out] User data from the request.
+ * @param pRes		[out] Result. (bytes transferred, or negative POSIX error code)
+ * @param wait		[in] If true, wait for a completion if none are available.
+ * @return 0 on success; -EAGAIN if !wait and no completions are available;
+ *         other negative POSIX error code on error.
+ */
+int IoUring::getCompletion(uint64_t *pUserData, int *pRes, bool wait)
+{
+#ifdef HAVE_IO_URING
+	assert(m_ringFd >= 0);
+	int ret = submit();
+	if (ret < 0) {
+		return ret;
+	}
+
+	while (true) {
+		const unsigned int head = *m_cqHead;
+		if (head != LOAD_ACQUIRE(m_cqTail)) {
+			// Completion is available.
+			const struct io_uring_cqe *const cqe =
+				static_cast<const struct io_uring_cqe*>(m_cqes) + (head & *m_cqMask);
+			*pUserData = cqe->user_data;
+			*pRes = cqe->res;
+			STORE_RELEASE(m_cqHead, head + 1);
+			return 0;
+		}
+
+		if (!wait) {
+			return -EAGAIN;
+		}
+
+		// Wait for a completion.
+		ret = sys_io_uring_enter(m_ringFd, 0, 1, IORING_ENTER_GETEVENTS);
+		if (ret < 0 && errno != EINTR) {
+			m_lastError = errno;
+			return -m_lastError;
+		}
+	}
+#else /* !HAVE_IO_URING */
+	UNUSED(pUserData);
+	UNUSED(pRes);
+	UNUSED(wait);
+	return -ENOSYS;
+#endif /* HAVE_IO_URING */
+}
@@ -0,0 +1,162 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * IoUring.hpp: Minimal Linux io_uring wrapper.                            *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_IOURING_HPP__
+#define __RVTHTOOL_LIBRVTH_IOURING_HPP__
+
+#include "libwiicrypto/common.h"
+
+// C includes.
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Minimal io_uring wrapper using the raw system calls,
+ * so liburing isn't required.
+ *
+ * Only fixed-buffer reads and writes are supported, since that's
+ * all the bulk copy functions need. If io_uring isn't available,
+ * either at compile time or at run time, isOpen() returns false
+ * and the caller should use synchronous I/O instead.
+ *
+ * This class is not thread-safe.
+ */
+class IoUring
+{
+	public:
+		/**
+		 * Create an io_uring instance.
+		 * Check isOpen() afterwards.
+		 * @param entries Number of submission queue entries.
+		 */
+		explicit IoUring(unsigned int entries);
+		~IoUring();
+
+	private:
+		DISABLE_COPY(IoUring)
+
+	public:
+		/**
+		 * Is the io_uring instance open?
+		 * @return True if open; false if not.
+		 */
+		inline bool isOpen(void) const
+		{
+			return (m_ringFd >= 0);
+		}
+
+		/**
+		 * Get the last error.
+		 * @return Last error. (positive POSIX error code)
+		 */
+		inline int lastError(void) const
+		{
+			return m_lastError;
+		}
+
+		/**
+		 * Get the number of submission queue entries.
+		 * @return Number of submission queue entries.
+		 */
+		inline unsigned int entries(void) const
+		{
+			return m_sqEntries;
+		}
+
+		/**
+		 * Register buffers for use with readFixed() and writeFixed().
+		 * All buffers must have the same size.
+		 * @param bufs		[in] Buffers.
+		 * @param count		[in] Number of buffers.
+		 * @param size		[in] Size of each buffer, in bytes.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int registerBuffers(uint8_t *const *bufs, unsigned int count, size_t size);
+
+		/**
+		 * Queue a read into a registered buffer.
+		 * The request is not submitted until submit() is called.
+		 * @param fd		[in] File descriptor.
+		 * @param buf		[in] Destination address. (within a registered buffer)
+		 * @param len		[in] Length, in bytes.
+		 * @param offset	[in] File offset, in bytes.
+		 * @param buf_index	[in] Registered buffer index.
+		 * @param user_data	[in] User data for the completion.
+		 * @return 0 on success; -EBUSY if the submission queue is full.
+		 */
+		int readFixed(int fd, void *buf, uint32_t len, int64_t offset,
+			unsigned int buf_index, uint64_t user_data);
+
+		/**
+		 * Queue a write from a registered buffer.
+		 * The request is not submitted until submit() is called.
+		 * @param fd		[in] File descriptor.
+		 * @param buf		[in] Source address. (within a registered buffer)
+		 * @param len		[in] Length, in bytes.
+		 * @param offset	[in] File offset, in bytes.
+		 * @param buf_index	[in] Registered buffer index.
+		 * @param user_data	[in] User data for the completion.
+		 * @return 0 on success; -EBUSY if the submission queue is full.
+		 */
+		int writeFixed(int fd, const void *buf, uint32_t len, int64_t offset,
+			unsigned int buf_index, uint64_t user_data);
+
+		/**
+		 * Submit all queued requests.
+		 * @return Number of requests submitted, or negative POSIX error code on error.
+		 */
+		int submit(void);
+
+		/**
+		 * Get the next completion.
+		 * Queued requests are submitted first.
+		 * @param pUserData	[out] User data from the request.
+		 * @param pRes		[out] Result. (bytes transferred, or negative POSIX error code)
+		 * @param wait		[in] If true, wait for a completion if none are available.
+		 * @return 0 on success; -EAGAIN if !wait and no completions are available;
+		 *         other negative POSIX error code on error.
+		 */
+		int getCompletion(uint64_t *pUserData, int *pRes, bool wait = true);
+
+	private:
+		/**
+		 * Queue a fixed-buffer request.
+		 * @param opcode	[in] IORING_OP_*
+		 * @return 0 on success; -EBUSY if the submission queue is full.
+		 */
+		int prep(uint8_t opcode, int fd, const void *buf, uint32_t len,
+			int64_t offset, unsigned int buf_index, uint64_t user_data);
+
+	private:
+		int m_ringFd;			// io_uring file descriptor, or -1
+		int m_lastError;		// Last error code
+		unsigned int m_sqEntries;	// Number of SQ entries
+		unsigned int m_toSubmit;	// Number of queued SQEs that haven't been submitted
+
+		// Ring mappings
+		void *m_sqRing;			// SQ ring mapping
+		size_t m_sqRingSize;		// Size of the SQ ring mapping
+		void *m_cqRing;			// CQ ring mapping (may be the same as m_sqRing)
+		size_t m_cqRingSize;		// Size of the CQ ring mapping
+		void *m_sqes;			// SQE array mapping
+		size_t m_sqesSize;		// Size of the SQE array mapping
+
+		// SQ ring fields
+		unsigned int *m_sqHead;
+		unsigned int *m_sqTail;
+		unsigned int *m_sqMask;
+		unsigned int *m_sqArray;
+
+		// CQ ring fields
+		unsigned int *m_cqHead;
+		unsigned int *m_cqTail;
+		unsigned int *m_cqMask;
+		void *m_cqes;
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_IOURING_HPP__ */
@@ -22,6 +22,9 @@
 
 #include "RefFile.hpp"
 
+// For LBA_SIZE
+#include "nhcd_structs.h"
+
 // C includes.
 #include <stdlib.h>
 
@@ -35,12 +38,17 @@
 # include <io.h>
 # include <winioctl.h>
 #else /* !_WIN32 */
+# include <fcntl.h>
 # include <sys/ioctl.h>
+# ifdef HAVE_MMAP
+#  include <sys/mman.h>
+# endif /* HAVE_MMAP */
 # include <sys/types.h>
 # include <sys/stat.h>
 # include <unistd.h>
 # ifdef __linux__
 #  include <linux/fs.h>
+#  include <sys/sysmacros.h>
 # endif /* __linux__ */
 #endif /* !_WIN32 */
 
@@ -66,6 +74,13 @@ RefFile::RefFile(const TCHAR *filename, bool create)
 	, m_lastError(0)
 	, m_file(nullptr)
 	, m_isWritable(false)
+	, m_dirty(false)
+	, m_seekFd(-1)
+	, m_directFd(-1)
+	, m_directAlign(LBA_SIZE)
+	, m_directIO(false)
+	, m_map(nullptr)
+	, m_mapSize(0)
 {
 	if (!filename) {
 		// No filename...
@@ -95,6 +110,21 @@ RefFile::RefFile(const TCHAR *filename, bool create)
 
 RefFile::~RefFile()
 {
+	if (m_map) {
+#if defined(_WIN32)
+		UnmapViewOfFile(m_map);
+#elif defined(HAVE_MMAP)
+		munmap(m_map, static_cast<size_t>(m_mapSize));
+#endif
+	}
+#ifndef _WIN32
+	if (m_seekFd >= 0) {
+		::close(m_seekFd);
+	}
+	if (m_directFd >= 0) {
+		::close(m_directFd);
+	}
+#endif /* !_WIN32 */
 	if (m_file) {
 		fclose(m_file);
 	}
@@ -138,6 +168,11 @@ int RefFile::makeWritable(void)
 	// Seek to the original position.
 	// TODO: Check for errors.
 	fseeko(m_file, pos, SEEK_SET);
+
+	if (ret == 0 && m_directIO) {
+		// Reopen the direct I/O file descriptor as writable.
+		ret = openDirectFd();
+	}
 	return ret;
 }
 
@@ -175,6 +210,75 @@ bool RefFile::isDevice(void) const
 #endif
 }
 
+/**
+ * Check if the file is stored on a rotational device.
+ *
+ * Rotational devices have a high seek penalty, so reads
+ * should be issued sequentially in LBA order. Other devices,
+ * e.g. SSDs, can handle concurrent reads efficiently.
+ *
+ * NOTE: If the device type can't be determined, the file
+ * is assumed to be on a rotational device.
+ *
+ * @return True if the file is on a rotational device; false if it isn't.
+ */
+bool RefFile::isRotational(void) const
+{
+	if (!m_file) {
+		// No file...
+		return true;
+	}
+
+#ifdef __linux__
+	// Linux: Check the block device's "rotational" attribute in sysfs.
+	struct stat buf;
+	int ret = fstat(fileno(m_file), &buf);
+	if (ret != 0) {
+		// fstat() failed.
+		return true;
+	}
+
+	// For device files, check the device itself.
+	// For regular files, check the device containing the file.
+	const dev_t dev = (S_ISBLK(buf.st_mode) ? buf.st_rdev : buf.st_dev);
+	if (major(dev) == 0) {
+		// Major device 0 is used for file systems that aren't
+		// backed by a single block device, e.g. tmpfs, overlayfs,
+		// and network file systems. There's no device to check,
+		// and these are usually not limited by disk seeks.
+		return false;
+	}
+
+	// NOTE: Partitions don't have a "queue" directory,
+	// so check the parent device if it isn't found.
+	static const char *const rotational_paths[] = {
+		"/sys/dev/block/%u:%u/queue/rotational",
+		"/sys/dev/block/%u:%u/../queue/rotational",
+	};
+	for (unsigned int i = 0; i < ARRAY_SIZE(rotational_paths); i++) {
+		char path[64];
+		snprintf(path, sizeof(path), rotational_paths[i],
+			static_cast<unsigned int>(major(dev)),
+			static_cast<unsigned int>(minor(dev)));
+
+		FILE *f_rot = fopen(path, "r");
+		if (!f_rot) {
+			continue;
+		}
+		const int c = fgetc(f_rot);
+		fclose(f_rot);
+		if (c == '0') {
+			return false;
+		} else if (c == '1') {
+			return true;
+		}
+	}
+#endif /* __linux__ */
+
+	// Unable to determine the device type.
+	return true;
+}
+
 /**
  * Try to make this file a sparse file.
  * @param size If not zero, try to set the file to this size.
@@ -322,3 +426,446 @@ int64_t RefFile::size(void)
 	}
 	return ret;
 }
+
+/**
+ * Map the entire file into memory. (read-only)
+ *
+ * The mapping is created on first use and remains valid
+ * until the RefFile is deleted. Data written using pwrite()
+ * is visible through the mapping.
+ *
+ * Device files and 32-bit builds are not supported,
+ * since RVT-H HDDs and images are too large to map there.
+ *
+ * @param pSize	[out,opt] Size of the mapping, in bytes.
+ * @return Pointer to the mapped file, or nullptr on error.
+ */
+const uint8_t *RefFile::map(int64_t *pSize)
+{
+	if (m_map) {
+		// File is already mapped.
+		if (pSize) {
+			*pSize = m_mapSize;
+		}
+		return m_map;
+	}
+
+	if (!m_file) {
+		// No file...
+		errno = EBADF;
+		return nullptr;
+	} else if (sizeof(void*) < 8 || isDevice()) {
+		// Not supported for 32-bit builds or device files.
+		errno = ENOTSUP;
+		return nullptr;
+	}
+
+	const int64_t filesize = this->size();
+	if (filesize <= 0) {
+		// Empty file and/or seek error.
+		// Empty files can't be mapped.
+		if (errno == 0) {
+			errno = EIO;
+		}
+		return nullptr;
+	}
+
+	// Make sure the OS file descriptor sees any buffered writes.
+	flushPending();
+
+#if defined(_WIN32)
+	HANDLE hFile = (HANDLE)_get_osfhandle(_fileno(m_file));
+	if (!hFile || hFile == INVALID_HANDLE_VALUE) {
+		errno = EBADF;
+		return nullptr;
+	}
+	HANDLE hMapping = CreateFileMapping(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!hMapping) {
+		// TODO: Convert Win32 error code to POSIX.
+		errno = EIO;
+		return nullptr;
+	}
+	void *ptr = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, static_cast<SIZE_T>(filesize));
+	// NOTE: The view keeps a reference to the mapping object.
+	CloseHandle(hMapping);
+	if (!ptr) {
+		errno = ENOMEM;
+		return nullptr;
+	}
+#elif defined(HAVE_MMAP)
+	void *ptr = mmap(nullptr, static_cast<size_t>(filesize), PROT_READ, MAP_SHARED, fileno(m_file), 0);
+	if (ptr == MAP_FAILED) {
+		if (errno == 0) {
+			errno = ENOMEM;
+		}
+		return nullptr;
+	}
+# ifdef MADV_SEQUENTIAL
+	// Most accesses are sequential copies, so
+	// aggressive readahead is beneficial.
+	madvise(ptr, static_cast<size_t>(filesize), MADV_SEQUENTIAL);
+# endif /* MADV_SEQUENTIAL */
+#else
+	// Memory mapping is not supported on this system.
+	errno = ENOTSUP;
+	return nullptr;
+#endif
+
+	m_map = static_cast<uint8_t*>(ptr);
+	m_mapSize = filesize;
+	if (pSize) {
+		*pSize = m_mapSize;
+	}
+	return m_map;
+}
+
+/**
+ * Check if a positional I/O request is suitably aligned for direct I/O.
+ * @param ptr		[in] Buffer.
+ * @param size		[in] Size, in bytes.
+ * @param offset	[in] File offset, in bytes.
+ * @param align		[in] Required alignment. (must be a power of two)
+ * @return True if aligned; false if not.
+ */
+static inline bool isDirectIOAligned(const void *ptr, size_t size, int64_t offset, unsigned int align)
+{
+	const uintptr_t mask = align - 1;
+	return ((reinterpret_cast<uintptr_t>(ptr) | static_cast<uintptr_t>(size) |
+		 static_cast<uintptr_t>(offset)) & mask) == 0;
+}
+
+/**
+ * (Re-)open the file descriptor used for direct I/O.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int RefFile::openDirectFd(void)
+{
+#if defined(_WIN32)
+	// TODO: Reopen the file with FILE_FLAG_NO_BUFFERING.
+	return -ENOTSUP;
+#elif defined(O_DIRECT)
+	// Open a separate file descriptor with O_DIRECT.
+	// The FILE* is left as-is so stdio reads of unaligned
+	// structures, e.g. the bank table, continue to work.
+	int fd = ::open(m_filename.c_str(), (m_isWritable ? O_RDWR : O_RDONLY) | O_DIRECT);
+	if (fd < 0) {
+		// Unable to open the file for direct I/O.
+		// (The file system might not support it.)
+		int err = errno;
+		if (err == 0) {
+			err = EIO;
+		}
+		m_lastError = err;
+		return -err;
+	}
+
+	// Determine the required alignment.
+	unsigned int align = LBA_SIZE;
+# ifdef BLKSSZGET
+	int sector_size = 0;
+	if (isDevice() && ioctl(fd, BLKSSZGET, &sector_size) == 0 && sector_size > 0) {
+		// Use the device's logical sector size.
+		align = static_cast<unsigned int>(sector_size);
+	} else
+# endif /* BLKSSZGET */
+	if (!isDevice()) {
+		// Regular files generally require page alignment.
+		align = 4096;
+	}
+
+	if (m_directFd >= 0) {
+		::close(m_directFd);
+	}
+	m_directFd = fd;
+	m_directAlign = align;
+	return 0;
+#elif defined(F_NOCACHE)
+	// macOS: Disable caching on the existing file descriptor.
+	// No alignment restrictions are needed here.
+	if (fcntl(fileno(m_file), F_NOCACHE, 1) != 0) {
+		int err = errno;
+		if (err == 0) {
+			err = EIO;
+		}
+		m_lastError = err;
+		return -err;
+	}
+	m_directAlign = 1;
+	return 0;
+#else
+	// Direct I/O is not supported on this system.
+	return -ENOTSUP;
+#endif
+}
+
+/**
+ * Enable or disable direct I/O for pread() and pwrite().
+ *
+ * Direct I/O bypasses the OS page cache, which is useful for
+ * one-shot copies to or from RVT-H Reader devices. Requests
+ * that aren't aligned to directIOAlignment() will still use
+ * buffered I/O, and the stdio wrappers are not affected.
+ *
+ * @param enable True to enable; false to disable.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int RefFile::setDirectIO(bool enable)
+{
+	if (!m_file) {
+		// File is not open.
+		return -EBADF;
+	} else if (enable == m_directIO) {
+		// No change.
+		return 0;
+	}
+
+	if (enable) {
+		// Flush any pending writes before bypassing the cache.
+		::fflush(m_file);
+		int ret = openDirectFd();
+		if (ret != 0) {
+			return ret;
+		}
+	} else {
+#ifndef _WIN32
+		if (m_directFd >= 0) {
+			::close(m_directFd);
+			m_directFd = -1;
+		}
+#endif /* !_WIN32 */
+#if defined(F_NOCACHE) && !defined(O_DIRECT)
+		fcntl(fileno(m_file), F_NOCACHE, 0);
+#endif /* F_NOCACHE && !O_DIRECT */
+		m_directAlign = LBA_SIZE;
+	}
+
+	m_directIO = enable;
+	return 0;
+}
+
+/**
+ * Get the OS file descriptor to use for a positional I/O request.
+ * Any pending stdio writes are flushed first.
+ *
+ * If direct I/O is enabled and the request is suitably aligned,
+ * the direct I/O file descriptor is returned.
+ *
+ * @param ptr		[in] Buffer.
+ * @param size		[in] Size, in bytes.
+ * @param offset	[in] File offset, in bytes.
+ * @return File descriptor, or -1 on error.
+ */
+int RefFile::ioFd(const void *ptr, size_t size, int64_t offset)
+{
+	if (!m_file) {
+		// No file...
+		errno = EBADF;
+		return -1;
+	}
+
+	// Make sure the OS file descriptor sees any buffered writes.
+	// NOTE: fflush() takes the stdio lock, so it's only called if
+	// there are stdio writes pending. Otherwise, concurrent readers
+	// would be serialized here.
+	flushPending();
+
+#ifdef _WIN32
+	// Not used on Windows.
+	UNUSED(ptr);
+	UNUSED(size);
+	UNUSED(offset);
+	errno = ENOTSUP;
+	return -1;
+#else /* !_WIN32 */
+	return (m_directFd >= 0 && isDirectIOAligned(ptr, size, offset, m_directAlign))
+		? m_directFd : fileno(m_file);
+#endif /* _WIN32 */
+}
+
+/**
+ * Find the next data region in a sparse file.
+ *
+ * Holes in sparse files are known to be all zeroes, so they
+ * don't need to be read. This uses SEEK_DATA and SEEK_HOLE
+ * if they're available. Device files are not supported.
+ *
+ * @param offset	[in] Starting offset, in bytes.
+ * @param pDataStart	[out] Start of the next data region at or after offset.
+ *			      (End of file if there's no more data.)
+ * @param pDataEnd	[out] End of the data region. (Start of the next hole.)
+ * @return 0 on success; negative POSIX error code on error. (-ENOTSUP if not supported)
+ */
+int RefFile::findData(int64_t offset, int64_t *pDataStart, int64_t *pDataEnd)
+{
+	assert(pDataStart != nullptr);
+	assert(pDataEnd != nullptr);
+	if (!m_file) {
+		// No file...
+		return -EBADF;
+	}
+
+#if !defined(_WIN32) && defined(SEEK_DATA) && defined(SEEK_HOLE)
+	if (isDevice()) {
+		// Devices don't have holes.
+		return -ENOTSUP;
+	}
+
+	// lseek() changes the file offset, which is shared with the FILE*
+	// and would race with other threads, so a private file descriptor
+	// is used. It's opened on first use. SEEK_DATA and SEEK_HOLE don't
+	// depend on the current offset, so it doesn't need to be locked
+	// after that.
+	flushPending();
+	int fd;
+	{
+		std::lock_guard<std::mutex> lock(m_posMutex);
+		if (m_seekFd < 0) {
+			m_seekFd = ::open(m_filename.c_str(), O_RDONLY);
+			if (m_seekFd < 0) {
+				return (errno != 0 ? -errno : -EIO);
+			}
+		}
+		fd = m_seekFd;
+	}
+
+	int ret = 0;
+	off_t data = lseek(fd, static_cast<off_t>(offset), SEEK_DATA);
+	if (data >= 0) {
+		const off_t hole = lseek(fd, data, SEEK_HOLE);
+		if (hole >= 0) {
+			*pDataStart = data;
+			*pDataEnd = hole;
+		} else {
+			ret = -errno;
+		}
+	} else if (errno == ENXIO) {
+		// No more data after this offset.
+		data = lseek(fd, 0, SEEK_END);
+		if (data >= 0) {
+			*pDataStart = data;
+			*pDataEnd = data;
+		} else {
+			ret = -errno;
+		}
+	} else {
+		// SEEK_DATA isn't supported here.
+		ret = -errno;
+	}
+	return ret;
+#else
+	// Not supported on this system.
+	UNUSED(offset);
+	UNUSED(pDataStart);
+	UNUSED(pDataEnd);
+	return -ENOTSUP;
+#endif
+}
+
+/**
+ * Read data from the file at the specified offset.
+ * Any pending stdio writes are flushed first.
+ * @param ptr	[out] Read buffer.
+ * @param size	[in] Number of bytes to read.
+ * @param offset	[in] File offset, in bytes.
+ * @return Number of bytes read. (May be short on EOF or error.)
+ */
+size_t RefFile::pread(void *ptr, size_t size, int64_t offset)
+{
+	if (!m_file) {
+		// No file...
+		errno = EBADF;
+		return 0;
+	}
+
+#ifdef HAVE_PREAD
+	// Use pread() directly on the file descriptor.
+	const int fd = ioFd(ptr, size, offset);
+	uint8_t *ptr8 = static_cast<uint8_t*>(ptr);
+	size_t total = 0;
+	while (total < size) {
+		ssize_t ret = ::pread(fd, ptr8 + total, size - total, static_cast<off_t>(offset + total));
+		if (ret < 0) {
+			if (errno == EINTR) {
+				// Interrupted. Try again.
+				continue;
+			}
+			// Read error.
+			break;
+		} else if (ret == 0) {
+			// End of file.
+			break;
+		}
+		total += static_cast<size_t>(ret);
+	}
+	return total;
+#else /* !HAVE_PREAD */
+	// No pread(). Use seek and read.
+	// NOTE: This changes the file position, so it's serialized
+	// to prevent concurrent requests from reading the wrong data.
+	std::lock_guard<std::mutex> lock(m_posMutex);
+	int ret = this->seeko(offset, SEEK_SET);
+	if (ret != 0) {
+		// Seek error.
+		if (errno == 0) {
+			errno = EIO;
+		}
+		return 0;
+	}
+	return this->read(ptr, 1, size);
+#endif /* HAVE_PREAD */
+}
+
+/**
+ * Write data to the file at the specified offset.
+ * Any pending stdio writes are flushed first.
+ * @param ptr	[in] Write buffer.
+ * @param size	[in] Number of bytes to write.
+ * @param offset	[in] File offset, in bytes.
+ * @return Number of bytes written. (May be short on error.)
+ */
+size_t RefFile::pwrite(const void *ptr, size_t size, int64_t offset)
+{
+	if (!m_file) {
+		// No file...
+		errno = EBADF;
+		return 0;
+	}
+
+#ifdef HAVE_PWRITE
+	// Use pwrite() directly on the file descriptor.
+	const int fd = ioFd(ptr, size, offset);
+	const uint8_t *ptr8 = static_cast<const uint8_t*>(ptr);
+	size_t total = 0;
+	while (total < size) {
+		ssize_t ret = ::pwrite(fd, ptr8 + total, size - total, static_cast<off_t>(offset + total));
+		if (ret < 0) {
+			if (errno == EINTR) {
+				// Interrupted. Try again.
+				continue;
+			}
+			// Write error.
+			break;
+		} else if (ret == 0) {
+			// Nothing was written.
+			errno = EIO;
+			break;
+		}
+		total += static_cast<size_t>(ret);
+	}
+	return total;
+#else /* !HAVE_PWRITE */
+	// No pwrite(). Use seek and write.
+	// NOTE: This changes the file position, so it's serialized
+	// to prevent concurrent requests from writing to the wrong offset.
+	std::lock_guard<std::mutex> lock(m_posMutex);
+	int ret = this->seeko(offset, SEEK_SET);
+	if (ret != 0) {
+		// Seek error.
+		if (errno == 0) {
+			errno = EIO;
+		}
+		return 0;
+	}
+	return this->write(ptr, 1, size);
+#endif /* HAVE_PWRITE */
+}
@@ -22,6 +22,8 @@
 #include <cstdio>
 
 // C++ includes.
+#include <atomic>
+#include <mutex>
 #include <string>
 
 class RefFile
@@ -55,7 +57,6 @@ class RefFile
 		 */
 		inline RefFile *ref(void)
 		{
-			// TODO: Atomic increment?
 			m_refCount++;
 			return this;
 		}
@@ -65,10 +66,10 @@ class RefFile
 		 */
 		inline void unref(void)
 		{
-			// TODO: Atomic decrement?
-			assert(m_refCount > 0);
-			if (--m_refCount <= 0) {
-				// Delete the object.
+			const int oldCount = m_refCount.fetch_sub(1);
+			assert(oldCount > 0);
+			if (oldCount == 1) {
+				// Last reference. Delete the object.
 				delete this;
 			}
 		}
@@ -103,6 +104,20 @@ class RefFile
 		 */
 		bool isDevice(void) const;
 
+		/**
+		 * Check if the file is stored on a rotational device.
+		 *
+		 * Rotational devices have a high seek penalty, so reads
+		 * should be issued sequentially in LBA order. Other devices,
+		 * e.g. SSDs, can handle concurrent reads efficiently.
+		 *
+		 * NOTE: If the device type can't be determined, the file
+		 * is assumed to be on a rotational device.
+		 *
+		 * @return True if the file is on a rotational device; false if it isn't.
+		 */
+		bool isRotational(void) const;
+
 		/**
 		 * Try to make this file a sparse file.
 		 * @param size If not zero, try to set the file to this size.
@@ -116,9 +131,77 @@ class RefFile
 		 */
 		int64_t size(void);
 
+		/**
+		 * Enable or disable direct I/O for pread() and pwrite().
+		 *
+		 * Direct I/O bypasses the OS page cache, which is useful for
+		 * one-shot copies to or from RVT-H Reader devices. Requests
+		 * that aren't aligned to directIOAlignment() will still use
+		 * buffered I/O, and the stdio wrappers are not affected.
+		 *
+		 * @param enable True to enable; false to disable.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int setDirectIO(bool enable);
+
+		/**
+		 * Is direct I/O enabled?
+		 * @return True if enabled; false if not.
+		 */
+		inline bool isDirectIO(void) const
+		{
+			return m_directIO;
+		}
+
+		/**
+		 * Get the required alignment for direct I/O.
+		 * Buffer addresses, sizes, and file offsets must all be
+		 * multiples of this value in order to use direct I/O.
+		 * @return Alignment, in bytes.
+		 */
+		inline unsigned int directIOAlignment(void) const
+		{
+			return m_directAlign;
+		}
+
+		/**
+		 * Map the entire file into memory. (read-only)
+		 *
+		 * The mapping is created on first use and remains valid
+		 * until the RefFile is deleted. Data written using pwrite()
+		 * is visible through the mapping.
+		 *
+		 * Device files and 32-bit builds are not supported,
+		 * since RVT-H HDDs and images are too large to map there.
+		 *
+		 * @param pSize	[out,opt] Size of the mapping, in bytes.
+		 * @return Pointer to the mapped file, or nullptr on error.
+		 */
+		const uint8_t *map(int64_t *pSize = nullptr);
+
+		/**
+		 * Find the next data region in a sparse file.
+		 *
+		 * Holes in sparse files are known to be all zeroes, so they
+		 * don't need to be read. This uses SEEK_DATA and SEEK_HOLE
+		 * if they're available. Device files are not supported.
+		 *
+		 * A separate file descriptor is used, so the FILE* position
+		 * isn't changed, and this can be called from multiple threads.
+		 *
+		 * @param offset	[in] Starting offset, in bytes.
+		 * @param pDataStart	[out] Start of the next data region at or after offset.
+		 *			      (End of file if there's no more data.)
+		 * @param pDataEnd	[out] End of the data region. (Start of the next hole.)
+		 * @return 0 on success; negative POSIX error code on error. (-ENOTSUP if not supported)
+		 */
+		int findData(int64_t offset, int64_t *pDataStart, int64_t *pDataEnd);
+
 	public:
 		/** Convenience wrappers for stdio functions. **/
 		// NOTE: These functions set errno, **NOT** m_lastError!
+		// NOTE: These functions use the shared file position, so they
+		// must not be used concurrently. Use pread() and pwrite() instead.
 
 		inline size_t read(void *ptr, size_t size, size_t nmemb)
 		{
@@ -127,6 +210,9 @@ class RefFile
 
 		inline size_t write(const void *ptr, size_t size, size_t nmemb)
 		{
+			// The data might be buffered by stdio, so it has to
+			// be flushed before the next positional I/O request.
+			m_dirty = true;
 			return ::fwrite(ptr, size, nmemb, m_file);
 		}
 
@@ -142,6 +228,7 @@ class RefFile
 
 		inline int64_t flush(void)
 		{
+			m_dirty = false;
 			return ::fflush(m_file);
 		}
 
@@ -165,6 +252,53 @@ class RefFile
 			return this->read(ptr, size, nmemb);
 		}
 
+	public:
+		/** Positional I/O functions **/
+		// These functions do not use or modify the current file position,
+		// so multiple Readers can share a single RefFile without seeking.
+		// NOTE: These functions set errno, **NOT** m_lastError!
+		// NOTE: If pread() or pwrite() aren't available (HAVE_PREAD,
+		// HAVE_PWRITE), these functions fall back to seek and read/write,
+		// which changes the shared file position. The fallback is serialized
+		// using a mutex, so these functions are always safe to call from
+		// multiple threads, but concurrent requests won't overlap.
+
+		/**
+		 * Read data from the file at the specified offset.
+		 * Any pending stdio writes are flushed first.
+		 * @param ptr	[out] Read buffer.
+		 * @param size	[in] Number of bytes to read.
+		 * @param offset	[in] File offset, in bytes.
+		 * @return Number of bytes read. (May be short on EOF or error.)
+		 */
+		size_t pread(void *ptr, size_t size, int64_t offset);
+
+		/**
+		 * Write data to the file at the specified offset.
+		 * Any pending stdio writes are flushed first.
+		 * @param ptr	[in] Write buffer.
+		 * @param size	[in] Number of bytes to write.
+		 * @param offset	[in] File offset, in bytes.
+		 * @return Number of bytes written. (May be short on error.)
+		 */
+		size_t pwrite(const void *ptr, size_t size, int64_t offset);
+
+		/**
+		 * Get the OS file descriptor to use for a positional I/O request.
+		 * This is used for asynchronous I/O, e.g. io_uring.
+		 * Any pending stdio writes are flushed first.
+		 *
+		 * If direct I/O is enabled and the request is suitably aligned,
+		 * the direct I/O file descriptor is returned.
+		 *
+		 * @param ptr		[in] Buffer.
+		 * @param size		[in] Size, in bytes.
+		 * @param offset	[in] File offset, in bytes.
+		 * @return File descriptor, or -1 on error.
+		 */
+		int ioFd(const void *ptr, size_t size, int64_t offset);
+
+	public:
 		/** Convenience wrappers for various RefFile fields. **/
 
 		inline const TCHAR *filename(void) const
@@ -178,11 +312,41 @@ class RefFile
 		}
 
 	private:
-		int m_refCount;			// Reference count
+		/**
+		 * (Re-)open the file descriptor used for direct I/O.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int openDirectFd(void);
+
+		/**
+		 * Flush pending stdio writes, if any, so the
+		 * OS file descriptor sees the written data.
+		 */
+		inline void flushPending(void)
+		{
+			if (m_dirty.exchange(false)) {
+				::fflush(m_file);
+			}
+		}
+
+	private:
+		std::atomic<int> m_refCount;	// Reference count
 		int m_lastError;		// Last error code
 		FILE *m_file;			// FILE pointer
 		std::tstring m_filename;	// Filename for reopening as writable
 		bool m_isWritable;		// Is the file writable?
+		std::atomic<bool> m_dirty;	// Are there stdio writes that haven't been flushed?
+		std::mutex m_posMutex;		// Serializes the seek-based pread()/pwrite() fallbacks and opening m_seekFd
+		int m_seekFd;			// File descriptor for findData(), or -1
+
+		// Direct I/O
+		int m_directFd;			// File descriptor opened with O_DIRECT, or -1
+		unsigned int m_directAlign;	// Direct I/O alignment, in bytes
+		bool m_directIO;		// Is direct I/O enabled?
+
+		// Memory mapping
+		uint8_t *m_map;			// Mapped file, or nullptr
+		int64_t m_mapSize;		// Size of the mapping, in bytes
 };
 
 #else /* !__cplusplus */
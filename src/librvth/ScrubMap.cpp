@@ -0,0 +1,306 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * ScrubMap.cpp: Map of the LBAs used by a disc image.                     *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "ScrubMap.hpp"
+#include "FST.hpp"
+#include "ptbl.h"
+#include "wii_crypt.h"
+#include "reader/Reader.hpp"
+
+// libwiicrypto
+#include "libwiicrypto/byteswap.h"
+
+// C includes. (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+// C++ includes.
+#include <memory>
+using std::unique_ptr;
+
+// Wii disc header area: disc header, partition tables,
+// and region settings. (0x4E000)
+#define WII_HEADER_AREA_SIZE 0x50000
+
+// H3 table size.
+#define H3_TABLE_SIZE 0x18000
+
+/**
+ * Build the map from a bank entry.
+ *
+ * If a file system table can't be loaded, e.g. because the
+ * partition's common key isn't available, the entire disc
+ * image or partition is marked as used, so nothing is lost.
+ *
+ * @param entry	[in] Bank entry.
+ * @return 0 on success; negative POSIX error code or positive RvtH_Errors code on error.
+ */
+int ScrubMap::load(RvtH_BankEntry *entry)
+{
+	assert(entry != nullptr);
+	assert(entry->reader != nullptr);
+	if (!entry || !entry->reader) {
+		return -EINVAL;
+	}
+
+	m_ranges.clear();
+	Reader *const reader = entry->reader;
+	switch (entry->type) {
+		case RVTH_BankType_GCN: {
+			// GameCube discs don't have partitions.
+			// The FST includes the system files, so the disc header,
+			// apploader, and main.dol are marked as used, too.
+			unique_ptr<FST> fst(FST::open(reader, nullptr, false));
+			if (!fst) {
+				add(0, reader->lba_len());
+				break;
+			}
+			for (unsigned int i = 0; i < fst->count(); i++) {
+				if (!fst->isDir(i)) {
+					addBytes(fst->fileOffset(i), fst->fileSize(i));
+				}
+			}
+			break;
+		}
+
+		case RVTH_BankType_Wii_SL:
+		case RVTH_BankType_Wii_DL: {
+			int ret = rvth_ptbl_load(entry);
+			if (ret != 0) {
+				// Unable to load the partition table.
+				return ret;
+			}
+
+			addBytes(0, WII_HEADER_AREA_SIZE);
+			const bool encrypted = (entry->crypto_type != RVL_CryptoType_None);
+			for (unsigned int i = 0; i < entry->pt_count; i++) {
+				const pt_entry_t *const pte = &entry->ptbl[i];
+				if (pte->lba_start == 0) {
+					// Empty entry.
+					continue;
+				}
+				addPartition(reader, pte, encrypted);
+			}
+			break;
+		}
+
+		default:
+			// Only GameCube and Wii disc images can be scrubbed.
+			return -EINVAL;
+	}
+
+	return 0;
+}
+
+/**
+ * Add the used regions of a Wii partition.
+ * @param reader	[in] Disc image reader.
+ * @param pte		[in] Partition table entry.
+ * @param encrypted	[in] If true, the partition is encrypted.
+ */
+void ScrubMap::addPartition(Reader *reader, const pt_entry_t *pte, bool encrypted)
+{
+	// Read the partition header to find the data area.
+	RVL_PartitionHeader pthdr;
+	if (reader->read(&pthdr, pte->lba_start, BYTES_TO_LBA(sizeof(pthdr))) != BYTES_TO_LBA(sizeof(pthdr))) {
+		// Read error. Keep the entire partition.
+		add(pte->lba_start, pte->lba_len);
+		return;
+	}
+	const int64_t data_offset = (int64_t)be32_to_cpu(pthdr.data_offset) << 2;
+	if (data_offset < (int64_t)sizeof(pthdr) ||
+	    data_offset % LBA_SIZE != 0 ||
+	    BYTES_TO_LBA(data_offset) >= pte->lba_len)
+	{
+		// Invalid data offset. Keep the entire partition.
+		add(pte->lba_start, pte->lba_len);
+		return;
+	}
+
+	// The partition header, ticket, TMD, certificate chain,
+	// and H3 table are stored before the data area.
+	const uint32_t lba_data = pte->lba_start + BYTES_TO_LBA(data_offset);
+	const uint32_t lba_end = pte->lba_start + pte->lba_len;
+	add(pte->lba_start, lba_data - pte->lba_start);
+	const int64_t h3_offset = (int64_t)be32_to_cpu(pthdr.h3_table_offset) << 2;
+	if (h3_offset >= data_offset && h3_offset + H3_TABLE_SIZE <= LBA_TO_BYTES(pte->lba_len)) {
+		// H3 table is after the data area.
+		addBytes(LBA_TO_BYTES(pte->lba_start) + h3_offset, H3_TABLE_SIZE);
+	}
+
+	unique_ptr<FST> fst(FST::open(reader, pte, encrypted));
+	if (!fst) {
+		// Unable to load the FST. Keep the entire data area.
+		add(lba_data, lba_end - lba_data);
+		return;
+	}
+
+	for (unsigned int i = 0; i < fst->count(); i++) {
+		if (fst->isDir(i) || fst->fileSize(i) == 0) {
+			continue;
+		}
+
+		const int64_t offset = fst->fileOffset(i);
+		const int64_t size = fst->fileSize(i);
+		uint32_t lba_start, lba_len;
+		if (encrypted) {
+			// Keep all groups containing the file.
+			const uint32_t group_first = static_cast<uint32_t>(offset / GROUP_SIZE_DEC);
+			const uint32_t group_last = static_cast<uint32_t>((offset + size - 1) / GROUP_SIZE_DEC);
+			lba_start = lba_data + (group_first * LBA_COUNT_ENC);
+			lba_len = (group_last - group_first + 1) * LBA_COUNT_ENC;
+		} else {
+			// Unencrypted partitions are stored linearly.
+			lba_start = lba_data + BYTES_TO_LBA(offset);
+			lba_len = BYTES_TO_LBA(offset + size + LBA_SIZE - 1) - BYTES_TO_LBA(offset);
+		}
+
+		if (lba_start >= lba_end) {
+			// File is outside of the partition.
+			continue;
+		} else if (lba_len > lba_end - lba_start) {
+			lba_len = lba_end - lba_start;
+		}
+		add(lba_start, lba_len);
+	}
+}
+
+/**
+ * Mark an LBA range as used.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ */
+void ScrubMap::add(uint32_t lba_start, uint32_t lba_len)
+{
+	if (lba_len == 0) {
+		return;
+	}
+	uint32_t lba_end = lba_start + lba_len;
+	if (lba_end < lba_start) {
+		// Overflow.
+		lba_end = ~0U;
+	}
+
+	// Merge with all ranges that overlap or touch this one.
+	auto iter = m_ranges.upper_bound(lba_end);
+	while (iter != m_ranges.begin()) {
+		auto prev = iter;
+		--prev;
+		if (prev->second < lba_start) {
+			// This range ends before the new range.
+			break;
+		}
+		if (prev->first < lba_start) {
+			lba_start = prev->first;
+		}
+		if (prev->second > lba_end) {
+			lba_end = prev->second;
+		}
+		iter = m_ranges.erase(prev);
+	}
+	m_ranges.emplace(lba_start, lba_end);
+}
+
+/**
+ * Mark a byte range as used.
+ * The range is expanded to whole LBAs.
+ * @param offset	[in] Starting offset, in bytes.
+ * @param size		[in] Size, in bytes.
+ */
+void ScrubMap::addBytes(int64_t offset, int64_t size)
+{
+	assert(offset >= 0);
+	assert(size >= 0);
+	if (offset < 0 || size <= 0) {
+		return;
+	}
+
+	const uint32_t lba_start = BYTES_TO_LBA(offset);
+	const uint32_t lba_end = BYTES_TO_LBA(offset + size + LBA_SIZE - 1);
+	add(lba_start, lba_end - lba_start);
+}
+
+/**
+ * Does any part of an LBA range contain used data?
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return True if any LBA in the range is used.
+ */
+bool ScrubMap::isUsed(uint32_t lba_start, uint32_t lba_len) const
+{
+	// Find the last range starting before the end of this range.
+	auto iter = m_ranges.lower_bound(lba_start + lba_len);
+	if (iter == m_ranges.begin()) {
+		return false;
+	}
+	--iter;
+	return (iter->second > lba_start);
+}
+
+/**
+ * Is an entire LBA range used?
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return True if every LBA in the range is used.
+ */
+bool ScrubMap::isFullyUsed(uint32_t lba_start, uint32_t lba_len) const
+{
+	// Find the range containing the first LBA.
+	// Ranges are merged, so it must also contain the last LBA.
+	auto iter = m_ranges.upper_bound(lba_start);
+	if (iter == m_ranges.begin()) {
+		return false;
+	}
+	--iter;
+	return (iter->second >= lba_start + lba_len);
+}
+
+/**
+ * Zero the unused LBAs in a buffer.
+ * @param buf		[in,out] Buffer containing the LBA range.
+ * @param lba_start	[in] Starting LBA of the buffer.
+ * @param lba_len	[in] Length of the buffer, in LBAs.
+ */
+void ScrubMap::clearUnused(uint8_t *buf, uint32_t lba_start, uint32_t lba_len) const
+{
+	const uint32_t lba_end = lba_start + lba_len;
+	uint32_t lba = lba_start;
+	while (lba < lba_end) {
+		auto iter = m_ranges.upper_bound(lba);
+		if (iter != m_ranges.begin()) {
+			auto prev = iter;
+			--prev;
+			if (prev->second > lba) {
+				// This LBA is used. Skip to the end of the range.
+				lba = (prev->second < lba_end ? prev->second : lba_end);
+				continue;
+			}
+		}
+
+		// Unused up to the start of the next range.
+		const uint32_t lba_next = (iter != m_ranges.end() && iter->first < lba_end
+			? iter->first : lba_end);
+		memset(&buf[LBA_TO_BYTES(lba - lba_start)], 0,
+			static_cast<size_t>(LBA_TO_BYTES(lba_next - lba)));
+		lba = lba_next;
+	}
+}
+
+/**
+ * Get the number of used LBAs.
+ * @return Number of used LBAs.
+ */
+uint32_t ScrubMap::usedLbaCount(void) const
+{
+	uint32_t count = 0;
+	for (auto iter = m_ranges.cbegin(); iter != m_ranges.cend(); ++iter) {
+		count += iter->second - iter->first;
+	}
+	return count;
+}
@@ -0,0 +1,134 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * ScrubMap.hpp: Map of the LBAs used by a disc image.                     *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_SCRUBMAP_HPP__
+#define __RVTHTOOL_LIBRVTH_SCRUBMAP_HPP__
+
+#include "libwiicrypto/common.h"
+
+// C includes.
+#include <stdint.h>
+
+// C++ includes.
+#include <map>
+
+class Reader;
+struct _pt_entry_t;
+struct _RvtH_BankEntry;
+
+/**
+ * Map of the LBAs in a disc image that contain referenced data.
+ *
+ * Used ranges are stored as a sorted list of non-overlapping LBA
+ * ranges. Adjacent and overlapping ranges are merged when added.
+ *
+ * load() builds the map from a bank's disc header, partition table,
+ * partition headers (ticket, TMD, certificate chain, and H3 table),
+ * and file system tables. For encrypted Wii partitions, whole 2 MB
+ * groups are kept, since each group's hash tables cover all of its
+ * sectors. Everything else is padding or leftover data, and doesn't
+ * have to be copied when extracting.
+ */
+class ScrubMap
+{
+	public:
+		ScrubMap() { }
+
+	private:
+		DISABLE_COPY(ScrubMap)
+
+	public:
+		/**
+		 * Build the map from a bank entry.
+		 *
+		 * If a file system table can't be loaded, e.g. because the
+		 * partition's common key isn't available, the entire disc
+		 * image or partition is marked as used, so nothing is lost.
+		 *
+		 * @param entry	[in] Bank entry.
+		 * @return 0 on success; negative POSIX error code or positive RvtH_Errors code on error.
+		 */
+		int load(struct _RvtH_BankEntry *entry);
+
+		/**
+		 * Mark an LBA range as used.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 */
+		void add(uint32_t lba_start, uint32_t lba_len);
+
+		/**
+		 * Mark a byte range as used.
+		 * The range is expanded to whole LBAs.
+		 * @param offset	[in] Starting offset, in bytes.
+		 * @param size		[in] Size, in bytes.
+		 */
+		void addBytes(int64_t offset, int64_t size);
+
+		/**
+		 * Clear the map.
+		 */
+		inline void clear(void)
+		{
+			m_ranges.clear();
+		}
+
+		/**
+		 * Does any part of an LBA range contain used data?
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return True if any LBA in the range is used.
+		 */
+		bool isUsed(uint32_t lba_start, uint32_t lba_len) const;
+
+		/**
+		 * Is an entire LBA range used?
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return True if every LBA in the range is used.
+		 */
+		bool isFullyUsed(uint32_t lba_start, uint32_t lba_len) const;
+
+		/**
+		 * Zero the unused LBAs in a buffer.
+		 * @param buf		[in,out] Buffer containing the LBA range.
+		 * @param lba_start	[in] Starting LBA of the buffer.
+		 * @param lba_len	[in] Length of the buffer, in LBAs.
+		 */
+		void clearUnused(uint8_t *buf, uint32_t lba_start, uint32_t lba_len) const;
+
+		/**
+		 * Get the number of used LBAs.
+		 * @return Number of used LBAs.
+		 */
+		uint32_t usedLbaCount(void) const;
+
+		/**
+		 * Get the number of used ranges.
+		 * @return Number of used ranges.
+		 */
+		inline unsigned int rangeCount(void) const
+		{
+			return static_cast<unsigned int>(m_ranges.size());
+		}
+
+	private:
+		/**
+		 * Add the used regions of a Wii partition.
+		 * @param reader	[in] Disc image reader.
+		 * @param pte		[in] Partition table entry.
+		 * @param encrypted	[in] If true, the partition is encrypted.
+		 */
+		void addPartition(Reader *reader, const struct _pt_entry_t *pte, bool encrypted);
+
+	private:
+		// Used ranges: key == starting LBA; value == ending LBA (exclusive)
+		std::map<uint32_t, uint32_t> m_ranges;
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_SCRUBMAP_HPP__ */
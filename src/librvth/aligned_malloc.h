@@ -0,0 +1,73 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * aligned_malloc.h: Aligned memory allocation functions.                  *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_ALIGNED_MALLOC_H__
+#define __RVTHTOOL_LIBRVTH_ALIGNED_MALLOC_H__
+
+#include "config.librvth.h"
+
+// C includes.
+#include <stddef.h>
+#include <stdlib.h>
+#ifdef _WIN32
+# include <malloc.h>
+#endif /* _WIN32 */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Page size used for I/O buffers.
+// Direct I/O requires buffers to be aligned to at least the
+// device's logical sector size; page alignment covers that.
+#define RVTH_PAGE_SIZE 4096
+
+/**
+ * Allocate an aligned block of memory.
+ * The block must be freed using aligned_free().
+ * @param alignment	[in] Alignment. (Must be a power of two.)
+ * @param size		[in] Size, in bytes.
+ * @return Allocated memory, or NULL on error.
+ */
+static inline void *aligned_malloc(size_t alignment, size_t size)
+{
+#if defined(_WIN32)
+	return _aligned_malloc(size, alignment);
+#elif defined(HAVE_POSIX_MEMALIGN)
+	void *ptr = NULL;
+	if (posix_memalign(&ptr, alignment, size) != 0) {
+		return NULL;
+	}
+	return ptr;
+#else
+	// FIXME: No aligned allocation function is available.
+	// Fall back to malloc(); direct I/O will use buffered I/O
+	// if the resulting buffer isn't aligned.
+	(void)alignment;
+	return malloc(size);
+#endif
+}
+
+/**
+ * Free a block of memory allocated using aligned_malloc().
+ * @param ptr	[in] Memory to free.
+ */
+static inline void aligned_free(void *ptr)
+{
+#ifdef _WIN32
+	_aligned_free(ptr);
+#else /* !_WIN32 */
+	free(ptr);
+#endif /* _WIN32 */
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RVTHTOOL_LIBRVTH_ALIGNED_MALLOC_H__ */
@@ -0,0 +1,620 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * bank_cache.cpp: On-disk cache of RVT-H bank table entries.              *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "config.librvth.h"
+
+#include "bank_cache.h"
+#include "bank_init.h"
+#include "ptbl.h"
+#include "query.h"
+#include "RefFile.hpp"
+
+#include "nhcd_structs.h"
+
+// Reader class
+#include "reader/Reader.hpp"
+
+// Nettle SHA-1
+#include <nettle/sha1.h>
+
+// C includes.
+#include <stdlib.h>
+#ifdef _WIN32
+# include <windows.h>
+# include <direct.h>
+# include <io.h>
+#else /* !_WIN32 */
+# include <sys/types.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif /* _WIN32 */
+
+// C includes. (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+// C++ includes.
+#include <string>
+using std::tstring;
+
+static_assert(RVTH_BANK_CACHE_HASH_SIZE == SHA1_DIGEST_SIZE, "RVTH_BANK_CACHE_HASH_SIZE is incorrect");
+
+// Cache file format.
+// All fields are in host-endian. Cache files aren't meant to be
+// portable; a cache file from a different architecture will fail
+// the version or size checks and will be regenerated.
+#define BANK_CACHE_MAGIC "RVTHBKC\0"
+// Version 2: AppLoader status is now checked for encrypted Wii banks.
+#define BANK_CACHE_VERSION 2
+
+typedef struct _BankCache_Header {
+	char magic[8];		// BANK_CACHE_MAGIC
+	uint32_t version;	// BANK_CACHE_VERSION
+	uint32_t entry_size;	// sizeof(BankCache_Entry)
+	uint32_t bank_count;	// Number of bank entries.
+	uint32_t reserved;
+	int64_t file_size;	// HDD image size. (0 for devices)
+	int64_t file_mtime;	// HDD image modification time. (0 for devices)
+	uint8_t nhcd_hash[RVTH_BANK_CACHE_HASH_SIZE];	// SHA-1 of the NHCD bank table.
+	uint8_t reserved2[4];
+} BankCache_Header;
+
+// Cached bank entry.
+// This is followed by pt_count pt_entry_t structs.
+typedef struct _BankCache_Entry {
+	uint32_t lba_start;
+	uint32_t lba_len;
+	int64_t timestamp;
+	uint32_t aplerr_val[3];
+	uint8_t type;
+	uint8_t region_code;
+	uint8_t is_deleted;
+	uint8_t has_reader;	// If non-zero, the bank has a disc image reader.
+	uint8_t aplerr;
+	uint8_t crypto_type;
+	uint8_t ios_version;
+	uint8_t pt_count;
+	RvtH_SigInfo ticket;
+	RvtH_SigInfo tmd;
+	uint8_t reserved[4];
+	GCN_DiscHeader discHeader;
+	RVL_VolumeGroupTable vg_orig;
+} BankCache_Entry;
+
+// Maximum number of partition table entries per bank.
+// NOTE: A Wii partition table has at most 31 entries.
+#define BANK_CACHE_MAX_PT_COUNT 31
+
+// Maximum cache file size.
+#define BANK_CACHE_MAX_SIZE (sizeof(BankCache_Header) + \
+	(32 * (sizeof(BankCache_Entry) + (BANK_CACHE_MAX_PT_COUNT * sizeof(pt_entry_t)))))
+
+/**
+ * Get the bank cache directory.
+ * @return Bank cache directory, or empty string if it can't be determined.
+ */
+static tstring rvth_bank_cache_dir(void)
+{
+	tstring dir;
+
+#ifdef _WIN32
+	const TCHAR *const localAppData = _tgetenv(_T("LOCALAPPDATA"));
+	if (!localAppData || localAppData[0] == _T('\0')) {
+		return dir;
+	}
+	dir = localAppData;
+	dir += _T("\\rvthtool\\banks");
+#else /* !_WIN32 */
+	const char *const xdg_cache_home = getenv("XDG_CACHE_HOME");
+	if (xdg_cache_home && xdg_cache_home[0] == '/') {
+		// NOTE: XDG_CACHE_HOME must be an absolute path.
+		dir = xdg_cache_home;
+	} else {
+		const char *const home = getenv("HOME");
+		if (!home || home[0] != '/') {
+			return dir;
+		}
+		dir = home;
+		dir += "/.cache";
+	}
+	dir += "/rvthtool/banks";
+#endif /* _WIN32 */
+
+	return dir;
+}
+
+/**
+ * Create a directory and all of its parent directories.
+ * @param path	[in] Directory.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int rvth_bank_cache_mkdir(const tstring &path)
+{
+#ifdef _WIN32
+	static const TCHAR sep = _T('\\');
+#else /* !_WIN32 */
+	static const TCHAR sep = _T('/');
+#endif /* _WIN32 */
+
+	// Create each path component in turn.
+	// Existing directories are skipped.
+	size_t pos = 1;
+	do {
+		pos = path.find(sep, pos);
+		const tstring sub = path.substr(0, pos);
+#ifdef _WIN32
+		int ret = _tmkdir(sub.c_str());
+#else /* !_WIN32 */
+		int ret = mkdir(sub.c_str(), 0700);
+#endif /* _WIN32 */
+		if (pos == tstring::npos && ret != 0 && errno != EEXIST) {
+			// NOTE: Errors for parent directories are ignored,
+			// since e.g. drive letters can't be created.
+			int err = errno;
+			if (err == 0) {
+				err = EIO;
+			}
+			return -err;
+		}
+		if (pos != tstring::npos) {
+			pos++;
+		}
+	} while (pos != tstring::npos);
+
+	return 0;
+}
+
+/**
+ * Get the bank cache filename and file information for an RVT-H HDD image or device.
+ * @param f_img		[in] RefFile*
+ * @param pFilename	[out] Cache filename.
+ * @param pFileSize	[out] HDD image size. (0 for devices)
+ * @param pFileMtime	[out] HDD image modification time. (0 for devices)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int rvth_bank_cache_get_filename(RefFile *f_img, tstring *pFilename,
+	int64_t *pFileSize, int64_t *pFileMtime)
+{
+	const tstring dir = rvth_bank_cache_dir();
+	if (dir.empty()) {
+		// No cache directory.
+		return -ENOENT;
+	}
+
+	tstring key;
+	if (f_img->isDevice()) {
+		// RVT-H Reader device. Use the serial number.
+		// The device filename may change between connections.
+#ifdef HAVE_QUERY
+		TCHAR *const serial = rvth_get_device_serial_number(f_img->filename(), nullptr);
+		if (!serial) {
+			// No serial number.
+			return -ENOTSUP;
+		}
+		key = _T("dev-");
+		for (const TCHAR *p = serial; *p != _T('\0'); p++) {
+			// Only allow alphanumeric characters in the filename.
+			const TCHAR chr = *p;
+			if ((chr >= _T('0') && chr <= _T('9')) ||
+			    (chr >= _T('A') && chr <= _T('Z')) ||
+			    (chr >= _T('a') && chr <= _T('z')))
+			{
+				key += chr;
+			} else {
+				key += _T('_');
+			}
+		}
+		free(serial);
+		*pFileSize = 0;
+		*pFileMtime = 0;
+#else /* !HAVE_QUERY */
+		// Serial number can't be determined.
+		return -ENOTSUP;
+#endif /* HAVE_QUERY */
+	} else {
+		// HDD image file. Use a hash of the canonical path.
+#ifdef _WIN32
+		TCHAR path[MAX_PATH];
+		if (!_tfullpath(path, f_img->filename(), ARRAY_SIZE(path))) {
+			return -ENOENT;
+		}
+		struct _stati64 sb;
+		if (_tstati64(path, &sb) != 0) {
+			return -errno;
+		}
+		const size_t path_len = _tcslen(path) * sizeof(TCHAR);
+#else /* !_WIN32 */
+		char *const path = realpath(f_img->filename(), nullptr);
+		if (!path) {
+			return -errno;
+		}
+		struct stat sb;
+		if (stat(path, &sb) != 0) {
+			int err = errno;
+			free(path);
+			return -err;
+		}
+		const size_t path_len = strlen(path);
+#endif /* _WIN32 */
+		*pFileSize = sb.st_size;
+		*pFileMtime = sb.st_mtime;
+
+		struct sha1_ctx sha1;
+		uint8_t digest[SHA1_DIGEST_SIZE];
+		sha1_init(&sha1);
+		sha1_update(&sha1, path_len, reinterpret_cast<const uint8_t*>(path));
+		sha1_digest(&sha1, sizeof(digest), digest);
+#ifndef _WIN32
+		free(path);
+#endif /* !_WIN32 */
+
+		key = _T("img-");
+		for (unsigned int i = 0; i < sizeof(digest); i++) {
+			static const TCHAR hex[] = _T("0123456789abcdef");
+			key += hex[digest[i] >> 4];
+			key += hex[digest[i] & 0x0F];
+		}
+	}
+
+	*pFilename = dir;
+#ifdef _WIN32
+	*pFilename += _T('\\');
+#else /* !_WIN32 */
+	*pFilename += _T('/');
+#endif /* _WIN32 */
+	*pFilename += key;
+	*pFilename += _T(".bin");
+	return 0;
+}
+
+/**
+ * Hash the NHCD bank table.
+ * The hash is used to check if the cached bank entries are up to date.
+ * @param nhcd_table		[in] NHCD bank table, as read from the disk. (header and bank entries)
+ * @param nhcd_table_size	[in] Size of nhcd_table, in bytes.
+ * @param nhcd_hash		[out] Hash. (RVTH_BANK_CACHE_HASH_SIZE bytes)
+ */
+void rvth_bank_cache_hash_nhcd(const void *nhcd_table, size_t nhcd_table_size,
+	uint8_t *nhcd_hash)
+{
+	struct sha1_ctx sha1;
+	sha1_init(&sha1);
+	sha1_update(&sha1, nhcd_table_size, static_cast<const uint8_t*>(nhcd_table));
+	sha1_digest(&sha1, SHA1_DIGEST_SIZE, nhcd_hash);
+}
+
+/**
+ * Free the readers and partition tables in an array of bank entries,
+ * and zero out the array.
+ * @param entries	[in,out] Bank entries.
+ * @param bank_count	[in] Number of bank entries.
+ */
+static void rvth_bank_cache_clear_entries(RvtH_BankEntry *entries, unsigned int bank_count)
+{
+	for (unsigned int i = 0; i < bank_count; i++) {
+		delete entries[i].reader;
+		free(entries[i].ptbl);
+	}
+	memset(entries, 0, bank_count * sizeof(*entries));
+}
+
+/**
+ * Load RVT-H bank entries from the bank cache.
+ *
+ * On success, all bank entries are initialized, including the
+ * disc image readers and partition tables.
+ *
+ * @param f_img			[in] RefFile* (RVT-H HDD image or device)
+ * @param nhcd_hash		[in] Hash of the NHCD bank table. (from rvth_bank_cache_hash_nhcd())
+ * @param entries		[out] Bank entries. (Must be zero-initialized.)
+ * @param bank_count		[in] Number of bank entries.
+ * @return 0 on success; negative POSIX error code on error. (-ENOENT if not cached)
+ */
+int rvth_bank_cache_load(RefFile *f_img,
+	const uint8_t *nhcd_hash,
+	RvtH_BankEntry *entries, unsigned int bank_count)
+{
+	tstring filename;
+	int64_t file_size, file_mtime;
+	uint8_t *buf = nullptr;
+	const uint8_t *p, *p_end;
+	const BankCache_Header *header;
+	FILE *f_cache;
+	size_t size;
+	int ret;
+
+	assert(f_img != nullptr);
+	assert(entries != nullptr);
+
+	ret = rvth_bank_cache_get_filename(f_img, &filename, &file_size, &file_mtime);
+	if (ret != 0) {
+		return ret;
+	}
+
+	// Read the entire cache file.
+	f_cache = _tfopen(filename.c_str(), _T("rb"));
+	if (!f_cache) {
+		return -ENOENT;
+	}
+	buf = static_cast<uint8_t*>(malloc(BANK_CACHE_MAX_SIZE + 1));
+	if (!buf) {
+		fclose(f_cache);
+		return -ENOMEM;
+	}
+	size = fread(buf, 1, BANK_CACHE_MAX_SIZE + 1, f_cache);
+	fclose(f_cache);
+	if (size < sizeof(BankCache_Header) || size > BANK_CACHE_MAX_SIZE) {
+		// Invalid size.
+		ret = -EIO;
+		goto end;
+	}
+
+	// Validate the header.
+	header = reinterpret_cast<const BankCache_Header*>(buf);
+	if (memcmp(header->magic, BANK_CACHE_MAGIC, sizeof(header->magic)) != 0 ||
+	    header->version != BANK_CACHE_VERSION ||
+	    header->entry_size != sizeof(BankCache_Entry) ||
+	    header->bank_count != bank_count ||
+	    header->file_size != file_size ||
+	    header->file_mtime != file_mtime ||
+	    memcmp(header->nhcd_hash, nhcd_hash, sizeof(header->nhcd_hash)) != 0)
+	{
+		// Cache file is out of date.
+		ret = -ENOENT;
+		goto end;
+	}
+
+	// Load the bank entries.
+	p = buf + sizeof(BankCache_Header);
+	p_end = buf + size;
+	for (unsigned int i = 0; i < bank_count; i++) {
+		RvtH_BankEntry *const entry = &entries[i];
+		BankCache_Entry cache_entry;
+
+		if (p + sizeof(cache_entry) > p_end) {
+			// Truncated cache file.
+			ret = -EIO;
+			goto end;
+		}
+		memcpy(&cache_entry, p, sizeof(cache_entry));
+		p += sizeof(cache_entry);
+
+		entry->lba_start = cache_entry.lba_start;
+		entry->lba_len = cache_entry.lba_len;
+		entry->timestamp = static_cast<time_t>(cache_entry.timestamp);
+		entry->type = cache_entry.type;
+		entry->region_code = cache_entry.region_code;
+		entry->is_deleted = !!cache_entry.is_deleted;
+		entry->aplerr = cache_entry.aplerr;
+		memcpy(entry->aplerr_val, cache_entry.aplerr_val, sizeof(entry->aplerr_val));
+		entry->discHeader = cache_entry.discHeader;
+		entry->crypto_type = cache_entry.crypto_type;
+		entry->ios_version = cache_entry.ios_version;
+		entry->ticket = cache_entry.ticket;
+		entry->tmd = cache_entry.tmd;
+		entry->vg_orig = cache_entry.vg_orig;
+
+		if (entry->type >= RVTH_BankType_MAX) {
+			// Invalid bank type.
+			ret = -EIO;
+			goto end;
+		}
+
+		if (cache_entry.pt_count > 0) {
+			const size_t pt_size = cache_entry.pt_count * sizeof(pt_entry_t);
+			if (p + pt_size > p_end) {
+				// Truncated cache file.
+				ret = -EIO;
+				goto end;
+			}
+			entry->ptbl = static_cast<pt_entry_t*>(malloc(pt_size));
+			if (!entry->ptbl) {
+				ret = -ENOMEM;
+				goto end;
+			}
+			memcpy(entry->ptbl, p, pt_size);
+			entry->pt_count = cache_entry.pt_count;
+			p += pt_size;
+		}
+
+		if (cache_entry.has_reader) {
+			// Initialize the disc image reader.
+			// NOTE: For devices, this doesn't read anything.
+			entry->reader = Reader::open(f_img, entry->lba_start,
+				rvth_get_BankEntry_reader_lba_len(entry->type, entry->lba_start));
+			if (!entry->reader) {
+				ret = -EIO;
+				goto end;
+			}
+		}
+	}
+
+	if (p != p_end) {
+		// Extra data at the end of the cache file.
+		ret = -EIO;
+	}
+
+end:
+	if (ret != 0) {
+		rvth_bank_cache_clear_entries(entries, bank_count);
+	}
+	free(buf);
+	return ret;
+}
+
+/**
+ * Save RVT-H bank entries to the bank cache.
+ * @param f_img			[in] RefFile* (RVT-H HDD image or device)
+ * @param nhcd_hash		[in] Hash of the NHCD bank table. (from rvth_bank_cache_hash_nhcd())
+ * @param entries		[in] Bank entries.
+ * @param bank_count		[in] Number of bank entries.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int rvth_bank_cache_save(RefFile *f_img,
+	const uint8_t *nhcd_hash,
+	const RvtH_BankEntry *entries, unsigned int bank_count)
+{
+	tstring filename, tmp_filename;
+	BankCache_Header header;
+	FILE *f_cache;
+	int ret = 0;
+	int err = 0;
+
+	assert(f_img != nullptr);
+	assert(entries != nullptr);
+
+	// Partition tables with too many entries can't be cached.
+	// Don't save a truncated partition table.
+	for (unsigned int i = 0; i < bank_count; i++) {
+		if (entries[i].ptbl && entries[i].pt_count > BANK_CACHE_MAX_PT_COUNT) {
+			return -ENOTSUP;
+		}
+	}
+
+	memset(&header, 0, sizeof(header));
+	ret = rvth_bank_cache_get_filename(f_img, &filename,
+		&header.file_size, &header.file_mtime);
+	if (ret != 0) {
+		return ret;
+	}
+
+	// Create the cache directory.
+	ret = rvth_bank_cache_mkdir(filename.substr(0, filename.find_last_of(_T("/\\"))));
+	if (ret != 0) {
+		return ret;
+	}
+
+	memcpy(header.magic, BANK_CACHE_MAGIC, sizeof(header.magic));
+	header.version = BANK_CACHE_VERSION;
+	header.entry_size = sizeof(BankCache_Entry);
+	header.bank_count = bank_count;
+	memcpy(header.nhcd_hash, nhcd_hash, sizeof(header.nhcd_hash));
+
+	// Write to a temporary file, then rename it, so another
+	// process never sees a partially-written cache file.
+	TCHAR pid_buf[32];
+#ifdef _WIN32
+	_sntprintf(pid_buf, ARRAY_SIZE(pid_buf), _T(".%lu.tmp"), GetCurrentProcessId());
+#else /* !_WIN32 */
+	_sntprintf(pid_buf, ARRAY_SIZE(pid_buf), _T(".%ld.tmp"), static_cast<long>(getpid()));
+#endif /* _WIN32 */
+	tmp_filename = filename + pid_buf;
+
+	f_cache = _tfopen(tmp_filename.c_str(), _T("wb"));
+	if (!f_cache) {
+		err = errno;
+		if (err == 0) {
+			err = EIO;
+		}
+		return -err;
+	}
+
+	if (fwrite(&header, 1, sizeof(header), f_cache) != sizeof(header)) {
+		err = EIO;
+		goto end;
+	}
+
+	for (unsigned int i = 0; i < bank_count; i++) {
+		const RvtH_BankEntry *const entry = &entries[i];
+		BankCache_Entry cache_entry;
+
+		memset(&cache_entry, 0, sizeof(cache_entry));
+		cache_entry.lba_start = entry->lba_start;
+		cache_entry.lba_len = entry->lba_len;
+		cache_entry.timestamp = static_cast<int64_t>(entry->timestamp);
+		cache_entry.type = entry->type;
+		cache_entry.region_code = entry->region_code;
+		cache_entry.is_deleted = entry->is_deleted;
+		cache_entry.has_reader = (entry->reader != nullptr);
+		cache_entry.aplerr = entry->aplerr;
+		memcpy(cache_entry.aplerr_val, entry->aplerr_val, sizeof(cache_entry.aplerr_val));
+		cache_entry.discHeader = entry->discHeader;
+		cache_entry.crypto_type = entry->crypto_type;
+		cache_entry.ios_version = entry->ios_version;
+		cache_entry.ticket = entry->ticket;
+		cache_entry.tmd = entry->tmd;
+		cache_entry.vg_orig = entry->vg_orig;
+		if (entry->ptbl) {
+			cache_entry.pt_count = static_cast<uint8_t>(entry->pt_count);
+		}
+
+		if (fwrite(&cache_entry, 1, sizeof(cache_entry), f_cache) != sizeof(cache_entry)) {
+			err = EIO;
+			goto end;
+		}
+		if (cache_entry.pt_count > 0) {
+			if (fwrite(entry->ptbl, sizeof(pt_entry_t), cache_entry.pt_count, f_cache) != cache_entry.pt_count) {
+				err = EIO;
+				goto end;
+			}
+		}
+	}
+
+end:
+	if (fclose(f_cache) != 0 && err == 0) {
+		err = EIO;
+	}
+	if (err == 0) {
+#ifdef _WIN32
+		if (!MoveFileEx(tmp_filename.c_str(), filename.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+			err = EIO;
+		}
+#else /* !_WIN32 */
+		if (rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+			err = errno;
+			if (err == 0) {
+				err = EIO;
+			}
+		}
+#endif /* _WIN32 */
+	}
+	if (err != 0) {
+#ifdef _WIN32
+		_tremove(tmp_filename.c_str());
+#else /* !_WIN32 */
+		remove(tmp_filename.c_str());
+#endif /* _WIN32 */
+		ret = -err;
+	}
+	return ret;
+}
+
+/**
+ * Invalidate the bank cache for an RVT-H HDD image or device.
+ * This must be called before modifying the HDD image or device.
+ * @param f_img	[in] RefFile* (RVT-H HDD image or device)
+ * @return 0 on success (or if nothing was cached); negative POSIX error code on error.
+ */
+int rvth_bank_cache_invalidate(RefFile *f_img)
+{
+	tstring filename;
+	int64_t file_size, file_mtime;
+
+	assert(f_img != nullptr);
+	int ret = rvth_bank_cache_get_filename(f_img, &filename, &file_size, &file_mtime);
+	if (ret != 0) {
+		// No cache filename, so nothing could have been cached.
+		return (ret == -ENOENT || ret == -ENOTSUP) ? 0 : ret;
+	}
+
+#ifdef _WIN32
+	ret = _tremove(filename.c_str());
+#else /* !_WIN32 */
+	ret = remove(filename.c_str());
+#endif /* _WIN32 */
+	if (ret != 0 && errno != ENOENT) {
+		int err = errno;
+		if (err == 0) {
+			err = EIO;
+		}
+		return -err;
+	}
+	return 0;
+}
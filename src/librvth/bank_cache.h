@@ -0,0 +1,94 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * bank_cache.h: On-disk cache of RVT-H bank table entries.                *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// Opening an RVT-H Reader reads the disc header, ticket, TMD, partition
+// table, and AppLoader of every bank, which requires several seeks per
+// bank. The bank cache stores the resulting RvtH_BankEntry fields so
+// subsequent opens only have to read the NHCD bank table.
+//
+// Cache files are stored in the user's cache directory:
+// - Windows: %LOCALAPPDATA%\rvthtool\banks
+// - Other: $XDG_CACHE_HOME/rvthtool/banks or ~/.cache/rvthtool/banks
+//
+// RVT-H Reader devices are identified by serial number. HDD image files
+// are identified by their canonical path, and are also checked against
+// their size and modification time. In both cases, the cache is only
+// used if the SHA-1 of the NHCD bank table (header and all bank entries)
+// matches the stored hash.
+
+#ifndef __RVTHTOOL_LIBRVTH_BANK_CACHE_H__
+#define __RVTHTOOL_LIBRVTH_BANK_CACHE_H__
+
+#include "rvth.hpp"
+
+// RefFile class
+#ifdef __cplusplus
+class RefFile;
+#else
+struct RefFile;
+typedef struct RefFile RefFile;
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Size of the NHCD bank table hash.
+#define RVTH_BANK_CACHE_HASH_SIZE 20
+
+/**
+ * Hash the NHCD bank table.
+ * The hash is used to check if the cached bank entries are up to date.
+ * @param nhcd_table		[in] NHCD bank table, as read from the disk. (header and bank entries)
+ * @param nhcd_table_size	[in] Size of nhcd_table, in bytes.
+ * @param nhcd_hash		[out] Hash. (RVTH_BANK_CACHE_HASH_SIZE bytes)
+ */
+void rvth_bank_cache_hash_nhcd(const void *nhcd_table, size_t nhcd_table_size,
+	uint8_t *nhcd_hash);
+
+/**
+ * Load RVT-H bank entries from the bank cache.
+ *
+ * On success, all bank entries are initialized, including the
+ * disc image readers and partition tables.
+ *
+ * @param f_img			[in] RefFile* (RVT-H HDD image or device)
+ * @param nhcd_hash		[in] Hash of the NHCD bank table. (from rvth_bank_cache_hash_nhcd())
+ * @param entries		[out] Bank entries. (Must be zero-initialized.)
+ * @param bank_count		[in] Number of bank entries.
+ * @return 0 on success; negative POSIX error code on error. (-ENOENT if not cached)
+ */
+int rvth_bank_cache_load(RefFile *f_img,
+	const uint8_t *nhcd_hash,
+	RvtH_BankEntry *entries, unsigned int bank_count);
+
+/**
+ * Save RVT-H bank entries to the bank cache.
+ * @param f_img			[in] RefFile* (RVT-H HDD image or device)
+ * @param nhcd_hash		[in] Hash of the NHCD bank table. (from rvth_bank_cache_hash_nhcd())
+ * @param entries		[in] Bank entries.
+ * @param bank_count		[in] Number of bank entries.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int rvth_bank_cache_save(RefFile *f_img,
+	const uint8_t *nhcd_hash,
+	const RvtH_BankEntry *entries, unsigned int bank_count);
+
+/**
+ * Invalidate the bank cache for an RVT-H HDD image or device.
+ * This must be called before modifying the HDD image or device.
+ * @param f_img	[in] RefFile* (RVT-H HDD image or device)
+ * @return 0 on success (or if nothing was cached); negative POSIX error code on error.
+ */
+int rvth_bank_cache_invalidate(RefFile *f_img);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RVTHTOOL_LIBRVTH_BANK_CACHE_H__ */
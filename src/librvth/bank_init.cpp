@@ -31,12 +31,17 @@
 #include "rvth_time.h"
 #include "rvth_error.h"
 #include "reader/Reader.hpp"
+#include "reader/WiiPartitionReader.hpp"
 
 // C includes. (C++ namespace)
 #include <cassert>
 #include <cerrno>
 #include <cstring>
 
+// C++ includes.
+#include <memory>
+using std::unique_ptr;
+
 /**
  * Set the region field in an RvtH_BankEntry.
  * The reader field must have already been set.
@@ -320,12 +325,15 @@ static bool dol_check_address_limit(const DOL_Header *dol, uint32_t limit)
 int rvth_init_BankEntry_AppLoader(RvtH_BankEntry *entry)
 {
 	uint32_t lba_size;
-	uint32_t lba_start = 0;
 	uint8_t shift = 0;
 	bool is_wii = false;
 	bool fst_after_dol = false;
 	unsigned int i;
 
+	// Wii game partition.
+	const pt_entry_t *game_pte = nullptr;
+	unique_ptr<WiiPartitionReader> wpr;
+
 	// Sector buffer.
 	uint8_t sector_buf[LBA_SIZE*2];
 
@@ -368,62 +376,56 @@ int rvth_init_BankEntry_AppLoader(RvtH_BankEntry *entry)
 
 		case RVTH_BankType_GCN:
 			// Shift value is 0.
-			lba_start = 0;
 			shift = 0;
 			is_wii = false;
 			break;
 
 		case RVTH_BankType_Wii_SL:
-		case RVTH_BankType_Wii_DL: {
+		case RVTH_BankType_Wii_DL:
 			// Find the game partition.
 			// TODO: Error checking.
-			const pt_entry_t *game_pte = rvth_ptbl_find_game(entry);
+			game_pte = rvth_ptbl_find_game(entry);
 			if (!game_pte) {
 				// No game partition...
 				return RVTH_ERROR_NO_GAME_PARTITION;
 			}
-			// NOTE: This is the partition header.
-			// Need to read the header to find the data offset.
-			lba_start = game_pte->lba_start;
 			shift = 2;
 			is_wii = true;
 			break;
-		}
-	}
-
-	// TODO: Need to manually decrypt the Wii sectors.
-	if (entry->crypto_type != RVL_CryptoType_None) {
-		return RVTH_ERROR_IS_ENCRYPTED;
 	}
 
 	if (is_wii) {
-		// Read the partition header to determine the data offset.
-		// 0x2B8: Data offset >> 2 (LBA 1)
-		uint64_t data_offset;
-		lba_size = entry->reader->read(sector_buf, lba_start + 1, 1);
+		// The boot block and main.dol are located in the game
+		// partition's user data. For encrypted partitions, only
+		// the groups containing them will be decrypted, which is
+		// usually just the first group.
+		int ret = 0;
+		wpr.reset(WiiPartitionReader::open(entry->reader, game_pte,
+			(entry->crypto_type != RVL_CryptoType_None), &ret));
+		if (!wpr) {
+			// Error opening the game partition.
+			return ret;
+		}
+		// Only a few small reads are needed.
+		wpr->setPrefetch(false);
+
+		// Read the boot block and boot info.
+		// Start address: 0x420
+		if (wpr->pread(&boot, sizeof(boot), 0x420) != sizeof(boot)) {
+			// Error reading the boot block and boot info.
+			return -EIO;
+		}
+	} else {
+		// Read the boot block and boot info.
+		// Start address: 0x420 (LBA 2)
+		lba_size = entry->reader->read(sector_buf, 2, 1);
 		if (lba_size != 1) {
 			// Error reading the boot block and boot info.
 			return -EIO;
 		}
-
-		// TODO: Optimize this?
-		data_offset = (sector_buf[0x0B8] << 24) |
-			      (sector_buf[0x0B9] << 16) |
-			      (sector_buf[0x0BA] <<  8) |
-			       sector_buf[0x0BB];
-		data_offset <<= shift;
-		lba_start += BYTES_TO_LBA(data_offset);
+		memcpy(&boot, &sector_buf[0x020], sizeof(boot));
 	}
 
-	// Read the boot block and boot info.
-	// Start address: 0x420 (LBA 2)
-	lba_size = entry->reader->read(sector_buf, lba_start + 2, 1);
-	if (lba_size != 1) {
-		// Error reading the boot block and boot info.
-		return -EIO;
-	}
-	memcpy(&boot, &sector_buf[0x020], sizeof(boot));
-
 	// BI2 fields.
 	debugMonSize = be32_to_cpu(boot.bi2.debugMonSize);
 	simMemSize = be32_to_cpu(boot.bi2.simMemSize);
@@ -475,14 +477,20 @@ int rvth_init_BankEntry_AppLoader(RvtH_BankEntry *entry)
 
 	// Load the DOL header.
 	dolOffset = (int64_t)be32_to_cpu(boot.bb2.bootFilePosition) << shift;
-	lba_size = entry->reader->read(sector_buf, lba_start + BYTES_TO_LBA(dolOffset), 2);
-	if (lba_size != 2) {
-		// Error reading the DOL header.
-		return -EIO;
+	if (is_wii) {
+		if (wpr->pread(&dol, sizeof(dol), dolOffset) != sizeof(dol)) {
+			// Error reading the DOL header.
+			return -EIO;
+		}
+	} else {
+		lba_size = entry->reader->read(sector_buf, BYTES_TO_LBA(dolOffset), 2);
+		if (lba_size != 2) {
+			// Error reading the DOL header.
+			return -EIO;
+		}
+		memcpy(&dol, &sector_buf[dolOffset % LBA_SIZE], sizeof(dol));
 	}
 
-	memcpy(&dol, &sector_buf[dolOffset % LBA_SIZE], sizeof(dol));
-
 	if (boot.bi2.dolLimit != cpu_to_be32(0)) {
 		// Calculate the total size of all sections.
 		// FIXME: ALIGN() macros aren't working...
@@ -585,8 +593,49 @@ int rvth_init_BankEntry_AppLoader(RvtH_BankEntry *entry)
 	return 0;
 }
 
+/**
+ * Get the maximum LBA length for an RVT-H bank entry's Reader.
+ * - GCN or Wii SL: Full bank size.
+ * - Wii DL: Dual-layer bank size.
+ * - First bank in extended bank table: Smaller bank size.
+ * @param type		[in] Bank type. (See RvtH_BankType_e.)
+ * @param lba_start	[in] Starting LBA.
+ * @return Maximum LBA length.
+ */
+uint32_t rvth_get_BankEntry_reader_lba_len(uint8_t type, uint32_t lba_start)
+{
+	if (lba_start < NHCD_BANKTABLE_ADDRESS_LBA) {
+		// Bank starts before the bank table.
+		// This is a relocated Bank 1 on a device with
+		// an extended bank table, so it can only support
+		// GCN disc images.
+		return NHCD_EXTBANKTABLE_BANK_1_SIZE_LBA;
+	}
+
+	// Use the default LBA length based on bank type.
+	switch (type) {
+		default:
+		case RVTH_BankType_Empty:
+		case RVTH_BankType_Unknown:
+		case RVTH_BankType_GCN:
+		case RVTH_BankType_Wii_SL:
+		case RVTH_BankType_Wii_DL_Bank2:
+			// Full bank.
+			return NHCD_BANK_WII_SL_SIZE_RVTR_LBA;
+
+		case RVTH_BankType_Wii_DL:
+			// Dual-layer bank.
+			return NHCD_BANK_WII_DL_SIZE_RVTR_LBA;
+	}
+}
+
 /**
  * Initialize an RVT-H bank entry from an opened HDD image.
+ *
+ * Only the disc header, bank type, LBAs, timestamp, and disc image
+ * reader are initialized. Use rvth_init_BankEntry_details() to
+ * initialize everything else.
+ *
  * @param entry			[out] RvtH_BankEntry
  * @param f_img			[in] RefFile*
  * @param type			[in] Bank type. (See RvtH_BankType_e.)
@@ -639,35 +688,8 @@ int rvth_init_BankEntry(RvtH_BankEntry *entry, RefFile *f_img,
 		entry->type = type;
 	}
 
-	// Determine the maximum LBA length for the Reader:
-	// - GCN or Wii SL: Full bank size.
-	// - Wii DL: Dual-layer bank size.
-	// - First bank in extended bank table: Smaller bank size.
-	if (lba_start < NHCD_BANKTABLE_ADDRESS_LBA) {
-		// Bank starts before the bank table.
-		// This is a relocated Bank 1 on a device with
-		// an extended bank table, so it can only support
-		// GCN disc images.
-		reader_lba_len = NHCD_EXTBANKTABLE_BANK_1_SIZE_LBA;
-	} else {
-		// Use the default LBA length based on bank type.
-		switch (type) {
-			default:
-			case RVTH_BankType_Empty:
-			case RVTH_BankType_Unknown:
-			case RVTH_BankType_GCN:
-			case RVTH_BankType_Wii_SL:
-			case RVTH_BankType_Wii_DL_Bank2:
-				// Full bank.
-				reader_lba_len = NHCD_BANK_WII_SL_SIZE_RVTR_LBA;
-				break;
-
-			case RVTH_BankType_Wii_DL:
-				// Dual-layer bank.
-				reader_lba_len = NHCD_BANK_WII_DL_SIZE_RVTR_LBA;
-				break;
-		}
-	}
+	// Determine the maximum LBA length for the Reader.
+	reader_lba_len = rvth_get_BankEntry_reader_lba_len(type, lba_start);
 
 	if (lba_len == 0) {
 		// Empty bank. Assume the length matches the bank,
@@ -694,14 +716,59 @@ int rvth_init_BankEntry(RvtH_BankEntry *entry, RefFile *f_img,
 		entry->timestamp = rvth_timestamp_parse(nhcd_timestamp);
 	}
 
-	// TODO: Error handling.
+	// NOTE: The region code, encryption status, and AppLoader
+	// status are initialized later by rvth_init_BankEntry_details().
+	return 0;
+}
+
+/**
+ * Initialize the region code, encryption status, partition table,
+ * and AppLoader status of an RVT-H bank entry.
+ *
+ * These fields require reading several parts of the disc image,
+ * so they aren't initialized by rvth_init_BankEntry().
+ *
+ * @param entry		[in,out] RvtH_BankEntry
+ * @return 0 on success; negative POSIX error code on I/O error.
+ */
+int rvth_init_BankEntry_details(RvtH_BankEntry *entry)
+{
+	int ret, err = 0;
+
+	if (!entry->reader) {
+		// No disc image reader.
+		return 0;
+	}
+
+	switch (entry->type) {
+		case RVTH_BankType_GCN:
+		case RVTH_BankType_Wii_SL:
+		case RVTH_BankType_Wii_DL:
+			break;
+
+		default:
+			// Nothing to initialize.
+			return 0;
+	}
+
+	// NOTE: Positive RvtH_Errors, e.g. no game partition, are
+	// expected for some disc images, so only I/O errors are returned.
+
 	// Initialize the region code.
-	rvth_init_BankEntry_region(entry);
+	ret = rvth_init_BankEntry_region(entry);
+	if (ret < 0 && err == 0) {
+		err = ret;
+	}
 	// Initialize the encryption status.
-	rvth_init_BankEntry_crypto(entry);
+	ret = rvth_init_BankEntry_crypto(entry);
+	if (ret < 0 && err == 0) {
+		err = ret;
+	}
 	// Initialize the AppLoader error status.
-	rvth_init_BankEntry_AppLoader(entry);
+	ret = rvth_init_BankEntry_AppLoader(entry);
+	if (ret < 0 && err == 0) {
+		err = ret;
+	}
 
-	// We're done here.
-	return 0;
+	return err;
 }
@@ -59,8 +59,24 @@ int rvth_init_BankEntry_crypto(RvtH_BankEntry *entry);
  */
 int rvth_init_BankEntry_AppLoader(RvtH_BankEntry *entry);
 
+/**
+ * Get the maximum LBA length for an RVT-H bank entry's Reader.
+ * - GCN or Wii SL: Full bank size.
+ * - Wii DL: Dual-layer bank size.
+ * - First bank in extended bank table: Smaller bank size.
+ * @param type		[in] Bank type. (See RvtH_BankType_e.)
+ * @param lba_start	[in] Starting LBA.
+ * @return Maximum LBA length.
+ */
+uint32_t rvth_get_BankEntry_reader_lba_len(uint8_t type, uint32_t lba_start);
+
 /**
  * Initialize an RVT-H bank entry from an opened HDD image.
+ *
+ * Only the disc header, bank type, LBAs, timestamp, and disc image
+ * reader are initialized. Use rvth_init_BankEntry_details() to
+ * initialize everything else.
+ *
  * @param entry			[out] RvtH_BankEntry
  * @param f_img			[in] RefFile*
  * @param type			[in] Bank type. (See RvtH_BankType_e.)
@@ -73,6 +89,18 @@ int rvth_init_BankEntry(RvtH_BankEntry *entry, RefFile *f_img,
 	uint8_t type, uint32_t lba_start, uint32_t lba_len,
 	const char *nhcd_timestamp);
 
+/**
+ * Initialize the region code, encryption status, partition table,
+ * and AppLoader status of an RVT-H bank entry.
+ *
+ * These fields require reading several parts of the disc image,
+ * so they aren't initialized by rvth_init_BankEntry().
+ *
+ * @param entry		[in,out] RvtH_BankEntry
+ * @return 0 on success; negative POSIX error code on I/O error.
+ */
+int rvth_init_BankEntry_details(RvtH_BankEntry *entry);
+
 #ifdef __cplusplus
 }
 #endif
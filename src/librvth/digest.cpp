@@ -0,0 +1,190 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * digest.cpp: RVT-H digest functions.                                     *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "rvth.hpp"
+#include "rvth_error.h"
+#include "DigestQueue.hpp"
+
+#include "byteswap.h"
+#include "nhcd_structs.h"
+
+// Disc image reader.
+#include "reader/Reader.hpp"
+#include "reader/ReadAheadQueue.hpp"
+
+// C includes. (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+// Process 1 MB at a time.
+#define BUF_SIZE 1048576
+#define LBA_COUNT_BUF BYTES_TO_LBA(BUF_SIZE)
+
+/**
+ * Compute the CRC32, MD5, and SHA-1 digests of a bank.
+ * The digests are computed in background threads while
+ * the bank is being read.
+ * @param bank		[in] Bank number. (0-7)
+ * @param digests	[out] Digests.
+ * @param callback	[in,opt] Progress callback.
+ * @param userdata	[in,opt] User data for progress callback.
+ * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+int RvtH::digestBank(unsigned int bank, RvtH_Digests *digests,
+	RvtH_Progress_Callback callback, void *userdata)
+{
+	ReadAheadQueue *queue = nullptr;
+	ReadAheadQueue::Chunk *chunk;
+	DigestQueue *dq = nullptr;
+	RvtH_BankEntry *entry;
+
+	// Callback state.
+	RvtH_Progress_State state;
+
+	int ret = 0;	// errno or RvtH_Errors
+	int err = 0;	// errno setting
+
+	assert(digests != nullptr);
+	if (!digests) {
+		errno = EINVAL;
+		return -EINVAL;
+	} else if (bank >= m_bankCount) {
+		errno = ERANGE;
+		return -ERANGE;
+	}
+
+	// Make sure the bank entry is fully initialized.
+	loadBankEntry(bank);
+
+	// Check the bank type.
+	entry = &m_entries[bank];
+	switch (entry->type) {
+		case RVTH_BankType_GCN:
+		case RVTH_BankType_Wii_SL:
+		case RVTH_BankType_Wii_DL:
+			// Bank can be hashed.
+			break;
+
+		case RVTH_BankType_Unknown:
+		default:
+			// Unknown bank status...
+			errno = EIO;
+			return RVTH_ERROR_BANK_UNKNOWN;
+
+		case RVTH_BankType_Empty:
+			// Bank is empty.
+			errno = ENOENT;
+			return RVTH_ERROR_BANK_EMPTY;
+
+		case RVTH_BankType_Wii_DL_Bank2:
+			// Second bank of a dual-layer Wii disc image.
+			// TODO: Automatically select the first bank?
+			errno = EIO;
+			return RVTH_ERROR_BANK_DL_2;
+	}
+
+	if (callback) {
+		// Initialize the callback state.
+		state.rvth = this;
+		state.rvth_gcm = nullptr;
+		state.bank_rvth = bank;
+		state.bank_gcm = ~0;
+		state.type = RVTH_PROGRESS_DIGEST;
+		state.lba_processed = 0;
+		state.lba_total = entry->lba_len;
+		state.digests = nullptr;
+	}
+
+	queue = new ReadAheadQueue(entry->reader, 0, entry->lba_len, LBA_COUNT_BUF, m_ioQueueDepth);
+	ret = queue->start();
+	if (ret != 0) {
+		// Unable to start the read-ahead queue.
+		err = -ret;
+		goto end;
+	}
+
+	dq = new DigestQueue(BUF_SIZE, m_ioQueueDepth);
+	ret = dq->start();
+	if (ret != 0) {
+		// Unable to start the digest threads.
+		err = -ret;
+		goto end;
+	}
+
+	while ((chunk = queue->next()) != nullptr) {
+		if (callback) {
+			bool bRet;
+			state.lba_processed = chunk->lba_start;
+			bRet = callback(&state, userdata);
+			if (!bRet) {
+				// Stop processing.
+				err = ECANCELED;
+				ret = -ECANCELED;
+				goto end;
+			}
+		}
+
+		if (chunk->hole) {
+			// Hole in a sparse image.
+			dq->updateZero(LBA_TO_BYTES(chunk->lba_len));
+			queue->release(chunk);
+			continue;
+		}
+
+		const uint8_t *src = chunk->data;
+		if (chunk->lba_start == 0 && LBA_TO_BYTES(chunk->lba_len) >= (int64_t)sizeof(GCN_DiscHeader)) {
+			// If the disc header was zeroed by the RVT-H's "Flush"
+			// function, hash the restored disc header, since that's
+			// what copyToGcm() writes.
+			const GCN_DiscHeader *const origHdr = (const GCN_DiscHeader*)src;
+			if (origHdr->magic_wii != be32_to_cpu(WII_MAGIC) &&
+			    origHdr->magic_gcn != be32_to_cpu(GCN_MAGIC))
+			{
+				uint8_t *const buf = ReadAheadQueue::makeWritable(chunk);
+				memcpy(buf, &entry->discHeader, sizeof(entry->discHeader));
+				src = buf;
+			}
+		}
+
+		dq->update(src, static_cast<size_t>(LBA_TO_BYTES(chunk->lba_len)));
+		queue->release(chunk);
+	}
+
+	// Check for read errors.
+	ret = queue->finish();
+	if (ret != 0) {
+		err = -ret;
+		goto end;
+	}
+
+	// Wait for the digests.
+	dq->finish(digests);
+
+	if (callback) {
+		bool bRet;
+		state.lba_processed = entry->lba_len;
+		state.digests = digests;
+		bRet = callback(&state, userdata);
+		if (!bRet) {
+			// Stop processing.
+			err = ECANCELED;
+			ret = -ECANCELED;
+			goto end;
+		}
+	}
+
+end:
+	// NOTE: Deleting the queue stops the read-ahead thread.
+	delete queue;
+	delete dq;
+	if (err != 0) {
+		errno = err;
+	}
+	return ret;
+}
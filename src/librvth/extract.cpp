@@ -27,6 +27,9 @@
 
 // Disc image reader.
 #include "reader/Reader.hpp"
+#include "reader/ReadAheadQueue.hpp"
+#include "ScrubMap.hpp"
+#include "DigestQueue.hpp"
 
 // libwiicrypto
 #include "libwiicrypto/sig_tools.h"
@@ -38,6 +41,8 @@
 // C includes. (C++ namespace)
 #include <cassert>
 #include <cerrno>
+#include <cinttypes>
+#include <cstdio>
 #include <cstring>
 #include <ctime>
 
@@ -134,21 +139,63 @@ static int64_t getDiskFreeSpace_lba(const TCHAR *filename)
 	return freeSpace_lba;
 }
 
+/**
+ * Write the digests of an extracted disc image to "<filename>.digests".
+ * @param filename	[in] Disc image filename.
+ * @param digests	[in] Digests.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int writeDigestsFile(const TCHAR *filename, const RvtH_Digests *digests)
+{
+	tstring sidecar(filename);
+	sidecar += _T(".digests");
+
+	FILE *f = _tfopen(sidecar.c_str(), _T("w"));
+	if (!f) {
+		return (errno != 0 ? -errno : -EIO);
+	}
+
+	fprintf(f, "size  %" PRIu64 "\n", digests->size);
+	fprintf(f, "crc32 %08x\n", digests->crc32);
+	fputs("md5   ", f);
+	for (unsigned int i = 0; i < sizeof(digests->md5); i++) {
+		fprintf(f, "%02x", digests->md5[i]);
+	}
+	fputs("\nsha1  ", f);
+	for (unsigned int i = 0; i < sizeof(digests->sha1); i++) {
+		fprintf(f, "%02x", digests->sha1[i]);
+	}
+	fputc('\n', f);
+
+	int ret = 0;
+	if (ferror(f)) {
+		ret = (errno != 0 ? -errno : -EIO);
+	}
+	if (fclose(f) != 0 && ret == 0) {
+		ret = (errno != 0 ? -errno : -EIO);
+	}
+	return ret;
+}
+
 /**
  * Copy a bank from this RVT-H HDD or standalone disc image to a writable standalone disc image.
  * @param rvth_dest	[out] Destination RvtH object.
  * @param bank_src	[in] Source bank number. (0-7)
  * @param callback	[in,opt] Progress callback.
  * @param userdata	[in,opt] User data for progress callback.
+ * @param scrub		[in,opt] If specified, only copy the LBAs marked as used.
+ * @param digests	[out,opt] If specified, digests of the copied disc image.
  * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
  */
-int RvtH::copyToGcm(RvtH *rvth_dest, unsigned int bank_src, RvtH_Progress_Callback callback, void *userdata)
+int RvtH::copyToGcm(RvtH *rvth_dest, unsigned int bank_src, RvtH_Progress_Callback callback, void *userdata,
+	const ScrubMap *scrub, RvtH_Digests *digests)
 {
 	uint32_t lba_copy_len;	// Total number of LBAs to copy. (entry_src->lba_len)
-	uint32_t lba_count;
-	uint32_t lba_buf_max;	// Highest LBA that can be written using the buffer.
 	uint32_t lba_nonsparse;	// Last LBA written that wasn't sparse.
 	unsigned int sprs;		// Sparse counter.
+	ReadAheadQueue *queue = nullptr;
+	ReadAheadQueue::Chunk *chunk;
+	DigestQueue *dq = nullptr;
 
 	// Callback state.
 	RvtH_Progress_State state;
@@ -172,6 +219,9 @@ int RvtH::copyToGcm(RvtH *rvth_dest, unsigned int bank_src, RvtH_Progress_Callba
 		return RVTH_ERROR_IS_HDD_IMAGE;
 	}
 
+	// Make sure the bank entry is fully initialized.
+	loadBankEntry(bank_src);
+
 	// Check if the source bank can be extracted.
 	const RvtH_BankEntry *const entry_src = &m_entries[bank_src];
 	switch (entry_src->type) {
@@ -199,35 +249,26 @@ int RvtH::copyToGcm(RvtH *rvth_dest, unsigned int bank_src, RvtH_Progress_Callba
 			return RVTH_ERROR_BANK_DL_2;
 	}
 
-	// Process 1 MB at a time.
-	#define BUF_SIZE 1048576
-	#define LBA_COUNT_BUF BYTES_TO_LBA(BUF_SIZE)
-	uint8_t *const buf = (uint8_t*)malloc(BUF_SIZE);
-	if (!buf) {
-		// Error allocating memory.
-		err = errno;
-		if (err == 0) {
-			err = ENOMEM;
-		}
-		ret = -err;
-		goto end;
-	}
-
 	// FIXME: If the file existed and wasn't 0 bytes,
 	// either truncate it or don't do sparse writes.
 
 	// Make this a sparse file.
+	// NOTE: Only linear images are preallocated. CISO images
+	// allocate blocks as they're written, and empty blocks
+	// aren't stored at all.
 	entry_dest = &rvth_dest->m_entries[0];
-	ret = rvth_dest->m_file->makeSparse(LBA_TO_BYTES(entry_dest->lba_len));
-	if (ret != 0) {
-		// Error managing the sparse file.
-		// TODO: Delete the file?
-		err = rvth_dest->m_file->lastError();
-		if (err == 0) {
-			err = ENOMEM;
+	if (entry_dest->reader->lbaToOffset(0) >= 0) {
+		ret = rvth_dest->m_file->makeSparse(LBA_TO_BYTES(entry_dest->lba_len));
+		if (ret != 0) {
+			// Error managing the sparse file.
+			// TODO: Delete the file?
+			err = rvth_dest->m_file->lastError();
+			if (err == 0) {
+				err = ENOMEM;
+			}
+			ret = -err;
+			goto end;
 		}
-		ret = -err;
-		goto end;
 	}
 
 	// Copy the bank table information.
@@ -261,15 +302,40 @@ int RvtH::copyToGcm(RvtH *rvth_dest, unsigned int bank_src, RvtH_Progress_Callba
 		state.type = RVTH_PROGRESS_EXTRACT;
 		state.lba_processed = 0;
 		state.lba_total = lba_copy_len;
+		state.digests = nullptr;
+	}
+
+	// Process 1 MB at a time.
+	// The source image is read ahead of the writer using a bounded
+	// queue, so the next chunks are being read while the current
+	// chunk is being written. (See setIoQueueDepth().)
+	#define BUF_SIZE 1048576
+	#define LBA_COUNT_BUF BYTES_TO_LBA(BUF_SIZE)
+	queue = new ReadAheadQueue(entry_src->reader, 0, lba_copy_len, LBA_COUNT_BUF, m_ioQueueDepth);
+	queue->setScrubMap(scrub);
+	ret = queue->start();
+	if (ret != 0) {
+		// Unable to start the read-ahead queue.
+		err = -ret;
+		goto end;
+	}
+
+	if (digests) {
+		// Hash the disc image as it's being written.
+		dq = new DigestQueue(BUF_SIZE, m_ioQueueDepth);
+		ret = dq->start();
+		if (ret != 0) {
+			// Unable to start the digest threads.
+			err = -ret;
+			goto end;
+		}
 	}
 
-	// TODO: Optimize seeking? (Reader::write() seeks every time.)
-	lba_buf_max = entry_dest->lba_len & ~(LBA_COUNT_BUF-1);
 	lba_nonsparse = 0;
-	for (lba_count = 0; lba_count < lba_buf_max; lba_count += LBA_COUNT_BUF) {
+	while ((chunk = queue->next()) != nullptr) {
 		if (callback) {
 			bool bRet;
-			state.lba_processed = lba_count;
+			state.lba_processed = chunk->lba_start;
 			bRet = callback(&state, userdata);
 			if (!bRet) {
 				// Stop processing.
@@ -279,65 +345,100 @@ int RvtH::copyToGcm(RvtH *rvth_dest, unsigned int bank_src, RvtH_Progress_Callba
 			}
 		}
 
-		// TODO: Error handling.
-		entry_src->reader->read(buf, lba_count, LBA_COUNT_BUF);
-
-		if (lba_count == 0) {
+		const uint8_t *src = chunk->data;
+		bool hole = chunk->hole;
+		if (chunk->lba_start == 0 && LBA_TO_BYTES(chunk->lba_len) >= (int64_t)sizeof(GCN_DiscHeader)) {
 			// Make sure we copy the disc header in if the
 			// header was zeroed by the RVT-H's "Flush" function.
-			// TODO: Move this outside of the `for` loop.
 			// TODO: Also check for NDDEMO?
-			const GCN_DiscHeader *const origHdr = (const GCN_DiscHeader*)buf;
+			const GCN_DiscHeader *const origHdr = (const GCN_DiscHeader*)src;
 			if (origHdr->magic_wii != be32_to_cpu(WII_MAGIC) &&
 			    origHdr->magic_gcn != be32_to_cpu(GCN_MAGIC))
 			{
 				// Missing magic number. Need to restore the disc header.
+				// Mapped data is read-only, so copy it to the buffer first.
+				uint8_t *const buf = ReadAheadQueue::makeWritable(chunk);
 				memcpy(buf, &entry_src->discHeader, sizeof(entry_src->discHeader));
+				src = buf;
+				hole = false;
 			}
 		}
 
-		// Check for empty 4 KB blocks.
-		for (sprs = 0; sprs < BUF_SIZE; sprs += 4096) {
-			if (!isBlockEmpty(&buf[sprs], 4096)) {
-				// 4 KB block is not empty.
-				lba_nonsparse = lba_count + (sprs / 512);
-				entry_dest->reader->write(&buf[sprs], lba_nonsparse, 8);
-				lba_nonsparse += 7;
+		if (scrub && !hole && !scrub->isFullyUsed(chunk->lba_start, chunk->lba_len)) {
+			// Partially-used chunk. Zero the unused LBAs
+			// so they're skipped by the empty block check.
+			uint8_t *const buf = ReadAheadQueue::makeWritable(chunk);
+			scrub->clearUnused(buf, chunk->lba_start, chunk->lba_len);
+			src = buf;
+		}
+
+		if (dq) {
+			// Hash the chunk exactly as it will appear in the destination.
+			if (hole) {
+				dq->updateZero(LBA_TO_BYTES(chunk->lba_len));
+			} else {
+				dq->update(src, static_cast<size_t>(LBA_TO_BYTES(chunk->lba_len)));
 			}
 		}
-	}
 
-	// Process any remaining LBAs.
-	if (lba_count < lba_copy_len) {
-		const unsigned int lba_left = lba_copy_len - lba_count;
-		const unsigned int sz_left = (unsigned int)BYTES_TO_LBA(lba_left);
+		if (hole) {
+			// Hole in a sparse source image, or unused data.
+			// Leave it sparse in the destination.
+			queue->release(chunk);
+			continue;
+		}
 
-		if (callback) {
-			bool bRet;
-			state.lba_processed = lba_count;
-			bRet = callback(&state, userdata);
-			if (!bRet) {
-				// Stop processing.
-				err = ECANCELED;
-				ret = -ECANCELED;
-				goto end;
+		// Check for empty blocks. Full chunks are checked in 4 KB blocks;
+		// the last chunk might not be a multiple of 4 KB, so it's checked
+		// in 512-byte blocks. Consecutive non-empty blocks are written
+		// using a single request.
+		const unsigned int blk_size = (chunk->lba_len == LBA_COUNT_BUF ? 4096 : LBA_SIZE);
+		const unsigned int chunk_size = (unsigned int)LBA_TO_BYTES(chunk->lba_len);
+		unsigned int run_start = 0;
+		for (sprs = 0; sprs <= chunk_size; sprs += blk_size) {
+			if (sprs < chunk_size && !isBlockEmpty(&src[sprs], blk_size)) {
+				// Block is not empty. Extend the current run.
+				continue;
 			}
-		}
-		entry_src->reader->read(buf, lba_count, lba_left);
 
-		// Check for empty 512-byte blocks.
-		for (sprs = 0; sprs < sz_left; sprs += 512) {
-			if (!isBlockEmpty(&buf[sprs], 512)) {
-				// 512-byte block is not empty.
-				lba_nonsparse = lba_count + (sprs / 512);
-				entry_dest->reader->write(&buf[sprs], lba_nonsparse, 1);
+			if (sprs > run_start) {
+				// Write the current run of non-empty blocks.
+				const uint32_t lba_run = chunk->lba_start + BYTES_TO_LBA(run_start);
+				const uint32_t lba_run_len = BYTES_TO_LBA(sprs - run_start);
+				ret = queue->write(chunk, entry_dest->reader, &src[run_start], lba_run, lba_run_len);
+				if (ret != 0) {
+					// Write error. (e.g. out of WBFS blocks)
+					err = -ret;
+					goto end;
+				}
+				lba_nonsparse = lba_run + lba_run_len - 1;
 			}
+			run_start = sprs + blk_size;
 		}
+
+		queue->release(chunk);
+	}
+
+	// Wait for all writes to complete.
+	ret = queue->finish();
+	if (ret != 0) {
+		err = -ret;
+		goto end;
+	}
+	delete queue;
+	queue = nullptr;
+
+	if (dq) {
+		// Wait for the digests.
+		dq->finish(digests);
+		delete dq;
+		dq = nullptr;
 	}
 
 	if (callback) {
 		bool bRet;
 		state.lba_processed = lba_copy_len;
+		state.digests = digests;
 		bRet = callback(&state, userdata);
 		if (!bRet) {
 			// Stop processing.
@@ -353,15 +454,18 @@ int RvtH::copyToGcm(RvtH *rvth_dest, unsigned int bank_src, RvtH_Progress_Callba
 		// We'll need to write an actual zero block.
 		// TODO: Maybe not needed if ftruncate() succeeded?
 		// TODO: Check for errors.
-		memset(buf, 0, 512);
-		entry_dest->reader->write(buf, lba_copy_len-1, 1);
+		uint8_t zero_lba[LBA_SIZE];
+		memset(zero_lba, 0, sizeof(zero_lba));
+		entry_dest->reader->write(zero_lba, lba_copy_len-1, 1);
 	}
 
 	// Finished extracting the disc image.
 	entry_dest->reader->flush();
 
 end:
-	free(buf);
+	// NOTE: Deleting the queue stops the read-ahead thread.
+	delete queue;
+	delete dq;
 	if (err != 0) {
 		errno = err;
 	}
@@ -374,7 +478,7 @@ end:
  * using the GCM constructor and then copyToGcm().
  * @param bank		[in] Bank number. (0-7)
  * @param filename	[in] Destination filename.
- * @param recrypt_key	[in] Key for recryption. (-1 for default; otherwise, see RVL_CryptoType_e)
+ * @param recrypt_key	[in] Key for recryption. (-1 for default; RVL_CryptoType_None to decrypt; otherwise, see RVL_CryptoType_e)
  * @param flags		[in] Flags. (See RvtH_Extract_Flags.)
  * @param callback	[in,opt] Progress callback.
  * @param userdata	[in,opt] User data for progress callback.
@@ -385,6 +489,10 @@ int RvtH::extract(unsigned int bank, const TCHAR *filename,
 {
 	RvtH *rvth_dest = nullptr;
 	int64_t diskFreeSpace_lba = 0;
+	uint32_t gcm_lba_needed;
+	ScrubMap scrub;
+	RvtH_Digests digests;
+	bool recrypt;
 	int ret = 0;
 
 	if (!filename || filename[0] == 0) {
@@ -402,11 +510,17 @@ int RvtH::extract(unsigned int bank, const TCHAR *filename,
 	// TODO: If recrypt_key == the original key,
 	// handle it as -1.
 
+	// Make sure the bank entry is fully initialized.
+	loadBankEntry(bank);
+
 	// Create a standalone disc image.
 	RvtH_BankEntry *const entry = &m_entries[bank];
 	const bool unenc_to_enc = (entry->type >= RVTH_BankType_Wii_SL &&
 				   entry->crypto_type == RVL_CryptoType_None &&
-				   recrypt_key > RVL_CryptoType_Unknown);
+				   recrypt_key > RVL_CryptoType_None);
+	const bool enc_to_unenc = (entry->type >= RVTH_BankType_Wii_SL &&
+				   entry->crypto_type > RVL_CryptoType_None &&
+				   recrypt_key == RVL_CryptoType_None);
 	uint32_t gcm_lba_len;
 	if (unenc_to_enc) {
 		// Converting from unencrypted to encrypted.
@@ -429,10 +543,84 @@ int RvtH::extract(unsigned int bank, const TCHAR *filename,
 		}
 		// Assuming 0x8000 header + 0x18000 H3 table.
 		gcm_lba_len += BYTES_TO_LBA(0x20000) + game_pte->lba_start;
+	} else if (enc_to_unenc) {
+		// Converting from encrypted to unencrypted.
+		// Need to convert 32k sectors to 31k.
+		// The image size depends on the partition header, so use
+		// the same calculation as copyToGcm_doDecrypt().
+		RVL_PartitionHeader pthdr;
+		uint32_t data_lba_src, lba_copy_len;
+		const pt_entry_t *game_pte = rvth_ptbl_find_game(entry);
+		if (!game_pte) {
+			// No game partition...
+			errno = EIO;
+			ret = RVTH_ERROR_NO_GAME_PARTITION;
+			goto end;
+		}
+
+		ret = getDecryptRange(entry->reader, game_pte, &pthdr,
+			&data_lba_src, &lba_copy_len, &gcm_lba_len);
+		if (ret != 0) {
+			// errno was set by getDecryptRange().
+			goto end;
+		}
 	} else {
 		// Use the bank size as-is.
 		gcm_lba_len = entry->lba_len;
 	}
+	recrypt = (recrypt_key > RVL_CryptoType_None && entry->crypto_type != recrypt_key);
+
+	if (flags & (RVTH_EXTRACT_CISO | RVTH_EXTRACT_WBFS | RVTH_EXTRACT_WBFS_APPEND)) {
+		// CISO and WBFS images are written sequentially, so they
+		// can't be used with anything that rewrites parts of the
+		// image after they're written, e.g. recryption.
+		// SDK headers aren't supported by CISO or WBFS readers.
+		if ((flags & RVTH_EXTRACT_CISO) &&
+		    (flags & (RVTH_EXTRACT_WBFS | RVTH_EXTRACT_WBFS_APPEND)))
+		{
+			// Only one output format can be selected.
+			errno = EINVAL;
+			ret = -EINVAL;
+			goto end;
+		}
+		if (unenc_to_enc || enc_to_unenc || (flags & RVTH_EXTRACT_PREPEND_SDK_HEADER) ||
+		    (recrypt_key > RVL_CryptoType_Unknown && entry->crypto_type != recrypt_key))
+		{
+			errno = ENOTSUP;
+			ret = -ENOTSUP;
+			goto end;
+		}
+	}
+
+	gcm_lba_needed = gcm_lba_len;
+	if (flags & RVTH_EXTRACT_SCRUB) {
+		// Recryption rewrites every group, so the
+		// unused groups can't be left empty.
+		if (unenc_to_enc || enc_to_unenc ||
+		    (recrypt_key > RVL_CryptoType_Unknown && entry->crypto_type != recrypt_key))
+		{
+			errno = ENOTSUP;
+			ret = -ENOTSUP;
+			goto end;
+		}
+
+		switch (entry->type) {
+			case RVTH_BankType_GCN:
+			case RVTH_BankType_Wii_SL:
+			case RVTH_BankType_Wii_DL:
+				// Find the used LBAs.
+				ret = scrub.load(entry);
+				if (ret != 0) {
+					errno = (ret < 0 ? -ret : EIO);
+					goto end;
+				}
+				gcm_lba_needed = scrub.usedLbaCount();
+				break;
+			default:
+				// copyToGcm() will report the error.
+				break;
+		}
+	}
 
 	if (flags & RVTH_EXTRACT_PREPEND_SDK_HEADER) {
 		if (entry->type == RVTH_BankType_GCN) {
@@ -443,24 +631,31 @@ int RvtH::extract(unsigned int bank, const TCHAR *filename,
 		}
 		// Prepend 32k to the GCM.
 		gcm_lba_len += BYTES_TO_LBA(32768);
+		gcm_lba_needed += BYTES_TO_LBA(32768);
 	}
 
 	// Check that we have enough free disk space.
-	// NOTE: We're not checking for sparse sectors.
-	diskFreeSpace_lba = getDiskFreeSpace_lba(filename);
-	if (diskFreeSpace_lba < 0) {
-		// Error...
-		ret = static_cast<int>(diskFreeSpace_lba);
-		errno = -ret;
-		goto end;
-	} else if (diskFreeSpace_lba < gcm_lba_len) {
-		// Not enough free disk space.
-		errno = ENOSPC;
-		ret = -ENOSPC;
-		goto end;
+	// NOTE: We're not checking for sparse sectors,
+	// except for the unused areas of scrubbed images.
+	// NOTE: When adding to an existing WBFS image, the space is
+	// allocated from the WBFS image's free blocks instead, and
+	// the writer will fail with ENOSPC if it runs out.
+	if (!(flags & RVTH_EXTRACT_WBFS_APPEND)) {
+		diskFreeSpace_lba = getDiskFreeSpace_lba(filename);
+		if (diskFreeSpace_lba < 0) {
+			// Error...
+			ret = static_cast<int>(diskFreeSpace_lba);
+			errno = -ret;
+			goto end;
+		} else if (diskFreeSpace_lba < gcm_lba_needed) {
+			// Not enough free disk space.
+			errno = ENOSPC;
+			ret = -ENOSPC;
+			goto end;
+		}
 	}
 
-	rvth_dest = new RvtH(filename, gcm_lba_len, &ret);
+	rvth_dest = new RvtH(filename, gcm_lba_len, flags, &ret);
 	if (!rvth_dest->isOpen()) {
 		// Error creating the standalone disc image.
 		errno = EIO;
@@ -531,14 +726,33 @@ int RvtH::extract(unsigned int bank, const TCHAR *filename,
 	// Copy the bank from the source image to the destination GCM.
 	if (unenc_to_enc) {
 		ret = copyToGcm_doCrypt(rvth_dest, bank, callback, userdata);
+	} else if (enc_to_unenc) {
+		ret = copyToGcm_doDecrypt(rvth_dest, bank, callback, userdata);
 	} else {
-		ret = copyToGcm(rvth_dest, bank, callback, userdata);
+		// The digests can be computed while copying,
+		// unless the image will be recrypted afterwards.
+		ret = copyToGcm(rvth_dest, bank, callback, userdata,
+			(flags & RVTH_EXTRACT_SCRUB) ? &scrub : nullptr,
+			((flags & RVTH_EXTRACT_DIGESTS) && !recrypt) ? &digests : nullptr);
 	}
-	if (ret == 0 && recrypt_key > RVL_CryptoType_Unknown) {
+	if (ret == 0 && recrypt) {
 		// Recrypt the disc image.
-		if (entry->crypto_type != recrypt_key) {
-			ret = rvth_dest->recryptWiiPartitions(0,
-				static_cast<RVL_CryptoType_e>(recrypt_key), callback, userdata);
+		ret = rvth_dest->recryptWiiPartitions(0,
+			static_cast<RVL_CryptoType_e>(recrypt_key), callback, userdata);
+	}
+
+	if (ret == 0 && (flags & RVTH_EXTRACT_DIGESTS)) {
+		if (unenc_to_enc || enc_to_unenc || recrypt) {
+			// Encryption, decryption, and recryption write the partition
+			// headers and H3 tables after the data, so the image has to
+			// be read back to get the digests.
+			ret = rvth_dest->digestBank(0, &digests, callback, userdata);
+		}
+		if (ret == 0) {
+			ret = writeDigestsFile(filename, &digests);
+			if (ret != 0) {
+				errno = -ret;
+			}
 		}
 	}
 
@@ -555,15 +769,17 @@ end:
  * @param bank_src	[in] Source bank number. (0-7)
  * @param callback	[in,opt] Progress callback.
  * @param userdata	[in,opt] User data for progress callback.
+ * @param digests	[out,opt] If specified, digests of the copied disc image.
  * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
  */
 int RvtH::copyToHDD(RvtH *rvth_dest, unsigned int bank_dest,
-	unsigned int bank_src, RvtH_Progress_Callback callback, void *userdata)
+	unsigned int bank_src, RvtH_Progress_Callback callback, void *userdata,
+	RvtH_Digests *digests)
 {
 	uint32_t lba_copy_len;	// Total number of LBAs to copy. (entry_src->lba_len)
-	uint32_t lba_count;
-	uint32_t lba_buf_max;	// Highest LBA that can be written using the buffer.
-	uint8_t *buf = NULL;
+	ReadAheadQueue *queue = nullptr;
+	ReadAheadQueue::Chunk *chunk;
+	DigestQueue *dq = nullptr;
 
 	// Callback state.
 	RvtH_Progress_State state;
@@ -585,6 +801,9 @@ int RvtH::copyToHDD(RvtH *rvth_dest, unsigned int bank_dest,
 		return RVTH_ERROR_NOT_HDD_IMAGE;
 	}
 
+	// Make sure the bank entry is fully initialized.
+	loadBankEntry(bank_src);
+
 	// Check if the source bank can be imported.
 	const RvtH_BankEntry *const entry_src = &m_entries[bank_src];
 	switch (entry_src->type) {
@@ -749,20 +968,6 @@ int RvtH::copyToHDD(RvtH *rvth_dest, unsigned int bank_dest,
 		// It has to be updated in memory for qrvthtool, though.
 	}
 
-	// Process 1 MB at a time.
-	#define BUF_SIZE 1048576
-	#define LBA_COUNT_BUF BYTES_TO_LBA(BUF_SIZE)
-	buf = (uint8_t*)malloc(BUF_SIZE);
-	if (!buf) {
-		// Error allocating memory.
-		err = errno;
-		if (err == 0) {
-			err = ENOMEM;
-		}
-		ret = -err;
-		goto end;
-	}
-
 	// Copy the bank table information.
 	entry_dest->lba_len	= entry_src->lba_len;
 	entry_dest->type	= entry_src->type;
@@ -776,6 +981,13 @@ int RvtH::copyToHDD(RvtH *rvth_dest, unsigned int bank_dest,
 	// Copy the disc header.
 	memcpy(&entry_dest->discHeader, &entry_src->discHeader, sizeof(entry_dest->discHeader));
 
+	// The destination bank entries were initialized from the source
+	// bank entry, so they don't need to be loaded from the disc image.
+	rvth_dest->setBankEntryLoaded(bank_dest);
+	if (entry_dest2) {
+		rvth_dest->setBankEntryLoaded(bank_dest+1);
+	}
+
 	// Timestamp.
 	if (entry_src->timestamp >= 0) {
 		entry_dest->timestamp = entry_src->timestamp;
@@ -796,15 +1008,37 @@ int RvtH::copyToHDD(RvtH *rvth_dest, unsigned int bank_dest,
 		state.type = RVTH_PROGRESS_IMPORT;
 		state.lba_processed = 0;
 		state.lba_total = lba_copy_len;
+		state.digests = nullptr;
+	}
+
+	// Process 1 MB at a time.
+	// The source image is read ahead of the writer using a bounded
+	// queue, so the next chunks are being read while the current
+	// chunk is being written to the RVT-H. (See setIoQueueDepth().)
+	queue = new ReadAheadQueue(entry_src->reader, 0, lba_copy_len, LBA_COUNT_BUF, rvth_dest->m_ioQueueDepth);
+	ret = queue->start();
+	if (ret != 0) {
+		// Unable to start the read-ahead queue.
+		err = -ret;
+		goto end;
+	}
+
+	if (digests) {
+		// Hash the disc image as it's being written.
+		dq = new DigestQueue(BUF_SIZE, rvth_dest->m_ioQueueDepth);
+		ret = dq->start();
+		if (ret != 0) {
+			// Unable to start the digest threads.
+			err = -ret;
+			goto end;
+		}
 	}
 
 	// TODO: Special indicator.
-	// TODO: Optimize seeking? (Reader::write() seeks every time.)
-	lba_buf_max = entry_dest->lba_len & ~(LBA_COUNT_BUF-1);
-	for (lba_count = 0; lba_count < lba_buf_max; lba_count += LBA_COUNT_BUF) {
+	while ((chunk = queue->next()) != nullptr) {
 		if (callback) {
 			bool bRet;
-			state.lba_processed = lba_count;
+			state.lba_processed = chunk->lba_start;
 			bRet = callback(&state, userdata);
 			if (!bRet) {
 				// Stop processing.
@@ -818,21 +1052,45 @@ int RvtH::copyToHDD(RvtH *rvth_dest, unsigned int bank_dest,
 		// GCMs being imported generally won't have the first
 		// 16 KB zeroed out...
 
-		// TODO: Error handling.
-		entry_src->reader->read(buf, lba_count, LBA_COUNT_BUF);
-		entry_dest->reader->write(buf, lba_count, LBA_COUNT_BUF);
+		// NOTE: Holes in sparse source images aren't read, but they
+		// still have to be written, since the bank may have old data.
+		// The chunk buffer is zeroed in that case.
+		if (dq) {
+			if (chunk->hole) {
+				dq->updateZero(LBA_TO_BYTES(chunk->lba_len));
+			} else {
+				dq->update(chunk->data, static_cast<size_t>(LBA_TO_BYTES(chunk->lba_len)));
+			}
+		}
+		ret = queue->write(chunk, entry_dest->reader, chunk->data, chunk->lba_start, chunk->lba_len);
+		if (ret != 0) {
+			// Write error.
+			err = -ret;
+			goto end;
+		}
+		queue->release(chunk);
 	}
 
-	// Process any remaining LBAs.
-	if (lba_count < lba_copy_len) {
-		const unsigned int lba_left = lba_copy_len - lba_count;
-		entry_src->reader->read(buf, lba_count, lba_left);
-		entry_dest->reader->write(buf, lba_count, lba_left);
+	// Wait for all writes to complete.
+	ret = queue->finish();
+	if (ret != 0) {
+		err = -ret;
+		goto end;
+	}
+	delete queue;
+	queue = nullptr;
+
+	if (dq) {
+		// Wait for the digests.
+		dq->finish(digests);
+		delete dq;
+		dq = nullptr;
 	}
 
 	if (callback) {
 		bool bRet;
 		state.lba_processed = lba_copy_len;
+		state.digests = digests;
 		bRet = callback(&state, userdata);
 		if (!bRet) {
 			// Stop processing.
@@ -852,7 +1110,9 @@ int RvtH::copyToHDD(RvtH *rvth_dest, unsigned int bank_dest,
 	// Finished importing the disc image.
 
 end:
-	free(buf);
+	// NOTE: Deleting the queue stops the read-ahead thread.
+	delete queue;
+	delete dq;
 	if (err != 0) {
 		errno = err;
 	}
@@ -868,11 +1128,13 @@ end:
  * @param callback	[in,opt] Progress callback.
  * @param userdata	[in,opt] User data for progress callback.
  * @param ios_force	[in,opt] IOS version to force. (-1 to use the existing IOS)
+ * @param digests	[out,opt] If specified, digests of the source disc image.
+ *			(Recryption and the import ID aren't included.)
  * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
  */
 int RvtH::import(unsigned int bank, const TCHAR *filename,
 	RvtH_Progress_Callback callback, void *userdata,
-	int ios_force)
+	int ios_force, RvtH_Digests *digests)
 {
 	if (!filename || filename[0] == 0) {
 		errno = EINVAL;
@@ -909,7 +1171,7 @@ int RvtH::import(unsigned int bank, const TCHAR *filename,
 	// Copy the bank from the source GCM to the HDD.
 	// TODO: HDD to HDD?
 	// NOTE: `bank` parameter starts at 0, not 1.
-	ret = rvth_src->copyToHDD(this, bank, 0, callback, userdata);
+	ret = rvth_src->copyToHDD(this, bank, 0, callback, userdata, digests);
 	if (ret == 0) {
 		// Must convert to debug realsigned for use on RVT-H.
 		const RvtH_BankEntry *const entry = this->bankEntry(bank);
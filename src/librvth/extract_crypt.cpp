@@ -22,16 +22,19 @@
 #include "disc_header.hpp"
 #include "ptbl.h"
 #include "rvth_error.h"
+#include "wii_crypt.h"
 
 #include "byteswap.h"
 #include "nhcd_structs.h"
 
 // Reader class
 #include "reader/Reader.hpp"
+#include "GroupQueue.hpp"
 
 // libwiicrypto
 #include "libwiicrypto/cert_store.h"
 #include "libwiicrypto/sig_tools.h"
+#include "libwiicrypto/sha1w.h"
 
 // C includes.
 #include <stdlib.h>
@@ -41,78 +44,14 @@
 #include <cerrno>
 #include <cstring>
 
+// C++ includes.
+#include <vector>
+using std::vector;
+
 // Encryption.
 #include "aesw.h"
 #include <nettle/sha1.h>
 
-// Sector: 32 KB [H0]
-// Subgroup: 8 sectors == 256 KB [H1]
-// Group: 8 subgroups == 2 MB [H2]
-
-#define SECTOR_SIZE_DEC		(31*1024)
-#define SECTOR_SIZE_ENC		(32*1024)
-#define SUBGROUP_SIZE_DEC	(8*SECTOR_SIZE_DEC)
-#define SUBGROUP_SIZE_ENC	(8*SECTOR_SIZE_ENC)
-#define GROUP_SIZE_DEC		(8*SUBGROUP_SIZE_DEC)
-#define GROUP_SIZE_ENC		(8*SUBGROUP_SIZE_ENC)
-
-// H3 table: SHA-1 hashes of each group's H2 tables.
-// Up to 4,915 groups can be hashed. (9,830 MB of encrypted data)
-// Unused hash entries are all zero.
-// The SHA-1 hash of the H3 table is stored in the TMD content table.
-typedef struct _Wii_Disc_H3_t {
-	uint8_t h3[4915][SHA1_DIGEST_SIZE];
-	uint8_t pad[4];
-} Wii_Disc_H3_t;
-ASSERT_STRUCT(Wii_Disc_H3_t, 0x18000);
-
-// Encrypted Wii disc sector: Hash data.
-// The hash data is encrypted using AES-128-CBC.
-// - Key: Decrypted title key.
-// - IV: All zero.
-typedef struct _Wii_Disc_Hashes_t {
-	// H0 hashes.
-	// One SHA-1 hash for each kilobyte of user data.
-	uint8_t H0[31][SHA1_DIGEST_SIZE];
-
-	// Padding. (0x00)
-	uint8_t pad_H0[20];
-
-	// H1 hashes.
-	// Each hash is over the H0 table for each sector
-	// in an 8-sector subgroup.
-	uint8_t H1[8][SHA1_DIGEST_SIZE];
-
-	// Padding. (0x00)
-	uint8_t pad_H1[32];
-
-	// H2 hashes.
-	// Each hash is over the H1 table for each subgroup
-	// in an 8-subgroup group.
-	// NOTE: The last 16 bytes of h2[7], when encrypted,
-	// is the user data CBC IV.
-	uint8_t H2[8][SHA1_DIGEST_SIZE];
-
-	// Padding. (0x00)
-	uint8_t pad_H2[32];
-} Wii_Disc_Hashes_t;
-ASSERT_STRUCT(Wii_Disc_Hashes_t, 1024);
-
-// Encrypted Wii disc sector.
-typedef struct _Wii_Disc_Sector_t {
-	// Hash table.
-	Wii_Disc_Hashes_t hashes;
-
-	// User data.
-	// This section is encrypted using AES-128-CBC:
-	// - Key: Decrypted title key.
-	// - IV: *Encrypted* bytes 0x3D0-0x3DF of the hash table,
-	//        aka the last 16 bytes of hashes.h2[7].
-	uint8_t data[31*1024];
-} Wii_Disc_Sector_t;
-ASSERT_STRUCT(Wii_Disc_Sector_t, 32*1024);
-
-// TODO: Static assertion that SHA1_DIGEST_SIZE == 20.
 
 /**
  * Encrypt a group of Wii sectors.
@@ -154,21 +93,15 @@ static int rvth_encrypt_group(AesCtx *aesw, const uint8_t *pInBuf,
 		return -EINVAL;
 	}
 
-	// Initialize the SHA-1 context.
-	sha1_init(&sha1);
-
 	// Copy the user data and calculate the H0 hashes.
+	// The H0 hashes are calculated using the batched SHA-1 functions,
+	// since there are 31 independent 1 KB blocks per sector.
 	for (i = 0; i < 64; i++, pInBuf += SECTOR_SIZE_DEC) {
 		// Copy user data.
-		uint8_t *pH0 = sbuf[i].hashes.H0[0];
-		uint8_t *pData = sbuf[i].data;
-		memcpy(pData, pInBuf, SECTOR_SIZE_DEC);
+		memcpy(sbuf[i].data, pInBuf, SECTOR_SIZE_DEC);
 
 		// Calculate the H0 hashes.
-		for (j = 0; j < 31; j++, pData += 1024, pH0 += SHA1_DIGEST_SIZE) {
-			sha1_update(&sha1, 1024, pData);
-			sha1_digest(&sha1, SHA1_DIGEST_SIZE, pH0);
-		}
+		sha1w_hash_strided(sbuf[i].data, 1024, 1024, 31, sbuf[i].hashes.H0[0]);
 
 		// Zero out the post-H0 padding.
 		memset(sbuf[i].hashes.pad_H0, 0, sizeof(sbuf[i].hashes.pad_H0));
@@ -178,14 +111,11 @@ static int rvth_encrypt_group(AesCtx *aesw, const uint8_t *pInBuf,
 	for (i = 0; i < 64; i += 8) {
 		// First sector in the subgroup.
 		Wii_Disc_Sector_t *const sbuf0 = &sbuf[i];
-		uint8_t *pH1 = sbuf0->hashes.H1[0];
 
 		// Hash the H0 tables and store the results
 		// in the first sector's H1 table.
-		for (j = i; j < i+8; j++, pH1 += SHA1_DIGEST_SIZE) {
-			sha1_update(&sha1, sizeof(sbuf[j].hashes.H0), sbuf[j].hashes.H0[0]);
-			sha1_digest(&sha1, SHA1_DIGEST_SIZE, pH1);
-		}
+		sha1w_hash_strided(sbuf0->hashes.H0[0], sizeof(sbuf0->hashes.H0),
+			sizeof(Wii_Disc_Sector_t), 8, sbuf0->hashes.H1[0]);
 		memset(sbuf0->hashes.pad_H1, 0, sizeof(sbuf0->hashes.pad_H1));
 
 		// Copy the H1 hashes to each sector in the subgroup.
@@ -197,11 +127,8 @@ static int rvth_encrypt_group(AesCtx *aesw, const uint8_t *pInBuf,
 
 	// Calculate the H2 hashes for the subgroups.
 	// NOTE: All sectors in this group have the same H2 hashes.
-	sbuf_tmp = sbuf;
-	for (i = 0; i < 8; i += 1, sbuf_tmp += 8) {
-		sha1_update(&sha1, sizeof(sbuf_tmp->hashes.H1), sbuf_tmp->hashes.H1[0]);
-		sha1_digest(&sha1, SHA1_DIGEST_SIZE, sbuf[0].hashes.H2[i]);
-	}
+	sha1w_hash_strided(sbuf[0].hashes.H1[0], sizeof(sbuf[0].hashes.H1),
+		sizeof(Wii_Disc_Sector_t) * 8, 8, sbuf[0].hashes.H2[0]);
 	memset(sbuf[0].hashes.pad_H2, 0, sizeof(sbuf[0].hashes.pad_H2));
 
 	// Copy the H2 hashes to all sectors and encrypt the hashes.
@@ -217,6 +144,7 @@ static int rvth_encrypt_group(AesCtx *aesw, const uint8_t *pInBuf,
 	}
 
 	// Calculate the H3 hash.
+	sha1_init(&sha1);
 	sha1_update(&sha1, sizeof(sbuf[0].hashes.H2), sbuf[0].hashes.H2[0]);
 	sha1_digest(&sha1, SHA1_DIGEST_SIZE, pH3);
 
@@ -236,6 +164,114 @@ static int rvth_encrypt_group(AesCtx *aesw, const uint8_t *pInBuf,
 	return 0;
 }
 
+/**
+ * Decrypt a group of Wii sectors.
+ * The hash tables are discarded, since unencrypted images don't have them.
+ * @param aesw AES context. (Key must be set to the decrypted title key.)
+ * @param pInBuf	[in] Input buffer.
+ * @param inSize	[in] Size of in_buf. (Must have 4,096 LBAs, or 2,097,152 bytes.)
+ * @param pOutBuf	[out] Output buffer.
+ * @param outSize	[in] Size of out_buf. (Must have 3,968 LBAs, or 2,031,616 bytes.)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int rvth_decrypt_group(AesCtx *aesw, const uint8_t *pInBuf,
+	size_t inSize, uint8_t *pOutBuf, size_t outSize)
+{
+	unsigned int i;
+
+	// Disc sector pointers.
+	const Wii_Disc_Sector_t *sbuf = (const Wii_Disc_Sector_t*)pInBuf;
+
+	assert(aesw);
+	assert(pInBuf);
+	assert(inSize == GROUP_SIZE_ENC);
+	assert(pOutBuf);
+	assert(outSize == GROUP_SIZE_DEC);
+
+	if (!aesw || !pInBuf || inSize != GROUP_SIZE_ENC ||
+	    !pOutBuf || outSize != GROUP_SIZE_DEC)
+	{
+		// Invalid parameters.
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	// Decrypt the user data.
+	for (i = 0; i < 64; i++, sbuf++, pOutBuf += SECTOR_SIZE_DEC) {
+		// User data IV is stored within the encrypted H2 table.
+		memcpy(pOutBuf, sbuf->data, SECTOR_SIZE_DEC);
+		aesw_set_iv(aesw, &sbuf->hashes.H2[7][4], 16);
+		aesw_decrypt(aesw, pOutBuf, SECTOR_SIZE_DEC);
+	}
+
+	return 0;
+}
+
+/**
+ * Write the disc header, a single-entry partition table, and the
+ * region information for a disc image containing only the game partition.
+ * @param reader_src	[in] Source reader.
+ * @param reader_dest	[in] Destination reader.
+ * @param game_pte	[in] Game partition.
+ * @param buf		[in] Temporary buffer. (at least 1 LBA)
+ * @param encrypted	[in] If true, the destination image is encrypted.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int write_game_partition_disc_header(Reader *reader_src, Reader *reader_dest,
+	const pt_entry_t *game_pte, uint8_t *buf, bool encrypted)
+{
+	int err;
+
+	// Copy the disc header.
+	errno = 0;
+	if (reader_src->read(buf, 0, 1) != 1) {
+		goto io_error;
+	}
+	buf[0x60] = (encrypted ? 0 : 1);	// Hashes are enabled
+	buf[0x61] = (encrypted ? 0 : 1);	// Disc is encrypted
+	errno = 0;
+	if (reader_dest->write(buf, 0, 1) != 1) {
+		goto io_error;
+	}
+
+	// Create a volume group and partition table with a single entry.
+	memset(buf, 0, 512);
+	{
+		RVL_VolumeGroupTable *const vgtbl = (RVL_VolumeGroupTable*)&buf[0];
+		RVL_PartitionTableEntry *const pt = (RVL_PartitionTableEntry*)&buf[sizeof(*vgtbl)];
+
+		vgtbl->vg[0].count = cpu_to_be32(1);
+		vgtbl->vg[0].addr = cpu_to_be32((uint32_t)((RVL_VolumeGroupTable_ADDRESS + sizeof(*vgtbl)) >> 2));
+		pt->addr = cpu_to_be32((uint32_t)(LBA_TO_BYTES(game_pte->lba_start) >> 2));
+		pt->type = cpu_to_be32(0);
+
+		errno = 0;
+		if (reader_dest->write(buf, BYTES_TO_LBA(RVL_VolumeGroupTable_ADDRESS), 1) != 1) {
+			goto io_error;
+		}
+	}
+
+	// Copy the region information.
+	errno = 0;
+	if (reader_src->read(buf, BYTES_TO_LBA(RVL_RegionSetting_ADDRESS), 1) != 1) {
+		goto io_error;
+	}
+	errno = 0;
+	if (reader_dest->write(buf, BYTES_TO_LBA(RVL_RegionSetting_ADDRESS), 1) != 1) {
+		goto io_error;
+	}
+	return 0;
+
+io_error:
+	// I/O error.
+	err = errno;
+	if (err == 0) {
+		err = EIO;
+	}
+	errno = err;
+	return -err;
+}
+
 /**
  * Decrypt the title key.
  * TODO: Pass in an aesw context for less overhead.
@@ -245,7 +281,7 @@ static int rvth_encrypt_group(AesCtx *aesw, const uint8_t *pInBuf,
  * @param crypto_type	[out] Encryption type. (See RVL_CryptoType_e.)
  * @return 0 on success; non-zero on error.
  */
-static int decrypt_title_key(const RVL_Ticket *ticket, uint8_t *titleKey, uint8_t *crypto_type)
+int rvth_decrypt_title_key(const RVL_Ticket *ticket, uint8_t *titleKey, uint8_t *crypto_type)
 {
 	const uint8_t *commonKey;
 	uint8_t iv[16];	// based on Title ID
@@ -329,24 +365,23 @@ int RvtH::copyToGcm_doCrypt(RvtH *rvth_dest, unsigned int bank_src,
 
 	// Buffers.
 	RVL_PartitionHeader pthdr;
-	uint8_t *buf_dec = NULL;
-	uint8_t *buf_enc = NULL;
+	uint8_t *buf_tmp = NULL;
 
 	// H3 table.
 	Wii_Disc_H3_t *H3_tbl = NULL;	// H3 hash table.
-	uint8_t *pH3;			// Current H3 hash.
 	RVL_Content_Entry *content;
 	struct sha1_ctx sha1;
 
-	// Current LBA counters.
-	// Relative to the game partition.
-	uint32_t data_offset;	// Partition data offset.
-	uint32_t lba_count_dec;	// Decrypted (source)
-	uint32_t lba_count_enc;	// Encrypted (destination)
+	// Partition data offset.
+	uint32_t data_offset;
+
+	// Group counters.
+	uint32_t group_count;	// Number of groups
+	uint32_t group_next;	// Next group to read
 
-	// Highest LBA that can be read from the source without
-	// padding the buffer.
-	uint32_t lba_max_dec;
+	// Group encryption queue.
+	GroupQueue *queue = nullptr;
+	GroupQueue::Job *job;
 
 	// Callback state.
 	RvtH_Progress_State state;
@@ -357,8 +392,8 @@ int RvtH::copyToGcm_doCrypt(RvtH *rvth_dest, unsigned int bank_src,
 	// Destination disc image.
 	RvtH_BankEntry *entry_dest;
 
-	// AES context.
-	AesCtx *aesw = NULL;
+	// AES contexts. (one per worker thread)
+	vector<AesCtx*> aesw;
 	uint8_t titleKey[16];
 
 	if (!rvth_dest) {
@@ -374,6 +409,9 @@ int RvtH::copyToGcm_doCrypt(RvtH *rvth_dest, unsigned int bank_src,
 		return RVTH_ERROR_IS_HDD_IMAGE;
 	}
 
+	// Make sure the bank entry is fully initialized.
+	loadBankEntry(bank_src);
+
 	// Check if the source bank can be extracted.
 	RvtH_BankEntry *const entry_src = &m_entries[bank_src];
 	switch (entry_src->type) {
@@ -422,14 +460,10 @@ int RvtH::copyToGcm_doCrypt(RvtH *rvth_dest, unsigned int bank_src,
 	// If more than one partition, and the other partition
 	// isn't an update partition, fail.
 
-	// Process 64 sectors at a time.
 	// TODO: Use unique_ptr<>?
-	#define LBA_COUNT_DEC BYTES_TO_LBA(GROUP_SIZE_DEC)
-	#define LBA_COUNT_ENC BYTES_TO_LBA(GROUP_SIZE_ENC)
-	buf_dec = static_cast<uint8_t*>(malloc(GROUP_SIZE_DEC));
-	buf_enc = static_cast<uint8_t*>(malloc(GROUP_SIZE_ENC));
+	buf_tmp = static_cast<uint8_t*>(malloc(LBA_SIZE));
 	H3_tbl = static_cast<Wii_Disc_H3_t*>(calloc(1, sizeof(*H3_tbl)));	// zero initialized
-	if (!buf_dec || !buf_enc || !H3_tbl) {
+	if (!buf_tmp || !H3_tbl) {
 		// Error allocating memory.
 		err = errno;
 		if (err == 0) {
@@ -439,16 +473,23 @@ int RvtH::copyToGcm_doCrypt(RvtH *rvth_dest, unsigned int bank_src,
 		goto end;
 	}
 
+	// Groups are encrypted in parallel using a pool of worker threads.
+	queue = new GroupQueue(GROUP_SIZE_DEC, GROUP_SIZE_ENC);
+
 	// Initialize encryption.
-	aesw = aesw_new();
-	if (!aesw) {
-		// Error initializing encryption.
-		err = errno;
-		if (err == 0) {
-			err = EIO;
+	// Each worker thread has its own AES context.
+	aesw.resize(queue->threadCount(), nullptr);
+	for (auto iter = aesw.begin(); iter != aesw.end(); ++iter) {
+		*iter = aesw_new();
+		if (!*iter) {
+			// Error initializing encryption.
+			err = errno;
+			if (err == 0) {
+				err = EIO;
+			}
+			ret = -err;
+			goto end;
 		}
-		ret = -err;
-		goto end;
 	}
 
 	// TODO: Set the expected file size.
@@ -476,41 +517,29 @@ int RvtH::copyToGcm_doCrypt(RvtH *rvth_dest, unsigned int bank_src,
 		entry_dest->timestamp = time(NULL);
 	}
 
-	// Copy the disc header.
-	// TODO: Error handling.
-	entry_src->reader->read(buf_dec, 0, 1);
-	buf_dec[0x60] = 0;	// Hashes are enabled
-	buf_dec[0x61] = 0;	// Disc is encrypted
-	entry_dest->reader->write(buf_dec, 0, 1);
-
-	// Create a volume group and partition table with a single entry.
-	// TODO: Error handling.
-	memset(buf_dec, 0, 512);
-	{
-		RVL_VolumeGroupTable *const vgtbl = (RVL_VolumeGroupTable*)&buf_dec[0];
-		RVL_PartitionTableEntry *const pt = (RVL_PartitionTableEntry*)&buf_dec[sizeof(*vgtbl)];
-
-		vgtbl->vg[0].count = cpu_to_be32(1);
-		vgtbl->vg[0].addr = cpu_to_be32((uint32_t)((RVL_VolumeGroupTable_ADDRESS + sizeof(*vgtbl)) >> 2));
-		pt->addr = cpu_to_be32((uint32_t)(LBA_TO_BYTES(game_pte->lba_start) >> 2));
-		pt->type = cpu_to_be32(0);
-
-		entry_dest->reader->write(buf_dec, BYTES_TO_LBA(RVL_VolumeGroupTable_ADDRESS), 1);
+	// Write the disc header and partition table.
+	ret = write_game_partition_disc_header(entry_src->reader, entry_dest->reader, game_pte, buf_tmp, true);
+	if (ret != 0) {
+		// I/O error.
+		err = -ret;
+		goto end;
 	}
 
-	// Copy the region information.
-	entry_src->reader->read(buf_dec, BYTES_TO_LBA(RVL_RegionSetting_ADDRESS), 1);
-	entry_dest->reader->write(buf_dec, BYTES_TO_LBA(RVL_RegionSetting_ADDRESS), 1);
-
-	// Copy the region information.
-	// TODO: Error handling.
-	entry_src->reader->read(buf_dec, BYTES_TO_LBA(RVL_RegionSetting_ADDRESS), 1);
-	entry_dest->reader->write(buf_dec, BYTES_TO_LBA(RVL_RegionSetting_ADDRESS), 1);
-
 	// Read the partition header.
 	// This will be rewritten later, since we need to update the
 	// content SHA-1 in the TMD.
-	entry_src->reader->read(&pthdr, game_pte->lba_start, BYTES_TO_LBA(sizeof(pthdr)));
+	errno = 0;
+	if (entry_src->reader->read(&pthdr, game_pte->lba_start, BYTES_TO_LBA(sizeof(pthdr))) !=
+	    BYTES_TO_LBA(sizeof(pthdr)))
+	{
+		// Read error.
+		err = errno;
+		if (err == 0) {
+			err = EIO;
+		}
+		ret = -err;
+		goto end;
+	}
 
 	// Data offset should be 0x8000 for unencrypted partitions.
 	data_offset = be32_to_cpu(pthdr.data_offset) << 2;
@@ -527,6 +556,15 @@ int RvtH::copyToGcm_doCrypt(RvtH *rvth_dest, unsigned int bank_src,
 	data_lba_dest = game_pte->lba_start + BYTES_TO_LBA(data_offset + sizeof(Wii_Disc_H3_t));
 	lba_copy_len -= BYTES_TO_LBA(data_offset);
 
+	// The H3 table has one hash per group.
+	group_count = (lba_copy_len + LBA_COUNT_DEC - 1) / LBA_COUNT_DEC;
+	if (group_count > ARRAY_SIZE(H3_tbl->h3)) {
+		// Too many groups for the H3 table.
+		err = EIO;
+		ret = RVTH_ERROR_IMAGE_TOO_BIG;
+		goto end;
+	}
+
 	if (callback) {
 		// Initialize the callback state.
 		// TODO: Fields for source vs. destination sizes?
@@ -537,55 +575,91 @@ int RvtH::copyToGcm_doCrypt(RvtH *rvth_dest, unsigned int bank_src,
 		state.type = RVTH_PROGRESS_EXTRACT;
 		state.lba_processed = 0;
 		state.lba_total = lba_copy_len;
+		state.digests = nullptr;
 	}
 
 	// Decrypt the title key.
-	ret = decrypt_title_key(&pthdr.ticket, titleKey, &entry_dest->crypto_type);
+	ret = rvth_decrypt_title_key(&pthdr.ticket, titleKey, &entry_dest->crypto_type);
 	if (ret != 0) {
 		// Error decrypting the title key.
 		err = EIO;
 		goto end;
 	}
-	aesw_set_key(aesw, titleKey, sizeof(titleKey));
-
-	// TODO: Optimize seeking? (Reader::write() seeks every time.)
-	lba_max_dec = lba_copy_len - (lba_copy_len % LBA_COUNT_DEC);
-	pH3 = H3_tbl->h3[0];
-	for (lba_count_dec = 0, lba_count_enc = 0;
-	     lba_count_dec < lba_max_dec;
-	     lba_count_dec += LBA_COUNT_DEC, lba_count_enc += LBA_COUNT_ENC, pH3 += SHA1_DIGEST_SIZE)
-	{
-		if (callback) {
-			bool bRet;
-			state.lba_processed = lba_count_dec;
-			bRet = callback(&state, userdata);
-			if (!bRet) {
-				// Stop processing.
-				err = ECANCELED;
-				ret = -ECANCELED;
-				goto end;
-			}
-		}
-
-		// TODO: Error handling.
-
-		// Read 64 decrypted sectors.
-		entry_src->reader->read(buf_dec, data_lba_src + lba_count_dec, LBA_COUNT_DEC);
+	for (auto iter = aesw.begin(); iter != aesw.end(); ++iter) {
+		aesw_set_key(*iter, titleKey, sizeof(titleKey));
+	}
 
+	// Start the worker threads.
+	// Each group's H3 hash is stored in the H3 table by group index.
+	ret = queue->start([&aesw, H3_tbl](unsigned int worker, GroupQueue::Job *job) {
 		// Encrypt the sectors. (64*31k -> 64*32k)
-		rvth_encrypt_group(aesw, buf_dec, GROUP_SIZE_DEC, buf_enc, GROUP_SIZE_ENC, pH3, SHA1_DIGEST_SIZE);
-
-		// Write 64 encrypted sectors.
-		entry_dest->reader->write(buf_enc, data_lba_dest + lba_count_enc, LBA_COUNT_ENC);
+		return rvth_encrypt_group(aesw[worker], job->src, GROUP_SIZE_DEC,
+			job->out, GROUP_SIZE_ENC, H3_tbl->h3[job->index], SHA1_DIGEST_SIZE);
+	});
+	if (ret != 0) {
+		// Unable to start the worker threads.
+		err = -ret;
+		goto end;
 	}
 
-	// If we have leftover, write a padded group.
-	if (lba_count_dec < lba_copy_len) {
-		const unsigned int lba_left = lba_copy_len - lba_count_dec;
+	// Groups are read and written by this thread, in order.
+	// While a group is being written, the worker threads
+	// encrypt the following groups.
+	group_next = 0;
+	for (;;) {
+		// Read groups into any free jobs.
+		while (group_next < group_count && (job = queue->acquire()) != nullptr) {
+			const uint32_t lba_count_dec = group_next * LBA_COUNT_DEC;
+			const uint32_t lba_left = lba_copy_len - lba_count_dec;
+
+			if (lba_left >= LBA_COUNT_DEC) {
+				// Read 64 decrypted sectors.
+				// If the source reader supports zero-copy access,
+				// encrypt directly from the mapped data.
+				job->src = entry_src->reader->map(data_lba_src + lba_count_dec, LBA_COUNT_DEC);
+				if (!job->src) {
+					errno = 0;
+					if (entry_src->reader->read(job->in, data_lba_src + lba_count_dec, LBA_COUNT_DEC) != LBA_COUNT_DEC) {
+						// Read error.
+						err = errno;
+						if (err == 0) {
+							err = EIO;
+						}
+						ret = -err;
+						goto end;
+					}
+					job->src = job->in;
+				}
+			} else {
+				// Leftover sectors. Read and pad the sectors.
+				errno = 0;
+				if (entry_src->reader->read(job->in, data_lba_src + lba_count_dec, lba_left) != lba_left) {
+					// Read error.
+					err = errno;
+					if (err == 0) {
+						err = EIO;
+					}
+					ret = -err;
+					goto end;
+				}
+				memset(&job->in[LBA_TO_BYTES(lba_left)], 0, LBA_TO_BYTES(LBA_COUNT_DEC - lba_left));
+				job->src = job->in;
+			}
+
+			job->index = group_next++;
+			queue->submit(job);
+		}
+
+		// Get the next encrypted group.
+		job = queue->next();
+		if (!job) {
+			// All groups have been written.
+			break;
+		}
 
 		if (callback) {
 			bool bRet;
-			state.lba_processed = lba_count_dec;
+			state.lba_processed = job->index * LBA_COUNT_DEC;
 			bRet = callback(&state, userdata);
 			if (!bRet) {
 				// Stop processing.
@@ -595,17 +669,31 @@ int RvtH::copyToGcm_doCrypt(RvtH *rvth_dest, unsigned int bank_src,
 			}
 		}
 
-		// Read and pad the sectors.
-		entry_src->reader->read(buf_dec, data_lba_src + lba_count_dec, lba_left);
-		memset(&buf_dec[LBA_TO_BYTES(LBA_COUNT_DEC - lba_left)], 0, LBA_TO_BYTES(lba_left));
-
-		// Encrypt the sectors. (64*31k -> 64*32k)
-		rvth_encrypt_group(aesw, buf_dec, GROUP_SIZE_DEC, buf_enc, GROUP_SIZE_ENC, pH3, SHA1_DIGEST_SIZE);
+		if (job->ret != 0) {
+			// Error encrypting the group.
+			ret = job->ret;
+			err = -ret;
+			goto end;
+		}
 
 		// Write 64 encrypted sectors.
-		entry_dest->reader->write(buf_enc, data_lba_dest + lba_count_enc, LBA_COUNT_ENC);
+		errno = 0;
+		if (entry_dest->reader->write(job->out, data_lba_dest + (job->index * LBA_COUNT_ENC), LBA_COUNT_ENC) != LBA_COUNT_ENC) {
+			// Write error.
+			err = errno;
+			if (err == 0) {
+				err = EIO;
+			}
+			ret = -err;
+			goto end;
+		}
+		queue->release(job);
 	}
 
+	// Worker threads are no longer needed.
+	delete queue;
+	queue = nullptr;
+
 	/** Update the partition header. **/
 
 	// H3 table offset. (0x8000 encrypted; not present unencrypted.)
@@ -616,7 +704,8 @@ int RvtH::copyToGcm_doCrypt(RvtH *rvth_dest, unsigned int bank_src,
 		be32_to_cpu(pthdr.data_offset) + (sizeof(*H3_tbl) >> 2));
 
 	// Data size. (usually 0 in unencrypted images)
-	pthdr.data_size = cpu_to_be32(LBA_TO_BYTES(lba_copy_len) >> 2);
+	// This is the size of the encrypted data, including hash tables.
+	pthdr.data_size = cpu_to_be32((uint32_t)(LBA_TO_BYTES(group_count * LBA_COUNT_ENC) >> 2));
 	assert(pthdr.data_offset == cpu_to_be32(0x20000 >> 2));
 
 	// H3 SHA-1 in the TMD.
@@ -631,11 +720,21 @@ int RvtH::copyToGcm_doCrypt(RvtH *rvth_dest, unsigned int bank_src,
 
 	// Write the partition header and H3 table.
 	// TODO: Specific callback notice?
-	entry_dest->reader->write(&pthdr,
-		game_pte->lba_start, BYTES_TO_LBA(sizeof(pthdr)));
-	entry_dest->reader->write(H3_tbl,
+	errno = 0;
+	if (entry_dest->reader->write(&pthdr,
+		game_pte->lba_start, BYTES_TO_LBA(sizeof(pthdr))) != BYTES_TO_LBA(sizeof(pthdr)) ||
+	    entry_dest->reader->write(H3_tbl,
 		game_pte->lba_start + BYTES_TO_LBA(sizeof(pthdr)),
-		BYTES_TO_LBA(sizeof(*H3_tbl)));
+		BYTES_TO_LBA(sizeof(*H3_tbl))) != BYTES_TO_LBA(sizeof(*H3_tbl)))
+	{
+		// Write error.
+		err = errno;
+		if (err == 0) {
+			err = EIO;
+		}
+		ret = -err;
+		goto end;
+	}
 
 	if (callback) {
 		bool bRet;
@@ -653,10 +752,448 @@ int RvtH::copyToGcm_doCrypt(RvtH *rvth_dest, unsigned int bank_src,
 	entry_dest->reader->flush();
 
 end:
-	free(buf_dec);
-	free(buf_enc);
+	// NOTE: Deleting the queue stops the worker threads.
+	delete queue;
+	free(buf_tmp);
 	free(H3_tbl);
-	aesw_free(aesw);
+	for (auto iter = aesw.begin(); iter != aesw.end(); ++iter) {
+		aesw_free(*iter);
+	}
+	if (err != 0) {
+		errno = err;
+	}
+	return ret;
+}
+
+/**
+ * Read the partition header of an encrypted game partition
+ * and determine which LBAs copyToGcm_doDecrypt() decrypts.
+ *
+ * If the partition header has a data size, the encrypted data is
+ * trimmed to it; otherwise, the rest of the partition is used.
+ * Only whole sectors are decrypted.
+ *
+ * @param reader		[in] Source reader.
+ * @param game_pte		[in] Game partition.
+ * @param pthdr			[out] Partition header.
+ * @param p_data_lba_src	[out] First LBA of the encrypted data.
+ * @param p_lba_copy_len	[out] Number of encrypted LBAs to decrypt.
+ * @param p_lba_dest_len	[out,opt] Size of the decrypted disc image, in LBAs.
+ * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+int RvtH::getDecryptRange(Reader *reader, const pt_entry_t *game_pte,
+	RVL_PartitionHeader *pthdr, uint32_t *p_data_lba_src,
+	uint32_t *p_lba_copy_len, uint32_t *p_lba_dest_len)
+{
+	// Read the partition header.
+	errno = 0;
+	if (reader->read(pthdr, game_pte->lba_start, BYTES_TO_LBA(sizeof(*pthdr))) !=
+	    BYTES_TO_LBA(sizeof(*pthdr)))
+	{
+		// Read error.
+		int err = errno;
+		if (err == 0) {
+			err = EIO;
+		}
+		errno = err;
+		return -err;
+	}
+
+	// Data offset should be at least 0x20000 for encrypted partitions.
+	// (0x8000 partition header, 0x18000 H3 table)
+	const uint32_t data_offset = be32_to_cpu(pthdr->data_offset) << 2;
+	if (data_offset < sizeof(*pthdr) + sizeof(Wii_Disc_H3_t) ||
+	    data_offset % LBA_SIZE != 0 ||
+	    BYTES_TO_LBA(data_offset) >= game_pte->lba_len)
+	{
+		errno = EIO;
+		return RVTH_ERROR_PARTITION_HEADER_CORRUPTED;
+	}
+
+	// Calculate the data offset LBA and the encrypted data size.
+	// If the partition header has a data size, use it;
+	// otherwise, use the rest of the partition.
+	uint32_t lba_copy_len = game_pte->lba_len - BYTES_TO_LBA(data_offset);
+	const uint64_t data_size = (uint64_t)be32_to_cpu(pthdr->data_size) << 2;
+	if (data_size != 0 && BYTES_TO_LBA(data_size) < lba_copy_len) {
+		lba_copy_len = (uint32_t)BYTES_TO_LBA(data_size);
+	}
+	// Only whole sectors can be decrypted.
+	lba_copy_len &= ~(BYTES_TO_LBA(SECTOR_SIZE_ENC) - 1);
+
+	*p_data_lba_src = game_pte->lba_start + BYTES_TO_LBA(data_offset);
+	*p_lba_copy_len = lba_copy_len;
+	if (p_lba_dest_len) {
+		// The decrypted data immediately follows the partition header,
+		// and each 32 KB sector is decrypted to 31 KB.
+		*p_lba_dest_len = game_pte->lba_start + BYTES_TO_LBA(sizeof(*pthdr)) +
+			(lba_copy_len / BYTES_TO_LBA(SECTOR_SIZE_ENC) * BYTES_TO_LBA(SECTOR_SIZE_DEC));
+	}
+	return 0;
+}
+
+/**
+ * Copy a bank from this RVT-H HDD or standalone disc image to a writable standalone disc image.
+ *
+ * This function copies an encrypted Game Partition and decrypts it,
+ * removing the H0-H2 hash tables and the H3 table. The result uses
+ * the unencrypted 31 KB-per-sector layout used by RVT-R NOCRYPTO images.
+ * The ticket and TMD are not modified.
+ *
+ * @param rvth_dest	[out] Destination RvtH object.
+ * @param bank_src	[in] Source bank number. (0-7)
+ * @param callback	[in,opt] Progress callback.
+ * @param userdata	[in,opt] User data for progress callback.
+ * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+int RvtH::copyToGcm_doDecrypt(RvtH *rvth_dest, unsigned int bank_src,
+	RvtH_Progress_Callback callback, void *userdata)
+{
+	uint32_t data_lba_src;	// Game partition, data offset LBA. (source, encrypted)
+	uint32_t data_lba_dest;	// Game partition, data offset LBA. (dest, unencrypted)
+	uint32_t lba_copy_len;	// Number of LBAs to copy. (encrypted data size)
+
+	// Buffers.
+	RVL_PartitionHeader pthdr;
+	uint8_t *buf_tmp = NULL;
+
+	// Group counters.
+	uint32_t group_count;	// Number of groups
+	uint32_t group_next;	// Next group to read
+
+	// Group decryption queue.
+	GroupQueue *queue = nullptr;
+	GroupQueue::Job *job;
+
+	// Callback state.
+	RvtH_Progress_State state;
+
+	int ret = 0;	// errno or RvtH_Errors
+	int err = 0;	// errno setting
+
+	// Destination disc image.
+	RvtH_BankEntry *entry_dest;
+
+	// AES contexts. (one per worker thread)
+	vector<AesCtx*> aesw;
+	uint8_t titleKey[16];
+	uint8_t crypto_type;
+
+	if (!rvth_dest) {
+		errno = EINVAL;
+		return -EINVAL;
+	} else if (bank_src >= m_bankCount) {
+		errno = ERANGE;
+		return -ERANGE;
+	} else if (rvth_dest->isHDD() || rvth_dest->bankCount() != 1) {
+		// Destination is not a standalone disc image.
+		errno = EIO;
+		return RVTH_ERROR_IS_HDD_IMAGE;
+	}
+
+	// Make sure the bank entry is fully initialized.
+	loadBankEntry(bank_src);
+
+	// Check if the source bank can be extracted.
+	RvtH_BankEntry *const entry_src = &m_entries[bank_src];
+	switch (entry_src->type) {
+		case RVTH_BankType_Wii_SL:
+		case RVTH_BankType_Wii_DL:
+			// Bank can be extracted.
+			break;
+
+		case RVTH_BankType_GCN:
+			// No encryption for GameCube.
+			errno = EIO;
+			return RVTH_ERROR_NOT_WII_IMAGE;
+
+		case RVTH_BankType_Unknown:
+		default:
+			// Unknown bank status...
+			errno = EIO;
+			return RVTH_ERROR_BANK_UNKNOWN;
+
+		case RVTH_BankType_Empty:
+			// Bank is empty.
+			errno = ENOENT;
+			return RVTH_ERROR_BANK_EMPTY;
+
+		case RVTH_BankType_Wii_DL_Bank2:
+			// Second bank of a dual-layer Wii disc image.
+			// TODO: Automatically select the first bank?
+			errno = EIO;
+			return RVTH_ERROR_BANK_DL_2;
+	}
+
+	if (entry_src->crypto_type <= RVL_CryptoType_None) {
+		// Bank is not encrypted.
+		errno = EINVAL;
+		return RVTH_ERROR_IS_UNENCRYPTED;
+	}
+
+	// Find the game partition.
+	// TODO: Copy other partitions later?
+	const pt_entry_t *const game_pte = rvth_ptbl_find_game(entry_src);
+	if (!game_pte) {
+		// Cannot find the game partition.
+		err = EIO;
+		ret = RVTH_ERROR_NO_GAME_PARTITION;
+		goto end;
+	}
+
+	buf_tmp = static_cast<uint8_t*>(malloc(LBA_SIZE));
+	if (!buf_tmp) {
+		// Error allocating memory.
+		err = errno;
+		if (err == 0) {
+			err = ENOMEM;
+		}
+		ret = -err;
+		goto end;
+	}
+
+	// Read the partition header and find the encrypted data.
+	ret = getDecryptRange(entry_src->reader, game_pte, &pthdr, &data_lba_src, &lba_copy_len);
+	if (ret != 0) {
+		err = (ret < 0 ? -ret : EIO);
+		goto end;
+	}
+	data_lba_dest = game_pte->lba_start + BYTES_TO_LBA(sizeof(pthdr));
+	group_count = (lba_copy_len + LBA_COUNT_ENC - 1) / LBA_COUNT_ENC;
+
+	// Decrypt the title key.
+	ret = rvth_decrypt_title_key(&pthdr.ticket, titleKey, &crypto_type);
+	if (ret != 0) {
+		// Error decrypting the title key.
+		err = EIO;
+		goto end;
+	}
+
+	// Groups are decrypted in parallel using a pool of worker threads.
+	queue = new GroupQueue(GROUP_SIZE_ENC, GROUP_SIZE_DEC);
+
+	// Initialize decryption.
+	// Each worker thread has its own AES context.
+	aesw.resize(queue->threadCount(), nullptr);
+	for (auto iter = aesw.begin(); iter != aesw.end(); ++iter) {
+		*iter = aesw_new();
+		if (!*iter) {
+			// Error initializing decryption.
+			err = errno;
+			if (err == 0) {
+				err = EIO;
+			}
+			ret = -err;
+			goto end;
+		}
+		aesw_set_key(*iter, titleKey, sizeof(titleKey));
+	}
+
+	// Copy the bank table information.
+	entry_dest = &rvth_dest->m_entries[0];
+	entry_dest->type	= entry_src->type;
+	entry_dest->region_code	= entry_src->region_code;
+	entry_dest->is_deleted	= false;
+	entry_dest->crypto_type	= RVL_CryptoType_None;
+	entry_dest->ios_version	= entry_src->ios_version;
+	entry_dest->ticket	= entry_src->ticket;
+	entry_dest->tmd		= entry_src->tmd;
+
+	// Copy the disc header.
+	memcpy(&entry_dest->discHeader, &entry_src->discHeader, sizeof(entry_dest->discHeader));
+	entry_dest->discHeader.hash_verify = 1;
+	entry_dest->discHeader.disc_noCrypt = 1;
+
+	// Timestamp.
+	if (entry_src->timestamp >= 0) {
+		entry_dest->timestamp = entry_src->timestamp;
+	} else {
+		entry_dest->timestamp = time(NULL);
+	}
+
+	// Write the disc header and partition table.
+	ret = write_game_partition_disc_header(entry_src->reader, entry_dest->reader, game_pte, buf_tmp, false);
+	if (ret != 0) {
+		// I/O error.
+		err = -ret;
+		goto end;
+	}
+
+	if (callback) {
+		// Initialize the callback state.
+		// TODO: Fields for source vs. destination sizes?
+		state.rvth = this;
+		state.rvth_gcm = rvth_dest;
+		state.bank_rvth = bank_src;
+		state.bank_gcm = 0;
+		state.type = RVTH_PROGRESS_EXTRACT;
+		state.lba_processed = 0;
+		state.lba_total = lba_copy_len;
+		state.digests = nullptr;
+	}
+
+	// Start the worker threads.
+	ret = queue->start([&aesw](unsigned int worker, GroupQueue::Job *job) {
+		// Decrypt the sectors. (64*32k -> 64*31k)
+		return rvth_decrypt_group(aesw[worker], job->src, GROUP_SIZE_ENC,
+			job->out, GROUP_SIZE_DEC);
+	});
+	if (ret != 0) {
+		// Unable to start the worker threads.
+		err = -ret;
+		goto end;
+	}
+
+	// Groups are read and written by this thread, in order.
+	// While a group is being written, the worker threads
+	// decrypt the following groups.
+	group_next = 0;
+	for (;;) {
+		// Read groups into any free jobs.
+		while (group_next < group_count && (job = queue->acquire()) != nullptr) {
+			const uint32_t lba_count_enc = group_next * LBA_COUNT_ENC;
+			const uint32_t lba_left = lba_copy_len - lba_count_enc;
+
+			if (lba_left >= LBA_COUNT_ENC) {
+				// Read 64 encrypted sectors.
+				// If the source reader supports zero-copy access,
+				// decrypt directly from the mapped data.
+				job->src = entry_src->reader->map(data_lba_src + lba_count_enc, LBA_COUNT_ENC);
+				if (!job->src) {
+					errno = 0;
+					if (entry_src->reader->read(job->in, data_lba_src + lba_count_enc, LBA_COUNT_ENC) != LBA_COUNT_ENC) {
+						// Read error.
+						err = errno;
+						if (err == 0) {
+							err = EIO;
+						}
+						ret = -err;
+						goto end;
+					}
+					job->src = job->in;
+				}
+			} else {
+				// Leftover sectors. Read and pad the sectors.
+				// The padding is decrypted, but it isn't written.
+				errno = 0;
+				if (entry_src->reader->read(job->in, data_lba_src + lba_count_enc, lba_left) != lba_left) {
+					// Read error.
+					err = errno;
+					if (err == 0) {
+						err = EIO;
+					}
+					ret = -err;
+					goto end;
+				}
+				memset(&job->in[LBA_TO_BYTES(lba_left)], 0, LBA_TO_BYTES(LBA_COUNT_ENC - lba_left));
+				job->src = job->in;
+			}
+
+			job->index = group_next++;
+			queue->submit(job);
+		}
+
+		// Get the next decrypted group.
+		job = queue->next();
+		if (!job) {
+			// All groups have been written.
+			break;
+		}
+
+		if (callback) {
+			bool bRet;
+			state.lba_processed = job->index * LBA_COUNT_ENC;
+			bRet = callback(&state, userdata);
+			if (!bRet) {
+				// Stop processing.
+				err = ECANCELED;
+				ret = -ECANCELED;
+				goto end;
+			}
+		}
+
+		if (job->ret != 0) {
+			// Error decrypting the group.
+			ret = job->ret;
+			err = -ret;
+			goto end;
+		}
+
+		// Write the decrypted sectors.
+		// The last group may have fewer than 64 sectors.
+		{
+			const uint32_t lba_left = lba_copy_len - (job->index * LBA_COUNT_ENC);
+			const uint32_t sectors = (lba_left >= LBA_COUNT_ENC
+				? 64 : lba_left / BYTES_TO_LBA(SECTOR_SIZE_ENC));
+			const uint32_t lba_write = sectors * BYTES_TO_LBA(SECTOR_SIZE_DEC);
+			errno = 0;
+			if (entry_dest->reader->write(job->out, data_lba_dest + (job->index * LBA_COUNT_DEC),
+			    lba_write) != lba_write)
+			{
+				// Write error.
+				err = errno;
+				if (err == 0) {
+					err = EIO;
+				}
+				ret = -err;
+				goto end;
+			}
+		}
+		queue->release(job);
+	}
+
+	// Worker threads are no longer needed.
+	delete queue;
+	queue = nullptr;
+
+	/** Update the partition header. **/
+
+	// H3 table offset. (0x8000 encrypted; not present unencrypted.)
+	pthdr.h3_table_offset = 0;
+
+	// Data offset. (0x20000 encrypted; 0x8000 unencrypted.)
+	pthdr.data_offset = cpu_to_be32(sizeof(pthdr) >> 2);
+
+	// Data size. (usually 0 in unencrypted images)
+	pthdr.data_size = 0;
+
+	// Write the partition header.
+	// The ticket and TMD are unchanged, so the signatures are still valid.
+	errno = 0;
+	if (entry_dest->reader->write(&pthdr, game_pte->lba_start, BYTES_TO_LBA(sizeof(pthdr))) !=
+	    BYTES_TO_LBA(sizeof(pthdr)))
+	{
+		// Write error.
+		err = errno;
+		if (err == 0) {
+			err = EIO;
+		}
+		ret = -err;
+		goto end;
+	}
+
+	if (callback) {
+		bool bRet;
+		state.lba_processed = lba_copy_len;
+		bRet = callback(&state, userdata);
+		if (!bRet) {
+			// Stop processing.
+			err = ECANCELED;
+			ret = -ECANCELED;
+			goto end;
+		}
+	}
+
+	// Finished extracting the disc image.
+	entry_dest->reader->flush();
+
+end:
+	// NOTE: Deleting the queue stops the worker threads.
+	delete queue;
+	free(buf_tmp);
+	for (auto iter = aesw.begin(); iter != aesw.end(); ++iter) {
+		aesw_free(*iter);
+	}
 	if (err != 0) {
 		errno = err;
 	}
@@ -0,0 +1,252 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * files.cpp: RVT-H file system functions.                                 *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "rvth.hpp"
+#include "FST.hpp"
+#include "ptbl.h"
+#include "rvth_error.h"
+#include "RefFile.hpp"
+#include "wii_crypt.h"
+#include "reader/WiiPartitionReader.hpp"
+
+// C includes.
+#include <stdlib.h>
+
+// C includes. (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+
+// Buffer size for extracting files.
+#define FILE_BUF_SIZE (1024*1024)
+
+/**
+ * Load the file system table of a bank.
+ *
+ * For Wii disc images, the game partition's FST is loaded.
+ * Files can then be read using FST::readFile(), which only
+ * reads and decrypts the groups containing the requested data.
+ *
+ * NOTE: The FST must be deleted before this RvtH object.
+ *
+ * @param bank	[in] Bank number. (0-7)
+ * @param pErr	[out,opt] Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ * @return FST*, or NULL on error.
+ */
+FST *RvtH::openFST(unsigned int bank, int *pErr)
+{
+	RvtH_BankEntry *entry;
+	const pt_entry_t *game_pte = nullptr;
+	int ret;	// errno or RvtH_Errors
+
+	if (bank >= m_bankCount) {
+		// Bank number is out of range.
+		ret = -ERANGE;
+		goto fail;
+	}
+
+	// Make sure the bank entry is fully initialized.
+	loadBankEntry(bank);
+
+	// Check the bank type.
+	entry = &m_entries[bank];
+	switch (entry->type) {
+		case RVTH_BankType_GCN:
+			// GameCube discs don't have partitions.
+			break;
+
+		case RVTH_BankType_Wii_SL:
+		case RVTH_BankType_Wii_DL:
+			// Find the game partition.
+			game_pte = rvth_ptbl_find_game(entry);
+			if (!game_pte) {
+				// No game partition...
+				ret = RVTH_ERROR_NO_GAME_PARTITION;
+				goto fail;
+			}
+			break;
+
+		case RVTH_BankType_Unknown:
+		default:
+			// Unknown bank status...
+			ret = RVTH_ERROR_BANK_UNKNOWN;
+			goto fail;
+
+		case RVTH_BankType_Empty:
+			// Bank is empty.
+			ret = RVTH_ERROR_BANK_EMPTY;
+			goto fail;
+
+		case RVTH_BankType_Wii_DL_Bank2:
+			// Second bank of a dual-layer Wii disc image.
+			// TODO: Automatically select the first bank?
+			ret = RVTH_ERROR_BANK_DL_2;
+			goto fail;
+	}
+
+	return FST::open(entry->reader, game_pte,
+		(entry->crypto_type != RVL_CryptoType_None), pErr);
+
+fail:
+	if (pErr) {
+		*pErr = ret;
+	}
+	errno = (ret < 0 ? -ret : EIO);
+	return nullptr;
+}
+
+/**
+ * Extract a single file from a bank.
+ * @param bank		[in] Bank number. (0-7)
+ * @param path		[in] Path of the file within the bank's file system.
+ * @param filename	[in] Destination filename.
+ * @param callback	[in,opt] Progress callback.
+ * @param userdata	[in,opt] User data for progress callback.
+ * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+int RvtH::extractFile(unsigned int bank, const char *path, const TCHAR *filename,
+	RvtH_Progress_Callback callback, void *userdata)
+{
+	FST *fst;
+	RefFile *f_out = nullptr;
+	uint8_t *buf = nullptr;
+	uint32_t file_size, pos;
+	int idx;
+
+	// Callback state.
+	RvtH_Progress_State state;
+
+	int ret = 0;	// errno or RvtH_Errors
+	int err = 0;	// errno setting
+
+	assert(path != nullptr);
+	assert(filename != nullptr);
+	if (!path || !filename) {
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	fst = openFST(bank, &ret);
+	if (!fst) {
+		// Error loading the FST.
+		return ret;
+	}
+
+	idx = fst->find(path);
+	if (idx < 0) {
+		// File not found.
+		err = -idx;
+		ret = idx;
+		goto end;
+	} else if (fst->isDir(idx)) {
+		// Directories can't be extracted.
+		err = EISDIR;
+		ret = -EISDIR;
+		goto end;
+	}
+
+	// Prefetching only helps if the file spans multiple groups.
+	file_size = fst->fileSize(idx);
+	fst->reader()->setPrefetch(file_size > GROUP_SIZE_DEC);
+
+	buf = static_cast<uint8_t*>(malloc(FILE_BUF_SIZE));
+	if (!buf) {
+		// Error allocating memory.
+		err = ENOMEM;
+		ret = -ENOMEM;
+		goto end;
+	}
+
+	f_out = new RefFile(filename, true);
+	if (!f_out->isOpen()) {
+		// Error creating the file.
+		err = f_out->lastError();
+		if (err == 0) {
+			err = EIO;
+		}
+		ret = -err;
+		f_out->unref();
+		f_out = nullptr;
+		goto end;
+	}
+
+	if (callback) {
+		state.type = RVTH_PROGRESS_EXTRACT;
+		state.rvth = this;
+		state.rvth_gcm = nullptr;
+		state.bank_rvth = bank;
+		state.bank_gcm = UINT_MAX;
+		state.lba_processed = 0;
+		state.lba_total = BYTES_TO_LBA((int64_t)file_size + LBA_SIZE - 1);
+		state.digests = nullptr;
+		if (!callback(&state, userdata)) {
+			// Stop processing.
+			err = ECANCELED;
+			ret = -ECANCELED;
+			goto end;
+		}
+	}
+
+	for (pos = 0; pos < file_size; ) {
+		size_t size = file_size - pos;
+		if (size > FILE_BUF_SIZE) {
+			size = FILE_BUF_SIZE;
+		}
+
+		errno = 0;
+		if (fst->readFile(idx, buf, size, pos) != size) {
+			// Error reading the file.
+			err = errno;
+			if (err == 0) {
+				err = EIO;
+			}
+			ret = -err;
+			goto end;
+		}
+		if (f_out->pwrite(buf, size, pos) != size) {
+			// Error writing the file.
+			err = errno;
+			if (err == 0) {
+				err = EIO;
+			}
+			ret = -err;
+			goto end;
+		}
+		pos += static_cast<uint32_t>(size);
+
+		if (callback) {
+			state.lba_processed = BYTES_TO_LBA((int64_t)pos + LBA_SIZE - 1);
+			if (!callback(&state, userdata)) {
+				// Stop processing.
+				err = ECANCELED;
+				ret = -ECANCELED;
+				goto end;
+			}
+		}
+	}
+
+end:
+	if (f_out) {
+		f_out->unref();
+		if (ret != 0) {
+			// Remove the incomplete file.
+#ifdef _WIN32
+			_tremove(filename);
+#else /* !_WIN32 */
+			remove(filename);
+#endif /* _WIN32 */
+		}
+	}
+	free(buf);
+	delete fst;
+	if (err != 0) {
+		errno = err;
+	}
+	return ret;
+}
@@ -32,15 +32,12 @@
 #include <cerrno>
 #include <cstring>
 
+// C++ includes.
+#include <algorithm>
+
 // CISO magic.
 static const char CISO_MAGIC[4] = {'C','I','S','O'};
 
-typedef struct PACKED _CisoHeader {
-	char magic[4];			// "CISO"
-	uint32_t block_size;		// LE32
-	uint8_t map[CISO_MAP_SIZE];	// 0 == unused; 1 == used; other == invalid
-} CisoHeader;
-
 /**
  * Is a given disc image supported by the CISO reader?
  * @param sbuf	[in] Sector buffer. (first LBA of the disc)
@@ -105,7 +102,6 @@ CisoReader::CisoReader(RefFile *file, uint32_t lba_start, uint32_t lba_len)
 	, m_real_lba_len(0)
 	, m_block_size_lba(0)
 {
-	int ret;
 	int err = 0;
 	size_t size;
 	unsigned int i;
@@ -142,16 +138,7 @@ CisoReader::CisoReader(RefFile *file, uint32_t lba_start, uint32_t lba_len)
 	m_real_lba_len = lba_len;
 
 	// Read the CISO header.
-	ret = m_file->seeko(lba_start * LBA_SIZE, SEEK_SET);
-	if (ret != 0) {
-		// Seek error.
-		err = errno;
-		if (err == 0) {
-			err = EIO;
-		}
-		goto fail;
-	}
-	size = m_file->read(cisoHeader, 1, sizeof(*cisoHeader));
+	size = m_file->pread(cisoHeader, sizeof(*cisoHeader), LBA_TO_BYTES(lba_start));
 	if (size != sizeof(*cisoHeader)) {
 		// Short read.
 		err = errno;
@@ -169,18 +156,27 @@ CisoReader::CisoReader(RefFile *file, uint32_t lba_start, uint32_t lba_len)
 	}
 	m_block_size_lba = BYTES_TO_LBA(le32_to_cpu(cisoHeader->block_size));
 
-	// Clear the CISO block map initially.
-	memset(m_blockMap, 0xFF, sizeof(m_blockMap));
-
-	// Parse the CISO block map.
-	for (i = 0; i < ARRAY_SIZE(m_blockMap); i++) {
+	// Parse the CISO block map into extents.
+	// Used blocks are stored sequentially, so consecutive used
+	// blocks are always physically contiguous.
+	for (i = 0; i < ARRAY_SIZE(cisoHeader->map); i++) {
 		switch (cisoHeader->map[i]) {
 			case 0:
 				// Empty block.
 				continue;
 			case 1:
 				// Used block.
-				m_blockMap[i] = physBlockIdx;
+				if (!m_extents.empty() && maxLogicalBlockUsed == i-1) {
+					// Extend the current extent.
+					m_extents.back().lba_len += m_block_size_lba;
+				} else {
+					// Start a new extent.
+					Extent extent;
+					extent.lba_start = i * m_block_size_lba;
+					extent.phys_lba = physBlockIdx * m_block_size_lba;
+					extent.lba_len = m_block_size_lba;
+					m_extents.push_back(extent);
+				}
 				physBlockIdx++;
 				maxLogicalBlockUsed = i;
 				break;
@@ -230,38 +226,56 @@ uint32_t CisoReader::read(void *ptr, uint32_t lba_start, uint32_t lba_len)
 		return 0;
 	}
 
-	// TODO: Optimize reading multiple LBAs at once.
-	// For now, we're looking up a single LBA at a time.
-	uint8_t *ptr8 = static_cast<uint8_t*>(ptr);
-	uint32_t lba_end = lba_start + lba_len;
-	for (uint32_t lba = lba_start; lba < lba_end; lba++, ptr8 += LBA_SIZE) {
-		unsigned int physBlockIdx = m_blockMap[lba / m_block_size_lba];
-		if (physBlockIdx == 0xFFFF) {
-			// Empty block.
-			memset(ptr8, 0, LBA_SIZE);
-		} else {
-			// Determine the offset.
-			const unsigned int blockStart = physBlockIdx * m_block_size_lba;
-			const unsigned int offset = lba % m_block_size_lba;
+	// Find the first extent that ends after lba_start.
+	auto iter = std::upper_bound(m_extents.cbegin(), m_extents.cend(), lba_start,
+		[](uint32_t lba, const Extent &extent) {
+			return lba < extent.lba_start + extent.lba_len;
+		});
 
-			int ret = m_file->seeko(LBA_TO_BYTES(blockStart + offset + m_lba_start), SEEK_SET);
-			if (ret != 0) {
-				// Seek error.
-				if (errno == 0) {
-					errno = EIO;
-				}
-				return 0;
+	// Read each extent using a single read, and zero out the holes.
+	uint8_t *ptr8 = static_cast<uint8_t*>(ptr);
+	const uint32_t lba_end = lba_start + lba_len;
+	uint32_t lba = lba_start;
+	while (lba < lba_end) {
+		if (iter == m_extents.cend() || lba < iter->lba_start) {
+			// Empty blocks until the next extent.
+			uint32_t hole_end = lba_end;
+			if (iter != m_extents.cend() && iter->lba_start < hole_end) {
+				hole_end = iter->lba_start;
 			}
-			size_t size = m_file->read(ptr8, LBA_SIZE, 1);
-			if (size != 1) {
+			memset(ptr8, 0, LBA_TO_BYTES(hole_end - lba));
+			ptr8 += LBA_TO_BYTES(hole_end - lba);
+			lbas_read += hole_end - lba;
+			lba = hole_end;
+			continue;
+		}
+
+		// Read from the current extent.
+		uint32_t ext_end = iter->lba_start + iter->lba_len;
+		if (ext_end > lba_end) {
+			ext_end = lba_end;
+		}
+		const size_t size = (size_t)LBA_TO_BYTES(ext_end - lba);
+		const int64_t offset = LBA_TO_BYTES(m_lba_start + iter->phys_lba + (lba - iter->lba_start));
+		errno = 0;
+		const size_t got = m_file->pread(ptr8, size, offset);
+		if (got != size) {
+			if (errno != 0 || iter + 1 != m_extents.cend()) {
 				// Read error.
 				if (errno == 0) {
 					errno = EIO;
 				}
 				return 0;
 			}
-			lbas_read++;
+			// Some CISO writers truncate the last block
+			// at the end of the disc image. The rest of
+			// the block is zero.
+			memset(ptr8 + got, 0, size - got);
 		}
+		lbas_read += ext_end - lba;
+		ptr8 += size;
+		lba = ext_end;
+		++iter;
 	}
 
 	return lbas_read;
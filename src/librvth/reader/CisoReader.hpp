@@ -23,6 +23,24 @@
 
 #include "Reader.hpp"
 
+// C++ includes.
+#include <vector>
+
+#define CISO_HEADER_SIZE 0x8000
+#define CISO_MAP_SIZE (CISO_HEADER_SIZE - sizeof(uint32_t) - (sizeof(char) * 4))
+
+// 32 KB minimum block size (GCN/Wii sector)
+// 16 MB maximum block size
+#define CISO_BLOCK_SIZE_MIN (32768)
+#define CISO_BLOCK_SIZE_MAX (16*1024*1024)
+
+// CISO header. (Also used by CisoWriter.)
+typedef struct PACKED _CisoHeader {
+	char magic[4];			// "CISO"
+	uint32_t block_size;		// LE32
+	uint8_t map[CISO_MAP_SIZE];	// 0 == unused; 1 == used; other == invalid
+} CisoHeader;
+
 class CisoReader : public Reader
 {
 	public:
@@ -64,14 +82,6 @@ class CisoReader : public Reader
 		uint32_t read(void *ptr, uint32_t lba_start, uint32_t lba_len) final;
 
 	private:
-		#define CISO_HEADER_SIZE 0x8000
-		#define CISO_MAP_SIZE (CISO_HEADER_SIZE - sizeof(uint32_t) - (sizeof(char) * 4))
-
-		// 32 KB minimum block size (GCN/Wii sector)
-		// 16 MB maximum block size
-		#define CISO_BLOCK_SIZE_MIN (32768)
-		#define CISO_BLOCK_SIZE_MAX (16*1024*1024)
-
 		// NOTE: reader.lba_len is the virtual image size.
 		// real_lba_len is the actual image size.
 		uint32_t m_real_lba_len;
@@ -79,10 +89,16 @@ class CisoReader : public Reader
 		// CISO block size, in LBAs.
 		uint32_t m_block_size_lba;
 
-		// Block map.
-		// 0x0000 == first block after CISO header.
-		// 0xFFFF == empty block.
-		uint16_t m_blockMap[CISO_MAP_SIZE];
+		// Extent list, built from the CISO block map.
+		// Each extent is a run of used blocks that are contiguous
+		// both logically and physically. Gaps between extents are
+		// empty blocks. Sorted by logical LBA.
+		struct Extent {
+			uint32_t lba_start;	// Logical starting LBA.
+			uint32_t phys_lba;	// Physical starting LBA, relative to the first block after the CISO header.
+			uint32_t lba_len;	// Length, in LBAs.
+		};
+		std::vector<Extent> m_extents;
 };
 
 #endif /* __RVTHTOOL_LIBRVTH_READER_CISOREADER_HPP__ */
@@ -0,0 +1,348 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * CisoWriter.cpp: CISO disc image writer class.                           *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "CisoWriter.hpp"
+#include "CisoReader.hpp"	// for CisoHeader
+#include "byteswap.h"
+
+#include "aligned_malloc.h"
+#include "rvth.hpp"	// for RvtH::isBlockEmpty()
+
+// For LBA_TO_BYTES()
+#include "nhcd_structs.h"
+
+// C includes.
+#include <stdlib.h>
+
+// C includes. (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+/**
+ * Create a CISO writer for a new disc image.
+ *
+ * The block size is the smallest power of two (32 KB or larger)
+ * that allows the entire image to fit in the CISO block map.
+ *
+ * @param file		RefFile*. (must be writable)
+ * @param lba_len	[in] Length of the disc image, in LBAs.
+ */
+CisoWriter::CisoWriter(RefFile *file, uint32_t lba_len)
+	: super(file, 0, lba_len)
+	, m_block_size_lba(0)
+	, m_physBlockCount(0)
+	, m_blockBuf(nullptr)
+	, m_curBlock(UINT32_MAX)
+	, m_maxBlock(0)
+	, m_blockDirty(false)
+	, m_hdrDirty(true)
+{
+	int err = 0;
+	uint32_t block_size;
+	uint32_t block_count = 0;
+
+	if (!isOpen()) {
+		// File wasn't opened.
+		return;
+	} else if (lba_len == 0) {
+		// Image size must be specified.
+		err = EINVAL;
+		goto fail;
+	}
+
+	// Find the smallest block size that fits in the block map.
+	for (block_size = CISO_BLOCK_SIZE_MIN; block_size <= CISO_BLOCK_SIZE_MAX; block_size <<= 1) {
+		const uint32_t block_size_lba = BYTES_TO_LBA(block_size);
+		block_count = (lba_len + block_size_lba - 1) / block_size_lba;
+		if (block_count <= CISO_MAP_SIZE)
+			break;
+	}
+	if (block_size > CISO_BLOCK_SIZE_MAX) {
+		// Image is too big for CISO.
+		err = EFBIG;
+		goto fail;
+	}
+	m_block_size_lba = BYTES_TO_LBA(block_size);
+	m_blockMap.assign(block_count, CISO_BLOCK_NONE);
+
+	// Allocate the block buffer.
+	m_blockBuf = static_cast<uint8_t*>(aligned_malloc(RVTH_PAGE_SIZE, block_size));
+	if (!m_blockBuf) {
+		err = ENOMEM;
+		goto fail;
+	}
+
+	// Writer initialized.
+	m_type = RVTH_ImageType_GCM;
+	return;
+
+fail:
+	// Failed to initialize the writer.
+	m_file->unref();
+	m_file = nullptr;
+	errno = err;
+}
+
+CisoWriter::~CisoWriter()
+{
+	if (m_file && (m_blockDirty || m_hdrDirty)) {
+		// Make sure the CISO header is written.
+		flush();
+	}
+	aligned_free(m_blockBuf);
+}
+
+/**
+ * Store the current block in the CISO image.
+ * Empty blocks are skipped, except for the last block,
+ * which determines the image size.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int CisoWriter::storeBlock(void)
+{
+	if (m_curBlock == UINT32_MAX || !m_blockDirty) {
+		// Nothing to store.
+		return 0;
+	}
+
+	const uint32_t block_size = static_cast<uint32_t>(LBA_TO_BYTES(m_block_size_lba));
+	uint16_t phys = m_blockMap[m_curBlock];
+	if (phys == CISO_BLOCK_NONE) {
+		if (m_curBlock != m_blockMap.size() - 1 &&
+		    RvtH::isBlockEmpty(m_blockBuf, block_size))
+		{
+			// Empty block. Don't store it.
+			m_blockDirty = false;
+			return 0;
+		}
+
+		// Allocate the next physical block.
+		// NOTE: Blocks are allocated in logical order,
+		// since CISO readers expect the used blocks to be
+		// stored sequentially.
+		phys = m_physBlockCount++;
+		m_blockMap[m_curBlock] = phys;
+		m_hdrDirty = true;
+	}
+
+	const int64_t offset = CISO_HEADER_SIZE + (static_cast<int64_t>(phys) * block_size);
+	errno = 0;
+	if (m_file->pwrite(m_blockBuf, block_size, offset) != block_size) {
+		// Write error.
+		const int err = (errno != 0 ? errno : EIO);
+		errno = err;
+		return -err;
+	}
+
+	m_blockDirty = false;
+	return 0;
+}
+
+/**
+ * Load a block into the block buffer.
+ * The current block must be stored first.
+ * @param block	[in] Logical block index.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int CisoWriter::loadBlock(uint32_t block)
+{
+	assert(!m_blockDirty);
+	assert(block < m_blockMap.size());
+
+	const uint32_t block_size = static_cast<uint32_t>(LBA_TO_BYTES(m_block_size_lba));
+	const uint16_t phys = m_blockMap[block];
+	if (phys == CISO_BLOCK_NONE) {
+		// Block isn't stored yet.
+		memset(m_blockBuf, 0, block_size);
+	} else {
+		// Block was stored previously.
+		const int64_t offset = CISO_HEADER_SIZE + (static_cast<int64_t>(phys) * block_size);
+		errno = 0;
+		if (m_file->pread(m_blockBuf, block_size, offset) != block_size) {
+			// Read error.
+			const int err = (errno != 0 ? errno : EIO);
+			m_curBlock = UINT32_MAX;
+			errno = err;
+			return -err;
+		}
+	}
+
+	m_curBlock = block;
+	if (block > m_maxBlock) {
+		m_maxBlock = block;
+	}
+	return 0;
+}
+
+/**
+ * Read data from the disc image.
+ * @param ptr		[out] Read buffer.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return Number of LBAs read, or 0 on error.
+ */
+uint32_t CisoWriter::read(void *ptr, uint32_t lba_start, uint32_t lba_len)
+{
+	// LBA bounds checking.
+	// TODO: Check for overflow?
+	lba_start += m_lba_start;
+	assert(lba_start + lba_len <= m_lba_start + m_lba_len);
+	if (lba_start + lba_len > m_lba_start + m_lba_len) {
+		// Out of range.
+		errno = EIO;
+		return 0;
+	}
+
+	uint8_t *ptr8 = static_cast<uint8_t*>(ptr);
+	const uint32_t lba_end = lba_start + lba_len;
+	for (uint32_t lba = lba_start; lba < lba_end; ) {
+		const uint32_t block = lba / m_block_size_lba;
+		const uint32_t lba_offset = lba % m_block_size_lba;
+		uint32_t lba_count = m_block_size_lba - lba_offset;
+		if (lba_count > lba_end - lba) {
+			lba_count = lba_end - lba;
+		}
+		const size_t size = static_cast<size_t>(LBA_TO_BYTES(lba_count));
+
+		const uint16_t phys = m_blockMap[block];
+		if (block == m_curBlock) {
+			// Current block.
+			memcpy(ptr8, &m_blockBuf[LBA_TO_BYTES(lba_offset)], size);
+		} else if (phys == CISO_BLOCK_NONE) {
+			// Block isn't stored.
+			memset(ptr8, 0, size);
+		} else {
+			// Read the block from the file.
+			const int64_t offset = CISO_HEADER_SIZE +
+				LBA_TO_BYTES((static_cast<uint32_t>(phys) * m_block_size_lba) + lba_offset);
+			if (m_file->pread(ptr8, size, offset) != size) {
+				// Read error.
+				if (errno == 0) {
+					errno = EIO;
+				}
+				return 0;
+			}
+		}
+
+		ptr8 += size;
+		lba += lba_count;
+	}
+
+	return lba_len;
+}
+
+/**
+ * Write data to the disc image.
+ * Writes must not go back to a block before the current block.
+ * @param ptr		[in] Write buffer.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return Number of LBAs written, or 0 on error.
+ */
+uint32_t CisoWriter::write(const void *ptr, uint32_t lba_start, uint32_t lba_len)
+{
+	// LBA bounds checking.
+	// TODO: Check for overflow?
+	lba_start += m_lba_start;
+	assert(lba_start + lba_len <= m_lba_start + m_lba_len);
+	if (lba_start + lba_len > m_lba_start + m_lba_len) {
+		// Out of range.
+		errno = EIO;
+		return 0;
+	}
+
+	const uint8_t *ptr8 = static_cast<const uint8_t*>(ptr);
+	const uint32_t lba_end = lba_start + lba_len;
+	for (uint32_t lba = lba_start; lba < lba_end; ) {
+		const uint32_t block = lba / m_block_size_lba;
+		if (block != m_curBlock) {
+			if (block < m_maxBlock && m_blockMap[block] == CISO_BLOCK_NONE) {
+				// Can't allocate a block before a block
+				// that has already been written.
+				errno = ESPIPE;
+				return 0;
+			}
+
+			// Switch to the new block.
+			if (storeBlock() != 0 || loadBlock(block) != 0) {
+				// I/O error.
+				return 0;
+			}
+		}
+
+		const uint32_t lba_offset = lba % m_block_size_lba;
+		uint32_t lba_count = m_block_size_lba - lba_offset;
+		if (lba_count > lba_end - lba) {
+			lba_count = lba_end - lba;
+		}
+		const size_t size = static_cast<size_t>(LBA_TO_BYTES(lba_count));
+		memcpy(&m_blockBuf[LBA_TO_BYTES(lba_offset)], ptr8, size);
+		m_blockDirty = true;
+
+		ptr8 += size;
+		lba += lba_count;
+	}
+
+	return lba_len;
+}
+
+/**
+ * Store the current block, write the CISO header,
+ * and flush the file buffers.
+ */
+void CisoWriter::flush(void)
+{
+	if (storeBlock() != 0) {
+		// I/O error.
+		return;
+	}
+
+	// The image size is determined by the last used block,
+	// so the last block must always be stored.
+	const uint32_t last_block = static_cast<uint32_t>(m_blockMap.size() - 1);
+	if (m_blockMap[last_block] == CISO_BLOCK_NONE) {
+		if (loadBlock(last_block) != 0) {
+			// I/O error.
+			return;
+		}
+		m_blockDirty = true;
+		if (storeBlock() != 0) {
+			// I/O error.
+			return;
+		}
+	}
+
+	if (m_hdrDirty) {
+		// Write the CISO header.
+		CisoHeader *const cisoHeader = static_cast<CisoHeader*>(calloc(1, sizeof(CisoHeader)));
+		if (!cisoHeader) {
+			errno = ENOMEM;
+			return;
+		}
+		memcpy(cisoHeader->magic, "CISO", sizeof(cisoHeader->magic));
+		cisoHeader->block_size = cpu_to_le32(static_cast<uint32_t>(LBA_TO_BYTES(m_block_size_lba)));
+		for (size_t i = 0; i < m_blockMap.size(); i++) {
+			cisoHeader->map[i] = (m_blockMap[i] != CISO_BLOCK_NONE);
+		}
+
+		errno = 0;
+		const size_t size = m_file->pwrite(cisoHeader, sizeof(*cisoHeader), 0);
+		free(cisoHeader);
+		if (size != sizeof(*cisoHeader)) {
+			// Write error.
+			if (errno == 0) {
+				errno = EIO;
+			}
+			return;
+		}
+		m_hdrDirty = false;
+	}
+
+	super::flush();
+}
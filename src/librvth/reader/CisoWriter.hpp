@@ -0,0 +1,110 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * CisoWriter.hpp: CISO disc image writer class.                           *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_READER_CISOWRITER_HPP__
+#define __RVTHTOOL_LIBRVTH_READER_CISOWRITER_HPP__
+
+#include "Reader.hpp"
+
+// C++ includes.
+#include <vector>
+
+/**
+ * Writes a new CISO disc image.
+ *
+ * Blocks are stored in the order they're written, and blocks that
+ * are entirely zero are not stored at all. The block map is kept
+ * in memory and written to the CISO header by flush().
+ *
+ * Writes must be sequential: once a write starts in a new block,
+ * earlier blocks can no longer be modified.
+ */
+class CisoWriter : public Reader
+{
+	public:
+		/**
+		 * Create a CISO writer for a new disc image.
+		 *
+		 * The block size is the smallest power of two (32 KB or larger)
+		 * that allows the entire image to fit in the CISO block map.
+		 *
+		 * @param file		RefFile*. (must be writable)
+		 * @param lba_len	[in] Length of the disc image, in LBAs.
+		 */
+		CisoWriter(RefFile *file, uint32_t lba_len);
+		~CisoWriter() final;
+
+	private:
+		typedef Reader super;
+		DISABLE_COPY(CisoWriter)
+
+	public:
+		/** I/O functions **/
+
+		/**
+		 * Read data from the disc image.
+		 * @param ptr		[out] Read buffer.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return Number of LBAs read, or 0 on error.
+		 */
+		uint32_t read(void *ptr, uint32_t lba_start, uint32_t lba_len) final;
+
+		/**
+		 * Write data to the disc image.
+		 * Writes must not go back to a block before the current block.
+		 * @param ptr		[in] Write buffer.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return Number of LBAs written, or 0 on error.
+		 */
+		uint32_t write(const void *ptr, uint32_t lba_start, uint32_t lba_len) final;
+
+		/**
+		 * Store the current block, write the CISO header,
+		 * and flush the file buffers.
+		 */
+		void flush(void) final;
+
+	private:
+		/**
+		 * Store the current block in the CISO image.
+		 * Empty blocks are skipped, except for the last block,
+		 * which determines the image size.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int storeBlock(void);
+
+		/**
+		 * Load a block into the block buffer.
+		 * The current block must be stored first.
+		 * @param block	[in] Logical block index.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int loadBlock(uint32_t block);
+
+	private:
+		#define CISO_BLOCK_NONE 0xFFFFU
+
+		// CISO block size, in LBAs.
+		uint32_t m_block_size_lba;
+
+		// Physical block index for each logical block,
+		// or CISO_BLOCK_NONE if the block isn't stored.
+		std::vector<uint16_t> m_blockMap;
+		uint16_t m_physBlockCount;
+
+		// Current block.
+		uint8_t *m_blockBuf;	// Block buffer
+		uint32_t m_curBlock;	// Logical block index, or UINT32_MAX if none
+		uint32_t m_maxBlock;	// Highest logical block index loaded so far
+		bool m_blockDirty;	// Has the block buffer been modified?
+		bool m_hdrDirty;	// Has the block map changed since the last flush()?
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_READER_CISOWRITER_HPP__ */
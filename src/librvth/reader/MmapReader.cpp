@@ -0,0 +1,105 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * MmapReader.cpp: Memory-mapped disc image reader class.                  *
+ * Used for plain binary disc images stored in regular files.              *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "MmapReader.hpp"
+
+// For LBA_TO_BYTES()
+#include "nhcd_structs.h"
+
+// C includes. (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+/**
+ * Create a memory-mapped reader for a disc image.
+ *
+ * If the file can't be mapped, e.g. if it's empty,
+ * this reader will fall back to PlainReader's
+ * positional I/O functions.
+ *
+ * NOTE: If lba_start == 0 and lba_len == 0, the entire file
+ * will be used.
+ *
+ * @param file		RefFile*.
+ * @param lba_start	[in] Starting LBA,
+ * @param lba_len	[in] Length, in LBAs.
+ */
+MmapReader::MmapReader(RefFile *file, uint32_t lba_start, uint32_t lba_len)
+	: super(file, lba_start, lba_len)
+	, m_map(nullptr)
+	, m_mapSize(0)
+{
+	if (!isOpen()) {
+		// File wasn't opened.
+		return;
+	}
+
+	// Map the file.
+	// NOTE: Errors are ignored here; read() will use
+	// PlainReader's implementation if the file isn't mapped.
+	const int errno_save = errno;
+	m_map = m_file->map(&m_mapSize);
+	if (!m_map) {
+		m_mapSize = 0;
+		errno = errno_save;
+	}
+}
+
+/**
+ * Read data from the disc image.
+ * @param ptr		[out] Read buffer.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return Number of LBAs read, or 0 on error.
+ */
+uint32_t MmapReader::read(void *ptr, uint32_t lba_start, uint32_t lba_len)
+{
+	const uint8_t *const src = map(lba_start, lba_len);
+	if (!src) {
+		// Not mapped, or the range extends past the mapping.
+		return super::read(ptr, lba_start, lba_len);
+	}
+
+	memcpy(ptr, src, static_cast<size_t>(LBA_TO_BYTES(lba_len)));
+	return lba_len;
+}
+
+/**
+ * Get a read-only pointer to an LBA range without copying.
+ * The pointer remains valid as long as the Reader is open.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return Pointer to the data, or nullptr if not available.
+ */
+const uint8_t *MmapReader::map(uint32_t lba_start, uint32_t lba_len)
+{
+	if (!m_map) {
+		// File isn't mapped.
+		return nullptr;
+	}
+
+	// LBA bounds checking.
+	// TODO: Check for overflow?
+	lba_start += m_lba_start;
+	assert(lba_start + lba_len <= m_lba_start + m_lba_len);
+	if (lba_start + lba_len > m_lba_start + m_lba_len) {
+		// Out of range.
+		errno = EIO;
+		return nullptr;
+	}
+
+	// Make sure the requested range is within the mapping.
+	// The file may have been extended since it was mapped.
+	if (LBA_TO_BYTES(lba_start) + LBA_TO_BYTES(lba_len) > m_mapSize) {
+		return nullptr;
+	}
+
+	return m_map + LBA_TO_BYTES(lba_start);
+}
@@ -0,0 +1,65 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * MmapReader.hpp: Memory-mapped disc image reader class.                  *
+ * Used for plain binary disc images stored in regular files.              *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_READER_MMAPREADER_HPP__
+#define __RVTHTOOL_LIBRVTH_READER_MMAPREADER_HPP__
+
+#include "PlainReader.hpp"
+
+class MmapReader : public PlainReader
+{
+	public:
+		/**
+		 * Create a memory-mapped reader for a disc image.
+		 *
+		 * If the file can't be mapped, e.g. if it's empty,
+		 * this reader will fall back to PlainReader's
+		 * positional I/O functions.
+		 *
+		 * NOTE: If lba_start == 0 and lba_len == 0, the entire file
+		 * will be used.
+		 *
+		 * @param file		RefFile*.
+		 * @param lba_start	[in] Starting LBA,
+		 * @param lba_len	[in] Length, in LBAs.
+		 */
+		MmapReader(RefFile *file, uint32_t lba_start, uint32_t lba_len);
+
+	private:
+		typedef PlainReader super;
+		DISABLE_COPY(MmapReader)
+
+	public:
+		/** I/O functions **/
+
+		/**
+		 * Read data from the disc image.
+		 * @param ptr		[out] Read buffer.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return Number of LBAs read, or 0 on error.
+		 */
+		uint32_t read(void *ptr, uint32_t lba_start, uint32_t lba_len) final;
+
+		/**
+		 * Get a read-only pointer to an LBA range without copying.
+		 * The pointer remains valid as long as the Reader is open.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return Pointer to the data, or nullptr if not available.
+		 */
+		const uint8_t *map(uint32_t lba_start, uint32_t lba_len) final;
+
+	private:
+		// Memory-mapped file. (owned by RefFile)
+		const uint8_t *m_map;
+		int64_t m_mapSize;
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_READER_MMAPREADER_HPP__ */
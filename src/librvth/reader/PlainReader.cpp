@@ -116,18 +116,9 @@ uint32_t PlainReader::read(void *ptr, uint32_t lba_start, uint32_t lba_len)
 		return 0;
 	}
 
-	// Seek to lba_start.
-	int ret = m_file->seeko(LBA_TO_BYTES(lba_start), SEEK_SET);
-	if (ret != 0) {
-		// Seek error.
-		if (errno == 0) {
-			errno = EIO;
-		}
-		return 0;
-	}
-
 	// Read the data.
-	return (uint32_t)m_file->read(ptr, LBA_SIZE, lba_len);
+	size_t size = m_file->pread(ptr, LBA_TO_BYTES(lba_len), LBA_TO_BYTES(lba_start));
+	return BYTES_TO_LBA(size);
 }
 
 /**
@@ -150,16 +141,21 @@ uint32_t PlainReader::write(const void *ptr, uint32_t lba_start, uint32_t lba_le
 		return 0;
 	}
 
-	// Seek to lba_start.
-	int ret = m_file->seeko(LBA_TO_BYTES(lba_start), SEEK_SET);
-	if (ret != 0) {
-		// Seek error.
-		if (errno == 0) {
-			errno = EIO;
-		}
-		return 0;
-	}
-
 	// Write the data.
-	return (uint32_t)m_file->write(ptr, LBA_SIZE, lba_len);
+	size_t size = m_file->pwrite(ptr, LBA_TO_BYTES(lba_len), LBA_TO_BYTES(lba_start));
+	return BYTES_TO_LBA(size);
+}
+
+/**
+ * Get the file offset of an LBA for linear disc images.
+ * @param lba	[in] LBA, relative to the start of the image.
+ * @return File offset, in bytes, or -1 if not available.
+ */
+int64_t PlainReader::lbaToOffset(uint32_t lba) const
+{
+	if (lba > m_lba_len) {
+		// Out of range.
+		return -1;
+	}
+	return LBA_TO_BYTES(m_lba_start + lba);
 }
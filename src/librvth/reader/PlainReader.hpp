@@ -53,7 +53,7 @@ class PlainReader : public Reader
 		 * @param lba_len	[in] Length, in LBAs.
 		 * @return Number of LBAs read, or 0 on error.
 		 */
-		uint32_t read(void *ptr, uint32_t lba_start, uint32_t lba_len) final;
+		uint32_t read(void *ptr, uint32_t lba_start, uint32_t lba_len) override;
 
 		/**
 		 * Write data to the disc image.
@@ -63,6 +63,13 @@ class PlainReader : public Reader
 		 * @return Number of LBAs read, or 0 on error.
 		 */
 		uint32_t write(const void *ptr, uint32_t lba_start, uint32_t lba_len) final;
+
+		/**
+		 * Get the file offset of an LBA for linear disc images.
+		 * @param lba	[in] LBA, relative to the start of the image.
+		 * @return File offset, in bytes, or -1 if not available.
+		 */
+		int64_t lbaToOffset(uint32_t lba) const final;
 };
 
 #ifdef __cplusplus
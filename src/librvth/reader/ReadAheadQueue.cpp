@@ -0,0 +1,636 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * ReadAheadQueue.cpp: Background read-ahead queue for sequential copies.  *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "ReadAheadQueue.hpp"
+#include "Reader.hpp"
+
+#include "IoUring.hpp"
+#include "RefFile.hpp"
+#include "ScrubMap.hpp"
+#include "aligned_malloc.h"
+#include "nhcd_structs.h"
+
+// C includes. (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+// C++ includes.
+#include <system_error>
+using std::lock_guard;
+using std::mutex;
+using std::unique_lock;
+
+// Number of io_uring submission queue entries.
+// Sparse extraction can queue many small writes per chunk,
+// so this is larger than the number of chunks.
+#define URING_ENTRIES 64
+
+/**
+ * Create a read-ahead queue.
+ * Call start() to start reading.
+ * @param reader	[in] Source reader.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Number of LBAs to read.
+ * @param chunk_lba	[in] Chunk size, in LBAs.
+ * @param depth		[in] Number of chunk buffers. (2 == double-buffered)
+ */
+ReadAheadQueue::ReadAheadQueue(Reader *reader, uint32_t lba_start, uint32_t lba_len,
+	uint32_t chunk_lba, unsigned int depth)
+	: m_reader(reader)
+	, m_lba_start(lba_start)
+	, m_lba_len(lba_len)
+	, m_chunk_lba(chunk_lba)
+	, m_depth(depth >= 2 ? depth : 2)
+	, m_dataStart(0)
+	, m_dataEnd(0)
+	, m_scrub(nullptr)
+	, m_done(false)
+	, m_ring(nullptr)
+	, m_lba_next(lba_start)
+	, m_cancel(false)
+	, m_stop(false)
+	, m_err(0)
+{
+	assert(reader != nullptr);
+	assert(chunk_lba > 0);
+}
+
+ReadAheadQueue::~ReadAheadQueue()
+{
+	cancel();
+	delete m_ring;
+	for (auto iter = m_chunks.begin(); iter != m_chunks.end(); ++iter) {
+		aligned_free(iter->buf);
+	}
+}
+
+/**
+ * Allocate the buffers and start reading.
+ * @param async	[in] If true, use io_uring if it's available.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int ReadAheadQueue::start(bool async)
+{
+	assert(m_chunks.empty());
+	if (!m_chunks.empty()) {
+		// Already started.
+		return -EBUSY;
+	}
+
+	// Allocate the chunk buffers.
+	// NOTE: Page-aligned for direct I/O.
+	const size_t buf_size = static_cast<size_t>(LBA_TO_BYTES(m_chunk_lba));
+	m_chunks.resize(m_depth);
+	for (unsigned int i = 0; i < m_depth; i++) {
+		Chunk *const chunk = &m_chunks[i];
+		memset(chunk, 0, sizeof(*chunk));
+		chunk->buf = static_cast<uint8_t*>(aligned_malloc(RVTH_PAGE_SIZE, buf_size));
+		chunk->index = i;
+		if (!chunk->buf) {
+			// Error allocating memory.
+			return -ENOMEM;
+		}
+		m_free.push_back(chunk);
+	}
+
+	// Use io_uring if the source image is linear.
+	if (async && m_reader->lbaToOffset(m_lba_start) >= 0) {
+		if (initRing() == 0) {
+			// io_uring is available.
+			fillReads();
+			return 0;
+		}
+		// io_uring isn't available. Use the thread engine.
+	}
+
+	// Start the read-ahead thread.
+	try {
+		m_thread = std::thread(&ReadAheadQueue::run, this);
+	} catch (const std::system_error &e) {
+		// Unable to create the thread.
+		int err = e.code().value();
+		return (err > 0 ? -err : -EAGAIN);
+	}
+	return 0;
+}
+
+/**
+ * Read-ahead thread function. (thread engine)
+ */
+void ReadAheadQueue::run(void)
+{
+	const uint32_t lba_end = m_lba_start + m_lba_len;
+	for (uint32_t lba = m_lba_start; lba < lba_end; lba += m_chunk_lba) {
+		// Wait for a free buffer.
+		Chunk *chunk;
+		{
+			unique_lock<mutex> lock(m_mutex);
+			m_cond.wait(lock, [this] { return m_cancel || !m_free.empty(); });
+			if (m_cancel) {
+				break;
+			}
+			chunk = m_free.front();
+			m_free.pop_front();
+		}
+
+		chunk->lba_start = lba;
+		chunk->lba_len = (lba_end - lba < m_chunk_lba ? lba_end - lba : m_chunk_lba);
+
+		// If the chunk is a hole in a sparse source image, don't read it.
+		// If the reader supports zero-copy access, use the data
+		// directly. Otherwise, read it into the chunk buffer.
+		chunk->hole = isHole(chunk->lba_start, chunk->lba_len);
+		chunk->data = (chunk->hole ? nullptr : m_reader->map(chunk->lba_start, chunk->lba_len));
+		if (chunk->hole) {
+			memset(chunk->buf, 0, static_cast<size_t>(LBA_TO_BYTES(chunk->lba_len)));
+			chunk->data = chunk->buf;
+		} else if (chunk->data) {
+			// Touch each page so the page faults are handled
+			// by this thread instead of the consumer.
+			const volatile uint8_t *const p = chunk->data;
+			const size_t sz = static_cast<size_t>(LBA_TO_BYTES(chunk->lba_len));
+			for (size_t i = 0; i < sz; i += RVTH_PAGE_SIZE) {
+				(void)p[i];
+			}
+		} else {
+			errno = 0;
+			const uint32_t lbas = m_reader->read(chunk->buf, chunk->lba_start, chunk->lba_len);
+			if (lbas != chunk->lba_len) {
+				// Read error. Stop reading; the consumer gets
+				// the chunks that were already read, and then
+				// the error from finish().
+				const int err = (errno != 0 ? errno : EIO);
+				lock_guard<mutex> lock(m_mutex);
+				setError(err);
+				m_free.push_back(chunk);
+				break;
+			}
+			chunk->data = chunk->buf;
+		}
+
+		// Chunk is ready.
+		{
+			lock_guard<mutex> lock(m_mutex);
+			m_filled.push_back(chunk);
+		}
+		m_cond.notify_all();
+	}
+
+	// Finished reading.
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_done = true;
+	}
+	m_cond.notify_all();
+}
+
+/**
+ * Initialize the io_uring engine.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int ReadAheadQueue::initRing(void)
+{
+	unsigned int entries = URING_ENTRIES;
+	if (entries < m_depth * 2) {
+		entries = m_depth * 2;
+	}
+
+	IoUring *const ring = new IoUring(entries);
+	if (!ring->isOpen()) {
+		int err = ring->lastError();
+		delete ring;
+		return -err;
+	}
+
+	// Register the chunk buffers.
+	std::vector<uint8_t*> bufs(m_depth);
+	for (unsigned int i = 0; i < m_depth; i++) {
+		bufs[i] = m_chunks[i].buf;
+	}
+	int ret = ring->registerBuffers(bufs.data(), m_depth,
+		static_cast<size_t>(LBA_TO_BYTES(m_chunk_lba)));
+	if (ret != 0) {
+		// Unable to register the buffers.
+		// This usually means RLIMIT_MEMLOCK is too low.
+		delete ring;
+		return ret;
+	}
+
+	// Request slots.
+	// The number of requests in flight is limited to the number
+	// of SQ entries, so the CQ ring (2x SQ) can't overflow.
+	m_ops.resize(ring->entries());
+	m_freeOps.resize(ring->entries());
+	for (unsigned int i = 0; i < ring->entries(); i++) {
+		m_freeOps[i] = ring->entries() - 1 - i;
+	}
+
+	m_ring = ring;
+	return 0;
+}
+
+/**
+ * Queue an I/O request. (io_uring engine)
+ * If too many requests are in flight, this will wait for
+ * a completion first.
+ * @param op I/O request.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int ReadAheadQueue::queueOp(const Op &op)
+{
+	while (m_freeOps.empty()) {
+		int ret = reapOne();
+		if (ret != 0) {
+			return ret;
+		}
+	}
+
+	const int fd = op.file->ioFd(op.buf, op.len, op.offset);
+	if (fd < 0) {
+		return (errno != 0 ? -errno : -EBADF);
+	}
+
+	const unsigned int idx = m_freeOps.back();
+	m_freeOps.pop_back();
+	m_ops[idx] = op;
+
+	int ret;
+	if (op.write) {
+		ret = m_ring->writeFixed(fd, op.buf, op.len, op.offset, op.chunk->index, idx);
+	} else {
+		ret = m_ring->readFixed(fd, op.buf, op.len, op.offset, op.chunk->index, idx);
+	}
+	if (ret == -EBUSY) {
+		// Submission queue is full. Submit the queued requests and retry.
+		// NOTE: This can't fail repeatedly, since the number
+		// of requests in flight is limited to the SQ size.
+		m_ring->submit();
+		if (op.write) {
+			ret = m_ring->writeFixed(fd, op.buf, op.len, op.offset, op.chunk->index, idx);
+		} else {
+			ret = m_ring->readFixed(fd, op.buf, op.len, op.offset, op.chunk->index, idx);
+		}
+	}
+	if (ret != 0) {
+		m_freeOps.push_back(idx);
+	}
+	return ret;
+}
+
+/**
+ * Process one completion. (io_uring engine)
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int ReadAheadQueue::reapOne(void)
+{
+	uint64_t user_data;
+	int res;
+	int ret = m_ring->getCompletion(&user_data, &res);
+	if (ret != 0) {
+		return ret;
+	}
+
+	assert(user_data < m_ops.size());
+	const unsigned int idx = static_cast<unsigned int>(user_data);
+	Op *const op = &m_ops[idx];
+	Chunk *const chunk = op->chunk;
+
+	// Short transfers and errors are retried synchronously,
+	// which also handles EINTR and EAGAIN.
+	const uint32_t done = (res > 0 ? static_cast<uint32_t>(res) : 0);
+	if (op->write) {
+		if (done < op->len) {
+			const size_t size = op->file->pwrite(op->buf + done, op->len - done, op->offset + done);
+			if (size != op->len - done) {
+				setError(errno);
+				m_stop = true;
+			}
+		}
+
+		assert(chunk->pending > 0);
+		chunk->pending--;
+		if (chunk->released && chunk->pending == 0) {
+			// Chunk can be reused.
+			m_free.push_back(chunk);
+		}
+	} else {
+		if (done < op->len) {
+			errno = 0;
+			const size_t size = op->file->pread(op->buf + done, op->len - done, op->offset + done);
+			if (done + size < op->len) {
+				// Read error, or the source image is truncated.
+				// This is an error with the thread engine, too.
+				setError(errno != 0 ? errno : EIO);
+				chunk->failed = true;
+			}
+		}
+		chunk->ready = true;
+	}
+
+	m_freeOps.push_back(idx);
+	return 0;
+}
+
+/**
+ * Queue reads for all free chunks. (io_uring engine)
+ */
+void ReadAheadQueue::fillReads(void)
+{
+	const uint32_t lba_end = m_lba_start + m_lba_len;
+	while (!m_cancel && !m_free.empty() && m_lba_next < lba_end) {
+		Chunk *const chunk = m_free.front();
+		m_free.pop_front();
+
+		chunk->lba_start = m_lba_next;
+		chunk->lba_len = (lba_end - m_lba_next < m_chunk_lba ? lba_end - m_lba_next : m_chunk_lba);
+		chunk->data = chunk->buf;
+		chunk->pending = 0;
+		chunk->ready = false;
+		chunk->failed = false;
+		chunk->released = false;
+		m_lba_next += chunk->lba_len;
+
+		chunk->hole = isHole(chunk->lba_start, chunk->lba_len);
+		if (chunk->hole) {
+			// Hole in a sparse source image. Don't read it.
+			memset(chunk->buf, 0, static_cast<size_t>(LBA_TO_BYTES(chunk->lba_len)));
+			chunk->ready = true;
+			m_filled.push_back(chunk);
+			continue;
+		}
+
+		Op op;
+		op.chunk = chunk;
+		op.file = m_reader->file();
+		op.buf = chunk->buf;
+		op.len = static_cast<uint32_t>(LBA_TO_BYTES(chunk->lba_len));
+		op.offset = m_reader->lbaToOffset(chunk->lba_start);
+		op.write = false;
+		if (queueOp(op) != 0) {
+			// Unable to queue the read. Read it synchronously.
+			errno = 0;
+			const uint32_t lbas = m_reader->read(chunk->buf, chunk->lba_start, chunk->lba_len);
+			if (lbas != chunk->lba_len) {
+				// Read error.
+				setError(errno);
+				chunk->failed = true;
+			}
+			chunk->ready = true;
+		}
+		m_filled.push_back(chunk);
+	}
+	m_ring->submit();
+}
+
+/**
+ * Check if an LBA range is entirely within a hole in the source image,
+ * or doesn't contain any used LBAs according to the scrub map.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return True if the range is a hole; false if it may contain data.
+ */
+bool ReadAheadQueue::isHole(uint32_t lba_start, uint32_t lba_len)
+{
+	if (m_scrub && !m_scrub->isUsed(lba_start, lba_len)) {
+		// Unused data.
+		return true;
+	}
+	if (lba_start >= m_dataEnd) {
+		// Past the cached data range. Find the next one.
+		m_reader->findData(lba_start, &m_dataStart, &m_dataEnd);
+	}
+	return (lba_start + lba_len <= m_dataStart);
+}
+
+/**
+ * Wait for all requests in flight. (io_uring engine)
+ */
+void ReadAheadQueue::drain(void)
+{
+	while (m_freeOps.size() < m_ops.size()) {
+		int ret = reapOne();
+		if (ret != 0) {
+			// Ring error. Nothing else can be done here.
+			assert(!"io_uring completion failed");
+			setError(-ret);
+			m_stop = true;
+			break;
+		}
+	}
+}
+
+/**
+ * Get the next chunk.
+ * This will block until the chunk has been read.
+ * The chunk must be returned using release().
+ * @return Next chunk, or nullptr if all chunks have been read.
+ * If a read failed, this returns nullptr once all chunks before
+ * the failed chunk have been returned. If a write failed, this
+ * returns nullptr immediately. finish() reports the error.
+ */
+ReadAheadQueue::Chunk *ReadAheadQueue::next(void)
+{
+	if (m_ring) {
+		// io_uring engine.
+		if (m_stop) {
+			// A write failed, or the ring failed.
+			return nullptr;
+		}
+		fillReads();
+		while (m_filled.empty()) {
+			if (m_cancel || m_lba_next >= m_lba_start + m_lba_len ||
+			    m_freeOps.size() == m_ops.size())
+			{
+				// No more chunks.
+				return nullptr;
+			}
+
+			// All chunks are waiting for writes to complete.
+			int ret = reapOne();
+			if (ret != 0) {
+				// Ring error.
+				setError(-ret);
+				m_stop = true;
+				return nullptr;
+			}
+			fillReads();
+		}
+
+		// Chunks are returned in order, so wait for the first one,
+		// even if a read for a later chunk has already failed.
+		Chunk *const chunk = m_filled.front();
+		while (!chunk->ready) {
+			int ret = reapOne();
+			if (ret != 0) {
+				// Ring error.
+				setError(-ret);
+				m_stop = true;
+				return nullptr;
+			}
+		}
+		if (chunk->failed || m_stop) {
+			// This chunk's read failed, or a write failed.
+			// Don't return stale data.
+			return nullptr;
+		}
+		m_filled.pop_front();
+		return chunk;
+	}
+
+	// Thread engine.
+	// NOTE: The read-ahead thread stops at the first read error,
+	// so all chunks in m_filled were read successfully.
+	unique_lock<mutex> lock(m_mutex);
+	m_cond.wait(lock, [this] { return m_done || m_stop || !m_filled.empty(); });
+	if (m_filled.empty() || m_stop) {
+		// No more chunks, or a write failed.
+		return nullptr;
+	}
+
+	Chunk *const chunk = m_filled.front();
+	m_filled.pop_front();
+	return chunk;
+}
+
+/**
+ * Write part of a chunk to a destination reader.
+ *
+ * With the io_uring engine, the write is queued and submitted
+ * when the chunk is released, and the chunk buffer isn't reused
+ * until the write completes. Otherwise, the data is written
+ * synchronously using Reader::write().
+ *
+ * Errors from queued writes are reported by finish().
+ *
+ * @param chunk		[in] Chunk returned by next().
+ * @param dest		[in] Destination reader.
+ * @param src		[in] Data to write. (must be within chunk->data)
+ * @param lba_start	[in] Destination LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int ReadAheadQueue::write(Chunk *chunk, Reader *dest, const uint8_t *src,
+	uint32_t lba_start, uint32_t lba_len)
+{
+	assert(src >= chunk->data);
+	assert(src + LBA_TO_BYTES(lba_len) <= chunk->data + LBA_TO_BYTES(chunk->lba_len));
+
+	// Asynchronous writes require a linear destination,
+	// and the data must be in the registered chunk buffer.
+	const int64_t offset = (m_ring && chunk->data == chunk->buf && lba_start + lba_len <= dest->lba_len())
+		? dest->lbaToOffset(lba_start) : -1;
+	if (offset >= 0) {
+		Op op;
+		op.chunk = chunk;
+		op.file = dest->file();
+		op.buf = chunk->buf + (src - chunk->data);
+		op.len = static_cast<uint32_t>(LBA_TO_BYTES(lba_len));
+		op.offset = offset;
+		op.write = true;
+		if (queueOp(op) == 0) {
+			chunk->pending++;
+			return 0;
+		}
+		// Unable to queue the write. Write it synchronously.
+	}
+
+	const uint32_t lbas = dest->write(src, lba_start, lba_len);
+	if (lbas != lba_len) {
+		const int err = (errno != 0 ? errno : EIO);
+		lock_guard<mutex> lock(m_mutex);
+		setError(err);
+		m_stop = true;
+		return -err;
+	}
+	return 0;
+}
+
+/**
+ * Release a chunk so its buffer can be reused.
+ * @param chunk Chunk returned by next().
+ */
+void ReadAheadQueue::release(Chunk *chunk)
+{
+	assert(chunk != nullptr);
+	if (m_ring) {
+		// io_uring engine.
+		// The chunk can't be reused until its writes have completed.
+		chunk->released = true;
+		if (chunk->pending == 0) {
+			m_free.push_back(chunk);
+		}
+		m_ring->submit();
+		return;
+	}
+
+	// Thread engine.
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_free.push_back(chunk);
+	}
+	m_cond.notify_all();
+}
+
+/**
+ * Wait for all queued writes to complete.
+ * @return 0 on success; negative POSIX error code if any read or write failed.
+ */
+int ReadAheadQueue::finish(void)
+{
+	if (m_ring) {
+		drain();
+	}
+
+	// NOTE: With the thread engine, read errors are
+	// recorded by the read-ahead thread.
+	lock_guard<mutex> lock(m_mutex);
+	return -m_err;
+}
+
+/**
+ * Stop reading and wait for all outstanding I/O to finish.
+ * This is called automatically by the destructor.
+ */
+void ReadAheadQueue::cancel(void)
+{
+	if (m_ring) {
+		// io_uring engine.
+		// Outstanding requests must finish before the
+		// buffers can be freed.
+		m_cancel = true;
+		drain();
+		return;
+	}
+
+	// Thread engine.
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_cancel = true;
+	}
+	m_cond.notify_all();
+	if (m_thread.joinable()) {
+		m_thread.join();
+	}
+}
+
+/**
+ * Make a chunk's data writable.
+ * If the chunk is using zero-copy data, it will be
+ * copied into the chunk buffer first.
+ * @param chunk Chunk.
+ * @return Writable chunk data.
+ */
+uint8_t *ReadAheadQueue::makeWritable(Chunk *chunk)
+{
+	if (chunk->data != chunk->buf) {
+		memcpy(chunk->buf, chunk->data, static_cast<size_t>(LBA_TO_BYTES(chunk->lba_len)));
+		chunk->data = chunk->buf;
+	}
+	return chunk->buf;
+}
@@ -0,0 +1,272 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * ReadAheadQueue.hpp: Background read-ahead queue for sequential copies.  *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_READER_READAHEADQUEUE_HPP__
+#define __RVTHTOOL_LIBRVTH_READER_READAHEADQUEUE_HPP__
+
+#include "libwiicrypto/common.h"
+
+// C includes.
+#include <stdint.h>
+
+// C++ includes.
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class IoUring;
+class Reader;
+class RefFile;
+class ScrubMap;
+
+/**
+ * Reads an LBA range from a Reader ahead of the caller.
+ *
+ * Chunks are read into a bounded ring of buffers, so the source can
+ * be read while the caller is writing the previous chunk to the
+ * destination. Chunks are always returned in order. If a read fails,
+ * all chunks before the failed chunk are still returned.
+ *
+ * Chunks that are entirely within holes in a sparse source image
+ * aren't read at all. Their buffers are zeroed instead. If a scrub
+ * map is set, chunks that don't contain any used data are handled
+ * the same way.
+ *
+ * Two engines are available:
+ * - io_uring: If the source is a linear image and io_uring is available,
+ *   up to `depth` chunk reads are kept in flight using registered buffers,
+ *   and write() queues asynchronous writes to linear destinations.
+ * - Thread: Otherwise, a background thread reads the chunks synchronously,
+ *   and write() writes synchronously.
+ */
+class ReadAheadQueue
+{
+	public:
+		/**
+		 * Create a read-ahead queue.
+		 * Call start() to start reading.
+		 * @param reader	[in] Source reader.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Number of LBAs to read.
+		 * @param chunk_lba	[in] Chunk size, in LBAs.
+		 * @param depth		[in] Number of chunk buffers. (2 == double-buffered)
+		 */
+		ReadAheadQueue(Reader *reader, uint32_t lba_start, uint32_t lba_len,
+			uint32_t chunk_lba, unsigned int depth = 3);
+		~ReadAheadQueue();
+
+	private:
+		DISABLE_COPY(ReadAheadQueue)
+
+	public:
+		struct Chunk {
+			uint8_t *buf;		// Chunk buffer. (page-aligned; always allocated)
+			const uint8_t *data;	// Chunk data. (either buf or zero-copy data from the Reader)
+			uint32_t lba_start;	// Starting LBA.
+			uint32_t lba_len;	// Length, in LBAs.
+			bool hole;		// Is this chunk a hole or unused? (all zeroes; not read)
+
+			// Internal state. (io_uring engine)
+			unsigned int index;	// Registered buffer index
+			unsigned int pending;	// Number of writes in flight
+			bool ready;		// Has the read completed?
+			bool failed;		// Did the read fail?
+			bool released;		// Has the caller released this chunk?
+		};
+
+		/**
+		 * Set the scrub map.
+		 * Chunks that don't contain any used LBAs won't be read.
+		 * This must be called before start().
+		 * @param scrub	[in] Scrub map. (LBAs are relative to the reader; must remain valid until the queue is deleted)
+		 */
+		inline void setScrubMap(const ScrubMap *scrub)
+		{
+			m_scrub = scrub;
+		}
+
+		/**
+		 * Allocate the buffers and start reading.
+		 * @param async	[in] If true, use io_uring if it's available.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int start(bool async = true);
+
+		/**
+		 * Is the io_uring engine in use?
+		 * @return True if io_uring is in use; false if using the thread engine.
+		 */
+		inline bool isAsync(void) const
+		{
+			return (m_ring != nullptr);
+		}
+
+		/**
+		 * Get the next chunk.
+		 * This will block until the chunk has been read.
+		 * The chunk must be returned using release().
+		 * @return Next chunk, or nullptr if all chunks have been read.
+		 * If a read failed, this returns nullptr once all chunks before
+		 * the failed chunk have been returned. If a write failed, this
+		 * returns nullptr immediately. finish() reports the error.
+		 */
+		Chunk *next(void);
+
+		/**
+		 * Write part of a chunk to a destination reader.
+		 *
+		 * With the io_uring engine, the write is queued and submitted
+		 * when the chunk is released, and the chunk buffer isn't reused
+		 * until the write completes. Otherwise, the data is written
+		 * synchronously using Reader::write().
+		 *
+		 * Errors from queued writes are reported by finish().
+		 *
+		 * @param chunk		[in] Chunk returned by next().
+		 * @param dest		[in] Destination reader.
+		 * @param src		[in] Data to write. (must be within chunk->data)
+		 * @param lba_start	[in] Destination LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int write(Chunk *chunk, Reader *dest, const uint8_t *src,
+			uint32_t lba_start, uint32_t lba_len);
+
+		/**
+		 * Release a chunk so its buffer can be reused.
+		 * @param chunk Chunk returned by next().
+		 */
+		void release(Chunk *chunk);
+
+		/**
+		 * Wait for all queued writes to complete.
+		 * @return 0 on success; negative POSIX error code if any read or write failed.
+		 */
+		int finish(void);
+
+		/**
+		 * Stop reading and wait for all outstanding I/O to finish.
+		 * This is called automatically by the destructor.
+		 */
+		void cancel(void);
+
+		/**
+		 * Make a chunk's data writable.
+		 * If the chunk is using zero-copy data, it will be
+		 * copied into the chunk buffer first.
+		 * @param chunk Chunk.
+		 * @return Writable chunk data.
+		 */
+		static uint8_t *makeWritable(Chunk *chunk);
+
+	private:
+		/**
+		 * Read-ahead thread function. (thread engine)
+		 */
+		void run(void);
+
+		/** io_uring engine **/
+
+		struct Op {
+			Chunk *chunk;		// Chunk
+			RefFile *file;		// File
+			uint8_t *buf;		// Buffer (within chunk->buf)
+			uint32_t len;		// Length, in bytes
+			int64_t offset;		// File offset, in bytes
+			bool write;		// True for writes; false for reads
+		};
+
+		/**
+		 * Initialize the io_uring engine.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int initRing(void);
+
+		/**
+		 * Queue an I/O request. (io_uring engine)
+		 * If too many requests are in flight, this will wait for
+		 * a completion first.
+		 * @param op I/O request.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int queueOp(const Op &op);
+
+		/**
+		 * Process one completion. (io_uring engine)
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int reapOne(void);
+
+		/**
+		 * Queue reads for all free chunks. (io_uring engine)
+		 */
+		void fillReads(void);
+
+		/**
+		 * Wait for all requests in flight. (io_uring engine)
+		 */
+		void drain(void);
+
+		/**
+		 * Check if an LBA range is entirely within a hole in the source image,
+		 * or doesn't contain any used LBAs according to the scrub map.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return True if the range is a hole; false if it may contain data.
+		 */
+		bool isHole(uint32_t lba_start, uint32_t lba_len);
+
+		/**
+		 * Record an I/O error, unless an error was already recorded.
+		 * @param err POSIX error code. (positive)
+		 */
+		inline void setError(int err)
+		{
+			if (m_err == 0) {
+				m_err = (err != 0 ? err : EIO);
+			}
+		}
+
+	private:
+		Reader *const m_reader;
+		const uint32_t m_lba_start;
+		const uint32_t m_lba_len;
+		const uint32_t m_chunk_lba;
+		const unsigned int m_depth;
+
+		// Cached data range in the source image. (See Reader::findData().)
+		uint32_t m_dataStart;
+		uint32_t m_dataEnd;
+
+		// Used LBAs in the source image. (NULL to read everything)
+		const ScrubMap *m_scrub;
+
+		std::vector<Chunk> m_chunks;
+		std::deque<Chunk*> m_free;	// Chunks available for reading.
+		std::deque<Chunk*> m_filled;	// Chunks that have been (or are being) read, in order.
+
+		// Thread engine
+		std::mutex m_mutex;
+		std::condition_variable m_cond;
+		std::thread m_thread;
+		bool m_done;	// Set by the read-ahead thread when finished.
+
+		// io_uring engine
+		IoUring *m_ring;
+		std::vector<Op> m_ops;			// Request slots
+		std::vector<unsigned int> m_freeOps;	// Free request slot indexes
+		uint32_t m_lba_next;			// Next LBA to read
+
+		bool m_cancel;	// Set by the consumer to stop reading.
+		bool m_stop;	// Set if a write or io_uring failed. No more chunks are returned.
+		int m_err;	// First I/O error. (positive POSIX error code; m_mutex for the thread engine)
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_READER_READAHEADQUEUE_HPP__ */
@@ -20,6 +20,7 @@
 
 #include "Reader.hpp"
 #include "PlainReader.hpp"
+#include "MmapReader.hpp"
 #include "CisoReader.hpp"
 #include "WbfsReader.hpp"
 
@@ -88,16 +89,8 @@ Reader *Reader::open(RefFile *file, uint32_t lba_start, uint32_t lba_len)
 
 	// Check for other disc image formats.
 	uint8_t sbuf[4096];
-	int ret = file->seeko(LBA_TO_BYTES(lba_start), SEEK_SET);
-	if (ret != 0) {
-		// Seek error.
-		if (errno == 0) {
-			errno = EIO;
-		}
-		return nullptr;
-	}
 	errno = 0;
-	size_t size = file->read(sbuf, 1, sizeof(sbuf));
+	size_t size = file->pread(sbuf, sizeof(sbuf), LBA_TO_BYTES(lba_start));
 	if (size != sizeof(sbuf)) {
 		// Short read. May be empty.
 		if (errno != 0) {
@@ -106,11 +99,9 @@ Reader *Reader::open(RefFile *file, uint32_t lba_start, uint32_t lba_len)
 		} else {
 			// Assume it's a new file.
 			// Use the plain disc image reader.
-			file->rewind();
 			return new PlainReader(file, lba_start, lba_len);
 		}
 	}
-	file->rewind();
 
 	// Check the magic number.
 	if (CisoReader::isSupported(sbuf, sizeof(sbuf))) {
@@ -138,6 +129,10 @@ Reader *Reader::open(RefFile *file, uint32_t lba_start, uint32_t lba_len)
 	}
 
 	// Use the plain disc image reader.
+	// For regular files in 64-bit builds, use memory mapping.
+	if (sizeof(void*) >= 8) {
+		return new MmapReader(file, lba_start, lba_len);
+	}
 	return new PlainReader(file, lba_start, lba_len);
 }
 
@@ -171,3 +166,87 @@ void Reader::flush(void)
 {
 	m_file->flush();
 }
+
+/**
+ * Get a read-only pointer to an LBA range without copying.
+ *
+ * This is only supported by readers that have direct access
+ * to the underlying data, e.g. memory-mapped files. If nullptr
+ * is returned, use read() instead.
+ *
+ * Base class implementation returns nullptr.
+ *
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return Pointer to the data, or nullptr if not available.
+ */
+const uint8_t *Reader::map(uint32_t lba_start, uint32_t lba_len)
+{
+	// Base class does not support zero-copy access.
+	UNUSED(lba_start);
+	UNUSED(lba_len);
+	return nullptr;
+}
+
+/**
+ * Get the file offset of an LBA for linear disc images.
+ *
+ * Plain disc images are stored linearly in the file, so their
+ * LBAs can be read or written directly using asynchronous I/O.
+ * Readers for compressed/compacted formats return -1.
+ *
+ * Base class implementation returns -1.
+ *
+ * @param lba	[in] LBA, relative to the start of the image.
+ * @return File offset, in bytes, or -1 if not available.
+ */
+int64_t Reader::lbaToOffset(uint32_t lba) const
+{
+	// Base class does not have a linear mapping.
+	UNUSED(lba);
+	return -1;
+}
+
+/**
+ * Find the next LBA range that may contain data.
+ *
+ * LBAs between lba and *pLbaStart are holes in a sparse
+ * disc image, and are known to be all zeroes. If holes can't
+ * be detected, the rest of the disc image is reported as data.
+ *
+ * @param lba		[in] Starting LBA.
+ * @param pLbaStart	[out] First LBA that may contain data. (lba_len() if none)
+ * @param pLbaEnd	[out] End of the data range. (exclusive)
+ */
+void Reader::findData(uint32_t lba, uint32_t *pLbaStart, uint32_t *pLbaEnd)
+{
+	assert(lba <= m_lba_len);
+
+	// Assume the rest of the image is data.
+	*pLbaStart = lba;
+	*pLbaEnd = m_lba_len;
+
+	// Only linear disc images can be checked for holes.
+	const int64_t offset = lbaToOffset(lba);
+	if (offset < 0) {
+		return;
+	}
+
+	int64_t dataStart, dataEnd;
+	if (m_file->findData(offset, &dataStart, &dataEnd) != 0) {
+		// Unable to check for holes.
+		return;
+	} else if (dataStart < offset) {
+		// Past the end of the file. There's no data here.
+		*pLbaStart = m_lba_len;
+		*pLbaEnd = m_lba_len;
+		return;
+	}
+
+	// Holes are usually aligned to the file system block size,
+	// but round outwards to LBAs just in case.
+	const int64_t lbaStart = lba + ((dataStart - offset) / LBA_SIZE);
+	const int64_t lbaEnd = lba + ((dataEnd - offset + LBA_SIZE - 1) / LBA_SIZE);
+	*pLbaStart = static_cast<uint32_t>(lbaStart < m_lba_len ? lbaStart : m_lba_len);
+	*pLbaEnd = static_cast<uint32_t>(lbaEnd < m_lba_len ? lbaEnd : m_lba_len);
+}
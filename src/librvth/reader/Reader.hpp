@@ -76,9 +76,9 @@ class Reader
 	public:
 		/** I/O functions **/
 
-		// TODO: lba_start param, or separate seek()?
-		// Regardless, we have to seek on each read because another
-		// disc image may have altered the file pointer.
+		// NOTE: Reads and writes use positional I/O (RefFile::pread()
+		// and RefFile::pwrite()), so they don't depend on the file
+		// position, and multiple readers can share a RefFile.
 
 		/**
 		 * Read data from the disc image.
@@ -101,7 +101,47 @@ class Reader
 		/**
 		 * Flush the file buffers.
 		 */
-		void flush(void);
+		virtual void flush(void);
+
+		/**
+		 * Get a read-only pointer to an LBA range without copying.
+		 *
+		 * This is only supported by readers that have direct access
+		 * to the underlying data, e.g. memory-mapped files. If nullptr
+		 * is returned, use read() instead.
+		 *
+		 * The pointer remains valid as long as the Reader is open.
+		 *
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return Pointer to the data, or nullptr if not available.
+		 */
+		virtual const uint8_t *map(uint32_t lba_start, uint32_t lba_len);
+
+		/**
+		 * Get the file offset of an LBA for linear disc images.
+		 *
+		 * Plain disc images are stored linearly in the file, so their
+		 * LBAs can be read or written directly using asynchronous I/O.
+		 * Readers for compressed/compacted formats return -1.
+		 *
+		 * @param lba	[in] LBA, relative to the start of the image.
+		 * @return File offset, in bytes, or -1 if not available.
+		 */
+		virtual int64_t lbaToOffset(uint32_t lba) const;
+
+		/**
+		 * Find the next LBA range that may contain data.
+		 *
+		 * LBAs between lba and *pLbaStart are holes in a sparse
+		 * disc image, and are known to be all zeroes. If holes can't
+		 * be detected, the rest of the disc image is reported as data.
+		 *
+		 * @param lba		[in] Starting LBA.
+		 * @param pLbaStart	[out] First LBA that may contain data. (lba_len() if none)
+		 * @param pLbaEnd	[out] End of the data range. (exclusive)
+		 */
+		void findData(uint32_t lba, uint32_t *pLbaStart, uint32_t *pLbaEnd);
 
 	public:
 		/** Accessors **/
@@ -118,6 +158,12 @@ class Reader
 		 */
 		inline uint32_t lba_len(void) const { return m_lba_len; }
 
+		/**
+		 * Get the underlying file.
+		 * @return RefFile*
+		 */
+		inline RefFile *file(void) const { return m_file; }
+
 		/**
 		 * Get the image type.
 		 * @return Image type.
@@ -90,7 +90,7 @@ static inline uint8_t size_to_shift(uint32_t size)
  * @param lba_start	[in] Starting LBA,
  * @return wbfs_t*, or NULL on error.
  */
-static wbfs_t *readWbfsHeader(RefFile *file, uint32_t lba_start)
+wbfs_t *WbfsReader::readWbfsHeader(RefFile *file, uint32_t lba_start)
 {
 	wbfs_head_t *head = NULL;
 	wbfs_t *p = NULL;
@@ -108,12 +108,7 @@ static wbfs_t *readWbfsHeader(RefFile *file, uint32_t lba_start)
 	}
 
 	// Read the WBFS header.
-	ret = file->seeko(LBA_TO_BYTES(lba_start), SEEK_SET);
-	if (ret != 0) {
-		// Seek error.
-		goto end;
-	}
-	size = file->read(head, 1, hd_sec_sz);
+	size = file->pread(head, hd_sec_sz, LBA_TO_BYTES(lba_start));
 	if (size != hd_sec_sz) {
 		// Read error.
 		ret = -1;
@@ -152,12 +147,7 @@ static wbfs_t *readWbfsHeader(RefFile *file, uint32_t lba_start)
 		}
 
 		// Re-read the WBFS header.
-		ret = file->seeko(LBA_TO_BYTES(lba_start), SEEK_SET);
-		if (ret != 0) {
-			// Seek error.
-			goto end;
-		}
-		size = file->read(head, 1, hd_sec_sz);
+		size = file->pread(head, hd_sec_sz, LBA_TO_BYTES(lba_start));
 		if (size != hd_sec_sz) {
 			// Read error.
 			ret = -1;
@@ -167,6 +157,7 @@ static wbfs_t *readWbfsHeader(RefFile *file, uint32_t lba_start)
 	
 	// Save the wbfs_head_t in the wbfs_t struct.
 	p->head = head;
+	ret = 0;
 
 	// Constants.
 	p->wii_sec_sz = 0x8000;
@@ -210,7 +201,7 @@ end:
  * All opened discs *must* be closed.
  * @param p wbfs_t struct.
  */
-static void freeWbfsHeader(wbfs_t *p)
+void WbfsReader::freeWbfsHeader(wbfs_t *p)
 {
 	assert(p != NULL);
 	assert(p->head != NULL);
@@ -240,7 +231,6 @@ static wbfs_disc_t *openWbfsDisc(RefFile *file, uint32_t lba_start, wbfs_t *p, u
 		if (head->disc_table[i]) {
 			if (count++ == index) {
 				// Found the disc table index.
-				int ret;
 				size_t size;
 
 				wbfs_disc_t *disc = (wbfs_disc_t*)malloc(sizeof(wbfs_disc_t));
@@ -259,13 +249,8 @@ static wbfs_disc_t *openWbfsDisc(RefFile *file, uint32_t lba_start, wbfs_t *p, u
 					return NULL;
 				}
 
-				ret = file->seeko(LBA_TO_BYTES(lba_start) + p->hd_sec_sz + (i*p->disc_info_sz), SEEK_SET);
-				if (ret != 0) {
-					// Seek error.
-					free(disc);
-					return NULL;
-				}
-				size = file->read(disc->header, 1, p->disc_info_sz);
+				size = file->pread(disc->header, p->disc_info_sz,
+					LBA_TO_BYTES(lba_start) + p->hd_sec_sz + (i*p->disc_info_sz));
 				if (size != p->disc_info_sz) {
 					// Error reading the disc information.
 					free(disc->header);
@@ -273,10 +258,9 @@ static wbfs_disc_t *openWbfsDisc(RefFile *file, uint32_t lba_start, wbfs_t *p, u
 					return NULL;
 				}
 
-				// TODO: Byteswap wlba_table[] here?
-				// Removes unnecessary byteswaps when reading,
-				// but may not be necessary if we're not reading
-				// the entire disc.
+				// NOTE: wlba_table[] is byteswapped by the
+				// WbfsReader constructor, not here, since the
+				// header should remain in WBFS byte order.
 
 				// Disc information read successfully.
 				p->n_disc_open++;
@@ -311,18 +295,18 @@ static void closeWbfsDisc(wbfs_disc_t *disc)
  * Get the non-sparse size of an open WBFS disc, in bytes.
  * This scans the block table to find the first block
  * from the end of wlba_table[] that has been allocated.
- * @param wlba_table	[in] Pointer to the wlba table
+ * @param wlba_table	[in] Pointer to the wlba table (host-endian)
  * @param disc		[in] wbfs_disc_t*
  * @return Non-sparse size, in bytes.
  */
-static int64_t getWbfsDiscSize(const be16_t *wlba_table, const wbfs_disc_t *disc)
+static int64_t getWbfsDiscSize(const uint16_t *wlba_table, const wbfs_disc_t *disc)
 {
 	// Find the last block that's used on the disc.
 	// NOTE: This is in WBFS blocks, not Wii blocks.
 	const wbfs_t *const p = disc->p;
 	int lastBlock = p->n_wbfs_sec_per_disc - 1;
 	for (; lastBlock >= 0; lastBlock--) {
-		if (wlba_table[lastBlock] != cpu_to_be16(0))
+		if (wlba_table[lastBlock] != 0)
 			break;
 	}
 
@@ -394,8 +378,18 @@ WbfsReader::WbfsReader(RefFile *file, uint32_t lba_start, uint32_t lba_len)
 		goto fail;
 	}
 
+	// Byteswap the block map once here so read() doesn't
+	// have to byteswap every entry it looks up.
+	m_wlba_table = static_cast<uint16_t*>(malloc(m_wbfs->n_wbfs_sec_per_disc * sizeof(uint16_t)));
+	if (!m_wlba_table) {
+		err = ENOMEM;
+		goto fail;
+	}
+	for (unsigned int i = 0; i < m_wbfs->n_wbfs_sec_per_disc; i++) {
+		m_wlba_table[i] = be16_to_cpu(m_wbfs_disc->header->wlba_table[i]);
+	}
+
 	// Save important values for later.
-	m_wlba_table = m_wbfs_disc->header->wlba_table;
 	// TODO: Convert to shift amount?
 	m_block_size_lba = BYTES_TO_LBA(m_wbfs->wbfs_sec_sz);
 
@@ -408,6 +402,8 @@ WbfsReader::WbfsReader(RefFile *file, uint32_t lba_start, uint32_t lba_len)
 
 fail:
 	// Failed to initialize the reader.
+	free(m_wlba_table);
+	m_wlba_table = nullptr;
 	if (m_wbfs_disc) {
 		closeWbfsDisc(m_wbfs_disc);
 		m_wbfs_disc = nullptr;
@@ -425,6 +421,7 @@ fail:
 WbfsReader::~WbfsReader()
 {
 	// Free the WBFS structs.
+	free(m_wlba_table);
 	if (m_wbfs_disc) {
 		closeWbfsDisc(m_wbfs_disc);
 	}
@@ -459,38 +456,56 @@ uint32_t WbfsReader::read(void *ptr, uint32_t lba_start, uint32_t lba_len)
 		return 0;
 	}
 
-	// TODO: Optimize reading multiple LBAs at once.
-	// For now, we're looking up a single LBA at a time.
+	// Split the request into runs of WBFS blocks that are either
+	// physically contiguous or all empty, and handle each run using
+	// a single read or memset().
 	uint8_t *ptr8 = static_cast<uint8_t*>(ptr);
-	uint32_t lba_end = lba_start + lba_len;
-	for (uint32_t lba = lba_start; lba < lba_end; lba++, ptr8 += LBA_SIZE) {
-		unsigned int physBlockIdx = be16_to_cpu(m_wlba_table[lba / m_block_size_lba]);
+	const uint32_t lba_end = lba_start + lba_len;
+	uint32_t lba = lba_start;
+	while (lba < lba_end) {
+		const uint32_t firstBlock = lba / m_block_size_lba;
+		const unsigned int physBlockIdx = m_wlba_table[firstBlock];
+
+		// Find the end of the run.
+		uint32_t block = firstBlock + 1;
+		uint32_t run_end = block * m_block_size_lba;
+		while (run_end < lba_end) {
+			const unsigned int nextPhysBlockIdx = m_wlba_table[block];
+			if (physBlockIdx == 0) {
+				if (nextPhysBlockIdx != 0)
+					break;
+			} else if (nextPhysBlockIdx != physBlockIdx + (block - firstBlock)) {
+				break;
+			}
+			block++;
+			run_end = block * m_block_size_lba;
+		}
+		if (run_end > lba_end) {
+			run_end = lba_end;
+		}
+		const uint32_t run_len = run_end - lba;
+
 		if (physBlockIdx == 0) {
-			// Empty block.
-			memset(ptr8, 0, LBA_SIZE);
+			// Empty blocks.
+			memset(ptr8, 0, LBA_TO_BYTES(run_len));
 		} else {
 			// Determine the offset.
 			const unsigned int blockStart = physBlockIdx * m_block_size_lba;
 			const unsigned int offset = lba % m_block_size_lba;
 
-			int ret = m_file->seeko(LBA_TO_BYTES(blockStart + offset + m_lba_start), SEEK_SET);
-			if (ret != 0) {
-				// Seek error.
-				if (errno == 0) {
-					errno = EIO;
-				}
-				return 0;
-			}
-			size_t size = m_file->read(ptr8, LBA_SIZE, 1);
-			if (size != 1) {
+			const size_t size = (size_t)LBA_TO_BYTES(run_len);
+			if (m_file->pread(ptr8, size, LBA_TO_BYTES(blockStart + offset + m_lba_start)) != size) {
 				// Read error.
 				if (errno == 0) {
 					errno = EIO;
 				}
 				return 0;
 			}
-			lbas_read++;
 		}
+
+		lbas_read += run_len;
+		ptr8 += LBA_TO_BYTES(run_len);
+		lba = run_end;
 	}
 
 	return lbas_read;
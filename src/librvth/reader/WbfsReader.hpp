@@ -27,7 +27,6 @@ struct wbfs_s;
 typedef struct wbfs_s wbfs_t;
 struct wbfs_disc_s;
 typedef struct wbfs_disc_s wbfs_disc_t;
-typedef uint16_t be16_t;
 
 class WbfsReader : public Reader
 {
@@ -60,6 +59,22 @@ class WbfsReader : public Reader
 		 */
 		static bool isSupported(const uint8_t *sbuf, size_t size);
 
+		/**
+		 * Read the WBFS header.
+		 * @param file		RefFile*.
+		 * @param lba_start	[in] Starting LBA,
+		 * @return wbfs_t*, or NULL on error.
+		 */
+		static wbfs_t *readWbfsHeader(RefFile *file, uint32_t lba_start);
+
+		/**
+		 * Free an allocated WBFS header.
+		 * This frees all associated structs.
+		 * All opened discs *must* be closed.
+		 * @param p wbfs_t struct.
+		 */
+		static void freeWbfsHeader(wbfs_t *p);
+
 	public:
 		/** I/O functions **/
 
@@ -84,7 +99,7 @@ class WbfsReader : public Reader
 		wbfs_t *m_wbfs;			// WBFS image.
 		wbfs_disc_t *m_wbfs_disc;	// Current disc.
 
-		const be16_t *m_wlba_table;	// Pointer to m_wbfs_disc->disc->header->wlba_table.
+		uint16_t *m_wlba_table;		// Host-endian copy of m_wbfs_disc->header->wlba_table.
 };
 
 #endif /* __RVTHTOOL_LIBRVTH_READER_WBFSREADER_HPP__ */
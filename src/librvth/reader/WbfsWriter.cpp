@@ -0,0 +1,503 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * WbfsWriter.cpp: WBFS disc image writer class.                           *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "WbfsWriter.hpp"
+#include "WbfsReader.hpp"	// for readWbfsHeader()
+#include "byteswap.h"
+
+#include "aligned_malloc.h"
+#include "rvth.hpp"	// for RvtH::isBlockEmpty()
+
+// For LBA_TO_BYTES()
+#include "nhcd_structs.h"
+
+// C includes.
+#include <stdlib.h>
+
+// C includes. (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+#include "libwbfs.h"
+
+// New WBFS images use 512-byte sectors and 2 MB blocks,
+// which is what libwbfs uses for small partitions.
+#define WBFS_NEW_HD_SEC_SZ_S	9
+#define WBFS_NEW_WBFS_SEC_SZ_S	21
+
+#define ALIGN_LBA(x) (((x)+p->hd_sec_sz-1)&(~(size_t)(p->hd_sec_sz-1)))
+
+/**
+ * Create a WBFS writer.
+ * @param file		RefFile*. (must be writable)
+ * @param lba_len	[in] Length of the disc image, in LBAs.
+ * @param append	[in] If true, add the disc to the existing WBFS image in `file`.
+ *			     Otherwise, create a new WBFS image.
+ */
+WbfsWriter::WbfsWriter(RefFile *file, uint32_t lba_len, bool append)
+	: super(file, 0, lba_len)
+	, m_wbfs(nullptr)
+	, m_discSlot(0)
+	, m_block_size_lba(0)
+	, m_lastBlock(0)
+	, m_allocHint(1)
+	, m_blockBuf(nullptr)
+	, m_curBlock(UINT32_MAX)
+	, m_blockDirty(false)
+{
+	int err = 0;
+	int ret;
+	const wbfs_t *p;
+
+	memset(m_discHeader, 0, sizeof(m_discHeader));
+	if (!isOpen()) {
+		// File wasn't opened.
+		return;
+	} else if (lba_len == 0) {
+		// Image size must be specified.
+		err = EINVAL;
+		goto fail;
+	}
+
+	if (!append) {
+		// Write an empty WBFS header.
+		ret = format(lba_len);
+		if (ret != 0) {
+			err = -ret;
+			goto fail;
+		}
+	}
+
+	// Read the WBFS header.
+	m_wbfs = WbfsReader::readWbfsHeader(m_file, 0);
+	if (!m_wbfs) {
+		// Not a WBFS image.
+		err = errno;
+		if (err == 0) {
+			err = EIO;
+		}
+		goto fail;
+	}
+	p = m_wbfs;
+
+	// Find a free disc slot.
+	for (m_discSlot = 0; m_discSlot < p->max_disc; m_discSlot++) {
+		if (p->head->disc_table[m_discSlot] == 0)
+			break;
+	}
+	if (m_discSlot >= p->max_disc) {
+		// WBFS disc table is full.
+		err = ENOSPC;
+		goto fail;
+	}
+
+	// Make sure the disc fits in the block map.
+	m_block_size_lba = BYTES_TO_LBA(p->wbfs_sec_sz);
+	m_lastBlock = (lba_len - 1) / m_block_size_lba;
+	if (m_lastBlock >= p->n_wbfs_sec_per_disc) {
+		// Disc is too big for this WBFS image.
+		err = EFBIG;
+		goto fail;
+	}
+	m_wlba_table.assign(p->n_wbfs_sec_per_disc, 0);
+
+	if (append) {
+		// Read the existing free block table.
+		ret = readFreeBlocks();
+		if (ret != 0) {
+			err = -ret;
+			goto fail;
+		}
+	} else {
+		// All blocks are free in a new WBFS image.
+		m_freeblks.assign(ALIGN_LBA(p->n_wbfs_sec / 8) / sizeof(uint32_t), 0xFFFFFFFFU);
+	}
+
+	// Allocate the block buffer.
+	m_blockBuf = static_cast<uint8_t*>(aligned_malloc(RVTH_PAGE_SIZE, p->wbfs_sec_sz));
+	if (!m_blockBuf) {
+		err = ENOMEM;
+		goto fail;
+	}
+
+	// Writer initialized.
+	m_type = RVTH_ImageType_GCM;
+	return;
+
+fail:
+	// Failed to initialize the writer.
+	if (m_wbfs) {
+		WbfsReader::freeWbfsHeader(m_wbfs);
+		m_wbfs = nullptr;
+	}
+	m_file->unref();
+	m_file = nullptr;
+	errno = err;
+}
+
+WbfsWriter::~WbfsWriter()
+{
+	// NOTE: Nothing is committed here. If flush() wasn't called,
+	// the blocks that were written are still marked as free.
+	aligned_free(m_blockBuf);
+	if (m_wbfs) {
+		WbfsReader::freeWbfsHeader(m_wbfs);
+	}
+}
+
+/**
+ * Write an empty WBFS header for a new WBFS image.
+ * @param lba_len	[in] Length of the disc image, in LBAs.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int WbfsWriter::format(uint32_t lba_len)
+{
+	// The WBFS image is just big enough for this disc:
+	// one block for the WBFS header, plus the disc blocks.
+	// NOTE: Rounded up to a multiple of 32 blocks so the
+	// free block table is a whole number of 32-bit words.
+	const uint32_t block_size_lba = BYTES_TO_LBA(1U << WBFS_NEW_WBFS_SEC_SZ_S);
+	uint32_t n_wbfs_sec = 1 + ((lba_len + block_size_lba - 1) / block_size_lba);
+	n_wbfs_sec = (n_wbfs_sec + 31) & ~31U;
+
+	uint8_t head_buf[1U << WBFS_NEW_HD_SEC_SZ_S];
+	memset(head_buf, 0, sizeof(head_buf));
+	wbfs_head_t *const head = reinterpret_cast<wbfs_head_t*>(head_buf);
+	memcpy(&head->magic, "WBFS", sizeof(head->magic));
+	head->n_hd_sec = cpu_to_be32(n_wbfs_sec << (WBFS_NEW_WBFS_SEC_SZ_S - WBFS_NEW_HD_SEC_SZ_S));
+	head->hd_sec_sz_s = WBFS_NEW_HD_SEC_SZ_S;
+	head->wbfs_sec_sz_s = WBFS_NEW_WBFS_SEC_SZ_S;
+
+	errno = 0;
+	if (m_file->pwrite(head_buf, sizeof(head_buf), 0) != sizeof(head_buf)) {
+		// Write error.
+		const int err = (errno != 0 ? errno : EIO);
+		errno = err;
+		return -err;
+	}
+	return 0;
+}
+
+/**
+ * Read the free block table.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int WbfsWriter::readFreeBlocks(void)
+{
+	const wbfs_t *const p = m_wbfs;
+	const size_t size = ALIGN_LBA(p->n_wbfs_sec / 8);
+	m_freeblks.resize(size / sizeof(uint32_t));
+
+	errno = 0;
+	if (m_file->pread(m_freeblks.data(), size,
+	    static_cast<int64_t>(p->freeblks_lba) << p->hd_sec_sz_s) != size)
+	{
+		// Read error.
+		const int err = (errno != 0 ? errno : EIO);
+		errno = err;
+		return -err;
+	}
+
+	for (uint32_t &word : m_freeblks) {
+		word = be32_to_cpu(word);
+	}
+	return 0;
+}
+
+/**
+ * Allocate a free WBFS block.
+ * @return Physical block index, or 0 if no blocks are free.
+ */
+uint16_t WbfsWriter::allocBlock(void)
+{
+	// NOTE: Block 0 is the WBFS header, so bit 0 is block 1.
+	const uint32_t n_wbfs_sec = m_wbfs->n_wbfs_sec;
+	for (uint32_t block = m_allocHint; block < n_wbfs_sec; block++) {
+		const uint32_t bit = block - 1;
+		uint32_t &word = m_freeblks[bit / 32];
+		if (word & (1U << (bit % 32))) {
+			// Found a free block.
+			word &= ~(1U << (bit % 32));
+			m_allocHint = block + 1;
+			return static_cast<uint16_t>(block);
+		}
+	}
+
+	// No free blocks.
+	return 0;
+}
+
+/**
+ * Store the current block in the WBFS image.
+ * Empty blocks are skipped, except for the last block,
+ * which determines the image size.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int WbfsWriter::storeBlock(void)
+{
+	if (m_curBlock == UINT32_MAX || !m_blockDirty) {
+		// Nothing to store.
+		return 0;
+	}
+
+	const uint32_t block_size = m_wbfs->wbfs_sec_sz;
+	if (m_curBlock == 0) {
+		// Save the disc header for the disc information.
+		memcpy(m_discHeader, m_blockBuf, sizeof(m_discHeader));
+	}
+
+	uint16_t phys = m_wlba_table[m_curBlock];
+	if (phys == 0) {
+		if (m_curBlock != m_lastBlock && RvtH::isBlockEmpty(m_blockBuf, block_size)) {
+			// Empty block. Don't store it.
+			m_blockDirty = false;
+			return 0;
+		}
+
+		phys = allocBlock();
+		if (phys == 0) {
+			// No free blocks.
+			errno = ENOSPC;
+			return -ENOSPC;
+		}
+		m_wlba_table[m_curBlock] = phys;
+	}
+
+	errno = 0;
+	const int64_t offset = static_cast<int64_t>(phys) << m_wbfs->wbfs_sec_sz_s;
+	if (m_file->pwrite(m_blockBuf, block_size, offset) != block_size) {
+		// Write error.
+		const int err = (errno != 0 ? errno : EIO);
+		errno = err;
+		return -err;
+	}
+
+	m_blockDirty = false;
+	return 0;
+}
+
+/**
+ * Load a block into the block buffer.
+ * The current block must be stored first.
+ * @param block	[in] Logical block index.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int WbfsWriter::loadBlock(uint32_t block)
+{
+	assert(!m_blockDirty);
+	assert(block <= m_lastBlock);
+
+	const uint32_t block_size = m_wbfs->wbfs_sec_sz;
+	const uint16_t phys = m_wlba_table[block];
+	if (phys == 0) {
+		// Block isn't stored yet.
+		memset(m_blockBuf, 0, block_size);
+	} else {
+		// Block was stored previously.
+		errno = 0;
+		const int64_t offset = static_cast<int64_t>(phys) << m_wbfs->wbfs_sec_sz_s;
+		if (m_file->pread(m_blockBuf, block_size, offset) != block_size) {
+			// Read error.
+			const int err = (errno != 0 ? errno : EIO);
+			m_curBlock = UINT32_MAX;
+			errno = err;
+			return -err;
+		}
+	}
+
+	m_curBlock = block;
+	return 0;
+}
+
+/**
+ * Read data from the disc image.
+ * @param ptr		[out] Read buffer.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return Number of LBAs read, or 0 on error.
+ */
+uint32_t WbfsWriter::read(void *ptr, uint32_t lba_start, uint32_t lba_len)
+{
+	// LBA bounds checking.
+	// TODO: Check for overflow?
+	lba_start += m_lba_start;
+	assert(lba_start + lba_len <= m_lba_start + m_lba_len);
+	if (lba_start + lba_len > m_lba_start + m_lba_len) {
+		// Out of range.
+		errno = EIO;
+		return 0;
+	}
+
+	uint8_t *ptr8 = static_cast<uint8_t*>(ptr);
+	const uint32_t lba_end = lba_start + lba_len;
+	for (uint32_t lba = lba_start; lba < lba_end; ) {
+		const uint32_t block = lba / m_block_size_lba;
+		const uint32_t lba_offset = lba % m_block_size_lba;
+		uint32_t lba_count = m_block_size_lba - lba_offset;
+		if (lba_count > lba_end - lba) {
+			lba_count = lba_end - lba;
+		}
+		const size_t size = static_cast<size_t>(LBA_TO_BYTES(lba_count));
+
+		const uint16_t phys = m_wlba_table[block];
+		if (block == m_curBlock) {
+			// Current block.
+			memcpy(ptr8, &m_blockBuf[LBA_TO_BYTES(lba_offset)], size);
+		} else if (phys == 0) {
+			// Block isn't stored.
+			memset(ptr8, 0, size);
+		} else {
+			// Read the block from the file.
+			const int64_t offset = (static_cast<int64_t>(phys) << m_wbfs->wbfs_sec_sz_s) +
+				LBA_TO_BYTES(lba_offset);
+			if (m_file->pread(ptr8, size, offset) != size) {
+				// Read error.
+				if (errno == 0) {
+					errno = EIO;
+				}
+				return 0;
+			}
+		}
+
+		ptr8 += size;
+		lba += lba_count;
+	}
+
+	return lba_len;
+}
+
+/**
+ * Write data to the disc image.
+ * @param ptr		[in] Write buffer.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return Number of LBAs written, or 0 on error.
+ */
+uint32_t WbfsWriter::write(const void *ptr, uint32_t lba_start, uint32_t lba_len)
+{
+	// LBA bounds checking.
+	// TODO: Check for overflow?
+	lba_start += m_lba_start;
+	assert(lba_start + lba_len <= m_lba_start + m_lba_len);
+	if (lba_start + lba_len > m_lba_start + m_lba_len) {
+		// Out of range.
+		errno = EIO;
+		return 0;
+	}
+
+	const uint8_t *ptr8 = static_cast<const uint8_t*>(ptr);
+	const uint32_t lba_end = lba_start + lba_len;
+	for (uint32_t lba = lba_start; lba < lba_end; ) {
+		const uint32_t block = lba / m_block_size_lba;
+		if (block != m_curBlock) {
+			// Switch to the new block.
+			if (storeBlock() != 0 || loadBlock(block) != 0) {
+				// I/O error.
+				return 0;
+			}
+		}
+
+		const uint32_t lba_offset = lba % m_block_size_lba;
+		uint32_t lba_count = m_block_size_lba - lba_offset;
+		if (lba_count > lba_end - lba) {
+			lba_count = lba_end - lba;
+		}
+		const size_t size = static_cast<size_t>(LBA_TO_BYTES(lba_count));
+		memcpy(&m_blockBuf[LBA_TO_BYTES(lba_offset)], ptr8, size);
+		m_blockDirty = true;
+
+		ptr8 += size;
+		lba += lba_count;
+	}
+
+	return lba_len;
+}
+
+/**
+ * Store the current block, write the disc information,
+ * free block table, and WBFS header, and flush the file buffers.
+ */
+void WbfsWriter::flush(void)
+{
+	const wbfs_t *const p = m_wbfs;
+	size_t size;
+
+	if (storeBlock() != 0) {
+		// I/O error.
+		return;
+	}
+
+	// The image size is determined by the last used block,
+	// so the last block must always be stored.
+	if (m_wlba_table[m_lastBlock] == 0) {
+		if (loadBlock(m_lastBlock) != 0) {
+			// I/O error.
+			return;
+		}
+		m_blockDirty = true;
+		if (storeBlock() != 0) {
+			// I/O error.
+			return;
+		}
+	}
+
+	// Write the disc information.
+	wbfs_disc_info_t *const info = static_cast<wbfs_disc_info_t*>(calloc(1, p->disc_info_sz));
+	if (!info) {
+		errno = ENOMEM;
+		return;
+	}
+	memcpy(info->disc_header_copy, m_discHeader, sizeof(info->disc_header_copy));
+	for (size_t i = 0; i < m_wlba_table.size(); i++) {
+		info->wlba_table[i] = cpu_to_be16(m_wlba_table[i]);
+	}
+	errno = 0;
+	size = m_file->pwrite(info, p->disc_info_sz,
+		p->hd_sec_sz + (static_cast<int64_t>(m_discSlot) * p->disc_info_sz));
+	free(info);
+	if (size != p->disc_info_sz) {
+		// Write error.
+		if (errno == 0) {
+			errno = EIO;
+		}
+		return;
+	}
+
+	// Write the free block table.
+	std::vector<uint32_t> freeblks_be(m_freeblks.size());
+	for (size_t i = 0; i < m_freeblks.size(); i++) {
+		freeblks_be[i] = cpu_to_be32(m_freeblks[i]);
+	}
+	size = freeblks_be.size() * sizeof(uint32_t);
+	errno = 0;
+	if (m_file->pwrite(freeblks_be.data(), size,
+	    static_cast<int64_t>(p->freeblks_lba) << p->hd_sec_sz_s) != size)
+	{
+		// Write error.
+		if (errno == 0) {
+			errno = EIO;
+		}
+		return;
+	}
+
+	// Add the disc to the disc table.
+	// This is written last, so the WBFS image remains
+	// consistent if any of the previous writes failed.
+	p->head->disc_table[m_discSlot] = 1;
+	errno = 0;
+	if (m_file->pwrite(p->head, p->hd_sec_sz, 0) != p->hd_sec_sz) {
+		// Write error.
+		if (errno == 0) {
+			errno = EIO;
+		}
+		return;
+	}
+
+	super::flush();
+}
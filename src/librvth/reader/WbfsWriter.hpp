@@ -0,0 +1,140 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * WbfsWriter.hpp: WBFS disc image writer class.                           *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_READER_WBFSWRITER_HPP__
+#define __RVTHTOOL_LIBRVTH_READER_WBFSWRITER_HPP__
+
+#include "Reader.hpp"
+
+// C++ includes.
+#include <vector>
+
+struct wbfs_s;
+typedef struct wbfs_s wbfs_t;
+
+/**
+ * Writes a disc to a WBFS image.
+ *
+ * The disc can either be written to a new standalone WBFS file,
+ * or added to an existing WBFS file or partition that may already
+ * contain other discs.
+ *
+ * Data is written in whole WBFS blocks. Blocks are allocated from the
+ * WBFS free block table as they're written, and blocks that are
+ * entirely zero are not allocated at all.
+ *
+ * The disc table entry, block map, and free block table are only
+ * written by flush(). If the writer is deleted without calling flush(),
+ * an existing WBFS image is left unchanged.
+ */
+class WbfsWriter : public Reader
+{
+	public:
+		/**
+		 * Create a WBFS writer.
+		 * @param file		RefFile*. (must be writable)
+		 * @param lba_len	[in] Length of the disc image, in LBAs.
+		 * @param append	[in] If true, add the disc to the existing WBFS image in `file`.
+		 *			     Otherwise, create a new WBFS image.
+		 */
+		WbfsWriter(RefFile *file, uint32_t lba_len, bool append);
+		~WbfsWriter() final;
+
+	private:
+		typedef Reader super;
+		DISABLE_COPY(WbfsWriter)
+
+	public:
+		/** I/O functions **/
+
+		/**
+		 * Read data from the disc image.
+		 * @param ptr		[out] Read buffer.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return Number of LBAs read, or 0 on error.
+		 */
+		uint32_t read(void *ptr, uint32_t lba_start, uint32_t lba_len) final;
+
+		/**
+		 * Write data to the disc image.
+		 * @param ptr		[in] Write buffer.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return Number of LBAs written, or 0 on error.
+		 */
+		uint32_t write(const void *ptr, uint32_t lba_start, uint32_t lba_len) final;
+
+		/**
+		 * Store the current block, write the disc information,
+		 * free block table, and WBFS header, and flush the file buffers.
+		 */
+		void flush(void) final;
+
+	private:
+		/**
+		 * Write an empty WBFS header for a new WBFS image.
+		 * @param lba_len	[in] Length of the disc image, in LBAs.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int format(uint32_t lba_len);
+
+		/**
+		 * Read the free block table.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int readFreeBlocks(void);
+
+		/**
+		 * Allocate a free WBFS block.
+		 * @return Physical block index, or 0 if no blocks are free.
+		 */
+		uint16_t allocBlock(void);
+
+		/**
+		 * Store the current block in the WBFS image.
+		 * Empty blocks are skipped, except for the last block,
+		 * which determines the image size.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int storeBlock(void);
+
+		/**
+		 * Load a block into the block buffer.
+		 * The current block must be stored first.
+		 * @param block	[in] Logical block index.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int loadBlock(uint32_t block);
+
+	private:
+		wbfs_t *m_wbfs;			// WBFS image.
+		unsigned int m_discSlot;	// Disc table index for the new disc.
+
+		// WBFS block size, in LBAs.
+		uint32_t m_block_size_lba;
+		uint32_t m_lastBlock;		// Last logical block of the disc.
+
+		// Physical block index for each logical block. (0 == not stored)
+		std::vector<uint16_t> m_wlba_table;
+
+		// Free block table. (host-endian)
+		// Bit (n-1) is set if physical block n is free.
+		std::vector<uint32_t> m_freeblks;
+		uint32_t m_allocHint;		// First physical block to check in allocBlock().
+
+		// Copy of the first 256 bytes of the disc, for the disc information.
+		uint8_t m_discHeader[0x100];
+
+		// Current block.
+		uint8_t *m_blockBuf;	// Block buffer
+		uint32_t m_curBlock;	// Logical block index, or UINT32_MAX if none
+		bool m_blockDirty;	// Has the block buffer been modified?
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_READER_WBFSWRITER_HPP__ */
@@ -0,0 +1,668 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * WiiPartitionReader.cpp: Decrypted Wii partition reader.                 *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "config.librvth.h"
+
+#include "WiiPartitionReader.hpp"
+#include "aligned_malloc.h"
+#include "ptbl.h"
+#include "rvth_error.h"
+#include "wii_crypt.h"
+
+// libwiicrypto
+#include "libwiicrypto/aesw.h"
+#include "libwiicrypto/byteswap.h"
+
+// C includes. (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+
+// C++ includes.
+#include <system_error>
+using std::lock_guard;
+using std::mutex;
+using std::unique_lock;
+
+// Number of LBAs in an encrypted or decrypted sector.
+#define SECTOR_LBA_ENC BYTES_TO_LBA(SECTOR_SIZE_ENC)
+#define SECTOR_LBA_DEC BYTES_TO_LBA(SECTOR_SIZE_DEC)
+
+/**
+ * Create a reader for a Wii partition's user data.
+ * @param reader	[in] Disc image reader.
+ * @param lba_data	[in] Starting LBA of the partition's data area, relative to reader.
+ * @param lba_data_len	[in] Length of the data area, in LBAs. (as stored on the disc)
+ * @param titleKey	[in,opt] Decrypted title key. (16 bytes; NULL if unencrypted)
+ * @param cache_groups	[in] Number of decrypted groups to cache. (minimum 2)
+ */
+WiiPartitionReader::WiiPartitionReader(Reader *reader, uint32_t lba_data, uint32_t lba_data_len,
+	const uint8_t *titleKey, unsigned int cache_groups)
+	: super(reader->file(), reader->lba_start() + lba_data, lba_data_len)
+	, m_reader(reader)
+	, m_lba_data(lba_data)
+	, m_sector_count(0)
+	, m_group_count(0)
+	, m_aesw(nullptr)
+	, m_encBuf(nullptr)
+	, m_decryptBusy(false)
+	, m_useCounter(0)
+	, m_lastGroup(~0U)
+	, m_aeswPrefetch(nullptr)
+	, m_encBufPrefetch(nullptr)
+	, m_prefetchEntry(nullptr)
+	, m_prefetchQueued(false)
+	, m_prefetchEnabled(true)
+	, m_stop(false)
+{
+	if (!m_file) {
+		// File is not open.
+		return;
+	}
+	m_type = reader->type();
+	memset(m_titleKey, 0, sizeof(m_titleKey));
+
+	if (!titleKey) {
+		// Unencrypted partition.
+		// The user data is stored as-is.
+		return;
+	}
+
+	// Encrypted partition.
+	// Only whole sectors can be decrypted.
+	m_sector_count = lba_data_len / SECTOR_LBA_ENC;
+	m_group_count = (m_sector_count + 63) / 64;
+	m_lba_len = m_sector_count * SECTOR_LBA_DEC;
+
+	int err;
+	m_aesw = aesw_new();
+	if (!m_aesw) {
+		// Error initializing decryption.
+		err = errno;
+		if (err == 0) {
+			err = EIO;
+		}
+		goto fail;
+	}
+	memcpy(m_titleKey, titleKey, sizeof(m_titleKey));
+	aesw_set_key(m_aesw, m_titleKey, sizeof(m_titleKey));
+
+	m_encBuf = static_cast<uint8_t*>(aligned_malloc(RVTH_PAGE_SIZE, GROUP_SIZE_ENC));
+	if (!m_encBuf) {
+		// Error allocating memory.
+		err = ENOMEM;
+		goto fail;
+	}
+
+	// Cache buffers are allocated when they're first used.
+	if (cache_groups < 2) {
+		cache_groups = 2;
+	}
+	m_cache.resize(cache_groups);
+	for (auto iter = m_cache.begin(); iter != m_cache.end(); ++iter) {
+		memset(&(*iter), 0, sizeof(*iter));
+		iter->state = CacheEntry::STATE_EMPTY;
+	}
+	return;
+
+fail:
+	// Failed to initialize the reader.
+	if (m_aesw) {
+		aesw_free(m_aesw);
+		m_aesw = nullptr;
+	}
+	m_file->unref();
+	m_file = nullptr;
+	errno = err;
+}
+
+WiiPartitionReader::~WiiPartitionReader()
+{
+	// Stop the prefetch thread.
+	if (m_thread.joinable()) {
+		{
+			lock_guard<mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_cond.notify_all();
+		m_thread.join();
+	}
+
+	for (auto iter = m_cache.begin(); iter != m_cache.end(); ++iter) {
+		aligned_free(iter->data);
+	}
+	for (auto iter = m_spareCtx.begin(); iter != m_spareCtx.end(); ++iter) {
+		aligned_free(iter->encBuf);
+		aesw_free(iter->aesw);
+	}
+	aligned_free(m_encBuf);
+	aligned_free(m_encBufPrefetch);
+	if (m_aesw) {
+		aesw_free(m_aesw);
+	}
+	if (m_aeswPrefetch) {
+		aesw_free(m_aeswPrefetch);
+	}
+}
+
+/**
+ * Create a reader for a Wii partition's user data.
+ *
+ * The partition header is read to find the data area.
+ * For encrypted partitions, the title key is decrypted
+ * using the common key specified in the ticket.
+ *
+ * @param reader	[in] Disc image reader.
+ * @param pte		[in] Partition table entry.
+ * @param encrypted	[in] If true, the partition is encrypted.
+ * @param pErr		[out,opt] Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ * @return WiiPartitionReader*, or NULL on error.
+ */
+WiiPartitionReader *WiiPartitionReader::open(Reader *reader, const pt_entry_t *pte,
+	bool encrypted, int *pErr)
+{
+	// Only the ticket and the partition header fields are needed.
+	static const uint32_t pthdr_lba = BYTES_TO_LBA(offsetof(RVL_PartitionHeader, data) + LBA_SIZE - 1);
+	RVL_PartitionHeader pthdr;
+	int64_t data_offset, data_offset_min, data_size;
+	uint32_t lba_data, lba_data_len;
+	uint8_t titleKey[16];
+	WiiPartitionReader *wpr;
+
+	int ret;	// errno or RvtH_Errors
+
+	assert(reader != nullptr);
+	assert(pte != nullptr);
+
+	// Read the partition header.
+	errno = 0;
+	if (reader->read(&pthdr, pte->lba_start, pthdr_lba) != pthdr_lba) {
+		// Error reading the partition header.
+		ret = -errno;
+		if (ret == 0) {
+			ret = -EIO;
+		}
+		goto fail;
+	}
+
+	// Encrypted partitions have an H3 table before the data.
+	data_offset = (int64_t)be32_to_cpu(pthdr.data_offset) << 2;
+	data_offset_min = (encrypted
+		? sizeof(pthdr) + sizeof(Wii_Disc_H3_t)
+		: sizeof(pthdr));
+	if (data_offset < data_offset_min ||
+	    data_offset % LBA_SIZE != 0 ||
+	    BYTES_TO_LBA(data_offset) >= pte->lba_len)
+	{
+		// Partition header is corrupted.
+		ret = RVTH_ERROR_PARTITION_HEADER_CORRUPTED;
+		goto fail;
+	}
+
+	// If the partition header has a data size, use it;
+	// otherwise, use the rest of the partition.
+	// NOTE: Unencrypted partitions may have the encrypted data size,
+	// so always use the rest of the partition for those.
+	lba_data = pte->lba_start + static_cast<uint32_t>(BYTES_TO_LBA(data_offset));
+	lba_data_len = pte->lba_len - static_cast<uint32_t>(BYTES_TO_LBA(data_offset));
+	data_size = (int64_t)be32_to_cpu(pthdr.data_size) << 2;
+	if (encrypted && data_size != 0 && BYTES_TO_LBA(data_size) < lba_data_len) {
+		lba_data_len = static_cast<uint32_t>(BYTES_TO_LBA(data_size));
+	}
+
+	if (encrypted) {
+		// Decrypt the title key.
+		uint8_t crypto_type;
+		ret = rvth_decrypt_title_key(&pthdr.ticket, titleKey, &crypto_type);
+		if (ret != 0) {
+			// Error decrypting the title key.
+			goto fail;
+		}
+	}
+
+	wpr = new WiiPartitionReader(reader, lba_data, lba_data_len,
+		(encrypted ? titleKey : nullptr));
+	if (!wpr->isOpen()) {
+		// Error initializing the reader.
+		ret = -errno;
+		if (ret == 0) {
+			ret = -EIO;
+		}
+		delete wpr;
+		goto fail;
+	}
+
+	if (pErr) {
+		*pErr = 0;
+	}
+	return wpr;
+
+fail:
+	if (pErr) {
+		*pErr = ret;
+	}
+	errno = (ret < 0 ? -ret : EIO);
+	return nullptr;
+}
+
+/**
+ * Read user data from the partition.
+ * @param ptr		[out] Read buffer.
+ * @param lba_start	[in] Starting LBA.
+ * @param lba_len	[in] Length, in LBAs.
+ * @return Number of LBAs read, or 0 on error.
+ */
+uint32_t WiiPartitionReader::read(void *ptr, uint32_t lba_start, uint32_t lba_len)
+{
+	// LBA bounds checking.
+	assert(lba_start + lba_len <= m_lba_len);
+	if (lba_start + lba_len > m_lba_len) {
+		// Out of range.
+		errno = EIO;
+		return 0;
+	}
+
+	if (!m_aesw) {
+		// Unencrypted partition. Read the data directly.
+		return m_reader->read(ptr, m_lba_data + lba_start, lba_len);
+	}
+
+	size_t size = this->pread(ptr, LBA_TO_BYTES(lba_len), LBA_TO_BYTES(lba_start));
+	return BYTES_TO_LBA(size);
+}
+
+/**
+ * Read user data from the partition.
+ * This can be used for reads that aren't LBA-aligned,
+ * e.g. files within the partition.
+ * @param ptr		[out] Read buffer.
+ * @param size		[in] Number of bytes to read.
+ * @param offset	[in] Offset, in bytes, relative to the start of the user data.
+ * @return Number of bytes read. (May be short on error or at the end of the partition.)
+ */
+size_t WiiPartitionReader::pread(void *ptr, size_t size, int64_t offset)
+{
+	const int64_t data_size = dataSize();
+	if (offset < 0 || offset >= data_size) {
+		// Out of range.
+		return 0;
+	}
+	if (static_cast<int64_t>(size) > data_size - offset) {
+		size = static_cast<size_t>(data_size - offset);
+	}
+
+	uint8_t *ptr8 = static_cast<uint8_t*>(ptr);
+	size_t total = 0;
+
+	if (!m_aesw) {
+		// Unencrypted partition. Read the data directly.
+		// Partial LBAs are read using a temporary buffer.
+		uint8_t sbuf[LBA_SIZE];
+		while (total < size) {
+			const uint32_t lba = m_lba_data + static_cast<uint32_t>(offset / LBA_SIZE);
+			const unsigned int lba_offset = static_cast<unsigned int>(offset % LBA_SIZE);
+			const size_t left = size - total;
+			if (lba_offset == 0 && left >= LBA_SIZE) {
+				// Read whole LBAs directly into the output buffer.
+				const uint32_t lba_len = static_cast<uint32_t>(left / LBA_SIZE);
+				const uint32_t lba_read = m_reader->read(ptr8, lba, lba_len);
+				total += LBA_TO_BYTES(lba_read);
+				if (lba_read != lba_len) {
+					break;
+				}
+				ptr8 += LBA_TO_BYTES(lba_read);
+				offset += LBA_TO_BYTES(lba_read);
+			} else {
+				// Read a partial LBA.
+				if (m_reader->read(sbuf, lba, 1) != 1) {
+					break;
+				}
+				size_t copy = LBA_SIZE - lba_offset;
+				if (copy > left) {
+					copy = left;
+				}
+				memcpy(ptr8, &sbuf[lba_offset], copy);
+				total += copy;
+				ptr8 += copy;
+				offset += copy;
+			}
+		}
+		return total;
+	}
+
+	// Encrypted partition. Copy from the decrypted groups.
+	while (total < size) {
+		const uint32_t group = static_cast<uint32_t>(offset / GROUP_SIZE_DEC);
+		const uint32_t group_offset = static_cast<uint32_t>(offset % GROUP_SIZE_DEC);
+		const CacheEntry *const entry = getGroup(group);
+		if (!entry) {
+			// Error decrypting the group.
+			break;
+		} else if (group_offset >= entry->size) {
+			// Out of range.
+			releaseGroup(entry);
+			break;
+		}
+
+		size_t copy = entry->size - group_offset;
+		if (copy > size - total) {
+			copy = size - total;
+		}
+		memcpy(ptr8, &entry->data[group_offset], copy);
+		releaseGroup(entry);
+		total += copy;
+		ptr8 += copy;
+		offset += copy;
+	}
+	return total;
+}
+
+/**
+ * Decrypt a group.
+ * @param aesw		[in] AES context. (Key must be set to the title key.)
+ * @param encBuf	[in] Temporary buffer for encrypted data. (GROUP_SIZE_ENC)
+ * @param group		[in] Group number.
+ * @param out		[out] Output buffer. (GROUP_SIZE_DEC)
+ * @param pSize		[out] Size of the decrypted data, in bytes.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+int WiiPartitionReader::decryptGroup(AesCtx *aesw, uint8_t *encBuf,
+	uint32_t group, uint8_t *out, uint32_t *pSize)
+{
+	assert(group < m_group_count);
+
+	// The last group may be partial.
+	uint32_t sectors = m_sector_count - (group * 64);
+	if (sectors > 64) {
+		sectors = 64;
+	}
+
+	// If the reader supports zero-copy access,
+	// decrypt directly from the mapped data.
+	const uint32_t lba_start = m_lba_data + (group * LBA_COUNT_ENC);
+	const uint32_t lba_len = sectors * SECTOR_LBA_ENC;
+	const uint8_t *src = m_reader->map(lba_start, lba_len);
+	if (!src) {
+		errno = 0;
+		if (m_reader->read(encBuf, lba_start, lba_len) != lba_len) {
+			// Read error.
+			int err = errno;
+			if (err == 0) {
+				err = EIO;
+			}
+			return -err;
+		}
+		src = encBuf;
+	}
+
+	// Decrypt the user data.
+	const Wii_Disc_Sector_t *sbuf = reinterpret_cast<const Wii_Disc_Sector_t*>(src);
+	for (uint32_t i = 0; i < sectors; i++, sbuf++, out += SECTOR_SIZE_DEC) {
+		// User data IV is stored within the encrypted H2 table.
+		memcpy(out, sbuf->data, SECTOR_SIZE_DEC);
+		aesw_set_iv(aesw, &sbuf->hashes.H2[7][4], 16);
+		aesw_decrypt(aesw, out, SECTOR_SIZE_DEC);
+	}
+
+	*pSize = sectors * SECTOR_SIZE_DEC;
+	return 0;
+}
+
+/**
+ * Get a decrypted group, decrypting it if it isn't cached.
+ * The returned entry won't be replaced until releaseGroup() is called.
+ * @param group	[in] Group number.
+ * @return Cache entry, or nullptr on error.
+ */
+const WiiPartitionReader::CacheEntry *WiiPartitionReader::getGroup(uint32_t group)
+{
+	unique_lock<mutex> lock(m_mutex);
+
+	CacheEntry *entry;
+	for (;;) {
+		// Check if the group is cached.
+		entry = nullptr;
+		for (auto iter = m_cache.begin(); iter != m_cache.end(); ++iter) {
+			if (iter->state != CacheEntry::STATE_EMPTY && iter->group == group) {
+				entry = &(*iter);
+				break;
+			}
+		}
+
+		if (entry) {
+			if (entry->state == CacheEntry::STATE_READY) {
+				// Found the group.
+				break;
+			}
+
+			// The group is being decrypted by another thread.
+			// Wait for it, then check again, since the
+			// decryption may have failed.
+			m_cond.wait(lock);
+			continue;
+		}
+
+		// Not cached. Decrypt the group.
+		entry = findVictim(nullptr);
+		if (!entry) {
+			// All entries are in use by other threads.
+			m_cond.wait(lock);
+			continue;
+		}
+		if (!entry->data) {
+			entry->data = static_cast<uint8_t*>(aligned_malloc(RVTH_PAGE_SIZE, GROUP_SIZE_DEC));
+			if (!entry->data) {
+				// Error allocating memory.
+				errno = ENOMEM;
+				return nullptr;
+			}
+		}
+
+		// Get a decryption context.
+		DecryptCtx ctx;
+		if (!m_decryptBusy) {
+			ctx.aesw = m_aesw;
+			ctx.encBuf = m_encBuf;
+			m_decryptBusy = true;
+		} else if (!m_spareCtx.empty()) {
+			ctx = m_spareCtx.back();
+			m_spareCtx.pop_back();
+		} else {
+			// Another thread is decrypting a different group.
+			ctx.aesw = aesw_new();
+			ctx.encBuf = static_cast<uint8_t*>(aligned_malloc(RVTH_PAGE_SIZE, GROUP_SIZE_ENC));
+			if (!ctx.aesw || !ctx.encBuf) {
+				// Error initializing decryption.
+				aligned_free(ctx.encBuf);
+				if (ctx.aesw) {
+					aesw_free(ctx.aesw);
+				}
+				errno = ENOMEM;
+				return nullptr;
+			}
+			aesw_set_key(ctx.aesw, m_titleKey, sizeof(m_titleKey));
+		}
+
+		// Other threads will wait for the entry while it's loading,
+		// so the lock can be released while decrypting.
+		entry->state = CacheEntry::STATE_LOADING;
+		entry->group = group;
+		lock.unlock();
+		int ret = decryptGroup(ctx.aesw, ctx.encBuf, group, entry->data, &entry->size);
+		lock.lock();
+
+		if (ctx.aesw == m_aesw) {
+			m_decryptBusy = false;
+		} else {
+			m_spareCtx.push_back(ctx);
+		}
+		entry->state = (ret == 0 ? CacheEntry::STATE_READY : CacheEntry::STATE_EMPTY);
+		m_cond.notify_all();
+		if (ret != 0) {
+			// Error decrypting the group.
+			errno = -ret;
+			return nullptr;
+		}
+		break;
+	}
+	entry->refs++;
+	entry->lastUsed = ++m_useCounter;
+
+	// If the reads are moving sequentially through the
+	// partition, start decrypting the next group.
+	if (group != m_lastGroup) {
+		if (m_prefetchEnabled && m_lastGroup != ~0U &&
+		    group == m_lastGroup + 1 && group + 1 < m_group_count)
+		{
+			prefetch(group + 1, entry);
+		}
+		m_lastGroup = group;
+	}
+	return entry;
+}
+
+/**
+ * Release a cache entry returned by getGroup().
+ * @param entry	[in] Cache entry.
+ */
+void WiiPartitionReader::releaseGroup(const CacheEntry *entry)
+{
+	lock_guard<mutex> lock(m_mutex);
+	CacheEntry *const ent = const_cast<CacheEntry*>(entry);
+	assert(ent->refs > 0);
+	if (--ent->refs == 0) {
+		// Wake up any threads waiting for a free entry.
+		m_cond.notify_all();
+	}
+}
+
+/**
+ * Find a cache entry to replace.
+ * Must be called with m_mutex held.
+ * @param exclude	[in,opt] Entry that must not be replaced.
+ * @return Cache entry, or nullptr if all entries are in use.
+ */
+WiiPartitionReader::CacheEntry *WiiPartitionReader::findVictim(const CacheEntry *exclude)
+{
+	// Use an empty entry if available.
+	// Otherwise, use the least recently used entry.
+	CacheEntry *victim = nullptr;
+	for (auto iter = m_cache.begin(); iter != m_cache.end(); ++iter) {
+		CacheEntry *const entry = &(*iter);
+		if (entry == exclude || entry->state == CacheEntry::STATE_LOADING || entry->refs > 0) {
+			continue;
+		} else if (entry->state == CacheEntry::STATE_EMPTY) {
+			return entry;
+		} else if (!victim || entry->lastUsed < victim->lastUsed) {
+			victim = entry;
+		}
+	}
+	return victim;
+}
+
+/**
+ * Start decrypting a group in the background.
+ * Must be called with m_mutex held.
+ * @param group		[in] Group number.
+ * @param exclude	[in] Entry that must not be replaced.
+ */
+void WiiPartitionReader::prefetch(uint32_t group, const CacheEntry *exclude)
+{
+#ifdef HAVE_PREAD
+	if (m_prefetchEntry) {
+		// A group is already being prefetched.
+		return;
+	}
+
+	// Check if the group is already cached.
+	for (auto iter = m_cache.begin(); iter != m_cache.end(); ++iter) {
+		if (iter->state != CacheEntry::STATE_EMPTY && iter->group == group) {
+			return;
+		}
+	}
+
+	CacheEntry *const entry = findVictim(exclude);
+	if (!entry) {
+		// No entries available.
+		return;
+	}
+
+	if (!m_thread.joinable()) {
+		// Start the prefetch thread.
+		// It has its own AES context and encrypted data buffer.
+		if (!m_aeswPrefetch) {
+			m_aeswPrefetch = aesw_new();
+			if (!m_aeswPrefetch) {
+				return;
+			}
+			aesw_set_key(m_aeswPrefetch, m_titleKey, sizeof(m_titleKey));
+		}
+		if (!m_encBufPrefetch) {
+			m_encBufPrefetch = static_cast<uint8_t*>(aligned_malloc(RVTH_PAGE_SIZE, GROUP_SIZE_ENC));
+			if (!m_encBufPrefetch) {
+				return;
+			}
+		}
+		try {
+			m_thread = std::thread(&WiiPartitionReader::run, this);
+		} catch (const std::system_error&) {
+			// Unable to create the thread.
+			// Groups will be decrypted when they're read.
+			return;
+		}
+	}
+
+	if (!entry->data) {
+		entry->data = static_cast<uint8_t*>(aligned_malloc(RVTH_PAGE_SIZE, GROUP_SIZE_DEC));
+		if (!entry->data) {
+			return;
+		}
+	}
+
+	entry->group = group;
+	entry->state = CacheEntry::STATE_LOADING;
+	m_prefetchEntry = entry;
+	m_prefetchQueued = true;
+	m_cond.notify_all();
+#else /* !HAVE_PREAD */
+	// Without pread(), RefFile::pread() is serialized using a
+	// mutex, so reading in the background wouldn't overlap.
+	UNUSED(group);
+	UNUSED(exclude);
+#endif /* HAVE_PREAD */
+}
+
+/**
+ * Prefetch thread function.
+ */
+void WiiPartitionReader::run(void)
+{
+	unique_lock<mutex> lock(m_mutex);
+	for (;;) {
+		m_cond.wait(lock, [this] { return m_stop || m_prefetchQueued; });
+		if (m_stop) {
+			break;
+		}
+		m_prefetchQueued = false;
+
+		// Other threads don't modify entries that are
+		// being decrypted, so the lock can be released.
+		CacheEntry *const entry = m_prefetchEntry;
+		lock.unlock();
+		uint32_t size = 0;
+		int ret = decryptGroup(m_aeswPrefetch, m_encBufPrefetch, entry->group, entry->data, &size);
+		lock.lock();
+
+		entry->size = size;
+		entry->state = (ret == 0 ? CacheEntry::STATE_READY : CacheEntry::STATE_EMPTY);
+		entry->lastUsed = ++m_useCounter;
+		m_prefetchEntry = nullptr;
+		m_cond.notify_all();
+	}
+}
@@ -0,0 +1,240 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * WiiPartitionReader.hpp: Decrypted Wii partition reader.                 *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_READER_WIIPARTITIONREADER_HPP__
+#define __RVTHTOOL_LIBRVTH_READER_WIIPARTITIONREADER_HPP__
+
+#include "Reader.hpp"
+#include "nhcd_structs.h"
+
+// C++ includes.
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct _AesCtx;
+struct _pt_entry_t;
+
+/**
+ * Reads the user data of a Wii partition.
+ *
+ * LBAs are relative to the start of the partition's user data, i.e.
+ * the decrypted address space without hash tables. Each 32 KB sector
+ * on the disc contains 31 KB (62 LBAs) of user data.
+ *
+ * For encrypted partitions, whole 2 MB groups are decrypted and kept
+ * in an LRU cache, so small reads don't have to decrypt the same
+ * sectors again. If the reads move sequentially from one group to the
+ * next, the following group is decrypted in a background thread.
+ *
+ * Unencrypted partitions are read directly from the disc image.
+ *
+ * read() and pread() can be called from multiple threads at the same
+ * time if the underlying reader supports it. Each group is only
+ * decrypted once, even if several threads request it at once.
+ *
+ * NOTE: The underlying reader is not owned by this reader,
+ * and it must remain valid until this reader is deleted.
+ */
+class WiiPartitionReader : public Reader
+{
+	public:
+		/**
+		 * Create a reader for a Wii partition's user data.
+		 * @param reader	[in] Disc image reader.
+		 * @param lba_data	[in] Starting LBA of the partition's data area, relative to reader.
+		 * @param lba_data_len	[in] Length of the data area, in LBAs. (as stored on the disc)
+		 * @param titleKey	[in,opt] Decrypted title key. (16 bytes; NULL if unencrypted)
+		 * @param cache_groups	[in] Number of decrypted groups to cache. (minimum 2)
+		 */
+		WiiPartitionReader(Reader *reader, uint32_t lba_data, uint32_t lba_data_len,
+			const uint8_t *titleKey, unsigned int cache_groups = 4);
+		~WiiPartitionReader();
+
+	private:
+		typedef Reader super;
+		DISABLE_COPY(WiiPartitionReader)
+
+	public:
+		/**
+		 * Create a reader for a Wii partition's user data.
+		 *
+		 * The partition header is read to find the data area.
+		 * For encrypted partitions, the title key is decrypted
+		 * using the common key specified in the ticket.
+		 *
+		 * @param reader	[in] Disc image reader.
+		 * @param pte		[in] Partition table entry.
+		 * @param encrypted	[in] If true, the partition is encrypted.
+		 * @param pErr		[out,opt] Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 * @return WiiPartitionReader*, or NULL on error.
+		 */
+		static WiiPartitionReader *open(Reader *reader, const struct _pt_entry_t *pte,
+			bool encrypted, int *pErr = nullptr);
+
+	public:
+		/** I/O functions **/
+
+		/**
+		 * Read user data from the partition.
+		 * @param ptr		[out] Read buffer.
+		 * @param lba_start	[in] Starting LBA.
+		 * @param lba_len	[in] Length, in LBAs.
+		 * @return Number of LBAs read, or 0 on error.
+		 */
+		uint32_t read(void *ptr, uint32_t lba_start, uint32_t lba_len) final;
+
+		/**
+		 * Read user data from the partition.
+		 * This can be used for reads that aren't LBA-aligned,
+		 * e.g. files within the partition.
+		 * @param ptr		[out] Read buffer.
+		 * @param size		[in] Number of bytes to read.
+		 * @param offset	[in] Offset, in bytes, relative to the start of the user data.
+		 * @return Number of bytes read. (May be short on error or at the end of the partition.)
+		 */
+		size_t pread(void *ptr, size_t size, int64_t offset);
+
+	public:
+		/** Accessors **/
+
+		/**
+		 * Is the partition encrypted?
+		 * @return True if encrypted; false if not.
+		 */
+		inline bool isEncrypted(void) const
+		{
+			return (m_aesw != nullptr);
+		}
+
+		/**
+		 * Get the size of the user data.
+		 * @return Size of the user data, in bytes.
+		 */
+		inline int64_t dataSize(void) const
+		{
+			return LBA_TO_BYTES(m_lba_len);
+		}
+
+		/**
+		 * Enable or disable background decryption of the next group
+		 * when reading sequentially. (Enabled by default.)
+		 *
+		 * This should be disabled if only a few small reads are needed,
+		 * e.g. when checking the boot block, since the next group would
+		 * be decrypted for nothing.
+		 *
+		 * @param enable True to enable; false to disable.
+		 */
+		inline void setPrefetch(bool enable)
+		{
+			m_prefetchEnabled = enable;
+		}
+
+	private:
+		// Decrypted group cache entry.
+		struct CacheEntry {
+			uint8_t *data;		// Decrypted user data. (GROUP_SIZE_DEC)
+			uint32_t group;		// Group number.
+			uint32_t size;		// Size of the valid data, in bytes.
+			uint32_t refs;		// Number of readers copying from this entry.
+			uint64_t lastUsed;	// LRU counter value when last used.
+			enum State : uint8_t {
+				STATE_EMPTY,	// Not valid.
+				STATE_LOADING,	// Being decrypted.
+				STATE_READY,	// Valid.
+			} state;
+		};
+
+		/**
+		 * Decrypt a group.
+		 * @param aesw		[in] AES context. (Key must be set to the title key.)
+		 * @param encBuf	[in] Temporary buffer for encrypted data. (GROUP_SIZE_ENC)
+		 * @param group		[in] Group number.
+		 * @param out		[out] Output buffer. (GROUP_SIZE_DEC)
+		 * @param pSize		[out] Size of the decrypted data, in bytes.
+		 * @return 0 on success; negative POSIX error code on error.
+		 */
+		int decryptGroup(struct _AesCtx *aesw, uint8_t *encBuf,
+			uint32_t group, uint8_t *out, uint32_t *pSize);
+
+		/**
+		 * Get a decrypted group, decrypting it if it isn't cached.
+		 * The returned entry won't be replaced until releaseGroup() is called.
+		 * @param group	[in] Group number.
+		 * @return Cache entry, or nullptr on error.
+		 */
+		const CacheEntry *getGroup(uint32_t group);
+
+		/**
+		 * Release a cache entry returned by getGroup().
+		 * @param entry	[in] Cache entry.
+		 */
+		void releaseGroup(const CacheEntry *entry);
+
+		/**
+		 * Find a cache entry to replace.
+		 * Entries that are being decrypted or read can't be replaced.
+		 * Must be called with m_mutex held.
+		 * @param exclude	[in,opt] Entry that must not be replaced.
+		 * @return Cache entry, or nullptr if all entries are in use.
+		 */
+		CacheEntry *findVictim(const CacheEntry *exclude);
+
+		/**
+		 * Start decrypting a group in the background.
+		 * Must be called with m_mutex held.
+		 * @param group		[in] Group number.
+		 * @param exclude	[in] Entry that must not be replaced.
+		 */
+		void prefetch(uint32_t group, const CacheEntry *exclude);
+
+		/**
+		 * Prefetch thread function.
+		 */
+		void run(void);
+
+	private:
+		Reader *m_reader;		// Disc image reader. (not owned)
+		uint32_t m_lba_data;		// Starting LBA of the data area, relative to m_reader.
+		uint32_t m_sector_count;	// Number of encrypted sectors.
+		uint32_t m_group_count;		// Number of groups.
+
+		// Decryption.
+		// If another thread is already using m_aesw and m_encBuf,
+		// a spare context is used instead.
+		struct DecryptCtx {
+			struct _AesCtx *aesw;
+			uint8_t *encBuf;
+		};
+		struct _AesCtx *m_aesw;
+		uint8_t *m_encBuf;
+		bool m_decryptBusy;
+		std::vector<DecryptCtx> m_spareCtx;
+		uint8_t m_titleKey[16];
+
+		// Decrypted group cache.
+		// Entries are only replaced by threads calling getGroup().
+		std::vector<CacheEntry> m_cache;
+		uint64_t m_useCounter;
+		uint32_t m_lastGroup;		// Last group read. (for sequential access detection)
+
+		// Prefetch thread.
+		std::thread m_thread;
+		std::mutex m_mutex;
+		std::condition_variable m_cond;
+		struct _AesCtx *m_aeswPrefetch;
+		uint8_t *m_encBufPrefetch;
+		CacheEntry *m_prefetchEntry;	// Entry being prefetched, or nullptr if idle.
+		bool m_prefetchQueued;		// Is m_prefetchEntry waiting for the thread?
+		bool m_prefetchEnabled;
+		bool m_stop;
+};
+
+#endif /* __RVTHTOOL_LIBRVTH_READER_WIIPARTITIONREADER_HPP__ */
@@ -167,6 +167,9 @@ int RvtH::recryptID(unsigned int bank)
 		return -ERANGE;
 	}
 
+	// Make sure the bank entry is fully initialized.
+	loadBankEntry(bank);
+
 	// Check the bank type.
 	RvtH_BankEntry *const entry = &m_entries[bank];
 	bool is_wii;
@@ -369,6 +372,9 @@ int RvtH::recryptWiiPartitions(unsigned int bank,
 		return -ERANGE;
 	}
 
+	// Make sure the bank entry is fully initialized.
+	loadBankEntry(bank);
+
 	// Check the bank type.
 	RvtH_BankEntry *const entry = &m_entries[bank];
 	switch (entry->type) {
@@ -448,6 +454,7 @@ int RvtH::recryptWiiPartitions(unsigned int bank,
 		state.type = RVTH_PROGRESS_RECRYPT;
 		state.lba_processed = 0;
 		state.lba_total = 1;
+		state.digests = nullptr;
 		callback(&state, userdata);
 	}
 
@@ -6,14 +6,18 @@
  * SPDX-License-Identifier: GPL-2.0-or-later                               *
  ***************************************************************************/
 
+#include "config.librvth.h"
+
 #include "rvth.hpp"
 
 #include "nhcd_structs.h"
 #include "disc_header.hpp"
 #include "ptbl.h"
 #include "bank_init.h"
+#include "bank_cache.h"
 #include "rvth_error.h"
 #include "reader/Reader.hpp"
+#include "GroupQueue.hpp"
 
 #include "libwiicrypto/byteswap.h"
 #include "libwiicrypto/cert.h"
@@ -26,6 +30,12 @@
 #include <stdlib.h>
 #include <string.h>
 
+// C++ includes.
+#include <mutex>
+using std::lock_guard;
+using std::mutex;
+using std::unique_lock;
+
 /**
  * Open a Wii or GameCube disc image.
  * @param f_img	[in] RefFile*
@@ -133,15 +143,9 @@ int RvtH::openGcm(RefFile *f_img)
 
 	if (type != RVTH_BankType_Empty) {
 		// Copy the disc header.
+		// NOTE: The region code, encryption status, and AppLoader
+		// status are initialized when the bank entry is accessed.
 		memcpy(&entry->discHeader, &discHeader.gcn, sizeof(entry->discHeader));
-
-		// TODO: Error handling.
-		// Initialize the region code.
-		rvth_init_BankEntry_region(entry);
-		// Initialize the encryption status.
-		rvth_init_BankEntry_crypto(entry);
-		// Initialize the AppLoader error status.
-		rvth_init_BankEntry_AppLoader(entry);
 	}
 
 	// Disc image loaded.
@@ -256,9 +260,12 @@ int RvtH::openHDD(RefFile *f_img)
 	int err = 0;	// errno setting
 
 	unsigned int i;
-	int64_t addr;
 	size_t size;
 
+	// NHCD bank table, including the header.
+	uint8_t *nhcd_table = nullptr;
+	size_t nhcd_table_size;
+
 	// Check the bank table header.
 	size = f_img->seekoAndRead(LBA_TO_BYTES(NHCD_BANKTABLE_ADDRESS_LBA), SEEK_SET,
 		&nhcd_header, 1, sizeof(nhcd_header));
@@ -321,9 +328,12 @@ int RvtH::openHDD(RefFile *f_img)
 		lba_start = NHCD_BANK_START_LBA(0, 8);
 		for (i = 0; i < m_bankCount; i++, rvth_entry++, lba_start += NHCD_BANK_SIZE_LBA) {
 			// Use "Empty" so we can try to detect the actual bank type.
-			rvth_init_BankEntry(rvth_entry, f_img,
+			if (rvth_init_BankEntry(rvth_entry, f_img,
 				RVTH_BankType_Empty,
-				lba_start, NHCD_BANK_SIZE_LBA, 0);
+				lba_start, NHCD_BANK_SIZE_LBA, 0) != 0)
+			{
+				m_bankEntryInitErr = true;
+			}
 		}
 
 		// RVT-H image loaded.
@@ -358,11 +368,46 @@ int RvtH::openHDD(RefFile *f_img)
 		goto fail;
 	};
 
+	// Read the entire NHCD bank table.
+	// This is used to validate the bank cache.
+	nhcd_table_size = (m_bankCount + 1) * NHCD_BLOCK_SIZE;
+	nhcd_table = static_cast<uint8_t*>(malloc(nhcd_table_size));
+	if (!nhcd_table) {
+		// Error allocating memory.
+		err = ENOMEM;
+		ret = -err;
+		goto fail;
+	}
+	memcpy(nhcd_table, &nhcd_header, sizeof(nhcd_header));
+	size = f_img->seekoAndRead(LBA_TO_BYTES(NHCD_BANKTABLE_ADDRESS_LBA) + NHCD_BLOCK_SIZE, SEEK_SET,
+		&nhcd_table[NHCD_BLOCK_SIZE], 1, m_bankCount * NHCD_BLOCK_SIZE);
+	if (size != m_bankCount * NHCD_BLOCK_SIZE) {
+		// Short read.
+		err = errno;
+		if (err == 0) {
+			err = EIO;
+		}
+		ret = -err;
+		goto fail;
+	}
+
 	m_file = f_img->ref();
+
+	// If the bank table hasn't changed, use the cached bank entries.
+	static_assert(sizeof(m_nhcdHash) == RVTH_BANK_CACHE_HASH_SIZE, "m_nhcdHash has the wrong size");
+	rvth_bank_cache_hash_nhcd(nhcd_table, nhcd_table_size, m_nhcdHash);
+	if (rvth_bank_cache_load(f_img, m_nhcdHash, m_entries, m_bankCount) == 0) {
+		// Bank entries loaded from the cache.
+		// All bank entries are fully initialized.
+		free(nhcd_table);
+		m_bankEntryLoaded = (m_bankCount >= 32 ? ~0U : ((1U << m_bankCount) - 1));
+		return RVTH_ERROR_SUCCESS;
+	}
+
 	rvth_entry = m_entries;
-	addr = (uint32_t)(LBA_TO_BYTES(NHCD_BANKTABLE_ADDRESS_LBA) + NHCD_BLOCK_SIZE);
-	for (i = 0; i < m_bankCount; i++, rvth_entry++, addr += 512) {
-		NHCD_BankEntry nhcd_entry;
+	for (i = 0; i < m_bankCount; i++, rvth_entry++) {
+		const NHCD_BankEntry *const nhcd_entry =
+			reinterpret_cast<const NHCD_BankEntry*>(&nhcd_table[(i + 1) * NHCD_BLOCK_SIZE]);
 		uint32_t lba_start = 0, lba_len = 0;
 		uint8_t type = RVTH_BankType_Unknown;
 
@@ -373,29 +418,8 @@ int RvtH::openHDD(RefFile *f_img)
 			continue;
 		}
 
-		ret = f_img->seeko(addr, SEEK_SET);
-		if (ret != 0) {
-			// Seek error.
-			err = errno;
-			if (err == 0) {
-				err = EIO;
-			}
-			ret = -err;
-			goto fail;
-		}
-		size = f_img->read(&nhcd_entry, 1, sizeof(nhcd_entry));
-		if (size != sizeof(nhcd_entry)) {
-			// Short read.
-			err = errno;
-			if (err == 0) {
-				err = EIO;
-			}
-			ret = -err;
-			goto fail;
-		}
-
 		// Check the type.
-		switch (be32_to_cpu(nhcd_entry.type)) {
+		switch (be32_to_cpu(nhcd_entry->type)) {
 			default:
 				// Unknown bank type...
 				type = RVTH_BankType_Unknown;
@@ -421,8 +445,8 @@ int RvtH::openHDD(RefFile *f_img)
 
 		// For valid types, use the listed LBAs if they're non-zero.
 		if (type >= RVTH_BankType_GCN) {
-			lba_start = be32_to_cpu(nhcd_entry.lba_start);
-			lba_len = be32_to_cpu(nhcd_entry.lba_len);
+			lba_start = be32_to_cpu(nhcd_entry->lba_start);
+			lba_len = be32_to_cpu(nhcd_entry->lba_len);
 		}
 
 		if (lba_start == 0 || lba_len == 0) {
@@ -433,15 +457,24 @@ int RvtH::openHDD(RefFile *f_img)
 		}
 
 		// Initialize the bank entry.
-		rvth_init_BankEntry(rvth_entry, f_img, type,
-			lba_start, lba_len, nhcd_entry.timestamp);
+		// NOTE: Only the disc header is read here. Everything else
+		// is loaded when the bank entry is accessed.
+		if (rvth_init_BankEntry(rvth_entry, f_img, type,
+			lba_start, lba_len, nhcd_entry->timestamp) != 0)
+		{
+			// I/O error. Don't cache the bank entries,
+			// since the error might be transient.
+			m_bankEntryInitErr = true;
+		}
 	}
+	free(nhcd_table);
 
 	// RVT-H image loaded.
 	return RVTH_ERROR_SUCCESS;
 
 fail:
 	// Failed to open the HDD image.
+	free(nhcd_table);
 	if (m_file) {
 		m_file->unref();
 		m_file = nullptr;
@@ -462,8 +495,12 @@ RvtH::RvtH(const TCHAR *filename, int *pErr)
 	, m_bankCount(0)
 	, m_imageType(RVTH_ImageType_Unknown)
 	, m_NHCD_status(NHCD_STATUS_UNKNOWN)
+	, m_ioQueueDepth(RVTH_IO_QUEUE_DEPTH_DEFAULT)
 	, m_entries(nullptr)
+	, m_bankEntryLoaded(0)
+	, m_bankEntryInitErr(false)
 {
+	memset(m_nhcdHash, 0, sizeof(m_nhcdHash));
 	// Open the disk image.
 	RefFile *const f_img = new RefFile(filename);
 	if (!f_img->isOpen()) {
@@ -564,5 +601,180 @@ const RvtH_BankEntry *RvtH::bankEntry(unsigned int bank, int *pErr) const
 		return nullptr;
 	}
 
+	// Make sure the bank entry is fully initialized.
+	// NOTE: I/O errors are ignored here, since the
+	// bank entry is still usable.
+	loadBankEntry(bank);
 	return &m_entries[bank];
 }
+
+/**
+ * Fully initialize all bank entries.
+ *
+ * When an RVT-H image is opened, only the disc headers are read.
+ * Everything else is loaded when the bank entry is first accessed.
+ * Call this function before accessing all of the bank entries,
+ * e.g. when listing the banks. For RVT-H HDD images and devices,
+ * this also updates the bank cache.
+ *
+ * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+int RvtH::prefetchBankEntries(void)
+{
+	const uint32_t allLoaded = (m_bankCount >= 32 ? ~0U : ((1U << m_bankCount) - 1));
+	unique_lock<mutex> lock(m_bankEntryMutex);
+	if (m_bankEntryLoaded == allLoaded) {
+		// All bank entries are already initialized.
+		return 0;
+	}
+
+	int ret = 0;
+#ifdef HAVE_PREAD
+	// Each bank entry is independent, so if the underlying storage
+	// doesn't have a seek penalty, initialize them in parallel.
+	// Rotational devices are read sequentially in LBA order.
+	// NOTE: RefFile::pread() isn't thread-safe without pread().
+	if (!m_file->isRotational()) {
+		unsigned int unloaded = 0;
+		for (unsigned int bank = 0; bank < m_bankCount; bank++) {
+			if (!(m_bankEntryLoaded & (1U << bank))) {
+				unloaded++;
+			}
+		}
+
+		unsigned int threads = GroupQueue::defaultThreadCount();
+		if (threads > unloaded) {
+			threads = unloaded;
+		}
+		if (threads > 1) {
+			ret = loadBankEntriesParallel(threads);
+		}
+	}
+#endif /* HAVE_PREAD */
+	lock.unlock();
+
+	// Initialize any remaining bank entries sequentially.
+	for (unsigned int bank = 0; bank < m_bankCount; bank++) {
+		int bret = loadBankEntry(bank);
+		if (bret != 0 && ret == 0) {
+			ret = bret;
+		}
+	}
+
+	// Save the bank entries to the cache.
+	// All bank entries are initialized at this point,
+	// so they won't be modified by other threads.
+	// NOTE: If an I/O error occurred, the bank entries aren't
+	// cached, since the error might be transient. If the RVT-H
+	// is writable, the bank entries may have been modified.
+	// Errors are ignored, since the cache is optional.
+	if (isHDD() && m_NHCD_status == NHCD_STATUS_OK &&
+	    !m_bankEntryInitErr && !m_file->isWritable())
+	{
+		rvth_bank_cache_save(m_file, m_nhcdHash, m_entries, m_bankCount);
+	}
+
+	return ret;
+}
+
+/**
+ * Fully initialize a bank entry if it hasn't been initialized yet.
+ * @param bank	[in] Bank number. (Must be in range.)
+ * @return 0 on success; negative POSIX error code on I/O error.
+ */
+int RvtH::loadBankEntry(unsigned int bank) const
+{
+	assert(bank < m_bankCount);
+	// NOTE: The lock is held while the bank entry is initialized,
+	// so other threads don't initialize the same bank entry or
+	// access it before it's fully initialized.
+	lock_guard<mutex> lock(m_bankEntryMutex);
+	if (m_bankEntryLoaded & (1U << bank)) {
+		// Bank entry is already initialized.
+		return 0;
+	}
+
+	// NOTE: The bank entry is marked as initialized even if
+	// an error occurs, since the error would most likely
+	// occur again. This matches the original behavior of
+	// initializing all bank entries when opening the image.
+	m_bankEntryLoaded |= (1U << bank);
+	int ret = rvth_init_BankEntry_details(&m_entries[bank]);
+	if (ret != 0) {
+		m_bankEntryInitErr = true;
+	}
+	return ret;
+}
+
+/**
+ * Fully initialize all bank entries that haven't been
+ * initialized yet using a pool of worker threads.
+ *
+ * The file must support concurrent positional reads.
+ * The caller must hold m_bankEntryMutex.
+ * If the worker threads can't be started, no bank entries
+ * are initialized, and the caller should fall back to
+ * initializing them one at a time.
+ *
+ * @param threads	[in] Number of worker threads.
+ * @return 0 on success; negative POSIX error code on I/O error.
+ */
+int RvtH::loadBankEntriesParallel(unsigned int threads)
+{
+	// NOTE: The job buffers aren't used, since each worker
+	// reads from the bank's own Reader. Each worker only
+	// modifies its own bank entry. The Readers share the
+	// RvtH's RefFile, which uses positional I/O and an
+	// atomic reference count, so it can be used from
+	// multiple threads. The loaded bitfield is only
+	// updated by this thread.
+	GroupQueue queue(LBA_SIZE, LBA_SIZE, threads);
+	int ret = queue.start([this](unsigned int worker, GroupQueue::Job *job) -> int {
+		((void)worker);
+		return rvth_init_BankEntry_details(&m_entries[job->index]);
+	});
+	if (ret != 0) {
+		// Unable to start the worker threads.
+		return 0;
+	}
+
+	// Record the result of a processed job.
+	// Jobs are returned in submission order, so the first
+	// error is reported for the lowest-numbered bank.
+	auto finishJob = [this, &queue, &ret](GroupQueue::Job *job) {
+		m_bankEntryLoaded |= (1U << job->index);
+		if (job->ret != 0) {
+			m_bankEntryInitErr = true;
+			if (ret == 0) {
+				ret = job->ret;
+			}
+		}
+		queue.release(job);
+	};
+
+	for (unsigned int bank = 0; bank < m_bankCount; bank++) {
+		if (m_bankEntryLoaded & (1U << bank)) {
+			// Bank entry is already initialized.
+			continue;
+		}
+
+		GroupQueue::Job *job = queue.acquire();
+		while (!job) {
+			// All jobs are busy. Wait for the oldest one.
+			finishJob(queue.next());
+			job = queue.acquire();
+		}
+
+		job->src = job->in;
+		job->index = bank;
+		queue.submit(job);
+	}
+
+	// Wait for the remaining jobs.
+	GroupQueue::Job *job;
+	while ((job = queue.next()) != nullptr) {
+		finishJob(job);
+	}
+
+	return ret;
+}
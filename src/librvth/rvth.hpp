@@ -95,8 +95,18 @@ typedef enum {
 	RVTH_PROGRESS_EXTRACT,		// Extract image
 	RVTH_PROGRESS_IMPORT,		// Import image
 	RVTH_PROGRESS_RECRYPT,		// Recrypt image
+	RVTH_PROGRESS_VERIFY,		// Verify image
+	RVTH_PROGRESS_DIGEST,		// Compute digests of an image
 } RvtH_Progress_Type;
 
+// Digests of a disc image.
+typedef struct _RvtH_Digests {
+	uint64_t size;		// Size of the hashed data, in bytes.
+	uint32_t crc32;		// CRC32
+	uint8_t md5[16];	// MD5
+	uint8_t sha1[20];	// SHA-1
+} RvtH_Digests;
+
 // Progress callback status.
 typedef struct _RvtH_Progress_State {
 	// RvtH objects.
@@ -117,6 +127,10 @@ typedef struct _RvtH_Progress_State {
 	// Otherwise, we're encrypting/decrypting.
 	uint32_t lba_processed;
 	uint32_t lba_total;
+
+	// Digests of the image, if requested.
+	// Only set in the final callback. (NULL otherwise)
+	const RvtH_Digests *digests;
 } RvtH_Progress_State;
 
 /**
@@ -127,12 +141,54 @@ typedef struct _RvtH_Progress_State {
  */
 typedef bool (*RvtH_Progress_Callback)(const RvtH_Progress_State *state, void *userdata);
 
+/** Hash verification **/
+
+// Hash verification error type.
+typedef enum {
+	RVTH_VERIFY_ERROR_H0	= 0,	// H0: 1 KB data block doesn't match the sector's H0 table.
+	RVTH_VERIFY_ERROR_H1,		// H1: Sector's H0 table doesn't match the H1 table.
+	RVTH_VERIFY_ERROR_H2,		// H2: Sector's H1 table doesn't match the H2 table.
+	RVTH_VERIFY_ERROR_H3,		// H3: Sector's H2 table doesn't match the H3 table.
+	RVTH_VERIFY_ERROR_H4,		// H4: H3 table doesn't match the TMD content hash.
+} RvtH_Verify_Error_Type;
+
+// Hash verification error.
+typedef struct _RvtH_Verify_Error {
+	RvtH_Verify_Error_Type type;	// Error type.
+	unsigned int pt_idx;		// Partition index in the bank's partition table.
+	uint32_t group;			// Group number in the partition. (H0-H3 only)
+	unsigned int sector;		// Sector number in the group. (0-63; H0-H3 only)
+	unsigned int block;		// 1 KB block number in the sector. (0-30; H0 only)
+	uint32_t lba;			// Absolute LBA of the sector, or the H3 table for H4.
+} RvtH_Verify_Error;
+
+/**
+ * RVT-H hash verification error callback.
+ * @param error		[in] Verification error.
+ * @param userdata	[in] User data specified when calling the RVT-H function.
+ * @return True to continue; false to abort.
+ */
+typedef bool (*RvtH_Verify_Callback)(const RvtH_Verify_Error *error, void *userdata);
+
+/** I/O options **/
+
+// Default number of 1 MB chunks in flight when extracting or importing.
+#define RVTH_IO_QUEUE_DEPTH_DEFAULT 4
+// Maximum number of 1 MB chunks in flight.
+#define RVTH_IO_QUEUE_DEPTH_MAX 64
+
 #ifdef __cplusplus
 }
 #endif
 
 #ifdef __cplusplus
 
+// C++ includes.
+#include <mutex>
+
+class FST;
+class ScrubMap;
+
 /** Main class **/
 
 class RvtH {
@@ -157,9 +213,10 @@ class RvtH {
 		 *
 		 * @param filename	[in] Filename.
 		 * @param lba_len	[in] LBA length. (Will NOT be allocated initially.)
+		 * @param flags		[in] Flags. (See RvtH_Extract_Flags; only the output format flags are used.)
 		 * @param pErr		[out,opt] Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
 		 */
-		RvtH(const TCHAR *filename, uint32_t lba_len, int *pErr = nullptr);
+		RvtH(const TCHAR *filename, uint32_t lba_len, unsigned int flags, int *pErr = nullptr);
 
 		~RvtH();
 
@@ -266,12 +323,104 @@ class RvtH {
 
 		/**
 		 * Get a bank table entry.
+		 *
+		 * If the bank entry hasn't been fully initialized yet, the region
+		 * code, encryption status, partition table, and AppLoader status
+		 * are loaded from the disc image first. This can be called from
+		 * multiple threads; each bank entry is only initialized once.
+		 *
 		 * @param bank	[in] Bank number. (0-7)
 		 * @param pErr	[out,opt] Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
 		 * @return Bank table entry.
 		 */
 		const RvtH_BankEntry *bankEntry(unsigned int bank, int *pErr = nullptr) const;
 
+		/**
+		 * Fully initialize all bank entries.
+		 *
+		 * When an RVT-H image is opened, only the disc headers are read.
+		 * Everything else is loaded when the bank entry is first accessed.
+		 * Call this function before accessing all of the bank entries,
+		 * e.g. when listing the banks. For RVT-H HDD images and devices,
+		 * this also updates the bank cache.
+		 *
+		 * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 */
+		int prefetchBankEntries(void);
+
+	private:
+		/**
+		 * Fully initialize a bank entry if it hasn't been initialized yet.
+		 * @param bank	[in] Bank number. (Must be in range.)
+		 * @return 0 on success; negative POSIX error code on I/O error.
+		 */
+		int loadBankEntry(unsigned int bank) const;
+
+		/**
+		 * Fully initialize all bank entries that haven't been
+		 * initialized yet using a pool of worker threads.
+		 *
+		 * The file must support concurrent positional reads.
+		 * The caller must hold m_bankEntryMutex.
+		 * If the worker threads can't be started, no bank entries
+		 * are initialized, and the caller should fall back to
+		 * initializing them one at a time.
+		 *
+		 * @param threads	[in] Number of worker threads.
+		 * @return 0 on success; negative POSIX error code on I/O error.
+		 */
+		int loadBankEntriesParallel(unsigned int threads);
+
+		/**
+		 * Mark a bank entry as fully initialized.
+		 * This is used when a bank entry is set up in memory
+		 * instead of being loaded from the disc image.
+		 * @param bank	[in] Bank number. (Must be in range.)
+		 */
+		inline void setBankEntryLoaded(unsigned int bank)
+		{
+			std::lock_guard<std::mutex> lock(m_bankEntryMutex);
+			m_bankEntryLoaded |= (1U << bank);
+		}
+
+	public:
+		/** I/O options (rvth_p.cpp) **/
+
+		/**
+		 * Enable or disable direct I/O for an RVT-H Reader device.
+		 *
+		 * Direct I/O bypasses the OS page cache when extracting or
+		 * importing banks, which prevents a multi-gigabyte copy from
+		 * evicting everything else from the cache.
+		 *
+		 * @param enable	[in] True to enable; false to disable.
+		 * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 */
+		int setDirectIO(bool enable);
+
+		/**
+		 * Set the I/O queue depth for extracting and importing banks.
+		 *
+		 * This is the number of 1 MB chunks that can be read ahead of
+		 * the writer. On Linux, io_uring is used to keep this many
+		 * reads in flight, plus the corresponding writes, if it's
+		 * available. Otherwise, a read-ahead thread is used.
+		 *
+		 * This applies to copies where this RvtH is the RVT-H side,
+		 * i.e. the source when extracting and the destination when
+		 * importing.
+		 *
+		 * @param depth	[in] Queue depth. (2 to RVTH_IO_QUEUE_DEPTH_MAX; 0 for default)
+		 * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 */
+		int setIoQueueDepth(unsigned int depth);
+
+		/**
+		 * Get the I/O queue depth for extracting and importing banks.
+		 * @return I/O queue depth.
+		 */
+		inline unsigned int ioQueueDepth(void) const { return m_ioQueueDepth; }
+
 	public:
 		/** Write functions (write.cpp) **/
 
@@ -298,11 +447,15 @@ class RvtH {
 		 * @param bank_src	[in] Source bank number. (0-7)
 		 * @param callback	[in,opt] Progress callback.
 		 * @param userdata	[in,opt] User data for progress callback.
+		 * @param scrub		[in,opt] If specified, only copy the LBAs marked as used.
+		 * @param digests	[out,opt] If specified, digests of the copied disc image.
 		 * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
 		 */
 		int copyToGcm(RvtH *rvth_dest, unsigned int bank_src,
 			RvtH_Progress_Callback callback = nullptr,
-			void *userdata = nullptr);
+			void *userdata = nullptr,
+			const ScrubMap *scrub = nullptr,
+			RvtH_Digests *digests = nullptr);
 
 		/**
 		 * Copy a bank from this RVT-H HDD or standalone disc image to a writable standalone disc image.
@@ -321,13 +474,51 @@ class RvtH {
 			RvtH_Progress_Callback callback = nullptr,
 			void *userdata = nullptr);
 
+		/**
+		 * Read the partition header of an encrypted game partition
+		 * and determine which LBAs copyToGcm_doDecrypt() decrypts.
+		 *
+		 * If the partition header has a data size, the encrypted data is
+		 * trimmed to it; otherwise, the rest of the partition is used.
+		 * Only whole sectors are decrypted.
+		 *
+		 * @param reader		[in] Source reader.
+		 * @param game_pte		[in] Game partition.
+		 * @param pthdr			[out] Partition header.
+		 * @param p_data_lba_src	[out] First LBA of the encrypted data.
+		 * @param p_lba_copy_len	[out] Number of encrypted LBAs to decrypt.
+		 * @param p_lba_dest_len	[out,opt] Size of the decrypted disc image, in LBAs.
+		 * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 */
+		static int getDecryptRange(Reader *reader, const struct _pt_entry_t *game_pte,
+			RVL_PartitionHeader *pthdr, uint32_t *p_data_lba_src,
+			uint32_t *p_lba_copy_len, uint32_t *p_lba_dest_len = nullptr);
+
+		/**
+		 * Copy a bank from this RVT-H HDD or standalone disc image to a writable standalone disc image.
+		 *
+		 * This function copies an encrypted Game Partition and decrypts it,
+		 * removing the H0-H2 hash tables and the H3 table. The result uses
+		 * the unencrypted 31 KB-per-sector layout used by RVT-R NOCRYPTO images.
+		 * The ticket and TMD are not modified.
+		 *
+		 * @param rvth_dest	[out] Destination RvtH object.
+		 * @param bank_src	[in] Source bank number. (0-7)
+		 * @param callback	[in,opt] Progress callback.
+		 * @param userdata	[in,opt] User data for progress callback.
+		 * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 */
+		int copyToGcm_doDecrypt(RvtH *rvth_dest, unsigned int bank_src,
+			RvtH_Progress_Callback callback = nullptr,
+			void *userdata = nullptr);
+
 		/**
 		 * Extract a disc image from this RVT-H disk image.
 		 * Compatibility wrapper; this function creates a new RvtH
 		 * using the GCM constructor and then copyToGcm().
 		 * @param bank		[in] Bank number. (0-7)
 		 * @param filename	[in] Destination filename.
-		 * @param recrypt_key	[in] Key for recryption. (-1 for default; otherwise, see RVL_CryptoType_e)
+		 * @param recrypt_key	[in] Key for recryption. (-1 for default; RVL_CryptoType_None to decrypt; otherwise, see RVL_CryptoType_e)
 		 * @param flags		[in] Flags. (See RvtH_Extract_Flags.)
 		 * @param callback	[in,opt] Progress callback.
 		 * @param userdata	[in,opt] User data for progress callback.
@@ -345,12 +536,14 @@ class RvtH {
 		 * @param bank_src	[in] Source bank number. (0-7)
 		 * @param callback	[in,opt] Progress callback.
 		 * @param userdata	[in,opt] User data for progress callback.
+		 * @param digests	[out,opt] If specified, digests of the copied disc image.
 		 * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
 		 */
 		int copyToHDD(RvtH *rvth_dest, unsigned int bank_dest,
 			unsigned int bank_src,
 			RvtH_Progress_Callback callback = nullptr,
-			void *userdata = nullptr);
+			void *userdata = nullptr,
+			RvtH_Digests *digests = nullptr);
 
 		/**
 		 * Import a disc image into this RVT-H disk image.
@@ -361,12 +554,32 @@ class RvtH {
 		 * @param callback	[in,opt] Progress callback.
 		 * @param userdata	[in,opt] User data for progress callback.
 		 * @param ios_force	[in,opt] IOS version to force. (-1 to use the existing IOS)
+		 * @param digests	[out,opt] If specified, digests of the source disc image.
+		 *			(Recryption and the import ID aren't included.)
 		 * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
 		 */
 		int import(unsigned int bank, const TCHAR *filename,
 			RvtH_Progress_Callback callback = nullptr,
 			void *userdata = nullptr,
-			int ios_force = -1);
+			int ios_force = -1,
+			RvtH_Digests *digests = nullptr);
+
+	public:
+		/** Digest functions (digest.cpp) **/
+
+		/**
+		 * Compute the CRC32, MD5, and SHA-1 digests of a bank.
+		 * The digests are computed in background threads while
+		 * the bank is being read.
+		 * @param bank		[in] Bank number. (0-7)
+		 * @param digests	[out] Digests.
+		 * @param callback	[in,opt] Progress callback.
+		 * @param userdata	[in,opt] User data for progress callback.
+		 * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 */
+		int digestBank(unsigned int bank, RvtH_Digests *digests,
+			RvtH_Progress_Callback callback = nullptr,
+			void *userdata = nullptr);
 
 	public:
 		/** Recryption functions (recrypt.cpp) **/
@@ -399,6 +612,64 @@ class RvtH {
 			void *userdata = nullptr,
 			int ios_force = -1);
 		
+	public:
+		/** Verification functions (verify.cpp) **/
+
+		/**
+		 * Verify the hash tree of every partition in a Wii disc image.
+		 *
+		 * Each group is decrypted, and the H0, H1, and H2 hashes are
+		 * recalculated and compared to the stored hashes. The H2 tables
+		 * are checked against the H3 table, and the H3 table is checked
+		 * against the content hash in the TMD.
+		 *
+		 * Groups are checked in parallel, but errors are always reported
+		 * in disc order.
+		 *
+		 * @param bank		[in] Bank number. (0-7)
+		 * @param errorCallback	[in,opt] Verification error callback.
+		 * @param callback	[in,opt] Progress callback.
+		 * @param userdata	[in,opt] User data for the callbacks.
+		 * @return 0 if all hashes are valid; RVTH_ERROR_VERIFY_FAILED if any hashes
+		 *         are invalid; other error code on error. (If negative, POSIX error;
+		 *         otherwise, see RvtH_Errors.)
+		 */
+		int verifyWiiPartitions(unsigned int bank,
+			RvtH_Verify_Callback errorCallback = nullptr,
+			RvtH_Progress_Callback callback = nullptr,
+			void *userdata = nullptr);
+
+	public:
+		/** File system functions (files.cpp) **/
+
+		/**
+		 * Load the file system table of a bank.
+		 *
+		 * For Wii disc images, the game partition's FST is loaded.
+		 * Files can then be read using FST::readFile(), which only
+		 * reads and decrypts the groups containing the requested data.
+		 *
+		 * NOTE: The FST must be deleted before this RvtH object.
+		 *
+		 * @param bank	[in] Bank number. (0-7)
+		 * @param pErr	[out,opt] Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 * @return FST*, or NULL on error.
+		 */
+		FST *openFST(unsigned int bank, int *pErr = nullptr);
+
+		/**
+		 * Extract a single file from a bank.
+		 * @param bank		[in] Bank number. (0-7)
+		 * @param path		[in] Path of the file within the bank's file system.
+		 * @param filename	[in] Destination filename.
+		 * @param callback	[in,opt] Progress callback.
+		 * @param userdata	[in,opt] User data for progress callback.
+		 * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+		 */
+		int extractFile(unsigned int bank, const char *path, const TCHAR *filename,
+			RvtH_Progress_Callback callback = nullptr,
+			void *userdata = nullptr);
+
 	private:
 		// Reference-counted FILE*.
 		RefFile *m_file;
@@ -414,8 +685,24 @@ class RvtH {
 		// NHCD header status.
 		NHCD_Status_e m_NHCD_status;
 
+		// I/O queue depth for extracting and importing.
+		unsigned int m_ioQueueDepth;
+
 		// BankEntry objects.
 		RvtH_BankEntry *m_entries;
+
+		// Bitfield of fully-initialized bank entries.
+		// NOTE: Up to 32 banks are supported.
+		mutable uint32_t m_bankEntryLoaded;
+		// Set if an I/O error occurred while initializing a bank entry.
+		mutable bool m_bankEntryInitErr;
+		// Protects m_bankEntryLoaded, m_bankEntryInitErr, and
+		// lazy initialization of the bank entries.
+		mutable std::mutex m_bankEntryMutex;
+
+		// Hash of the NHCD bank table, for the bank cache.
+		// Only valid if m_NHCD_status == NHCD_STATUS_OK.
+		uint8_t m_nhcdHash[20];
 };
 
 #endif /* __cplusplus */
@@ -60,6 +60,32 @@ typedef enum {
 	// Prepend a 32 KB SDK header.
 	// Required for rvtwriter, NDEV ODEM, etc.
 	RVTH_EXTRACT_PREPEND_SDK_HEADER		= (1 << 0),
+
+	// Write a CISO image instead of a plain GCM.
+	// Empty blocks are not stored in the image.
+	// Cannot be combined with recryption or SDK headers.
+	RVTH_EXTRACT_CISO			= (1 << 1),
+
+	// Write a standalone WBFS image instead of a plain GCM.
+	// Empty blocks are not stored in the image.
+	// Cannot be combined with recryption or SDK headers.
+	RVTH_EXTRACT_WBFS			= (1 << 2),
+
+	// Add the disc to an existing WBFS file or partition.
+	// Implies RVTH_EXTRACT_WBFS.
+	RVTH_EXTRACT_WBFS_APPEND		= (1 << 3),
+
+	// Only copy the data used by the disc image: headers, partition
+	// headers, H3 tables, and files referenced by the FSTs.
+	// Unused areas are left sparse, or aren't stored in CISO/WBFS.
+	// Cannot be combined with recryption.
+	RVTH_EXTRACT_SCRUB			= (1 << 4),
+
+	// Compute the CRC32, MD5, and SHA-1 digests of the extracted
+	// disc image and write them to "<filename>.digests".
+	// The SDK header, if any, isn't included. For CISO and WBFS,
+	// the digests are of the disc image, not the container.
+	RVTH_EXTRACT_DIGESTS			= (1 << 5),
 } RvtH_Extract_Flags;
 
 #ifdef __cplusplus
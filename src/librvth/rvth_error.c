@@ -99,6 +99,16 @@ const char *rvth_error(int err)
 
 		// tr: RVTH_ERROR_NDEV_GCN_NOT_SUPPORTED
 		"NDEV headers for GCN are currently unsupported.",
+
+		// Verification.
+
+		// tr: RVTH_ERROR_VERIFY_FAILED
+		"Hash verification failed",
+
+		// File system.
+
+		// tr: RVTH_ERROR_FST_CORRUPTED
+		"File system table is corrupted",
 	};
 	static_assert(ARRAY_SIZE(errtbl) == RVTH_ERROR_MAX, "Missing error descriptions!");
 
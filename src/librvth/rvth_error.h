@@ -58,6 +58,12 @@ typedef enum {
 	// NDEV option.
 	RVTH_ERROR_NDEV_GCN_NOT_SUPPORTED	= 26,	// NDEV headers for GCN are currently unsupported.
 
+	// Verification.
+	RVTH_ERROR_VERIFY_FAILED		= 27,	// Hash verification failed.
+
+	// File system.
+	RVTH_ERROR_FST_CORRUPTED		= 28,	// File system table is corrupted.
+
 	RVTH_ERROR_MAX
 } RvtH_Errors;
 
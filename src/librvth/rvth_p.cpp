@@ -9,6 +9,7 @@
 #include "rvth.hpp"
 
 #include "RefFile.hpp"
+#include "bank_cache.h"
 #include "rvth_time.h"
 #include "rvth_error.h"
 
@@ -48,7 +49,65 @@ int RvtH::makeWritable(void)
 	}
 
 	// Make this writable.
-	return m_file->makeWritable();
+	int ret = m_file->makeWritable();
+	if (ret != 0) {
+		return ret;
+	}
+
+	// The bank cache will be out of date once anything is written.
+	rvth_bank_cache_invalidate(m_file);
+	return 0;
+}
+
+/**
+ * Enable or disable direct I/O for an RVT-H Reader device.
+ *
+ * Direct I/O bypasses the OS page cache when extracting or
+ * importing banks, which prevents a multi-gigabyte copy from
+ * evicting everything else from the cache.
+ *
+ * @param enable	[in] True to enable; false to disable.
+ * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+int RvtH::setDirectIO(bool enable)
+{
+	if (!m_file) {
+		errno = EBADF;
+		return -EBADF;
+	}
+
+	// Only RVT-H Reader devices are supported.
+	// Disc image files should use the page cache as usual.
+	if (enable && !m_file->isDevice()) {
+		errno = EINVAL;
+		return RVTH_ERROR_NOT_A_DEVICE;
+	}
+
+	return m_file->setDirectIO(enable);
+}
+
+/**
+ * Set the I/O queue depth for extracting and importing banks.
+ *
+ * This is the number of 1 MB chunks that can be read ahead of
+ * the writer. On Linux, io_uring is used to keep this many
+ * reads in flight, plus the corresponding writes, if it's
+ * available. Otherwise, a read-ahead thread is used.
+ *
+ * @param depth	[in] Queue depth. (2 to RVTH_IO_QUEUE_DEPTH_MAX; 0 for default)
+ * @return Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
+ */
+int RvtH::setIoQueueDepth(unsigned int depth)
+{
+	if (depth == 0) {
+		depth = RVTH_IO_QUEUE_DEPTH_DEFAULT;
+	} else if (depth < 2 || depth > RVTH_IO_QUEUE_DEPTH_MAX) {
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	m_ioQueueDepth = depth;
+	return 0;
 }
 
 /**
@@ -183,5 +242,8 @@ int RvtH::writeBankEntry(unsigned int bank, time_t *pTimestamp)
 	}
 
 	// Bank entry written successfully.
+	// Invalidate the bank cache again in case another process
+	// cached the bank entries while the bank was being written.
+	rvth_bank_cache_invalidate(m_file);
 	return 0;
 }
@@ -0,0 +1,343 @@
+/***************************************************************************
+ * RVT-H Tool (librvth/tests)                                              *
+ * BankCacheTest.cpp: Bank cache tests.                                    *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// Google Test
+#include "gtest/gtest.h"
+
+#include "librvth/bank_cache.h"
+#include "librvth/ptbl.h"
+#include "librvth/RefFile.hpp"
+#include "librvth/nhcd_structs.h"
+#include "librvth/reader/Reader.hpp"
+
+// C includes.
+#include <stdlib.h>
+#ifdef _WIN32
+# include <direct.h>
+#else /* !_WIN32 */
+# include <sys/stat.h>
+# include <unistd.h>
+#endif /* _WIN32 */
+
+// C includes. (C++ namespace)
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+// C++ includes.
+#include <string>
+using std::string;
+
+namespace LibRvtH { namespace Tests {
+
+// Number of banks in the test bank table.
+#define TEST_BANK_COUNT 8
+
+class BankCacheTest : public ::testing::Test
+{
+	protected:
+		BankCacheTest()
+			: m_file(nullptr)
+		{
+			memset(m_nhcd_table, 0, sizeof(m_nhcd_table));
+			memset(m_nhcd_hash, 0, sizeof(m_nhcd_hash));
+			memset(m_entries, 0, sizeof(m_entries));
+			memset(m_ptbl, 0, sizeof(m_ptbl));
+		}
+
+		void SetUp(void) final;
+		void TearDown(void) final;
+
+	public:
+		/**
+		 * Free the readers and partition tables in a bank entry array.
+		 * @param entries Bank entries.
+		 */
+		static void freeEntries(RvtH_BankEntry *entries);
+
+	protected:
+		RefFile *m_file;
+		string m_cacheDir;
+		string m_filename;
+
+		uint8_t m_nhcd_table[(TEST_BANK_COUNT + 1) * NHCD_BLOCK_SIZE];
+		uint8_t m_nhcd_hash[RVTH_BANK_CACHE_HASH_SIZE];
+		RvtH_BankEntry m_entries[TEST_BANK_COUNT];
+		pt_entry_t m_ptbl[2];
+};
+
+/**
+ * Set up the cache directory, the test file, and the bank entries.
+ */
+void BankCacheTest::SetUp(void)
+{
+	// Use a cache directory in the current directory.
+	m_cacheDir = "BankCacheTest.cache";
+#ifdef _WIN32
+	ASSERT_EQ(0, _putenv_s("LOCALAPPDATA", m_cacheDir.c_str()));
+#else /* !_WIN32 */
+	char *const cwd = getcwd(nullptr, 0);
+	ASSERT_TRUE(cwd != nullptr);
+	m_cacheDir = string(cwd) + '/' + m_cacheDir;
+	free(cwd);
+	ASSERT_EQ(0, setenv("XDG_CACHE_HOME", m_cacheDir.c_str(), 1));
+#endif /* _WIN32 */
+
+	// Create a small "HDD image".
+	// Only the filename, size, and modification time are used.
+	m_filename = "BankCacheTest.bin";
+	FILE *f = fopen(m_filename.c_str(), "wb");
+	ASSERT_TRUE(f != nullptr);
+	ASSERT_EQ(1U, fwrite("RVTH", 4, 1, f));
+	fclose(f);
+	m_file = new RefFile(m_filename.c_str());
+	ASSERT_TRUE(m_file->isOpen());
+
+	// NHCD bank table.
+	for (unsigned int i = 0; i < sizeof(m_nhcd_table); i++) {
+		m_nhcd_table[i] = static_cast<uint8_t>(i * 7);
+	}
+	rvth_bank_cache_hash_nhcd(m_nhcd_table, sizeof(m_nhcd_table), m_nhcd_hash);
+
+	// Bank entries.
+	m_ptbl[0].lba_start = 0x100;
+	m_ptbl[0].lba_len = 0x200;
+	m_ptbl[0].type = 1;
+	m_ptbl[1].lba_start = 0x300;
+	m_ptbl[1].lba_len = 0x8000;
+	m_ptbl[1].type = 0;
+	m_ptbl[1].pt = 1;
+	m_ptbl[1].pt_orig = 1;
+
+	for (unsigned int i = 0; i < TEST_BANK_COUNT; i++) {
+		RvtH_BankEntry *const entry = &m_entries[i];
+		entry->lba_start = NHCD_BANK_START_LBA(i, TEST_BANK_COUNT);
+		entry->lba_len = NHCD_BANK_WII_SL_SIZE_RVTR_LBA;
+		entry->timestamp = 1600000000 + i;
+		entry->type = (i % 2 == 0 ? RVTH_BankType_Wii_SL : RVTH_BankType_Empty);
+		entry->region_code = static_cast<uint8_t>(i);
+		entry->is_deleted = (i == 3);
+		entry->aplerr = static_cast<uint8_t>(i);
+		entry->aplerr_val[0] = 0x81200000 + i;
+		snprintf(entry->discHeader.game_title, sizeof(entry->discHeader.game_title), "Bank %u", i + 1);
+		entry->crypto_type = RVL_CryptoType_Debug;
+		entry->ios_version = 36;
+		entry->ticket.sig_type = RVL_SigType_Debug;
+		entry->tmd.sig_status = RVL_SigStatus_OK;
+		entry->vg_orig.vg[0].count = 2;
+		entry->vg_orig.vg[0].addr = 0x10008;
+	}
+	m_entries[0].ptbl = m_ptbl;
+	m_entries[0].pt_count = 2;
+}
+
+void BankCacheTest::TearDown(void)
+{
+	rvth_bank_cache_invalidate(m_file);
+	if (m_file) {
+		m_file->unref();
+		m_file = nullptr;
+	}
+	remove(m_filename.c_str());
+
+	// Remove the cache directories.
+#ifdef _WIN32
+	_rmdir((m_cacheDir + "\\rvthtool\\banks").c_str());
+	_rmdir((m_cacheDir + "\\rvthtool").c_str());
+	_rmdir(m_cacheDir.c_str());
+#else /* !_WIN32 */
+	rmdir((m_cacheDir + "/rvthtool/banks").c_str());
+	rmdir((m_cacheDir + "/rvthtool").c_str());
+	rmdir(m_cacheDir.c_str());
+#endif /* _WIN32 */
+}
+
+/**
+ * Free the readers and partition tables in a bank entry array.
+ * @param entries Bank entries.
+ */
+void BankCacheTest::freeEntries(RvtH_BankEntry *entries)
+{
+	for (unsigned int i = 0; i < TEST_BANK_COUNT; i++) {
+		delete entries[i].reader;
+		free(entries[i].ptbl);
+	}
+}
+
+/**
+ * Save the bank entries and load them back.
+ */
+TEST_F(BankCacheTest, saveAndLoad)
+{
+	ASSERT_EQ(0, rvth_bank_cache_save(m_file, m_nhcd_hash,
+		m_entries, TEST_BANK_COUNT));
+
+	RvtH_BankEntry loaded[TEST_BANK_COUNT];
+	memset(loaded, 0, sizeof(loaded));
+	ASSERT_EQ(0, rvth_bank_cache_load(m_file, m_nhcd_hash,
+		loaded, TEST_BANK_COUNT));
+
+	for (unsigned int i = 0; i < TEST_BANK_COUNT; i++) {
+		const RvtH_BankEntry *const expected = &m_entries[i];
+		const RvtH_BankEntry *const actual = &loaded[i];
+
+		EXPECT_EQ(expected->lba_start, actual->lba_start) << "bank " << i;
+		EXPECT_EQ(expected->lba_len, actual->lba_len) << "bank " << i;
+		EXPECT_EQ(expected->timestamp, actual->timestamp) << "bank " << i;
+		EXPECT_EQ(expected->type, actual->type) << "bank " << i;
+		EXPECT_EQ(expected->region_code, actual->region_code) << "bank " << i;
+		EXPECT_EQ(expected->is_deleted, actual->is_deleted) << "bank " << i;
+		EXPECT_EQ(expected->aplerr, actual->aplerr) << "bank " << i;
+		EXPECT_EQ(0, memcmp(expected->aplerr_val, actual->aplerr_val, sizeof(actual->aplerr_val))) << "bank " << i;
+		EXPECT_EQ(0, memcmp(&expected->discHeader, &actual->discHeader, sizeof(actual->discHeader))) << "bank " << i;
+		EXPECT_EQ(expected->crypto_type, actual->crypto_type) << "bank " << i;
+		EXPECT_EQ(expected->ios_version, actual->ios_version) << "bank " << i;
+		EXPECT_EQ(0, memcmp(&expected->ticket, &actual->ticket, sizeof(actual->ticket))) << "bank " << i;
+		EXPECT_EQ(0, memcmp(&expected->tmd, &actual->tmd, sizeof(actual->tmd))) << "bank " << i;
+		EXPECT_EQ(0, memcmp(&expected->vg_orig, &actual->vg_orig, sizeof(actual->vg_orig))) << "bank " << i;
+
+		// None of the original entries have readers.
+		EXPECT_TRUE(actual->reader == nullptr) << "bank " << i;
+
+		EXPECT_EQ(expected->pt_count, actual->pt_count) << "bank " << i;
+		if (expected->ptbl) {
+			ASSERT_TRUE(actual->ptbl != nullptr) << "bank " << i;
+			EXPECT_EQ(0, memcmp(expected->ptbl, actual->ptbl,
+				expected->pt_count * sizeof(pt_entry_t))) << "bank " << i;
+		} else {
+			EXPECT_TRUE(actual->ptbl == nullptr) << "bank " << i;
+		}
+	}
+
+	freeEntries(loaded);
+}
+
+/**
+ * Readers are recreated for banks that had them.
+ */
+TEST_F(BankCacheTest, readers)
+{
+	m_entries[0].reader = Reader::open(m_file, m_entries[0].lba_start, m_entries[0].lba_len);
+	ASSERT_TRUE(m_entries[0].reader != nullptr);
+	const int ret = rvth_bank_cache_save(m_file, m_nhcd_hash,
+		m_entries, TEST_BANK_COUNT);
+	delete m_entries[0].reader;
+	m_entries[0].reader = nullptr;
+	ASSERT_EQ(0, ret);
+
+	RvtH_BankEntry loaded[TEST_BANK_COUNT];
+	memset(loaded, 0, sizeof(loaded));
+	ASSERT_EQ(0, rvth_bank_cache_load(m_file, m_nhcd_hash,
+		loaded, TEST_BANK_COUNT));
+	ASSERT_TRUE(loaded[0].reader != nullptr);
+	EXPECT_EQ(m_entries[0].lba_start, loaded[0].reader->lba_start());
+	for (unsigned int i = 1; i < TEST_BANK_COUNT; i++) {
+		EXPECT_TRUE(loaded[i].reader == nullptr) << "bank " << i;
+	}
+
+	freeEntries(loaded);
+}
+
+/**
+ * The cache must not be used if the NHCD bank table has changed.
+ */
+TEST_F(BankCacheTest, nhcdTableChanged)
+{
+	ASSERT_EQ(0, rvth_bank_cache_save(m_file, m_nhcd_hash,
+		m_entries, TEST_BANK_COUNT));
+
+	// Change a timestamp in one of the bank entries.
+	m_nhcd_table[(3 * NHCD_BLOCK_SIZE) + 0x12] ^= 1;
+	rvth_bank_cache_hash_nhcd(m_nhcd_table, sizeof(m_nhcd_table), m_nhcd_hash);
+
+	RvtH_BankEntry loaded[TEST_BANK_COUNT];
+	memset(loaded, 0, sizeof(loaded));
+	EXPECT_EQ(-ENOENT, rvth_bank_cache_load(m_file, m_nhcd_hash,
+		loaded, TEST_BANK_COUNT));
+
+	// Entries must be left empty.
+	for (unsigned int i = 0; i < TEST_BANK_COUNT; i++) {
+		EXPECT_TRUE(loaded[i].reader == nullptr) << "bank " << i;
+		EXPECT_TRUE(loaded[i].ptbl == nullptr) << "bank " << i;
+		EXPECT_EQ(0U, loaded[i].lba_start) << "bank " << i;
+	}
+}
+
+/**
+ * The cache must not be used if the bank count has changed.
+ */
+TEST_F(BankCacheTest, bankCountChanged)
+{
+	ASSERT_EQ(0, rvth_bank_cache_save(m_file, m_nhcd_hash,
+		m_entries, TEST_BANK_COUNT));
+
+	RvtH_BankEntry loaded[TEST_BANK_COUNT];
+	memset(loaded, 0, sizeof(loaded));
+	EXPECT_EQ(-ENOENT, rvth_bank_cache_load(m_file, m_nhcd_hash,
+		loaded, TEST_BANK_COUNT - 1));
+}
+
+/**
+ * Partition tables that are too large for the cache must not be truncated.
+ */
+TEST_F(BankCacheTest, tooManyPartitions)
+{
+	pt_entry_t ptbl[32];
+	memset(ptbl, 0, sizeof(ptbl));
+	m_entries[2].ptbl = ptbl;
+	m_entries[2].pt_count = 32;
+	const int ret = rvth_bank_cache_save(m_file, m_nhcd_hash,
+		m_entries, TEST_BANK_COUNT);
+	m_entries[2].ptbl = nullptr;
+	m_entries[2].pt_count = 0;
+	EXPECT_EQ(-ENOTSUP, ret);
+
+	RvtH_BankEntry loaded[TEST_BANK_COUNT];
+	memset(loaded, 0, sizeof(loaded));
+	EXPECT_EQ(-ENOENT, rvth_bank_cache_load(m_file, m_nhcd_hash,
+		loaded, TEST_BANK_COUNT));
+}
+
+/**
+ * Invalidating the cache removes the cached entries.
+ */
+TEST_F(BankCacheTest, invalidate)
+{
+	ASSERT_EQ(0, rvth_bank_cache_save(m_file, m_nhcd_hash,
+		m_entries, TEST_BANK_COUNT));
+	ASSERT_EQ(0, rvth_bank_cache_invalidate(m_file));
+
+	RvtH_BankEntry loaded[TEST_BANK_COUNT];
+	memset(loaded, 0, sizeof(loaded));
+	EXPECT_EQ(-ENOENT, rvth_bank_cache_load(m_file, m_nhcd_hash,
+		loaded, TEST_BANK_COUNT));
+
+	// Invalidating again is not an error.
+	EXPECT_EQ(0, rvth_bank_cache_invalidate(m_file));
+}
+
+} }
+
+#ifdef _MSC_VER
+# define RVTH_CDECL __cdecl
+#else
+# define RVTH_CDECL
+#endif
+
+/**
+ * Test suite main function.
+ */
+int RVTH_CDECL main(int argc, char *argv[])
+{
+	fprintf(stderr, "librvth test suite: Bank cache tests.\n\n");
+	fflush(nullptr);
+
+	// coverity[fun_call_w_exception]: uncaught exceptions cause nonzero exit anyway, so don't warn.
+	::testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,187 @@
+/***************************************************************************
+ * RVT-H Tool (librvth/tests)                                              *
+ * CisoWriterTest.cpp: CisoWriter tests.                                   *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// Google Test
+#include "gtest/gtest.h"
+
+#include "librvth/RefFile.hpp"
+#include "librvth/nhcd_structs.h"
+#include "librvth/reader/CisoReader.hpp"
+#include "librvth/reader/CisoWriter.hpp"
+
+// libwiicrypto
+#include "libwiicrypto/byteswap.h"
+
+// C includes. (C++ namespace)
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+// C++ includes.
+#include <memory>
+#include <vector>
+using std::unique_ptr;
+using std::vector;
+
+namespace LibRvtH { namespace Tests {
+
+// Block size, in LBAs. (Small images use the minimum block size.)
+#define BLOCK_LBA BYTES_TO_LBA(CISO_BLOCK_SIZE_MIN)
+// Number of blocks in the test image.
+#define BLOCK_COUNT 10
+// Test image size, in LBAs.
+#define TEST_IMAGE_LBA (BLOCK_LBA * BLOCK_COUNT)
+
+class CisoWriterTest : public ::testing::Test
+{
+	protected:
+		void SetUp(void) final;
+		void TearDown(void) final;
+
+	public:
+		/**
+		 * Create a CisoWriter for a new test file.
+		 * @return CisoWriter.
+		 */
+		CisoWriter *createWriter(void);
+
+	protected:
+		vector<uint8_t> m_data;
+};
+
+#define TEST_FILENAME "CisoWriterTest.ciso"
+
+void CisoWriterTest::SetUp(void)
+{
+	// Blocks 0, 3, 4, and 7 have data.
+	// The other blocks, including the last one, are all zero.
+	m_data.assign(LBA_TO_BYTES(TEST_IMAGE_LBA), 0);
+	static const unsigned int used[] = {0, 3, 4, 7};
+	for (unsigned int i = 0; i < ARRAY_SIZE(used); i++) {
+		uint8_t *const block = &m_data[LBA_TO_BYTES(used[i] * BLOCK_LBA)];
+		for (unsigned int j = 0; j < CISO_BLOCK_SIZE_MIN; j += 64) {
+			block[j] = static_cast<uint8_t>(used[i] + 1);
+			block[j + 1] = static_cast<uint8_t>(j >> 8);
+		}
+	}
+}
+
+void CisoWriterTest::TearDown(void)
+{
+	remove(TEST_FILENAME);
+}
+
+/**
+ * Create a CisoWriter for a new test file.
+ * @return CisoWriter.
+ */
+CisoWriter *CisoWriterTest::createWriter(void)
+{
+	RefFile *const file = new RefFile(_T(TEST_FILENAME), true);
+	EXPECT_TRUE(file->isOpen());
+	CisoWriter *const writer = new CisoWriter(file, TEST_IMAGE_LBA);
+	file->unref();
+	EXPECT_TRUE(writer->isOpen());
+	return writer;
+}
+
+/**
+ * Write the test image sequentially, one LBA range at a time,
+ * and read it back using CisoReader.
+ */
+TEST_F(CisoWriterTest, roundTrip)
+{
+	unique_ptr<CisoWriter> writer(createWriter());
+	ASSERT_TRUE(writer->isOpen());
+
+	// Write in odd-sized pieces so writes cross block boundaries.
+	const uint32_t step = BLOCK_LBA / 3;
+	for (uint32_t lba = 0; lba < TEST_IMAGE_LBA; lba += step) {
+		const uint32_t lba_len = (TEST_IMAGE_LBA - lba < step ? TEST_IMAGE_LBA - lba : step);
+		ASSERT_EQ(lba_len, writer->write(&m_data[LBA_TO_BYTES(lba)], lba, lba_len));
+	}
+
+	// The writer can read back its own data.
+	vector<uint8_t> actual(m_data.size());
+	ASSERT_EQ(TEST_IMAGE_LBA, writer->read(actual.data(), 0, TEST_IMAGE_LBA));
+	EXPECT_TRUE(m_data == actual);
+
+	// Deleting the writer writes the CISO header.
+	writer.reset();
+
+	RefFile *const file = new RefFile(_T(TEST_FILENAME));
+	ASSERT_TRUE(file->isOpen());
+
+	// Check the header. Empty blocks aren't stored,
+	// but the last block is, since it determines the image size.
+	CisoHeader hdr;
+	ASSERT_EQ(1U, file->seekoAndRead(0, SEEK_SET, &hdr, sizeof(hdr), 1));
+	EXPECT_EQ(0, memcmp(hdr.magic, "CISO", 4));
+	EXPECT_EQ(static_cast<uint32_t>(CISO_BLOCK_SIZE_MIN), le32_to_cpu(hdr.block_size));
+	static const uint8_t map_expected[BLOCK_COUNT] = {1,0,0,1,1,0,0,1,0,1};
+	EXPECT_EQ(0, memcmp(map_expected, hdr.map, sizeof(map_expected)));
+	for (unsigned int i = BLOCK_COUNT; i < CISO_MAP_SIZE; i++) {
+		ASSERT_EQ(0, hdr.map[i]) << "block " << i;
+	}
+	EXPECT_EQ(CISO_HEADER_SIZE + (5 * CISO_BLOCK_SIZE_MIN), file->size());
+
+	// Read the image back.
+	unique_ptr<CisoReader> reader(new CisoReader(file, 0, 0));
+	file->unref();
+	ASSERT_TRUE(reader->isOpen());
+	ASSERT_EQ(TEST_IMAGE_LBA, reader->lba_len());
+	memset(actual.data(), 0xAA, actual.size());
+	ASSERT_EQ(TEST_IMAGE_LBA, reader->read(actual.data(), 0, TEST_IMAGE_LBA));
+	EXPECT_TRUE(m_data == actual);
+}
+
+/**
+ * Writes can go back to a block that has been stored,
+ * but not to an empty block that was skipped.
+ */
+TEST_F(CisoWriterTest, backwardWrite)
+{
+	unique_ptr<CisoWriter> writer(createWriter());
+	ASSERT_TRUE(writer->isOpen());
+
+	// Block 0 has data. Block 5 is written next, skipping blocks 1-4.
+	ASSERT_EQ(BLOCK_LBA, writer->write(&m_data[0], 0, BLOCK_LBA));
+	ASSERT_EQ(BLOCK_LBA, writer->write(&m_data[LBA_TO_BYTES(3 * BLOCK_LBA)], 5 * BLOCK_LBA, BLOCK_LBA));
+
+	// Block 2 was skipped, so it can't be written anymore.
+	errno = 0;
+	EXPECT_EQ(0U, writer->write(&m_data[LBA_TO_BYTES(3 * BLOCK_LBA)], 2 * BLOCK_LBA, 1));
+	EXPECT_EQ(ESPIPE, errno);
+
+	// Block 0 was stored, so it can be rewritten.
+	ASSERT_EQ(1U, writer->write(&m_data[LBA_TO_BYTES(4 * BLOCK_LBA)], 1, 1));
+	vector<uint8_t> actual(LBA_SIZE);
+	ASSERT_EQ(1U, writer->read(actual.data(), 1, 1));
+	EXPECT_EQ(0, memcmp(&m_data[LBA_TO_BYTES(4 * BLOCK_LBA)], actual.data(), LBA_SIZE));
+}
+
+} }
+
+#ifdef _MSC_VER
+# define RVTH_CDECL __cdecl
+#else
+# define RVTH_CDECL
+#endif
+
+/**
+ * Test suite main function.
+ */
+int RVTH_CDECL main(int argc, char *argv[])
+{
+	fprintf(stderr, "librvth test suite: CisoWriter tests.\n\n");
+	fflush(nullptr);
+
+	// coverity[fun_call_w_exception]: uncaught exceptions cause nonzero exit anyway, so don't warn.
+	::testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,144 @@
+/***************************************************************************
+ * RVT-H Tool (librvth/tests)                                              *
+ * DigestQueueTest.cpp: DigestQueue tests.                                 *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// Google Test
+#include "gtest/gtest.h"
+
+#include "librvth/DigestQueue.hpp"
+#include "librvth/rvth.hpp"
+
+// C includes. (C++ namespace)
+#include <cstdio>
+#include <cstring>
+
+// C++ includes.
+#include <vector>
+using std::vector;
+
+namespace LibRvtH { namespace Tests {
+
+class DigestQueueTest : public ::testing::Test
+{ };
+
+/**
+ * Hash a buffer using a DigestQueue.
+ * @param data		[in] Data.
+ * @param size		[in] Size, in bytes.
+ * @param split		[in] Split the data into updates of this size. (0 for one update)
+ * @param digests	[out] Digests.
+ */
+static void hashBuffer(const uint8_t *data, size_t size, size_t split, RvtH_Digests *digests)
+{
+	// Use small buffers so the queue wraps around.
+	DigestQueue dq(4096, 2);
+	ASSERT_EQ(0, dq.start());
+	if (split == 0) {
+		split = size;
+	}
+	for (size_t pos = 0; pos < size; pos += split) {
+		dq.update(&data[pos], (size - pos > split ? split : size - pos));
+	}
+	dq.finish(digests);
+}
+
+/**
+ * Check the digests of the standard check string.
+ */
+TEST_F(DigestQueueTest, checkString)
+{
+	static const char check[] = "123456789";
+	static const uint8_t md5[16] = {
+		0x25,0xf9,0xe7,0x94,0x32,0x3b,0x45,0x38,
+		0x85,0xf5,0x18,0x1f,0x1b,0x62,0x4d,0x0b
+	};
+	static const uint8_t sha1[20] = {
+		0xf7,0xc3,0xbc,0x1d,0x80,0x8e,0x04,0x73,0x2a,0xdf,
+		0x67,0x99,0x65,0xcc,0xc3,0x4c,0xa7,0xae,0x34,0x41
+	};
+
+	EXPECT_EQ(0xCBF43926U, DigestQueue::crc32(0, reinterpret_cast<const uint8_t*>(check), 9));
+
+	RvtH_Digests digests;
+	hashBuffer(reinterpret_cast<const uint8_t*>(check), 9, 0, &digests);
+	EXPECT_EQ(9U, digests.size);
+	EXPECT_EQ(0xCBF43926U, digests.crc32);
+	EXPECT_EQ(0, memcmp(md5, digests.md5, sizeof(md5)));
+	EXPECT_EQ(0, memcmp(sha1, digests.sha1, sizeof(sha1)));
+}
+
+/**
+ * Check that split updates produce the same digests as a single update.
+ */
+TEST_F(DigestQueueTest, splitUpdates)
+{
+	vector<uint8_t> data(100000);
+	for (size_t i = 0; i < data.size(); i++) {
+		data[i] = static_cast<uint8_t>((i * 7) ^ (i >> 8));
+	}
+
+	RvtH_Digests whole, split;
+	hashBuffer(data.data(), data.size(), 0, &whole);
+	hashBuffer(data.data(), data.size(), 1000, &split);
+	EXPECT_EQ(data.size(), whole.size);
+	EXPECT_EQ(whole.size, split.size);
+	EXPECT_EQ(whole.crc32, split.crc32);
+	EXPECT_EQ(0, memcmp(whole.md5, split.md5, sizeof(whole.md5)));
+	EXPECT_EQ(0, memcmp(whole.sha1, split.sha1, sizeof(whole.sha1)));
+
+	// The incremental CRC32 must match, too.
+	uint32_t crc = DigestQueue::crc32(0, data.data(), 12345);
+	crc = DigestQueue::crc32(crc, &data[12345], data.size() - 12345);
+	EXPECT_EQ(whole.crc32, crc);
+}
+
+/**
+ * Check that updateZero() is the same as hashing zero bytes.
+ */
+TEST_F(DigestQueueTest, updateZero)
+{
+	vector<uint8_t> data(20000, 0);
+	data[0] = 0x55;
+	data[data.size() - 1] = 0xAA;
+
+	RvtH_Digests expected;
+	hashBuffer(data.data(), data.size(), 0, &expected);
+
+	RvtH_Digests digests;
+	DigestQueue dq(4096, 2);
+	ASSERT_EQ(0, dq.start());
+	dq.update(&data[0], 1);
+	dq.updateZero(data.size() - 2);
+	dq.update(&data[data.size() - 1], 1);
+	dq.finish(&digests);
+
+	EXPECT_EQ(expected.size, digests.size);
+	EXPECT_EQ(expected.crc32, digests.crc32);
+	EXPECT_EQ(0, memcmp(expected.md5, digests.md5, sizeof(expected.md5)));
+	EXPECT_EQ(0, memcmp(expected.sha1, digests.sha1, sizeof(expected.sha1)));
+}
+
+} }
+
+#ifdef _MSC_VER
+# define RVTH_CDECL __cdecl
+#else
+# define RVTH_CDECL
+#endif
+
+/**
+ * Test suite main function.
+ */
+int RVTH_CDECL main(int argc, char *argv[])
+{
+	fprintf(stderr, "librvth test suite: DigestQueue tests.\n\n");
+	fflush(nullptr);
+
+	// coverity[fun_call_w_exception]: uncaught exceptions cause nonzero exit anyway, so don't warn.
+	::testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
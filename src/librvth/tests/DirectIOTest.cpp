@@ -0,0 +1,244 @@
+/***************************************************************************
+ * RVT-H Tool (librvth/tests)                                              *
+ * DirectIOTest.cpp: Direct I/O test and throughput measurement.           *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// Google Test
+#include "gtest/gtest.h"
+
+#include "librvth/RefFile.hpp"
+#include "librvth/aligned_malloc.h"
+#include "librvth/nhcd_structs.h"
+
+// C includes.
+#include <stdlib.h>
+#ifndef _WIN32
+# include <fcntl.h>
+# include <unistd.h>
+#endif /* !_WIN32 */
+
+// C includes. (C++ namespace)
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+// C++ includes.
+#include <chrono>
+#include <string>
+using std::string;
+
+namespace LibRvtH { namespace Tests {
+
+// Test file size. (32 MB)
+#define TEST_FILE_SIZE (32U*1024U*1024U)
+// Buffer size used by the extract/import loops. (1 MB)
+#define BUF_SIZE (1024U*1024U)
+
+class DirectIOTest : public ::testing::Test
+{
+	protected:
+		DirectIOTest()
+			: m_file(nullptr)
+			, m_buf(nullptr)
+			, m_isTempFile(false) { }
+
+		void SetUp(void) final;
+		void TearDown(void) final;
+
+	public:
+		/**
+		 * Read the entire file using pread() and measure the throughput.
+		 * @param direct	[in] If true, use direct I/O.
+		 * @return Throughput, in MiB/s, or negative on error.
+		 */
+		double measureThroughput(bool direct);
+
+		/**
+		 * Drop the file from the OS page cache, if possible.
+		 */
+		void dropCache(void);
+
+	protected:
+		RefFile *m_file;
+		uint8_t *m_buf;
+		string m_filename;
+		int64_t m_size;
+		bool m_isTempFile;
+};
+
+/**
+ * Set up the test file.
+ *
+ * If the RVTH_DIRECTIO_BENCH_FILE environment variable is set,
+ * that file or device is opened read-only and measured instead.
+ */
+void DirectIOTest::SetUp(void)
+{
+	m_buf = static_cast<uint8_t*>(aligned_malloc(RVTH_PAGE_SIZE, BUF_SIZE));
+	ASSERT_TRUE(m_buf != nullptr);
+
+	const char *const bench_file = getenv("RVTH_DIRECTIO_BENCH_FILE");
+	if (bench_file && bench_file[0] != '\0') {
+		// Use the specified file or device.
+		m_filename = bench_file;
+	} else {
+		// Create a temporary file in the current directory.
+		// NOTE: Not using /tmp, since tmpfs doesn't support O_DIRECT.
+		m_filename = "DirectIOTest.bin";
+		m_isTempFile = true;
+
+		FILE *f = fopen(m_filename.c_str(), "wb");
+		ASSERT_TRUE(f != nullptr);
+		for (unsigned int i = 0; i < TEST_FILE_SIZE; i += BUF_SIZE) {
+			for (unsigned int j = 0; j < BUF_SIZE; j += 4) {
+				const uint32_t val = i + j;
+				memcpy(&m_buf[j], &val, sizeof(val));
+			}
+			ASSERT_EQ(1U, fwrite(m_buf, BUF_SIZE, 1, f));
+		}
+		fclose(f);
+	}
+
+	m_file = new RefFile(m_filename.c_str());
+	ASSERT_TRUE(m_file->isOpen());
+	m_size = m_file->size();
+	ASSERT_GT(m_size, 0);
+}
+
+void DirectIOTest::TearDown(void)
+{
+	if (m_file) {
+		m_file->unref();
+		m_file = nullptr;
+	}
+	if (m_isTempFile) {
+		remove(m_filename.c_str());
+	}
+	aligned_free(m_buf);
+	m_buf = nullptr;
+}
+
+/**
+ * Drop the file from the OS page cache, if possible.
+ */
+void DirectIOTest::dropCache(void)
+{
+#if !defined(_WIN32) && defined(POSIX_FADV_DONTNEED)
+	int fd = open(m_filename.c_str(), O_RDONLY);
+	if (fd >= 0) {
+		fdatasync(fd);
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+		close(fd);
+	}
+#endif /* !_WIN32 && POSIX_FADV_DONTNEED */
+}
+
+/**
+ * Read the entire file using pread() and measure the throughput.
+ * @param direct	[in] If true, use direct I/O.
+ * @return Throughput, in MiB/s, or negative on error.
+ */
+double DirectIOTest::measureThroughput(bool direct)
+{
+	if (m_file->setDirectIO(direct) != 0) {
+		return -1.0;
+	}
+	dropCache();
+
+	const auto start = std::chrono::steady_clock::now();
+	int64_t total = 0;
+	for (int64_t offset = 0; offset < m_size; offset += BUF_SIZE) {
+		size_t size = BUF_SIZE;
+		if (offset + size > static_cast<uint64_t>(m_size)) {
+			size = static_cast<size_t>(m_size - offset);
+		}
+		if (m_file->pread(m_buf, size, offset) != size) {
+			return -1.0;
+		}
+		total += size;
+	}
+	const auto end = std::chrono::steady_clock::now();
+
+	const double secs = std::chrono::duration<double>(end - start).count();
+	return (static_cast<double>(total) / (1024.0*1024.0)) / (secs > 0 ? secs : 1e-9);
+}
+
+/**
+ * Verify that direct I/O reads return the same data as buffered reads,
+ * including unaligned requests, which fall back to buffered I/O.
+ */
+TEST_F(DirectIOTest, readBack)
+{
+	int ret = m_file->setDirectIO(true);
+	if (ret != 0) {
+		// Direct I/O isn't supported here.
+		printf("Direct I/O is not supported for '%s': %s\n", m_filename.c_str(), strerror(-ret));
+		return;
+	}
+	ASSERT_TRUE(m_file->isDirectIO());
+	const unsigned int align = m_file->directIOAlignment();
+	ASSERT_NE(0U, align);
+
+	// Aligned read.
+	uint8_t *const cmp = static_cast<uint8_t*>(malloc(BUF_SIZE));
+	ASSERT_TRUE(cmp != nullptr);
+	ASSERT_EQ(BUF_SIZE, m_file->pread(m_buf, BUF_SIZE, BUF_SIZE));
+	ASSERT_EQ(0, m_file->setDirectIO(false));
+	ASSERT_EQ(BUF_SIZE, m_file->pread(cmp, BUF_SIZE, BUF_SIZE));
+	EXPECT_EQ(0, memcmp(m_buf, cmp, BUF_SIZE));
+
+	// Unaligned read. (falls back to buffered I/O)
+	ASSERT_EQ(0, m_file->setDirectIO(true));
+	ASSERT_EQ(1000U, m_file->pread(m_buf + 1, 1000, 12345));
+	ASSERT_EQ(0, m_file->setDirectIO(false));
+	ASSERT_EQ(1000U, m_file->pread(cmp, 1000, 12345));
+	EXPECT_EQ(0, memcmp(m_buf + 1, cmp, 1000));
+
+	free(cmp);
+}
+
+/**
+ * Compare buffered and direct I/O throughput on the same file.
+ * Set RVTH_DIRECTIO_BENCH_FILE to an RVT-H Reader device to
+ * measure the device instead of a temporary file.
+ */
+TEST_F(DirectIOTest, throughput)
+{
+	const double buffered = measureThroughput(false);
+	ASSERT_GT(buffered, 0.0);
+	const double direct = measureThroughput(true);
+	if (direct < 0) {
+		printf("Direct I/O is not supported for '%s'.\n", m_filename.c_str());
+		printf("Buffered: %.1f MiB/s\n", buffered);
+		return;
+	}
+
+	printf("File:     %s (%lld MiB)\n", m_filename.c_str(),
+		static_cast<long long>(m_size / (1024*1024)));
+	printf("Buffered: %.1f MiB/s\n", buffered);
+	printf("Direct:   %.1f MiB/s\n", direct);
+}
+
+} }
+
+#ifdef _MSC_VER
+# define RVTH_CDECL __cdecl
+#else
+# define RVTH_CDECL
+#endif
+
+/**
+ * Test suite main function.
+ */
+int RVTH_CDECL main(int argc, char *argv[])
+{
+	fprintf(stderr, "librvth test suite: Direct I/O tests.\n\n");
+	fflush(nullptr);
+
+	// coverity[fun_call_w_exception]: uncaught exceptions cause nonzero exit anyway, so don't warn.
+	::testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,348 @@
+/***************************************************************************
+ * RVT-H Tool (librvth/tests)                                              *
+ * FSTTest.cpp: FST tests.                                                 *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// Google Test
+#include "gtest/gtest.h"
+
+#include "librvth/FST.hpp"
+#include "librvth/RefFile.hpp"
+#include "librvth/nhcd_structs.h"
+#include "librvth/rvth_error.h"
+#include "librvth/reader/PlainReader.hpp"
+
+// libwiicrypto
+#include "libwiicrypto/byteswap.h"
+
+// C includes. (C++ namespace)
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+// C++ includes.
+#include <memory>
+#include <string>
+#include <vector>
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace LibRvtH { namespace Tests {
+
+// Disc layout. (GameCube)
+#define FST_ADDRESS	0x8000
+#define DOL_ADDRESS	0x4000
+#define FILE_A_ADDRESS	0x10000
+#define FILE_B_ADDRESS	0x20000
+#define FILE_A_SIZE	1000U
+#define FILE_B_SIZE	100000U
+#define DISC_SIZE	0x40000
+
+class FSTTest : public ::testing::Test
+{
+	protected:
+		void SetUp(void) final;
+
+		/**
+		 * Add an FST entry.
+		 * @param type		[in] 0 for files; 1 for directories.
+		 * @param name		[in] Name.
+		 * @param a		[in] File offset or parent directory index.
+		 * @param b		[in] File size or next entry index.
+		 */
+		void addEntry(unsigned int type, const char *name, uint32_t a, uint32_t b);
+
+		/**
+		 * Get the FST data.
+		 * @return FST data.
+		 */
+		vector<uint8_t> fstData(void) const;
+
+	protected:
+		vector<GCN_FST_Entry> m_entries;
+		string m_strings;
+};
+
+void FSTTest::SetUp(void)
+{
+	// /a.bin
+	// /dir/
+	// /dir/B.bin
+	// /dir/sub/
+	// /dir/sub/c.txt
+	// /empty/
+	addEntry(1, "", 0, 7);
+	addEntry(0, "a.bin", FILE_A_ADDRESS, FILE_A_SIZE);
+	addEntry(1, "dir", 0, 6);
+	addEntry(0, "B.bin", FILE_B_ADDRESS, FILE_B_SIZE);
+	addEntry(1, "sub", 2, 6);
+	addEntry(0, "c.txt", FILE_B_ADDRESS + FILE_B_SIZE, 77);
+	addEntry(1, "empty", 0, 7);
+}
+
+/**
+ * Add an FST entry.
+ * @param type		[in] 0 for files; 1 for directories.
+ * @param name		[in] Name.
+ * @param a		[in] File offset or parent directory index.
+ * @param b		[in] File size or next entry index.
+ */
+void FSTTest::addEntry(unsigned int type, const char *name, uint32_t a, uint32_t b)
+{
+	GCN_FST_Entry entry;
+	if (m_entries.empty()) {
+		// Root directory has no name.
+		entry.file_type_name_offset = cpu_to_be32(type << 24);
+	} else {
+		entry.file_type_name_offset = cpu_to_be32((type << 24) | static_cast<uint32_t>(m_strings.size()));
+		m_strings.append(name, strlen(name) + 1);
+	}
+	entry.file.offset = cpu_to_be32(a);
+	entry.file.size = cpu_to_be32(b);
+	m_entries.push_back(entry);
+}
+
+/**
+ * Get the FST data.
+ * @return FST data.
+ */
+vector<uint8_t> FSTTest::fstData(void) const
+{
+	vector<uint8_t> data(m_entries.size() * sizeof(GCN_FST_Entry) + m_strings.size());
+	memcpy(data.data(), m_entries.data(), m_entries.size() * sizeof(GCN_FST_Entry));
+	memcpy(&data[m_entries.size() * sizeof(GCN_FST_Entry)], m_strings.data(), m_strings.size());
+	return data;
+}
+
+/**
+ * Parse the FST and check the entries.
+ */
+TEST_F(FSTTest, parse)
+{
+	const vector<uint8_t> data = fstData();
+	FST fst(data.data(), static_cast<uint32_t>(data.size()), 0);
+	ASSERT_TRUE(fst.isOpen());
+	ASSERT_EQ(7U, fst.count());
+
+	EXPECT_TRUE(fst.isDir(0));
+	EXPECT_STREQ("", fst.name(0));
+	EXPECT_EQ("/", fst.path(0));
+
+	EXPECT_FALSE(fst.isDir(1));
+	EXPECT_EQ("/a.bin", fst.path(1));
+	EXPECT_EQ(FILE_A_ADDRESS, fst.fileOffset(1));
+	EXPECT_EQ(FILE_A_SIZE, fst.fileSize(1));
+	EXPECT_EQ(0U, fst.parent(1));
+
+	EXPECT_TRUE(fst.isDir(2));
+	EXPECT_EQ("/dir/", fst.path(2));
+	EXPECT_EQ(6U, fst.nextIndex(2));
+	EXPECT_EQ("/dir/sub/c.txt", fst.path(5));
+	EXPECT_EQ(4U, fst.parent(5));
+	EXPECT_EQ("/empty/", fst.path(6));
+	EXPECT_EQ(0U, fst.parent(6));
+}
+
+/**
+ * Wii file offsets are shifted right by 2.
+ */
+TEST_F(FSTTest, wiiOffsets)
+{
+	m_entries[1].file.offset = cpu_to_be32(0x80000000);
+	const vector<uint8_t> data = fstData();
+	FST fst(data.data(), static_cast<uint32_t>(data.size()), 2);
+	ASSERT_TRUE(fst.isOpen());
+	EXPECT_EQ(0x200000000LL, fst.fileOffset(1));
+}
+
+/**
+ * Find entries by path.
+ */
+TEST_F(FSTTest, find)
+{
+	const vector<uint8_t> data = fstData();
+	FST fst(data.data(), static_cast<uint32_t>(data.size()), 0);
+	ASSERT_TRUE(fst.isOpen());
+
+	EXPECT_EQ(0, fst.find(""));
+	EXPECT_EQ(0, fst.find("/"));
+	EXPECT_EQ(1, fst.find("/a.bin"));
+	EXPECT_EQ(1, fst.find("a.bin"));
+	EXPECT_EQ(2, fst.find("/dir/"));
+	EXPECT_EQ(3, fst.find("/dir/B.bin"));
+	EXPECT_EQ(3, fst.find("/DIR/b.BIN"));	// case-insensitive
+	EXPECT_EQ(5, fst.find("dir//sub/c.txt"));
+	EXPECT_EQ(6, fst.find("/empty"));
+
+	EXPECT_EQ(-ENOENT, fst.find("/c.txt"));		// not in the root directory
+	EXPECT_EQ(-ENOENT, fst.find("/dir/sub/c.tx"));	// partial name
+	EXPECT_EQ(-ENOENT, fst.find("/empty/a.bin"));
+	EXPECT_EQ(-ENOTDIR, fst.find("/a.bin/x"));
+}
+
+/**
+ * Corrupted FSTs are rejected.
+ */
+TEST_F(FSTTest, corrupted)
+{
+	// Entry count is larger than the FST.
+	vector<uint8_t> data = fstData();
+	reinterpret_cast<GCN_FST_Entry*>(data.data())[0].dir.last_entry_idx = cpu_to_be32(1000);
+	EXPECT_FALSE(FST(data.data(), static_cast<uint32_t>(data.size()), 0).isOpen());
+
+	// Root entry is a file.
+	data = fstData();
+	data[0] = 0;
+	EXPECT_FALSE(FST(data.data(), static_cast<uint32_t>(data.size()), 0).isOpen());
+
+	// Name offset is out of range.
+	data = fstData();
+	reinterpret_cast<GCN_FST_Entry*>(data.data())[1].file_type_name_offset = cpu_to_be32(0x00FFFFFF);
+	EXPECT_FALSE(FST(data.data(), static_cast<uint32_t>(data.size()), 0).isOpen());
+
+	// Subdirectory extends past its parent directory.
+	data = fstData();
+	reinterpret_cast<GCN_FST_Entry*>(data.data())[4].dir.last_entry_idx = cpu_to_be32(7);
+	EXPECT_FALSE(FST(data.data(), static_cast<uint32_t>(data.size()), 0).isOpen());
+
+	// Invalid entry type.
+	data = fstData();
+	data[sizeof(GCN_FST_Entry) * 3] = 2;
+	EXPECT_FALSE(FST(data.data(), static_cast<uint32_t>(data.size()), 0).isOpen());
+
+	// Too small.
+	EXPECT_FALSE(FST(data.data(), 4, 0).isOpen());
+}
+
+#define TEST_FILENAME "FSTTest.gcm"
+
+/**
+ * Load the FST from a GameCube disc image and read files.
+ */
+TEST_F(FSTTest, openGCN)
+{
+	vector<uint8_t> disc(DISC_SIZE);
+	for (size_t i = 0; i < disc.size(); i++) {
+		disc[i] = static_cast<uint8_t>((i * 7) ^ (i >> 9));
+	}
+
+	// Boot block.
+	const vector<uint8_t> data = fstData();
+	GCN_Boot_Block *const bb2 = reinterpret_cast<GCN_Boot_Block*>(&disc[GCN_Boot_Block_ADDRESS]);
+	bb2->bootFilePosition = cpu_to_be32(DOL_ADDRESS);
+	bb2->FSTPosition = cpu_to_be32(FST_ADDRESS);
+	bb2->FSTLength = cpu_to_be32(static_cast<uint32_t>(data.size()));
+	memcpy(&disc[FST_ADDRESS], data.data(), data.size());
+
+	// Apploader header: 0x1000 bytes of code and no trailer.
+	uint32_t *const apl_hdr = reinterpret_cast<uint32_t*>(&disc[0x2440]);
+	apl_hdr[5] = cpu_to_be32(0x1000);
+	apl_hdr[6] = 0;
+
+	// DOL header: One text section that ends at 0x1234.
+	DOL_Header *const dol = reinterpret_cast<DOL_Header*>(&disc[DOL_ADDRESS]);
+	memset(dol, 0, sizeof(*dol));
+	dol->textData[0] = cpu_to_be32(0x100);
+	dol->textLen[0] = cpu_to_be32(0x1134);
+
+	FILE *f = fopen(TEST_FILENAME, "wb");
+	ASSERT_TRUE(f != nullptr);
+	ASSERT_EQ(1U, fwrite(disc.data(), disc.size(), 1, f));
+	fclose(f);
+
+	RefFile *const file = new RefFile(_T(TEST_FILENAME));
+	ASSERT_TRUE(file->isOpen());
+	unique_ptr<Reader> reader(new PlainReader(file, 0, BYTES_TO_LBA(DISC_SIZE)));
+	file->unref();
+
+	int err = -1;
+	unique_ptr<FST> fst(FST::open(reader.get(), nullptr, false, &err));
+	ASSERT_TRUE(fst.get() != nullptr);
+	EXPECT_EQ(0, err);
+
+	// Read a file in pieces.
+	int idx = fst->find("/dir/B.bin");
+	ASSERT_EQ(3, idx);
+	vector<uint8_t> buf(FILE_B_SIZE);
+	EXPECT_EQ(333U, fst->readFile(idx, buf.data(), 333, 0));
+	EXPECT_EQ(static_cast<size_t>(FILE_B_SIZE - 333),
+		fst->readFile(idx, &buf[333], FILE_B_SIZE, 333));
+	EXPECT_EQ(0, memcmp(&disc[FILE_B_ADDRESS], buf.data(), FILE_B_SIZE));
+	EXPECT_EQ(0U, fst->readFile(idx, buf.data(), 1, FILE_B_SIZE));
+
+	// System files.
+	idx = fst->find("/sys/main.dol");
+	ASSERT_GT(idx, 6);
+	EXPECT_EQ(DOL_ADDRESS, fst->fileOffset(idx));
+	EXPECT_EQ(0x1234U, fst->fileSize(idx));
+	idx = fst->find("/sys/apploader.img");
+	ASSERT_GT(idx, 6);
+	EXPECT_EQ(0x20U + 0x1000U, fst->fileSize(idx));
+	idx = fst->find("/sys/fst.bin");
+	ASSERT_GT(idx, 6);
+	EXPECT_EQ(data.size(), fst->fileSize(idx));
+	EXPECT_EQ(data.size(), fst->readFile(idx, buf.data(), buf.size(), 0));
+	EXPECT_EQ(0, memcmp(data.data(), buf.data(), data.size()));
+	EXPECT_EQ("/sys/fst.bin", fst->path(idx));
+	EXPECT_EQ(fst->count(), fst->nextIndex(0));
+
+	// Directories can't be read.
+	EXPECT_EQ(0U, fst->readFile(2, buf.data(), 1, 0));
+
+	fst.reset();
+	reader.reset();
+	remove(TEST_FILENAME);
+}
+
+/**
+ * An FST that's out of range is reported as corrupted.
+ */
+TEST_F(FSTTest, openOutOfRange)
+{
+	vector<uint8_t> disc(DISC_SIZE);
+	GCN_Boot_Block *const bb2 = reinterpret_cast<GCN_Boot_Block*>(&disc[GCN_Boot_Block_ADDRESS]);
+	bb2->FSTPosition = cpu_to_be32(DISC_SIZE - 8);
+	bb2->FSTLength = cpu_to_be32(0x100);
+
+	FILE *f = fopen(TEST_FILENAME, "wb");
+	ASSERT_TRUE(f != nullptr);
+	ASSERT_EQ(1U, fwrite(disc.data(), disc.size(), 1, f));
+	fclose(f);
+
+	RefFile *const file = new RefFile(_T(TEST_FILENAME));
+	ASSERT_TRUE(file->isOpen());
+	unique_ptr<Reader> reader(new PlainReader(file, 0, BYTES_TO_LBA(DISC_SIZE)));
+	file->unref();
+
+	int err = 0;
+	EXPECT_TRUE(FST::open(reader.get(), nullptr, false, &err) == nullptr);
+	EXPECT_EQ(RVTH_ERROR_FST_CORRUPTED, err);
+
+	reader.reset();
+	remove(TEST_FILENAME);
+}
+
+} }
+
+#ifdef _MSC_VER
+# define RVTH_CDECL __cdecl
+#else
+# define RVTH_CDECL
+#endif
+
+/**
+ * Test suite main function.
+ */
+int RVTH_CDECL main(int argc, char *argv[])
+{
+	fprintf(stderr, "librvth test suite: FST tests.\n\n");
+	fflush(nullptr);
+
+	// coverity[fun_call_w_exception]: uncaught exceptions cause nonzero exit anyway, so don't warn.
+	::testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
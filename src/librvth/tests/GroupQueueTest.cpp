@@ -0,0 +1,163 @@
+/***************************************************************************
+ * RVT-H Tool (librvth/tests)                                              *
+ * GroupQueueTest.cpp: GroupQueue tests.                                   *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// Google Test
+#include "gtest/gtest.h"
+
+#include "librvth/GroupQueue.hpp"
+
+// C includes. (C++ namespace)
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+// C++ includes.
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+using std::vector;
+
+namespace LibRvtH { namespace Tests {
+
+// Job buffer size. (small, since only the ordering is being tested)
+#define JOB_SIZE 4096U
+// Number of jobs to process.
+#define JOB_COUNT 200U
+
+/**
+ * Job function: Fill the output buffer with the input byte plus one.
+ * Jobs with lower indexes take longer, so they finish out of order.
+ * @param worker	[in] Worker index.
+ * @param job		[in/out] Job.
+ * @return 0 on success; -EIO for job 123.
+ */
+static int fillJob(unsigned int worker, GroupQueue::Job *job)
+{
+	((void)worker);
+	if ((job->index % 4) == 0) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(2));
+	}
+	memset(job->out, job->src[0] + 1, JOB_SIZE);
+	return (job->index == 123 ? -EIO : 0);
+}
+
+/**
+ * Run all jobs through the queue.
+ * @param threads Number of worker threads.
+ */
+static void runJobs(unsigned int threads)
+{
+	GroupQueue queue(JOB_SIZE, JOB_SIZE, threads);
+	ASSERT_EQ(0, queue.start(fillJob));
+	if (threads > 0) {
+		EXPECT_EQ(threads, queue.threadCount());
+	}
+
+	uint32_t next = 0, expected = 0;
+	for (;;) {
+		GroupQueue::Job *job;
+		while (next < JOB_COUNT && (job = queue.acquire()) != nullptr) {
+			memset(job->in, static_cast<uint8_t>(next), JOB_SIZE);
+			job->src = job->in;
+			job->index = next++;
+			queue.submit(job);
+		}
+
+		job = queue.next();
+		if (!job)
+			break;
+
+		// Jobs must be returned in order.
+		ASSERT_EQ(expected, job->index);
+		EXPECT_EQ(job->index == 123 ? -EIO : 0, job->ret);
+		const uint8_t chr = static_cast<uint8_t>(job->index + 1);
+		for (unsigned int i = 0; i < JOB_SIZE; i++) {
+			ASSERT_EQ(chr, job->out[i]);
+		}
+		queue.release(job);
+		expected++;
+	}
+	EXPECT_EQ(JOB_COUNT, expected);
+}
+
+/**
+ * Process jobs using a single worker thread.
+ */
+TEST(GroupQueueTest, singleThread)
+{
+	runJobs(1);
+}
+
+/**
+ * Process jobs using multiple worker threads.
+ */
+TEST(GroupQueueTest, multiThread)
+{
+	runJobs(8);
+}
+
+/**
+ * Process jobs using the default number of worker threads.
+ */
+TEST(GroupQueueTest, defaultThreads)
+{
+	EXPECT_GE(GroupQueue::defaultThreadCount(), 1U);
+	runJobs(0);
+}
+
+/**
+ * Cancel the queue while jobs are pending.
+ */
+TEST(GroupQueueTest, cancel)
+{
+	std::atomic<unsigned int> processed(0);
+	GroupQueue queue(JOB_SIZE, JOB_SIZE, 2);
+	ASSERT_EQ(0, queue.start([&processed](unsigned int worker, GroupQueue::Job *job) {
+		((void)worker);
+		((void)job);
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		processed++;
+		return 0;
+	}));
+
+	GroupQueue::Job *job;
+	uint32_t submitted = 0;
+	while ((job = queue.acquire()) != nullptr) {
+		job->src = job->in;
+		job->index = submitted++;
+		queue.submit(job);
+	}
+	EXPECT_EQ(4U, submitted);
+
+	// Jobs that haven't been started are discarded.
+	queue.cancel();
+	EXPECT_LE(processed.load(), submitted);
+	EXPECT_EQ(nullptr, queue.next());
+}
+
+} }
+
+#ifdef _MSC_VER
+# define RVTH_CDECL __cdecl
+#else
+# define RVTH_CDECL
+#endif
+
+/**
+ * Test suite main function.
+ */
+int RVTH_CDECL main(int argc, char *argv[])
+{
+	fprintf(stderr, "librvth test suite: GroupQueue tests.\n\n");
+	fflush(nullptr);
+
+	// coverity[fun_call_w_exception]: uncaught exceptions cause nonzero exit anyway, so don't warn.
+	::testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,359 @@
+/***************************************************************************
+ * RVT-H Tool (librvth/tests)                                              *
+ * ReadAheadQueueTest.cpp: ReadAheadQueue tests.                           *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// Google Test
+#include "gtest/gtest.h"
+
+#include "librvth/RefFile.hpp"
+#include "librvth/nhcd_structs.h"
+#include "librvth/reader/PlainReader.hpp"
+#include "librvth/reader/MmapReader.hpp"
+#include "librvth/reader/ReadAheadQueue.hpp"
+
+// C includes. (C++ namespace)
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+// C++ includes.
+#include <memory>
+#include <vector>
+using std::unique_ptr;
+using std::vector;
+
+namespace LibRvtH { namespace Tests {
+
+// Chunk size used by the extract/import loops. (1 MB)
+#define CHUNK_LBA BYTES_TO_LBA(1024U*1024U)
+// Test file size, in LBAs. (5.5 MB; not a multiple of the chunk size)
+#define TEST_FILE_LBA (CHUNK_LBA*5 + CHUNK_LBA/2)
+
+// Test parameter flags.
+#define TEST_MMAP	(1U << 0)	/* Use MmapReader instead of PlainReader. */
+#define TEST_ASYNC	(1U << 1)	/* Allow the io_uring engine. */
+
+/**
+ * Reader that fails reads containing a specific LBA.
+ * The source isn't linear, so the thread engine is always used.
+ */
+class FailingReader : public Reader
+{
+	public:
+		FailingReader(RefFile *file, uint32_t lba_start, uint32_t lba_len, uint32_t lba_bad)
+			: Reader(file, lba_start, lba_len)
+			, m_lba_bad(lba_bad) { }
+
+	public:
+		uint32_t read(void *ptr, uint32_t lba_start, uint32_t lba_len) final
+		{
+			if (m_lba_bad >= lba_start && m_lba_bad < lba_start + lba_len) {
+				errno = EIO;
+				return 0;
+			}
+			const size_t size = m_file->pread(ptr, LBA_TO_BYTES(lba_len),
+				LBA_TO_BYTES(m_lba_start + lba_start));
+			return BYTES_TO_LBA(size);
+		}
+
+	private:
+		const uint32_t m_lba_bad;
+};
+
+class ReadAheadQueueTest : public ::testing::TestWithParam<unsigned int>
+{
+	protected:
+		ReadAheadQueueTest()
+			: m_file(nullptr) { }
+
+		void SetUp(void) final;
+		void TearDown(void) final;
+
+	public:
+		/**
+		 * Create a Reader for the test file.
+		 * @param mmap If true, use MmapReader; otherwise, use PlainReader.
+		 * @return Reader.
+		 */
+		Reader *createReader(bool mmap);
+
+	protected:
+		RefFile *m_file;
+		vector<uint8_t> m_data;
+};
+
+#define TEST_FILENAME "ReadAheadQueueTest.bin"
+#define TEST_FILENAME_COPY "ReadAheadQueueTest.copy.bin"
+
+void ReadAheadQueueTest::SetUp(void)
+{
+	// Each LBA is filled with its LBA number.
+	m_data.resize(LBA_TO_BYTES(TEST_FILE_LBA));
+	for (uint32_t lba = 0; lba < TEST_FILE_LBA; lba++) {
+		memset(&m_data[LBA_TO_BYTES(lba)], static_cast<int>(lba * 7), LBA_SIZE);
+	}
+
+	FILE *f = fopen(TEST_FILENAME, "wb");
+	ASSERT_TRUE(f != nullptr);
+	ASSERT_EQ(1U, fwrite(m_data.data(), m_data.size(), 1, f));
+	fclose(f);
+
+	m_file = new RefFile(_T(TEST_FILENAME));
+	ASSERT_TRUE(m_file->isOpen());
+}
+
+void ReadAheadQueueTest::TearDown(void)
+{
+	if (m_file) {
+		m_file->unref();
+		m_file = nullptr;
+	}
+	remove(TEST_FILENAME);
+	remove(TEST_FILENAME_COPY);
+}
+
+/**
+ * Create a Reader for the test file.
+ * @param mmap If true, use MmapReader; otherwise, use PlainReader.
+ * @return Reader.
+ */
+Reader *ReadAheadQueueTest::createReader(bool mmap)
+{
+	if (mmap) {
+		return new MmapReader(m_file, 0, TEST_FILE_LBA);
+	}
+	return new PlainReader(m_file, 0, TEST_FILE_LBA);
+}
+
+/**
+ * Read the entire file through the queue and verify
+ * that the chunks are returned in order with the correct data.
+ */
+TEST_P(ReadAheadQueueTest, readAll)
+{
+	unique_ptr<Reader> reader(createReader(!!(GetParam() & TEST_MMAP)));
+	ReadAheadQueue queue(reader.get(), 0, TEST_FILE_LBA, CHUNK_LBA, 2);
+	ASSERT_EQ(0, queue.start(!!(GetParam() & TEST_ASYNC)));
+
+	uint32_t lba_expected = 0;
+	ReadAheadQueue::Chunk *chunk;
+	while ((chunk = queue.next()) != nullptr) {
+		ASSERT_EQ(lba_expected, chunk->lba_start);
+		const uint32_t lba_len = (TEST_FILE_LBA - lba_expected < CHUNK_LBA
+			? TEST_FILE_LBA - lba_expected
+			: CHUNK_LBA);
+		ASSERT_EQ(lba_len, chunk->lba_len);
+		EXPECT_EQ(0, memcmp(&m_data[LBA_TO_BYTES(lba_expected)], chunk->data,
+			LBA_TO_BYTES(lba_len)));
+
+		// makeWritable() must preserve the data.
+		uint8_t *const buf = ReadAheadQueue::makeWritable(chunk);
+		EXPECT_EQ(buf, chunk->data);
+		EXPECT_EQ(0, memcmp(&m_data[LBA_TO_BYTES(lba_expected)], buf,
+			LBA_TO_BYTES(lba_len)));
+
+		lba_expected += lba_len;
+		queue.release(chunk);
+	}
+	EXPECT_EQ(TEST_FILE_LBA, lba_expected);
+}
+
+/**
+ * Cancel the queue while the read-ahead thread is blocked
+ * waiting for a free buffer.
+ */
+TEST_P(ReadAheadQueueTest, cancel)
+{
+	unique_ptr<Reader> reader(createReader(!!(GetParam() & TEST_MMAP)));
+	ReadAheadQueue queue(reader.get(), 0, TEST_FILE_LBA, CHUNK_LBA, 2);
+	ASSERT_EQ(0, queue.start(!!(GetParam() & TEST_ASYNC)));
+
+	// Take one chunk and never release it.
+	ReadAheadQueue::Chunk *const chunk = queue.next();
+	ASSERT_TRUE(chunk != nullptr);
+	EXPECT_EQ(0U, chunk->lba_start);
+
+	// This must not deadlock.
+	queue.cancel();
+}
+
+/**
+ * Copy the file using write(), writing each chunk in two pieces
+ * with a gap, and verify the destination file.
+ */
+TEST_P(ReadAheadQueueTest, copy)
+{
+	unique_ptr<Reader> reader(createReader(!!(GetParam() & TEST_MMAP)));
+	ReadAheadQueue queue(reader.get(), 0, TEST_FILE_LBA, CHUNK_LBA, 2);
+	ASSERT_EQ(0, queue.start(!!(GetParam() & TEST_ASYNC)));
+	printf("Engine: %s\n", queue.isAsync() ? "io_uring" : "thread");
+
+	RefFile *const destFile = new RefFile(_T(TEST_FILENAME_COPY), true);
+	ASSERT_TRUE(destFile->isOpen());
+	ASSERT_EQ(0, destFile->makeSparse(LBA_TO_BYTES(TEST_FILE_LBA)));
+	unique_ptr<Reader> dest(new PlainReader(destFile, 0, TEST_FILE_LBA));
+	destFile->unref();
+
+	ReadAheadQueue::Chunk *chunk;
+	while ((chunk = queue.next()) != nullptr) {
+		// Skip the second LBA of each chunk.
+		EXPECT_EQ(0, queue.write(chunk, dest.get(), chunk->data, chunk->lba_start, 1));
+		EXPECT_EQ(0, queue.write(chunk, dest.get(), chunk->data + LBA_SIZE*2,
+			chunk->lba_start + 2, chunk->lba_len - 2));
+		queue.release(chunk);
+	}
+	ASSERT_EQ(0, queue.finish());
+
+	// Verify the destination file.
+	vector<uint8_t> expected(m_data);
+	for (uint32_t lba = 1; lba < TEST_FILE_LBA; lba += CHUNK_LBA) {
+		memset(&expected[LBA_TO_BYTES(lba)], 0, LBA_SIZE);
+	}
+	vector<uint8_t> actual(expected.size());
+	ASSERT_EQ(TEST_FILE_LBA, dest->read(actual.data(), 0, TEST_FILE_LBA));
+	EXPECT_TRUE(expected == actual);
+}
+
+/**
+ * Read a sparse file whose second chunk is the only data.
+ * The other chunks must be returned as holes, and checking
+ * for holes must not change the file position.
+ */
+TEST_P(ReadAheadQueueTest, sparse)
+{
+	RefFile *const sparseFile = new RefFile(_T(TEST_FILENAME_COPY), true);
+	ASSERT_TRUE(sparseFile->isOpen());
+	ASSERT_EQ(0, sparseFile->makeSparse(LBA_TO_BYTES(TEST_FILE_LBA)));
+	ASSERT_EQ(static_cast<size_t>(LBA_TO_BYTES(CHUNK_LBA)), sparseFile->pwrite(&m_data[LBA_TO_BYTES(CHUNK_LBA)],
+		LBA_TO_BYTES(CHUNK_LBA), LBA_TO_BYTES(CHUNK_LBA)));
+	ASSERT_EQ(0, sparseFile->seeko(12345, SEEK_SET));
+
+	unique_ptr<Reader> reader(new PlainReader(sparseFile, 0, TEST_FILE_LBA));
+	ReadAheadQueue queue(reader.get(), 0, TEST_FILE_LBA, CHUNK_LBA, 2);
+	ASSERT_EQ(0, queue.start(!!(GetParam() & TEST_ASYNC)));
+
+	const vector<uint8_t> zero(LBA_TO_BYTES(CHUNK_LBA), 0);
+	uint32_t lba_expected = 0;
+	ReadAheadQueue::Chunk *chunk;
+	while ((chunk = queue.next()) != nullptr) {
+		ASSERT_EQ(lba_expected, chunk->lba_start);
+		if (chunk->lba_start == CHUNK_LBA) {
+			EXPECT_EQ(0, memcmp(&m_data[LBA_TO_BYTES(CHUNK_LBA)], chunk->data,
+				LBA_TO_BYTES(chunk->lba_len)));
+		} else {
+			// NOTE: Not all file systems support SEEK_HOLE,
+			// so chunk->hole isn't checked here.
+			EXPECT_EQ(0, memcmp(zero.data(), chunk->data, LBA_TO_BYTES(chunk->lba_len)));
+		}
+		lba_expected += chunk->lba_len;
+		queue.release(chunk);
+	}
+	EXPECT_EQ(TEST_FILE_LBA, lba_expected);
+	EXPECT_EQ(0, queue.finish());
+	EXPECT_EQ(12345, sparseFile->tello());
+	sparseFile->unref();
+}
+
+/**
+ * Read the file with a read error in the third chunk.
+ * The chunks before the error must be returned, and
+ * finish() must report the error.
+ */
+TEST_P(ReadAheadQueueTest, readError)
+{
+	unique_ptr<Reader> reader(new FailingReader(m_file, 0, TEST_FILE_LBA, CHUNK_LBA*2 + 5));
+	ReadAheadQueue queue(reader.get(), 0, TEST_FILE_LBA, CHUNK_LBA, 2);
+	ASSERT_EQ(0, queue.start(!!(GetParam() & TEST_ASYNC)));
+	EXPECT_FALSE(queue.isAsync());
+
+	uint32_t lba_expected = 0;
+	ReadAheadQueue::Chunk *chunk;
+	while ((chunk = queue.next()) != nullptr) {
+		ASSERT_EQ(lba_expected, chunk->lba_start);
+		EXPECT_EQ(0, memcmp(&m_data[LBA_TO_BYTES(lba_expected)], chunk->data,
+			LBA_TO_BYTES(chunk->lba_len)));
+		lba_expected += chunk->lba_len;
+		queue.release(chunk);
+	}
+	EXPECT_EQ(CHUNK_LBA*2, lba_expected);
+	EXPECT_EQ(-EIO, queue.finish());
+}
+
+/**
+ * Read a source image that was truncated in the middle of the
+ * third chunk. Both engines must report a short read as an error
+ * instead of returning zeroes.
+ */
+TEST_P(ReadAheadQueueTest, truncated)
+{
+	const size_t size = static_cast<size_t>(LBA_TO_BYTES(CHUNK_LBA*2 + 100));
+	FILE *f = fopen(TEST_FILENAME_COPY, "wb");
+	ASSERT_TRUE(f != nullptr);
+	ASSERT_EQ(1U, fwrite(m_data.data(), size, 1, f));
+	fclose(f);
+
+	RefFile *const truncFile = new RefFile(_T(TEST_FILENAME_COPY));
+	ASSERT_TRUE(truncFile->isOpen());
+	unique_ptr<Reader> reader(new PlainReader(truncFile, 0, TEST_FILE_LBA));
+	truncFile->unref();
+
+	ReadAheadQueue queue(reader.get(), 0, TEST_FILE_LBA, CHUNK_LBA, 2);
+	ASSERT_EQ(0, queue.start(!!(GetParam() & TEST_ASYNC)));
+	printf("Engine: %s\n", queue.isAsync() ? "io_uring" : "thread");
+
+	uint32_t lba_expected = 0;
+	ReadAheadQueue::Chunk *chunk;
+	while ((chunk = queue.next()) != nullptr) {
+		ASSERT_EQ(lba_expected, chunk->lba_start);
+		lba_expected += chunk->lba_len;
+		queue.release(chunk);
+	}
+	EXPECT_EQ(CHUNK_LBA*2, lba_expected);
+	EXPECT_EQ(-EIO, queue.finish());
+}
+
+/**
+ * Read from a directory, which fails with EISDIR.
+ * No chunks may be returned, and finish() must report the error.
+ */
+TEST_P(ReadAheadQueueTest, readErrorDirectory)
+{
+	RefFile *const dirFile = new RefFile(_T("."));
+	ASSERT_TRUE(dirFile->isOpen());
+	unique_ptr<Reader> reader(new PlainReader(dirFile, 0, TEST_FILE_LBA));
+	dirFile->unref();
+
+	ReadAheadQueue queue(reader.get(), 0, TEST_FILE_LBA, CHUNK_LBA, 2);
+	ASSERT_EQ(0, queue.start(!!(GetParam() & TEST_ASYNC)));
+	printf("Engine: %s\n", queue.isAsync() ? "io_uring" : "thread");
+	EXPECT_TRUE(queue.next() == nullptr);
+	EXPECT_EQ(-EISDIR, queue.finish());
+}
+
+INSTANTIATE_TEST_CASE_P(ReadAheadQueueTest, ReadAheadQueueTest,
+	::testing::Values(0U, TEST_MMAP, TEST_ASYNC, TEST_MMAP | TEST_ASYNC));
+
+} }
+
+#ifdef _MSC_VER
+# define RVTH_CDECL __cdecl
+#else
+# define RVTH_CDECL
+#endif
+
+/**
+ * Test suite main function.
+ */
+int RVTH_CDECL main(int argc, char *argv[])
+{
+	fprintf(stderr, "librvth test suite: ReadAheadQueue tests.\n\n");
+	fflush(nullptr);
+
+	// coverity[fun_call_w_exception]: uncaught exceptions cause nonzero exit anyway, so don't warn.
+	::testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,211 @@
+/***************************************************************************
+ * RVT-H Tool (librvth/tests)                                              *
+ * ScrubMapTest.cpp: ScrubMap tests.                                       *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// Google Test
+#include "gtest/gtest.h"
+
+#include "librvth/ScrubMap.hpp"
+#include "librvth/RefFile.hpp"
+#include "librvth/nhcd_structs.h"
+#include "librvth/rvth.hpp"
+#include "librvth/reader/PlainReader.hpp"
+
+// libwiicrypto
+#include "libwiicrypto/byteswap.h"
+
+// C includes. (C++ namespace)
+#include <cstdio>
+#include <cstring>
+
+// C++ includes.
+#include <memory>
+#include <vector>
+using std::unique_ptr;
+using std::vector;
+
+namespace LibRvtH { namespace Tests {
+
+class ScrubMapTest : public ::testing::Test
+{ };
+
+/**
+ * Add ranges and check that they're merged.
+ */
+TEST_F(ScrubMapTest, addMerge)
+{
+	ScrubMap scrub;
+	scrub.add(100, 10);
+	scrub.add(200, 10);
+	EXPECT_EQ(2U, scrub.rangeCount());
+	EXPECT_EQ(20U, scrub.usedLbaCount());
+
+	// Touching ranges are merged.
+	scrub.add(110, 5);
+	EXPECT_EQ(2U, scrub.rangeCount());
+	EXPECT_EQ(25U, scrub.usedLbaCount());
+
+	// A range covering both ranges merges them.
+	scrub.add(90, 150);
+	EXPECT_EQ(1U, scrub.rangeCount());
+	EXPECT_EQ(150U, scrub.usedLbaCount());
+
+	// Ranges within an existing range don't change anything.
+	scrub.add(100, 1);
+	scrub.add(0, 0);
+	EXPECT_EQ(1U, scrub.rangeCount());
+	EXPECT_EQ(150U, scrub.usedLbaCount());
+
+	// Byte ranges are expanded to whole LBAs.
+	scrub.clear();
+	scrub.addBytes(LBA_SIZE - 1, 2);
+	EXPECT_EQ(2U, scrub.usedLbaCount());
+	EXPECT_TRUE(scrub.isFullyUsed(0, 2));
+}
+
+/**
+ * Check isUsed() and isFullyUsed().
+ */
+TEST_F(ScrubMapTest, isUsed)
+{
+	ScrubMap scrub;
+	EXPECT_FALSE(scrub.isUsed(0, 1000));
+
+	scrub.add(100, 10);
+	scrub.add(200, 10);
+
+	EXPECT_FALSE(scrub.isUsed(0, 100));
+	EXPECT_TRUE(scrub.isUsed(0, 101));
+	EXPECT_TRUE(scrub.isUsed(109, 1));
+	EXPECT_FALSE(scrub.isUsed(110, 90));
+	EXPECT_TRUE(scrub.isUsed(110, 91));
+	EXPECT_FALSE(scrub.isUsed(210, 1000));
+
+	EXPECT_TRUE(scrub.isFullyUsed(100, 10));
+	EXPECT_TRUE(scrub.isFullyUsed(105, 5));
+	EXPECT_FALSE(scrub.isFullyUsed(99, 2));
+	EXPECT_FALSE(scrub.isFullyUsed(105, 10));
+	EXPECT_FALSE(scrub.isFullyUsed(100, 110));
+}
+
+/**
+ * Check that clearUnused() only zeroes unused LBAs.
+ */
+TEST_F(ScrubMapTest, clearUnused)
+{
+	ScrubMap scrub;
+	scrub.add(2, 2);
+	scrub.add(6, 10);
+
+	// Buffer covering LBAs 1-7.
+	vector<uint8_t> buf(LBA_TO_BYTES(7), 0xAA);
+	scrub.clearUnused(buf.data(), 1, 7);
+
+	static const bool used[7] = {false, true, true, false, false, true, true};
+	for (unsigned int i = 0; i < 7; i++) {
+		const uint8_t expected = (used[i] ? 0xAA : 0x00);
+		const uint8_t *const lba = &buf[LBA_TO_BYTES(i)];
+		EXPECT_EQ(expected, lba[0]) << "LBA " << (i + 1);
+		EXPECT_EQ(expected, lba[LBA_SIZE - 1]) << "LBA " << (i + 1);
+	}
+}
+
+#define TEST_FILENAME "ScrubMapTest.gcm"
+#define DISC_SIZE	0x100000
+#define FST_ADDRESS	0x8000
+#define DOL_ADDRESS	0x4000
+#define FILE_ADDRESS	0x80000
+#define FILE_SIZE	1000U
+
+/**
+ * Build a map from a GameCube disc image.
+ */
+TEST_F(ScrubMapTest, loadGCN)
+{
+	vector<uint8_t> disc(DISC_SIZE, 0xAA);
+
+	// FST: Root directory and one file.
+	GCN_FST_Entry *const fst = reinterpret_cast<GCN_FST_Entry*>(&disc[FST_ADDRESS]);
+	fst[0].file_type_name_offset = cpu_to_be32(0x01000000);
+	fst[0].dir.parent_dir_idx = 0;
+	fst[0].dir.last_entry_idx = cpu_to_be32(2);
+	fst[1].file_type_name_offset = cpu_to_be32(0);
+	fst[1].file.offset = cpu_to_be32(FILE_ADDRESS);
+	fst[1].file.size = cpu_to_be32(FILE_SIZE);
+	memcpy(&fst[2], "a.bin", 6);
+	const uint32_t fst_size = (2 * sizeof(GCN_FST_Entry)) + 6;
+
+	// Boot block.
+	GCN_Boot_Block *const bb2 = reinterpret_cast<GCN_Boot_Block*>(&disc[GCN_Boot_Block_ADDRESS]);
+	bb2->bootFilePosition = cpu_to_be32(DOL_ADDRESS);
+	bb2->FSTPosition = cpu_to_be32(FST_ADDRESS);
+	bb2->FSTLength = cpu_to_be32(fst_size);
+
+	// Apploader header: 0x1000 bytes of code and no trailer.
+	uint32_t *const apl_hdr = reinterpret_cast<uint32_t*>(&disc[0x2440]);
+	apl_hdr[5] = cpu_to_be32(0x1000);
+	apl_hdr[6] = 0;
+
+	// DOL header: One text section that ends at 0x1000.
+	DOL_Header *const dol = reinterpret_cast<DOL_Header*>(&disc[DOL_ADDRESS]);
+	memset(dol, 0, sizeof(*dol));
+	dol->textData[0] = cpu_to_be32(0x100);
+	dol->textLen[0] = cpu_to_be32(0xF00);
+
+	FILE *f = fopen(TEST_FILENAME, "wb");
+	ASSERT_TRUE(f != nullptr);
+	ASSERT_EQ(1U, fwrite(disc.data(), disc.size(), 1, f));
+	fclose(f);
+
+	RefFile *const file = new RefFile(_T(TEST_FILENAME));
+	ASSERT_TRUE(file->isOpen());
+	unique_ptr<Reader> reader(new PlainReader(file, 0, BYTES_TO_LBA(DISC_SIZE)));
+	file->unref();
+
+	RvtH_BankEntry entry;
+	memset(&entry, 0, sizeof(entry));
+	entry.reader = reader.get();
+	entry.type = RVTH_BankType_GCN;
+
+	ScrubMap scrub;
+	ASSERT_EQ(0, scrub.load(&entry));
+
+	// Disc header, bi2.bin, and apploader.
+	EXPECT_TRUE(scrub.isFullyUsed(0, BYTES_TO_LBA(0x2440 + 0x20 + 0x1000)));
+	// main.dol and fst.bin
+	EXPECT_TRUE(scrub.isFullyUsed(BYTES_TO_LBA(DOL_ADDRESS), BYTES_TO_LBA(0x1000)));
+	EXPECT_TRUE(scrub.isFullyUsed(BYTES_TO_LBA(FST_ADDRESS), 1));
+	// a.bin
+	EXPECT_TRUE(scrub.isFullyUsed(BYTES_TO_LBA(FILE_ADDRESS), 2));
+	EXPECT_FALSE(scrub.isUsed(BYTES_TO_LBA(FILE_ADDRESS) + 2, BYTES_TO_LBA(DISC_SIZE - FILE_ADDRESS) - 2));
+	// Unused area between the FST and a.bin.
+	EXPECT_FALSE(scrub.isUsed(BYTES_TO_LBA(FST_ADDRESS) + 1, BYTES_TO_LBA(FILE_ADDRESS - FST_ADDRESS) - 1));
+
+	reader.reset();
+	remove(TEST_FILENAME);
+}
+
+} }
+
+#ifdef _MSC_VER
+# define RVTH_CDECL __cdecl
+#else
+# define RVTH_CDECL
+#endif
+
+/**
+ * Test suite main function.
+ */
+int RVTH_CDECL main(int argc, char *argv[])
+{
+	fprintf(stderr, "librvth test suite: ScrubMap tests.\n\n");
+	fflush(nullptr);
+
+	// coverity[fun_call_w_exception]: uncaught exceptions cause nonzero exit anyway, so don't warn.
+	::testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,333 @@
+/***************************************************************************
+ * RVT-H Tool (librvth/tests)                                              *
+ * VerifyTest.cpp: Wii partition hash verification tests.                 *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// Google Test
+#include "gtest/gtest.h"
+
+#include "librvth/rvth.hpp"
+#include "librvth/rvth_error.h"
+#include "librvth/nhcd_structs.h"
+#include "librvth/wii_crypt.h"
+#include "WiiTestImage.hpp"
+
+// libwiicrypto
+#include "libwiicrypto/aesw.h"
+#include "libwiicrypto/byteswap.h"
+#include "libwiicrypto/cert_store.h"
+#include "libwiicrypto/gcn_structs.h"
+#include "libwiicrypto/sha1w.h"
+#include "libwiicrypto/wii_structs.h"
+
+// C includes. (C++ namespace)
+#include <cstdio>
+#include <cstring>
+
+// C++ includes.
+#include <vector>
+using std::vector;
+
+namespace LibRvtH { namespace Tests {
+
+// Disc layout: Partition table, then a single game partition.
+#define PARTITION_OFFSET 0x50000
+#define TMD_OFFSET 0x2C0
+#define H3_OFFSET 0x8000
+#define DATA_OFFSET (0x8000 + 0x18000)
+// Number of encrypted sectors. (1 full group and a partial group)
+#define SECTOR_COUNT (64 + 16)
+// Image size, in bytes.
+#define IMAGE_SIZE (PARTITION_OFFSET + DATA_OFFSET + (SECTOR_COUNT * SECTOR_SIZE_ENC))
+
+class VerifyTest : public ::testing::Test
+{
+	protected:
+		void SetUp(void) final;
+		void TearDown(void) final;
+
+	public:
+		/**
+		 * Verification error callback.
+		 * @param error		[in] Verification error.
+		 * @param userdata	[in] vector<RvtH_Verify_Error>*
+		 * @return True to continue.
+		 */
+		static bool errorCallback(const RvtH_Verify_Error *error, void *userdata);
+
+		/**
+		 * Verify the test image.
+		 * @param errors	[out] Verification errors.
+		 * @return verifyWiiPartitions() return value.
+		 */
+		int verify(vector<RvtH_Verify_Error> &errors);
+
+		/**
+		 * XOR a byte in the test image.
+		 * @param offset Offset, in bytes.
+		 */
+		void corrupt(uint32_t offset);
+};
+
+#define TEST_FILENAME "VerifyTest.gcm"
+
+/**
+ * Build the hash tables for a group and encrypt it.
+ * @param aesw		[in] AES context. (Key must be set to the title key.)
+ * @param sector	[in/out] Decrypted sectors, with user data.
+ * @param sectors	[in] Number of sectors in the group. (1-64)
+ * @param h3		[out] H3 hash for the group.
+ */
+static void encryptGroup(AesCtx *aesw, Wii_Disc_Sector_t *sector, unsigned int sectors, uint8_t *h3)
+{
+	static const uint8_t iv_zero[16] = {0};
+	struct sha1_ctx sha1;
+	uint8_t h1[8][8][SHA1_DIGEST_SIZE];
+	uint8_t h2[8][SHA1_DIGEST_SIZE];
+
+	// H0: Hash of each 1 KB block. H1: Hash of each sector's H0 table.
+	memset(h1, 0, sizeof(h1));
+	for (unsigned int s = 0; s < sectors; s++) {
+		for (unsigned int b = 0; b < 31; b++) {
+			sha1_init(&sha1);
+			sha1_update(&sha1, 1024, &sector[s].data[b * 1024]);
+			sha1_digest(&sha1, SHA1_DIGEST_SIZE, sector[s].hashes.H0[b]);
+		}
+		sha1_init(&sha1);
+		sha1_update(&sha1, sizeof(sector[s].hashes.H0), sector[s].hashes.H0[0]);
+		sha1_digest(&sha1, SHA1_DIGEST_SIZE, h1[s / 8][s % 8]);
+	}
+
+	// H2: Hash of each subgroup's H1 table.
+	for (unsigned int sg = 0; sg < 8; sg++) {
+		sha1_init(&sha1);
+		sha1_update(&sha1, sizeof(h1[sg]), h1[sg][0]);
+		sha1_digest(&sha1, SHA1_DIGEST_SIZE, h2[sg]);
+	}
+
+	// H3: Hash of the H2 table.
+	sha1_init(&sha1);
+	sha1_update(&sha1, sizeof(h2), h2[0]);
+	sha1_digest(&sha1, SHA1_DIGEST_SIZE, h3);
+
+	for (unsigned int s = 0; s < sectors; s++) {
+		memcpy(sector[s].hashes.H1, h1[s / 8], sizeof(sector[s].hashes.H1));
+		memcpy(sector[s].hashes.H2, h2, sizeof(sector[s].hashes.H2));
+
+		// Hash table: IV is all zero.
+		aesw_set_iv(aesw, iv_zero, sizeof(iv_zero));
+		aesw_encrypt(aesw, reinterpret_cast<uint8_t*>(&sector[s].hashes), sizeof(sector[s].hashes));
+
+		// User data IV is stored within the *encrypted* H2 table.
+		aesw_set_iv(aesw, &sector[s].hashes.H2[7][4], 16);
+		aesw_encrypt(aesw, sector[s].data, sizeof(sector[s].data));
+	}
+}
+
+void VerifyTest::SetUp(void)
+{
+	vector<uint8_t> image(IMAGE_SIZE);
+	AesCtx *const aesw = aesw_new();
+	ASSERT_TRUE(aesw != nullptr);
+
+	// Disc header.
+	GCN_DiscHeader *const discHeader = reinterpret_cast<GCN_DiscHeader*>(image.data());
+	memcpy(discHeader->id6, "RVTS01", 6);
+	discHeader->magic_wii = cpu_to_be32(WII_MAGIC);
+	strcpy(discHeader->game_title, "VERIFY TEST");
+
+	// Partition table.
+	RVL_VolumeGroupTable *const vgtbl = reinterpret_cast<RVL_VolumeGroupTable*>(
+		&image[RVL_VolumeGroupTable_ADDRESS]);
+	vgtbl->vg[0].count = cpu_to_be32(1);
+	vgtbl->vg[0].addr = cpu_to_be32((RVL_VolumeGroupTable_ADDRESS + sizeof(*vgtbl)) >> 2);
+	RVL_PartitionTableEntry *const ptent = reinterpret_cast<RVL_PartitionTableEntry*>(
+		&image[RVL_VolumeGroupTable_ADDRESS + sizeof(*vgtbl)]);
+	ptent->addr = cpu_to_be32(PARTITION_OFFSET >> 2);
+	ptent->type = cpu_to_be32(0);
+
+	// Partition header with a debug ticket.
+	RVL_PartitionHeader *const pthdr = reinterpret_cast<RVL_PartitionHeader*>(&image[PARTITION_OFFSET]);
+	ASSERT_NO_FATAL_FAILURE(initDebugTicket(&pthdr->ticket, 0x52565453));	// "RVTS"
+	pthdr->tmd_size = cpu_to_be32(sizeof(RVL_TMD_Header) + sizeof(RVL_Content_Entry));
+	pthdr->tmd_offset = cpu_to_be32(TMD_OFFSET >> 2);
+	pthdr->h3_table_offset = cpu_to_be32(H3_OFFSET >> 2);
+	pthdr->data_offset = cpu_to_be32(DATA_OFFSET >> 2);
+	pthdr->data_size = cpu_to_be32((SECTOR_COUNT * SECTOR_SIZE_ENC) >> 2);
+
+	// TMD with one content entry.
+	RVL_TMD_Header *const tmd = reinterpret_cast<RVL_TMD_Header*>(&pthdr->u8[TMD_OFFSET]);
+	const char *const tmdIssuer = RVL_Cert_Issuers[RVL_CERT_ISSUER_DEBUG_TMD];
+	memcpy(tmd->issuer, tmdIssuer, strlen(tmdIssuer));
+	tmd->title_id = pthdr->ticket.title_id;
+	tmd->nbr_cont = cpu_to_be16(1);
+	RVL_Content_Entry *const content = reinterpret_cast<RVL_Content_Entry*>(
+		&pthdr->u8[TMD_OFFSET + sizeof(RVL_TMD_Header)]);
+
+	// User data is a simple pseudo-random sequence.
+	TestRandom rng;
+	Wii_Disc_Sector_t *const sector = reinterpret_cast<Wii_Disc_Sector_t*>(
+		&image[PARTITION_OFFSET + DATA_OFFSET]);
+	for (unsigned int i = 0; i < SECTOR_COUNT; i++) {
+		rng.fill(sector[i].data, sizeof(sector[i].data));
+	}
+
+	// Encrypt the groups and calculate the H3 table.
+	Wii_Disc_H3_t *const h3tbl = reinterpret_cast<Wii_Disc_H3_t*>(&image[PARTITION_OFFSET + H3_OFFSET]);
+	aesw_set_key(aesw, testTitleKey, sizeof(testTitleKey));
+	encryptGroup(aesw, &sector[0], 64, h3tbl->h3[0]);
+	encryptGroup(aesw, &sector[64], SECTOR_COUNT - 64, h3tbl->h3[1]);
+	aesw_free(aesw);
+
+	struct sha1_ctx sha1;
+	sha1_init(&sha1);
+	sha1_update(&sha1, sizeof(*h3tbl), reinterpret_cast<const uint8_t*>(h3tbl));
+	sha1_digest(&sha1, sizeof(content->sha1_hash), content->sha1_hash);
+
+	FILE *f = fopen(TEST_FILENAME, "wb");
+	ASSERT_TRUE(f != nullptr);
+	ASSERT_EQ(1U, fwrite(image.data(), image.size(), 1, f));
+	fclose(f);
+}
+
+void VerifyTest::TearDown(void)
+{
+	remove(TEST_FILENAME);
+}
+
+/**
+ * Verification error callback.
+ * @param error		[in] Verification error.
+ * @param userdata	[in] vector<RvtH_Verify_Error>*
+ * @return True to continue.
+ */
+bool VerifyTest::errorCallback(const RvtH_Verify_Error *error, void *userdata)
+{
+	static_cast<vector<RvtH_Verify_Error>*>(userdata)->push_back(*error);
+	return true;
+}
+
+/**
+ * Verify the test image.
+ * @param errors	[out] Verification errors.
+ * @return verifyWiiPartitions() return value.
+ */
+int VerifyTest::verify(vector<RvtH_Verify_Error> &errors)
+{
+	int err = 0;
+	RvtH *const rvth = new RvtH(_T(TEST_FILENAME), &err);
+	EXPECT_EQ(0, err);
+	EXPECT_EQ(1U, rvth->bankCount());
+
+	errors.clear();
+	const int ret = rvth->verifyWiiPartitions(0, errorCallback, nullptr, &errors);
+	delete rvth;
+	return ret;
+}
+
+/**
+ * XOR a byte in the test image.
+ * @param offset Offset, in bytes.
+ */
+void VerifyTest::corrupt(uint32_t offset)
+{
+	FILE *f = fopen(TEST_FILENAME, "r+b");
+	ASSERT_TRUE(f != nullptr);
+	ASSERT_EQ(0, fseek(f, offset, SEEK_SET));
+	const int c = fgetc(f);
+	ASSERT_NE(EOF, c);
+	ASSERT_EQ(0, fseek(f, offset, SEEK_SET));
+	ASSERT_NE(EOF, fputc(c ^ 0xFF, f));
+	fclose(f);
+}
+
+/**
+ * Verify an image with a valid hash tree.
+ */
+TEST_F(VerifyTest, valid)
+{
+	vector<RvtH_Verify_Error> errors;
+	EXPECT_EQ(0, verify(errors));
+	EXPECT_EQ(0U, errors.size());
+}
+
+/**
+ * Corrupt one 1 KB block of user data in each group.
+ * Only the H0 hash of that block should fail, and the
+ * group, sector, block, and LBA must be reported.
+ */
+TEST_F(VerifyTest, corruptedSector)
+{
+	static const struct {
+		uint32_t group;
+		unsigned int sector;
+		unsigned int block;
+	} bad[] = {
+		{0, 17, 30},
+		{1, 5, 3},	// Partial group
+	};
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(bad); i++) {
+		const uint32_t sector_offset = PARTITION_OFFSET + DATA_OFFSET +
+			(((bad[i].group * 64) + bad[i].sector) * SECTOR_SIZE_ENC);
+		corrupt(sector_offset + sizeof(Wii_Disc_Hashes_t) + (bad[i].block * 1024) + 100);
+	}
+
+	vector<RvtH_Verify_Error> errors;
+	EXPECT_EQ(RVTH_ERROR_VERIFY_FAILED, verify(errors));
+	ASSERT_EQ(static_cast<size_t>(ARRAY_SIZE(bad)), errors.size());
+	for (unsigned int i = 0; i < ARRAY_SIZE(bad); i++) {
+		EXPECT_EQ(RVTH_VERIFY_ERROR_H0, errors[i].type);
+		EXPECT_EQ(0U, errors[i].pt_idx);
+		EXPECT_EQ(bad[i].group, errors[i].group);
+		EXPECT_EQ(bad[i].sector, errors[i].sector);
+		EXPECT_EQ(bad[i].block, errors[i].block);
+		EXPECT_EQ(BYTES_TO_LBA(PARTITION_OFFSET + DATA_OFFSET) +
+			(((bad[i].group * 64) + bad[i].sector) * BYTES_TO_LBA(SECTOR_SIZE_ENC)),
+			errors[i].lba);
+	}
+}
+
+/**
+ * Corrupt the H3 table. The TMD content hash and the
+ * H3 hashes of every sector in the group should fail.
+ */
+TEST_F(VerifyTest, corruptedH3)
+{
+	corrupt(PARTITION_OFFSET + H3_OFFSET + SHA1_DIGEST_SIZE + 1);
+
+	vector<RvtH_Verify_Error> errors;
+	EXPECT_EQ(RVTH_ERROR_VERIFY_FAILED, verify(errors));
+	ASSERT_EQ(1U + (SECTOR_COUNT - 64), errors.size());
+	EXPECT_EQ(RVTH_VERIFY_ERROR_H4, errors[0].type);
+	EXPECT_EQ(BYTES_TO_LBA(PARTITION_OFFSET + H3_OFFSET), errors[0].lba);
+	for (unsigned int i = 1; i < errors.size(); i++) {
+		EXPECT_EQ(RVTH_VERIFY_ERROR_H3, errors[i].type);
+		EXPECT_EQ(1U, errors[i].group);
+		EXPECT_EQ(i - 1, errors[i].sector);
+	}
+}
+
+} }
+
+#ifdef _MSC_VER
+# define RVTH_CDECL __cdecl
+#else
+# define RVTH_CDECL
+#endif
+
+/**
+ * Test suite main function.
+ */
+int RVTH_CDECL main(int argc, char *argv[])
+{
+	fprintf(stderr, "librvth test suite: Verify tests.\n\n");
+	fflush(nullptr);
+
+	// coverity[fun_call_w_exception]: uncaught exceptions cause nonzero exit anyway, so don't warn.
+	::testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,271 @@
+/***************************************************************************
+ * RVT-H Tool (librvth/tests)                                              *
+ * WbfsWriterTest.cpp: WbfsWriter tests.                                   *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// Google Test
+#include "gtest/gtest.h"
+
+#include "librvth/RefFile.hpp"
+#include "librvth/nhcd_structs.h"
+#include "librvth/reader/WbfsReader.hpp"
+#include "librvth/reader/WbfsWriter.hpp"
+#include "librvth/reader/libwbfs.h"
+
+// libwiicrypto
+#include "libwiicrypto/byteswap.h"
+
+// C includes. (C++ namespace)
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+// C++ includes.
+#include <memory>
+#include <vector>
+using std::unique_ptr;
+using std::vector;
+
+namespace LibRvtH { namespace Tests {
+
+// WBFS block size for new images. (2 MB)
+#define BLOCK_SIZE (2U*1024U*1024U)
+#define BLOCK_LBA BYTES_TO_LBA(BLOCK_SIZE)
+// Number of blocks in each test disc.
+#define BLOCK_COUNT 6
+// Test disc size, in LBAs.
+#define TEST_DISC_LBA (BLOCK_LBA * BLOCK_COUNT)
+
+class WbfsWriterTest : public ::testing::Test
+{
+	protected:
+		void SetUp(void) final;
+		void TearDown(void) final;
+
+	public:
+		/**
+		 * Create test disc data.
+		 * Blocks 0 and 2 have data. The other blocks are all zero.
+		 * @param data	[out] Disc data.
+		 * @param id	[in] Disc ID byte.
+		 */
+		static void createDisc(vector<uint8_t> &data, uint8_t id);
+
+		/**
+		 * Write a disc to the WBFS test file.
+		 * @param data		[in] Disc data.
+		 * @param append	[in] If true, add the disc to the existing WBFS image.
+		 * @param flush		[in] If true, flush the writer before deleting it.
+		 */
+		static void writeDisc(const vector<uint8_t> &data, bool append, bool flush);
+
+		/**
+		 * Read the first word of the free block table.
+		 * @param file	[in] RefFile.
+		 * @return First word of the free block table. (host-endian)
+		 */
+		static uint32_t readFreeBlocks0(RefFile *file);
+
+	protected:
+		vector<uint8_t> m_disc1;
+		vector<uint8_t> m_disc2;
+};
+
+#define TEST_FILENAME "WbfsWriterTest.wbfs"
+
+void WbfsWriterTest::SetUp(void)
+{
+	createDisc(m_disc1, 1);
+	createDisc(m_disc2, 2);
+}
+
+void WbfsWriterTest::TearDown(void)
+{
+	remove(TEST_FILENAME);
+}
+
+/**
+ * Create test disc data.
+ * Blocks 0 and 2 have data. The other blocks are all zero.
+ * @param data	[out] Disc data.
+ * @param id	[in] Disc ID byte.
+ */
+void WbfsWriterTest::createDisc(vector<uint8_t> &data, uint8_t id)
+{
+	data.assign(LBA_TO_BYTES(TEST_DISC_LBA), 0);
+	static const unsigned int used[] = {0, 2};
+	for (unsigned int i = 0; i < ARRAY_SIZE(used); i++) {
+		uint8_t *const block = &data[used[i] * BLOCK_SIZE];
+		for (unsigned int j = 0; j < BLOCK_SIZE; j += 4096) {
+			block[j] = id;
+			block[j + 1] = static_cast<uint8_t>(used[i]);
+			block[j + 2] = static_cast<uint8_t>(j >> 12);
+		}
+	}
+}
+
+/**
+ * Write a disc to the WBFS test file.
+ * @param data		[in] Disc data.
+ * @param append	[in] If true, add the disc to the existing WBFS image.
+ * @param flush		[in] If true, flush the writer before deleting it.
+ */
+void WbfsWriterTest::writeDisc(const vector<uint8_t> &data, bool append, bool flush)
+{
+	RefFile *const file = new RefFile(_T(TEST_FILENAME), !append);
+	ASSERT_TRUE(file->isOpen());
+	if (append) {
+		ASSERT_EQ(0, file->makeWritable());
+	}
+	unique_ptr<WbfsWriter> writer(new WbfsWriter(file, TEST_DISC_LBA, append));
+	file->unref();
+	ASSERT_TRUE(writer->isOpen());
+
+	// Write in odd-sized pieces so writes cross block boundaries.
+	const uint32_t step = BLOCK_LBA / 3 + 1;
+	for (uint32_t lba = 0; lba < TEST_DISC_LBA; lba += step) {
+		const uint32_t lba_len = (TEST_DISC_LBA - lba < step ? TEST_DISC_LBA - lba : step);
+		ASSERT_EQ(lba_len, writer->write(&data[LBA_TO_BYTES(lba)], lba, lba_len));
+	}
+
+	// The writer can read back its own data.
+	vector<uint8_t> actual(data.size());
+	ASSERT_EQ(TEST_DISC_LBA, writer->read(actual.data(), 0, TEST_DISC_LBA));
+	EXPECT_TRUE(data == actual);
+
+	if (flush) {
+		errno = 0;
+		writer->flush();
+		ASSERT_EQ(0, errno);
+	}
+}
+
+/**
+ * Read the first word of the free block table.
+ * @param file	[in] RefFile.
+ * @return First word of the free block table. (host-endian)
+ */
+uint32_t WbfsWriterTest::readFreeBlocks0(RefFile *file)
+{
+	wbfs_t *const p = WbfsReader::readWbfsHeader(file, 0);
+	EXPECT_TRUE(p != nullptr);
+	if (!p) {
+		return 0;
+	}
+
+	uint32_t word = 0;
+	EXPECT_EQ(sizeof(word), file->pread(&word, sizeof(word),
+		static_cast<int64_t>(p->freeblks_lba) << p->hd_sec_sz_s));
+	WbfsReader::freeWbfsHeader(p);
+	return be32_to_cpu(word);
+}
+
+/**
+ * Write a new WBFS image and read it back using WbfsReader.
+ */
+TEST_F(WbfsWriterTest, newImage)
+{
+	ASSERT_NO_FATAL_FAILURE(writeDisc(m_disc1, false, true));
+
+	RefFile *const file = new RefFile(_T(TEST_FILENAME));
+	ASSERT_TRUE(file->isOpen());
+
+	// Empty blocks aren't stored, but the last block is,
+	// since it determines the image size. Blocks 0, 2, and 5
+	// are physical blocks 1, 2, and 3. (bit n == block n+1)
+	EXPECT_EQ(~0x7U, readFreeBlocks0(file));
+
+	unique_ptr<WbfsReader> reader(new WbfsReader(file, 0, 0));
+	file->unref();
+	ASSERT_TRUE(reader->isOpen());
+	ASSERT_EQ(TEST_DISC_LBA, reader->lba_len());
+	vector<uint8_t> actual(m_disc1.size(), 0xAA);
+	ASSERT_EQ(TEST_DISC_LBA, reader->read(actual.data(), 0, TEST_DISC_LBA));
+	EXPECT_TRUE(m_disc1 == actual);
+}
+
+/**
+ * Add a second disc to an existing WBFS image.
+ */
+TEST_F(WbfsWriterTest, appendDisc)
+{
+	ASSERT_NO_FATAL_FAILURE(writeDisc(m_disc1, false, true));
+
+	// If the writer isn't flushed, the image isn't changed.
+	// The disc table slot is only set after everything else
+	// has been written.
+	ASSERT_NO_FATAL_FAILURE(writeDisc(m_disc2, true, false));
+	RefFile *file = new RefFile(_T(TEST_FILENAME));
+	ASSERT_TRUE(file->isOpen());
+	wbfs_t *p = WbfsReader::readWbfsHeader(file, 0);
+	ASSERT_TRUE(p != nullptr);
+	EXPECT_EQ(1, p->head->disc_table[0]);
+	EXPECT_EQ(0, p->head->disc_table[1]);
+	WbfsReader::freeWbfsHeader(p);
+	EXPECT_EQ(~0x7U, readFreeBlocks0(file));
+	file->unref();
+
+	// Add the second disc.
+	ASSERT_NO_FATAL_FAILURE(writeDisc(m_disc2, true, true));
+	file = new RefFile(_T(TEST_FILENAME));
+	ASSERT_TRUE(file->isOpen());
+	p = WbfsReader::readWbfsHeader(file, 0);
+	ASSERT_TRUE(p != nullptr);
+	EXPECT_EQ(1, p->head->disc_table[0]);
+	EXPECT_EQ(1, p->head->disc_table[1]);
+
+	// The second disc uses the next free blocks: 4, 5, and 6.
+	EXPECT_EQ(~0x3FU, readFreeBlocks0(file));
+
+	// Check the second disc's block map and data.
+	vector<uint8_t> infoBuf(p->disc_info_sz);
+	ASSERT_EQ(infoBuf.size(), file->pread(infoBuf.data(), infoBuf.size(),
+		p->hd_sec_sz + p->disc_info_sz));
+	const wbfs_disc_info_t *const info = reinterpret_cast<const wbfs_disc_info_t*>(infoBuf.data());
+	EXPECT_EQ(0, memcmp(info->disc_header_copy, m_disc2.data(), sizeof(info->disc_header_copy)));
+	static const uint16_t wlba_expected[BLOCK_COUNT] = {4, 0, 5, 0, 0, 6};
+	vector<uint8_t> block(BLOCK_SIZE);
+	for (unsigned int i = 0; i < BLOCK_COUNT; i++) {
+		const uint16_t phys = be16_to_cpu(info->wlba_table[i]);
+		ASSERT_EQ(wlba_expected[i], phys) << "block " << i;
+		if (phys == 0)
+			continue;
+		ASSERT_EQ(block.size(), file->pread(block.data(), block.size(),
+			static_cast<int64_t>(phys) * BLOCK_SIZE));
+		EXPECT_EQ(0, memcmp(&m_disc2[i * BLOCK_SIZE], block.data(), BLOCK_SIZE)) << "block " << i;
+	}
+	WbfsReader::freeWbfsHeader(p);
+
+	// The first disc is unchanged.
+	unique_ptr<WbfsReader> reader(new WbfsReader(file, 0, 0));
+	file->unref();
+	ASSERT_TRUE(reader->isOpen());
+	ASSERT_EQ(TEST_DISC_LBA, reader->lba_len());
+	vector<uint8_t> actual(m_disc1.size(), 0xAA);
+	ASSERT_EQ(TEST_DISC_LBA, reader->read(actual.data(), 0, TEST_DISC_LBA));
+	EXPECT_TRUE(m_disc1 == actual);
+}
+
+} }
+
+#ifdef _MSC_VER
+# define RVTH_CDECL __cdecl
+#else
+# define RVTH_CDECL
+#endif
+
+/**
+ * Test suite main function.
+ */
+int RVTH_CDECL main(int argc, char *argv[])
+{
+	fprintf(stderr, "librvth test suite: WbfsWriter tests.\n\n");
+	fflush(nullptr);
+
+	// coverity[fun_call_w_exception]: uncaught exceptions cause nonzero exit anyway, so don't warn.
+	::testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
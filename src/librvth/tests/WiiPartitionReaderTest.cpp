@@ -0,0 +1,297 @@
+/***************************************************************************
+ * RVT-H Tool (librvth/tests)                                              *
+ * WiiPartitionReaderTest.cpp: WiiPartitionReader tests.                   *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// Google Test
+#include "gtest/gtest.h"
+
+#include "librvth/RefFile.hpp"
+#include "librvth/nhcd_structs.h"
+#include "librvth/ptbl.h"
+#include "librvth/wii_crypt.h"
+#include "librvth/reader/PlainReader.hpp"
+#include "librvth/reader/MmapReader.hpp"
+#include "librvth/reader/WiiPartitionReader.hpp"
+#include "WiiTestImage.hpp"
+
+// libwiicrypto
+#include "libwiicrypto/aesw.h"
+#include "libwiicrypto/byteswap.h"
+
+// C includes. (C++ namespace)
+#include <cstdio>
+#include <cstring>
+
+// C++ includes.
+#include <memory>
+#include <thread>
+#include <vector>
+using std::thread;
+using std::unique_ptr;
+using std::vector;
+
+namespace LibRvtH { namespace Tests {
+
+// Partition layout: Partition header, H3 table, and encrypted data.
+#define DATA_OFFSET (0x8000 + 0x18000)
+// Number of encrypted sectors. (2 full groups and a partial group)
+#define SECTOR_COUNT (64*2 + 10)
+// Partition length, in LBAs.
+#define PARTITION_LBA (BYTES_TO_LBA(DATA_OFFSET) + (SECTOR_COUNT * BYTES_TO_LBA(SECTOR_SIZE_ENC)))
+
+// Test parameter flags.
+#define TEST_MMAP	(1U << 0)	/* Use MmapReader instead of PlainReader. */
+
+class WiiPartitionReaderTest : public ::testing::TestWithParam<unsigned int>
+{
+	protected:
+		WiiPartitionReaderTest()
+			: m_file(nullptr) { }
+
+		void SetUp(void) final;
+		void TearDown(void) final;
+
+	public:
+		/**
+		 * Create a Reader for the test file.
+		 * @return Reader.
+		 */
+		Reader *createReader(void);
+
+	protected:
+		RefFile *m_file;
+		vector<uint8_t> m_plain;	// Decrypted user data.
+		pt_entry_t m_pte;		// Partition table entry.
+};
+
+#define TEST_FILENAME "WiiPartitionReaderTest.bin"
+
+void WiiPartitionReaderTest::SetUp(void)
+{
+	// User data is a simple pseudo-random sequence.
+	m_plain.resize(SECTOR_COUNT * SECTOR_SIZE_DEC);
+	TestRandom().fill(m_plain.data(), m_plain.size());
+
+	vector<uint8_t> image(LBA_TO_BYTES(PARTITION_LBA));
+	AesCtx *const aesw = aesw_new();
+	ASSERT_TRUE(aesw != nullptr);
+
+	// Partition header with a debug ticket.
+	RVL_PartitionHeader *const pthdr = reinterpret_cast<RVL_PartitionHeader*>(image.data());
+	ASSERT_NO_FATAL_FAILURE(initDebugTicket(&pthdr->ticket, 0x52564C45));	// "RVLE"
+	pthdr->data_offset = cpu_to_be32(DATA_OFFSET >> 2);
+	pthdr->data_size = cpu_to_be32((SECTOR_COUNT * SECTOR_SIZE_ENC) >> 2);
+
+	// Encrypted sectors.
+	// The hash tables are filled with junk, since only
+	// the user data IV is used for decryption.
+	aesw_set_key(aesw, testTitleKey, sizeof(testTitleKey));
+	Wii_Disc_Sector_t *sector = reinterpret_cast<Wii_Disc_Sector_t*>(&image[DATA_OFFSET]);
+	for (unsigned int i = 0; i < SECTOR_COUNT; i++, sector++) {
+		memset(&sector->hashes, static_cast<int>(i * 13), sizeof(sector->hashes));
+		memcpy(sector->data, &m_plain[i * SECTOR_SIZE_DEC], SECTOR_SIZE_DEC);
+		aesw_set_iv(aesw, &sector->hashes.H2[7][4], 16);
+		aesw_encrypt(aesw, sector->data, sizeof(sector->data));
+	}
+	aesw_free(aesw);
+
+	FILE *f = fopen(TEST_FILENAME, "wb");
+	ASSERT_TRUE(f != nullptr);
+	ASSERT_EQ(1U, fwrite(image.data(), image.size(), 1, f));
+	fclose(f);
+
+	m_file = new RefFile(_T(TEST_FILENAME));
+	ASSERT_TRUE(m_file->isOpen());
+
+	memset(&m_pte, 0, sizeof(m_pte));
+	m_pte.lba_start = 0;
+	m_pte.lba_len = PARTITION_LBA;
+}
+
+void WiiPartitionReaderTest::TearDown(void)
+{
+	if (m_file) {
+		m_file->unref();
+		m_file = nullptr;
+	}
+	remove(TEST_FILENAME);
+}
+
+/**
+ * Create a Reader for the test file.
+ * @return Reader.
+ */
+Reader *WiiPartitionReaderTest::createReader(void)
+{
+	if (GetParam() & TEST_MMAP) {
+		return new MmapReader(m_file, 0, PARTITION_LBA);
+	}
+	return new PlainReader(m_file, 0, PARTITION_LBA);
+}
+
+/**
+ * Open the partition using the partition header and
+ * read all of the user data sequentially.
+ */
+TEST_P(WiiPartitionReaderTest, readAll)
+{
+	unique_ptr<Reader> reader(createReader());
+	unique_ptr<WiiPartitionReader> wpr(WiiPartitionReader::open(reader.get(), &m_pte, true));
+	ASSERT_TRUE(wpr.get() != nullptr);
+	EXPECT_TRUE(wpr->isEncrypted());
+	ASSERT_EQ(static_cast<int64_t>(m_plain.size()), wpr->dataSize());
+	ASSERT_EQ(BYTES_TO_LBA(m_plain.size()), wpr->lba_len());
+
+	// Read 64 KB at a time, so the groups are prefetched.
+	static const uint32_t chunk_lba = BYTES_TO_LBA(65536);
+	vector<uint8_t> buf(LBA_TO_BYTES(chunk_lba));
+	for (uint32_t lba = 0; lba < wpr->lba_len(); lba += chunk_lba) {
+		uint32_t lba_len = wpr->lba_len() - lba;
+		if (lba_len > chunk_lba) {
+			lba_len = chunk_lba;
+		}
+		ASSERT_EQ(lba_len, wpr->read(buf.data(), lba, lba_len));
+		ASSERT_EQ(0, memcmp(&m_plain[LBA_TO_BYTES(lba)], buf.data(), LBA_TO_BYTES(lba_len)))
+			<< "LBA " << lba;
+	}
+}
+
+/**
+ * Read unaligned ranges, including ranges that cross group
+ * boundaries, with a cache that's smaller than the partition.
+ */
+TEST_P(WiiPartitionReaderTest, unalignedReads)
+{
+	unique_ptr<Reader> reader(createReader());
+	unique_ptr<WiiPartitionReader> wpr(new WiiPartitionReader(reader.get(),
+		BYTES_TO_LBA(DATA_OFFSET), PARTITION_LBA - BYTES_TO_LBA(DATA_OFFSET), testTitleKey, 2));
+	ASSERT_TRUE(wpr->isOpen());
+
+	static const struct {
+		int64_t offset;
+		size_t size;
+	} ranges[] = {
+		{0, 4},
+		{0x420, 0x20},
+		{GROUP_SIZE_DEC - 3, 10},			// Group 0 -> Group 1
+		{(GROUP_SIZE_DEC * 2) + 12345, 4321},		// Group 2 (partial)
+		{SECTOR_SIZE_DEC - 1, 2},			// Sector 0 -> Sector 1
+		{(GROUP_SIZE_DEC * 2) - 1000, 100000},		// Group 1 -> Group 2
+		{100, (GROUP_SIZE_DEC * 2) + 1000},		// All three groups
+		{7, 3},
+	};
+
+	vector<uint8_t> buf;
+	for (unsigned int i = 0; i < ARRAY_SIZE(ranges); i++) {
+		buf.assign(ranges[i].size, 0);
+		ASSERT_EQ(ranges[i].size, wpr->pread(buf.data(), ranges[i].size, ranges[i].offset))
+			<< "range " << i;
+		EXPECT_EQ(0, memcmp(&m_plain[ranges[i].offset], buf.data(), ranges[i].size))
+			<< "range " << i;
+	}
+}
+
+/**
+ * Reads at the end of the partition are truncated.
+ */
+TEST_P(WiiPartitionReaderTest, readPastEnd)
+{
+	unique_ptr<Reader> reader(createReader());
+	unique_ptr<WiiPartitionReader> wpr(WiiPartitionReader::open(reader.get(), &m_pte, true));
+	ASSERT_TRUE(wpr.get() != nullptr);
+
+	uint8_t buf[256];
+	const int64_t end = wpr->dataSize();
+	EXPECT_EQ(100U, wpr->pread(buf, sizeof(buf), end - 100));
+	EXPECT_EQ(0, memcmp(&m_plain[end - 100], buf, 100));
+	EXPECT_EQ(0U, wpr->pread(buf, sizeof(buf), end));
+	EXPECT_EQ(0U, wpr->pread(buf, sizeof(buf), end + 1000));
+}
+
+/**
+ * Unencrypted partitions are read directly.
+ */
+TEST_P(WiiPartitionReaderTest, unencrypted)
+{
+	// Treat the encrypted image as unencrypted data.
+	vector<uint8_t> image(LBA_TO_BYTES(PARTITION_LBA));
+	ASSERT_EQ(image.size(), m_file->pread(image.data(), image.size(), 0));
+
+	unique_ptr<Reader> reader(createReader());
+	unique_ptr<WiiPartitionReader> wpr(WiiPartitionReader::open(reader.get(), &m_pte, false));
+	ASSERT_TRUE(wpr.get() != nullptr);
+	EXPECT_FALSE(wpr->isEncrypted());
+	ASSERT_EQ(static_cast<int64_t>(image.size() - DATA_OFFSET), wpr->dataSize());
+
+	uint8_t buf[2048];
+	ASSERT_EQ(1500U, wpr->pread(buf, 1500, 777));
+	EXPECT_EQ(0, memcmp(&image[DATA_OFFSET + 777], buf, 1500));
+	ASSERT_EQ(3U, wpr->read(buf, 5, 3));
+	EXPECT_EQ(0, memcmp(&image[DATA_OFFSET + LBA_TO_BYTES(5)], buf, LBA_TO_BYTES(3)));
+}
+
+/**
+ * Read from multiple threads at the same time.
+ * The cache is smaller than the number of threads,
+ * so threads have to wait for entries to be released.
+ */
+TEST_P(WiiPartitionReaderTest, concurrentReads)
+{
+	unique_ptr<Reader> reader(createReader());
+	unique_ptr<WiiPartitionReader> wpr(new WiiPartitionReader(reader.get(),
+		BYTES_TO_LBA(DATA_OFFSET), PARTITION_LBA - BYTES_TO_LBA(DATA_OFFSET), testTitleKey, 2));
+	ASSERT_TRUE(wpr->isOpen());
+
+	static const unsigned int threadCount = 4;
+	unsigned int errors[threadCount] = {0, 0, 0, 0};
+	vector<thread> threads;
+	for (unsigned int t = 0; t < threadCount; t++) {
+		threads.emplace_back([this, &wpr, &errors, t]() {
+			TestRandom rng(0x9E3779B9U * (t + 1));
+			vector<uint8_t> buf(8192);
+			for (unsigned int i = 0; i < 200; i++) {
+				const int64_t offset = rng.next() % (m_plain.size() - buf.size());
+				if (wpr->pread(buf.data(), buf.size(), offset) != buf.size() ||
+				    memcmp(&m_plain[offset], buf.data(), buf.size()) != 0)
+				{
+					errors[t]++;
+				}
+			}
+		});
+	}
+	for (auto iter = threads.begin(); iter != threads.end(); ++iter) {
+		iter->join();
+	}
+
+	for (unsigned int t = 0; t < threadCount; t++) {
+		EXPECT_EQ(0U, errors[t]) << "thread " << t;
+	}
+}
+
+INSTANTIATE_TEST_CASE_P(WiiPartitionReaderTest, WiiPartitionReaderTest,
+	::testing::Values(0U, TEST_MMAP));
+
+} }
+
+#ifdef _MSC_VER
+# define RVTH_CDECL __cdecl
+#else
+# define RVTH_CDECL
+#endif
+
+/**
+ * Test suite main function.
+ */
+int RVTH_CDECL main(int argc, char *argv[])
+{
+	fprintf(stderr, "librvth test suite: WiiPartitionReader tests.\n\n");
+	fflush(nullptr);
+
+	// coverity[fun_call_w_exception]: uncaught exceptions cause nonzero exit anyway, so don't warn.
+	::testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,73 @@
+/***************************************************************************
+ * RVT-H Tool (librvth/tests)                                              *
+ * WiiTestImage.cpp: Shared helpers for encrypted Wii test images.         *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "WiiTestImage.hpp"
+
+// Google Test
+#include "gtest/gtest.h"
+
+// libwiicrypto
+#include "libwiicrypto/aesw.h"
+#include "libwiicrypto/byteswap.h"
+#include "libwiicrypto/cert_store.h"
+
+// C includes. (C++ namespace)
+#include <cstring>
+
+namespace LibRvtH { namespace Tests {
+
+// Title key used by the test images. (decrypted)
+const uint8_t testTitleKey[16] = {
+	0x00,0x11,0x22,0x33,0x44,0x55,0x66,0x77,
+	0x88,0x99,0xAA,0xBB,0xCC,0xDD,0xEE,0xFF
+};
+
+/**
+ * Initialize a debug ticket with the test title key.
+ * The title key is encrypted with the debug common key.
+ *
+ * NOTE: Uses gtest assertions, so call it using
+ * ASSERT_NO_FATAL_FAILURE().
+ *
+ * @param ticket	[in/out] Ticket. (must be zeroed)
+ * @param title_id_lo	[in] Low 32 bits of the title ID. (host-endian)
+ */
+void initDebugTicket(RVL_Ticket *ticket, uint32_t title_id_lo)
+{
+	AesCtx *const aesw = aesw_new();
+	ASSERT_TRUE(aesw != nullptr);
+
+	const char *const issuer = RVL_Cert_Issuers[RVL_CERT_ISSUER_DEBUG_TICKET];
+	memcpy(ticket->issuer, issuer, strlen(issuer));
+	ticket->title_id.hi = cpu_to_be32(0x00010000);
+	ticket->title_id.lo = cpu_to_be32(title_id_lo);
+
+	// IV is the title ID, followed by zeroes.
+	uint8_t iv[16];
+	memcpy(iv, &ticket->title_id, 8);
+	memset(&iv[8], 0, 8);
+	memcpy(ticket->enc_title_key, testTitleKey, sizeof(testTitleKey));
+	aesw_set_key(aesw, RVL_AES_Keys[RVL_KEY_DEBUG], 16);
+	aesw_set_iv(aesw, iv, sizeof(iv));
+	aesw_encrypt(aesw, ticket->enc_title_key, sizeof(ticket->enc_title_key));
+	aesw_free(aesw);
+}
+
+/**
+ * Fill a buffer with the next bytes in the sequence.
+ * @param buf	[out] Buffer.
+ * @param size	[in] Size of buf, in bytes.
+ */
+void TestRandom::fill(uint8_t *buf, size_t size)
+{
+	for (; size > 0; size--, buf++) {
+		*buf = static_cast<uint8_t>(next() >> 16);
+	}
+}
+
+} }
@@ -0,0 +1,70 @@
+/***************************************************************************
+ * RVT-H Tool (librvth/tests)                                              *
+ * WiiTestImage.hpp: Shared helpers for encrypted Wii test images.         *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_LIBRVTH_TESTS_WIITESTIMAGE_HPP__
+#define __RVTHTOOL_LIBRVTH_TESTS_WIITESTIMAGE_HPP__
+
+// libwiicrypto
+#include "libwiicrypto/wii_structs.h"
+
+// C includes.
+#include <stddef.h>
+#include <stdint.h>
+
+namespace LibRvtH { namespace Tests {
+
+// Title key used by the test images. (decrypted)
+extern const uint8_t testTitleKey[16];
+
+/**
+ * Initialize a debug ticket with the test title key.
+ * The title key is encrypted with the debug common key.
+ *
+ * NOTE: Uses gtest assertions, so call it using
+ * ASSERT_NO_FATAL_FAILURE().
+ *
+ * @param ticket	[in/out] Ticket. (must be zeroed)
+ * @param title_id_lo	[in] Low 32 bits of the title ID. (host-endian)
+ */
+void initDebugTicket(RVL_Ticket *ticket, uint32_t title_id_lo);
+
+/**
+ * Simple pseudo-random sequence for test data.
+ * The sequence is always the same for a given seed.
+ */
+class TestRandom
+{
+	public:
+		explicit TestRandom(uint32_t seed = 0x12345678)
+			: m_seed(seed) { }
+
+	public:
+		/**
+		 * Get the next value in the sequence.
+		 * @return Next value.
+		 */
+		inline uint32_t next(void)
+		{
+			m_seed = (m_seed * 1103515245U) + 12345U;
+			return m_seed;
+		}
+
+		/**
+		 * Fill a buffer with the next bytes in the sequence.
+		 * @param buf	[out] Buffer.
+		 * @param size	[in] Size of buf, in bytes.
+		 */
+		void fill(uint8_t *buf, size_t size);
+
+	private:
+		uint32_t m_seed;
+};
+
+} }
+
+#endif /* __RVTHTOOL_LIBRVTH_TESTS_WIITESTIMAGE_HPP__ */
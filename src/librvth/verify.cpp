@@ -0,0 +1,623 @@
+/***************************************************************************
+ * RVT-H Tool (librvth)                                                    *
+ * verify.cpp: Verify the hash tree of an encrypted Wii disc image.        *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "rvth.hpp"
+#include "ptbl.h"
+#include "rvth_error.h"
+#include "wii_crypt.h"
+
+#include "byteswap.h"
+#include "nhcd_structs.h"
+
+// Reader class
+#include "reader/Reader.hpp"
+#include "reader/ReadAheadQueue.hpp"
+#include "GroupQueue.hpp"
+
+// libwiicrypto
+#include "libwiicrypto/sha1w.h"
+
+// C includes.
+#include <stdlib.h>
+
+// C includes. (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+// C++ includes.
+#include <vector>
+using std::vector;
+
+// Encryption.
+#include "aesw.h"
+
+// Verification results for a single group.
+// Bitmasks indicate which hashes don't match.
+typedef struct _verify_group_t {
+	// Decrypted sectors.
+	Wii_Disc_Sector_t sector[64];
+
+	uint32_t h0_bad[64];	// Bad H0 hashes, one bit per 1 KB block.
+	uint64_t h1_bad;	// Sectors whose H0 table doesn't match H1.
+	uint64_t h2_bad;	// Sectors whose H1 table doesn't match H2.
+	uint64_t h3_bad;	// Sectors whose H2 table doesn't match H3.
+} verify_group_t;
+
+/**
+ * Decrypt a group of Wii sectors and verify the hashes.
+ * @param aesw		[in] AES context. (Key must be set to the decrypted title key.)
+ * @param pInBuf	[in] Encrypted group. (GROUP_SIZE_ENC)
+ * @param sectors	[in] Number of sectors present in the group. (1-64)
+ * @param h3		[in] Expected H3 hash for this group.
+ * @param result	[out] Decrypted sectors and verification results.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int rvth_verify_group(AesCtx *aesw, const uint8_t *pInBuf,
+	unsigned int sectors, const uint8_t *h3, verify_group_t *result)
+{
+	// Calculated hashes.
+	uint8_t hash[64][SHA1_DIGEST_SIZE];
+	static const uint8_t iv_zero[16] = {0};
+	const Wii_Disc_Sector_t *sbuf = (const Wii_Disc_Sector_t*)pInBuf;
+	unsigned int s, b;
+
+	assert(aesw);
+	assert(pInBuf);
+	assert(sectors >= 1 && sectors <= 64);
+	assert(h3);
+	assert(result);
+
+	if (!aesw || !pInBuf || sectors < 1 || sectors > 64 || !h3 || !result) {
+		// Invalid parameters.
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	result->h1_bad = 0;
+	result->h2_bad = 0;
+	result->h3_bad = 0;
+
+	// Decrypt the sectors.
+	for (s = 0; s < sectors; s++, sbuf++) {
+		Wii_Disc_Sector_t *const sector = &result->sector[s];
+		memcpy(sector, sbuf, sizeof(*sector));
+
+		// Hash table: IV is all zero.
+		aesw_set_iv(aesw, iv_zero, sizeof(iv_zero));
+		aesw_decrypt(aesw, (uint8_t*)&sector->hashes, sizeof(sector->hashes));
+
+		// User data IV is stored within the *encrypted* H2 table.
+		aesw_set_iv(aesw, &sbuf->hashes.H2[7][4], 16);
+		aesw_decrypt(aesw, sector->data, sizeof(sector->data));
+	}
+
+	// H0: One hash for each 1 KB block of user data.
+	for (s = 0; s < sectors; s++) {
+		const Wii_Disc_Sector_t *const sector = &result->sector[s];
+		uint32_t bad = 0;
+
+		sha1w_hash_strided(sector->data, 1024, 1024, 31, &hash[0][0]);
+		for (b = 0; b < 31; b++) {
+			if (memcmp(hash[b], sector->hashes.H0[b], SHA1_DIGEST_SIZE) != 0) {
+				bad |= (1U << b);
+			}
+		}
+		result->h0_bad[s] = bad;
+	}
+
+	// H1: Hash of each sector's H0 table.
+	sha1w_hash_strided(result->sector[0].hashes.H0[0], sizeof(result->sector[0].hashes.H0),
+		sizeof(Wii_Disc_Sector_t), sectors, &hash[0][0]);
+	for (s = 0; s < sectors; s++) {
+		if (memcmp(hash[s], result->sector[s].hashes.H1[s % 8], SHA1_DIGEST_SIZE) != 0) {
+			result->h1_bad |= (1ULL << s);
+		}
+	}
+
+	// H2: Hash of each sector's H1 table.
+	sha1w_hash_strided(result->sector[0].hashes.H1[0], sizeof(result->sector[0].hashes.H1),
+		sizeof(Wii_Disc_Sector_t), sectors, &hash[0][0]);
+	for (s = 0; s < sectors; s++) {
+		if (memcmp(hash[s], result->sector[s].hashes.H2[s / 8], SHA1_DIGEST_SIZE) != 0) {
+			result->h2_bad |= (1ULL << s);
+		}
+	}
+
+	// H3: Hash of each sector's H2 table.
+	sha1w_hash_strided(result->sector[0].hashes.H2[0], sizeof(result->sector[0].hashes.H2),
+		sizeof(Wii_Disc_Sector_t), sectors, &hash[0][0]);
+	for (s = 0; s < sectors; s++) {
+		if (memcmp(hash[s], h3, SHA1_DIGEST_SIZE) != 0) {
+			result->h3_bad |= (1ULL << s);
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Report the verification errors for a group.
+ * @param result	[in] Verification results.
+ * @param sectors	[in] Number of sectors present in the group.
+ * @param error		[in/out] Error template. (pt_idx, group, and the group's starting LBA must be set.)
+ * @param errorCallback	[in,opt] Verification error callback.
+ * @param userdata	[in,opt] User data for the callback.
+ * @param errCount	[in/out] Number of errors.
+ * @return True to continue; false if the callback aborted.
+ */
+static bool report_group_errors(const verify_group_t *result, unsigned int sectors,
+	RvtH_Verify_Error *error, RvtH_Verify_Callback errorCallback, void *userdata,
+	unsigned int *errCount)
+{
+	const uint32_t lba_group = error->lba;
+	bool bRet = true;
+	unsigned int s, b;
+
+	for (s = 0; s < sectors && bRet; s++) {
+		const uint64_t mask = (1ULL << s);
+
+		error->sector = s;
+		error->lba = lba_group + (s * BYTES_TO_LBA(SECTOR_SIZE_ENC));
+		error->block = 0;
+
+		for (b = 0; b < 31 && bRet; b++) {
+			if (result->h0_bad[s] & (1U << b)) {
+				(*errCount)++;
+				error->type = RVTH_VERIFY_ERROR_H0;
+				error->block = b;
+				if (errorCallback) {
+					bRet = errorCallback(error, userdata);
+				}
+			}
+		}
+		error->block = 0;
+
+		if (bRet && (result->h1_bad & mask)) {
+			(*errCount)++;
+			error->type = RVTH_VERIFY_ERROR_H1;
+			if (errorCallback) {
+				bRet = errorCallback(error, userdata);
+			}
+		}
+		if (bRet && (result->h2_bad & mask)) {
+			(*errCount)++;
+			error->type = RVTH_VERIFY_ERROR_H2;
+			if (errorCallback) {
+				bRet = errorCallback(error, userdata);
+			}
+		}
+		if (bRet && (result->h3_bad & mask)) {
+			(*errCount)++;
+			error->type = RVTH_VERIFY_ERROR_H3;
+			if (errorCallback) {
+				bRet = errorCallback(error, userdata);
+			}
+		}
+	}
+
+	error->lba = lba_group;
+	return bRet;
+}
+
+/**
+ * Verify the hash tree of every partition in a Wii disc image.
+ *
+ * Each group is decrypted, and the H0, H1, and H2 hashes are
+ * recalculated and compared to the stored hashes. The H2 tables
+ * are checked against the H3 table, and the H3 table is checked
+ * against the content hash in the TMD.
+ *
+ * Groups are checked in parallel, but errors are always reported
+ * in disc order.
+ *
+ * @param bank		[in] Bank number. (0-7)
+ * @param errorCallback	[in,opt] Verification error callback.
+ * @param callback	[in,opt] Progress callback.
+ * @param userdata	[in,opt] User data for the callbacks.
+ * @return 0 if all hashes are valid; RVTH_ERROR_VERIFY_FAILED if any hashes
+ *         are invalid; other error code on error. (If negative, POSIX error;
+ *         otherwise, see RvtH_Errors.)
+ */
+int RvtH::verifyWiiPartitions(unsigned int bank,
+	RvtH_Verify_Callback errorCallback,
+	RvtH_Progress_Callback callback, void *userdata)
+{
+	// Buffers.
+	RVL_PartitionHeader pthdr;
+	Wii_Disc_H3_t *h3tbl = nullptr;
+
+	// Current partition.
+	const pt_entry_t *pte;
+	uint32_t data_lba;	// Data offset LBA.
+	uint32_t lba_verify_len = 0;	// Number of LBAs to verify.
+	uint32_t lba_base = 0;	// LBAs processed in previous partitions.
+
+	// Group counters.
+	uint32_t group_count;	// Number of groups
+	uint32_t group_next;	// Next group to read
+
+	// Group verification queue.
+	GroupQueue *queue = nullptr;
+	GroupQueue::Job *job;
+
+	// Read-ahead queue for the current partition.
+	ReadAheadQueue *readQueue = nullptr;
+	ReadAheadQueue::Chunk *chunk;
+
+	// Callback state.
+	RvtH_Progress_State state;
+	RvtH_Verify_Error error;
+	unsigned int errCount = 0;
+
+	int ret = 0;	// errno or RvtH_Errors
+	int err = 0;	// errno setting
+
+	// AES contexts. (one per worker thread)
+	vector<AesCtx*> aesw;
+	uint8_t titleKey[16];
+	uint8_t crypto_type;
+
+	if (bank >= m_bankCount) {
+		// Bank number is out of range.
+		errno = ERANGE;
+		return -ERANGE;
+	}
+
+	// Make sure the bank entry is fully initialized.
+	loadBankEntry(bank);
+
+	// Check the bank type.
+	RvtH_BankEntry *const entry = &m_entries[bank];
+	switch (entry->type) {
+		case RVTH_BankType_Wii_SL:
+		case RVTH_BankType_Wii_DL:
+			// Bank can be verified.
+			break;
+
+		case RVTH_BankType_GCN:
+			// No hash tree for GameCube.
+			errno = EIO;
+			return RVTH_ERROR_NOT_WII_IMAGE;
+
+		case RVTH_BankType_Unknown:
+		default:
+			// Unknown bank status...
+			errno = EIO;
+			return RVTH_ERROR_BANK_UNKNOWN;
+
+		case RVTH_BankType_Empty:
+			// Bank is empty.
+			errno = ENOENT;
+			return RVTH_ERROR_BANK_EMPTY;
+
+		case RVTH_BankType_Wii_DL_Bank2:
+			// Second bank of a dual-layer Wii disc image.
+			// TODO: Automatically select the first bank?
+			errno = EIO;
+			return RVTH_ERROR_BANK_DL_2;
+	}
+
+	if (entry->crypto_type <= RVL_CryptoType_None) {
+		// Unencrypted images don't have a hash tree.
+		errno = EINVAL;
+		return RVTH_ERROR_IS_UNENCRYPTED;
+	}
+
+	memset(&error, 0, sizeof(error));
+
+	// Make sure the partition table is loaded.
+	ret = rvth_ptbl_load(entry);
+	if (ret != 0 || entry->pt_count == 0 || !entry->ptbl) {
+		// Unable to load the partition table.
+		if (ret == 0) {
+			ret = RVTH_ERROR_NO_GAME_PARTITION;
+		}
+		err = EIO;
+		goto end;
+	}
+
+	h3tbl = static_cast<Wii_Disc_H3_t*>(malloc(sizeof(*h3tbl)));
+	if (!h3tbl) {
+		// Error allocating memory.
+		err = errno;
+		if (err == 0) {
+			err = ENOMEM;
+		}
+		ret = -err;
+		goto end;
+	}
+
+	// Groups are verified in parallel using a pool of worker threads.
+	// The worker function refers to the current partition's state,
+	// which is only changed while the queue is idle.
+	queue = new GroupQueue(GROUP_SIZE_ENC, sizeof(verify_group_t));
+	aesw.resize(queue->threadCount(), nullptr);
+	for (auto iter = aesw.begin(); iter != aesw.end(); ++iter) {
+		*iter = aesw_new();
+		if (!*iter) {
+			// Error initializing decryption.
+			err = errno;
+			if (err == 0) {
+				err = EIO;
+			}
+			ret = -err;
+			goto end;
+		}
+	}
+
+	ret = queue->start([&aesw, &h3tbl, &lba_verify_len](unsigned int worker, GroupQueue::Job *job) {
+		const uint32_t lba_left = lba_verify_len - (job->index * LBA_COUNT_ENC);
+		const unsigned int sectors = (lba_left >= LBA_COUNT_ENC
+			? 64 : lba_left / BYTES_TO_LBA(SECTOR_SIZE_ENC));
+		return rvth_verify_group(aesw[worker], job->src, sectors,
+			h3tbl->h3[job->index], reinterpret_cast<verify_group_t*>(job->out));
+	});
+	if (ret != 0) {
+		// Unable to start the worker threads.
+		err = -ret;
+		goto end;
+	}
+
+	if (callback) {
+		// Initialize the callback state.
+		// The total is the size of all partitions;
+		// unused space at the end of each partition is skipped.
+		state.rvth = this;
+		state.rvth_gcm = NULL;
+		state.bank_rvth = bank;
+		state.bank_gcm = ~0;
+		state.type = RVTH_PROGRESS_VERIFY;
+		state.lba_processed = 0;
+		state.digests = nullptr;
+		state.lba_total = 0;
+		pte = entry->ptbl;
+		for (unsigned int i = 0; i < entry->pt_count; i++, pte++) {
+			state.lba_total += pte->lba_len;
+		}
+	}
+
+	// Process each partition.
+	pte = entry->ptbl;
+	for (unsigned int i = 0; i < entry->pt_count; i++, pte++) {
+		uint32_t data_offset, h3_offset;
+		uint32_t tmd_offset, tmd_size;
+		uint64_t data_size;
+		uint32_t lba_size;
+
+		// Read the partition header.
+		errno = 0;
+		lba_size = entry->reader->read(&pthdr, pte->lba_start, BYTES_TO_LBA(sizeof(pthdr)));
+		if (lba_size != BYTES_TO_LBA(sizeof(pthdr))) {
+			// Read error.
+			err = errno;
+			if (err == 0) {
+				err = EIO;
+			}
+			ret = -err;
+			goto end;
+		}
+
+		// Data offset should be at least 0x20000 for encrypted partitions.
+		// (0x8000 partition header, 0x18000 H3 table)
+		data_offset = be32_to_cpu(pthdr.data_offset) << 2;
+		h3_offset = be32_to_cpu(pthdr.h3_table_offset) << 2;
+		tmd_offset = be32_to_cpu(pthdr.tmd_offset) << 2;
+		tmd_size = be32_to_cpu(pthdr.tmd_size);
+		if (data_offset < sizeof(pthdr) + sizeof(Wii_Disc_H3_t) ||
+		    data_offset % LBA_SIZE != 0 ||
+		    BYTES_TO_LBA(data_offset) >= pte->lba_len ||
+		    h3_offset < sizeof(pthdr) || h3_offset % LBA_SIZE != 0 ||
+		    h3_offset > data_offset - sizeof(Wii_Disc_H3_t) ||
+		    tmd_size < sizeof(RVL_TMD_Header) + sizeof(RVL_Content_Entry) ||
+		    tmd_offset > sizeof(pthdr) - sizeof(RVL_TMD_Header) - sizeof(RVL_Content_Entry))
+		{
+			err = EIO;
+			ret = RVTH_ERROR_PARTITION_HEADER_CORRUPTED;
+			goto end;
+		}
+
+		// Decrypt the title key.
+		ret = rvth_decrypt_title_key(&pthdr.ticket, titleKey, &crypto_type);
+		if (ret != 0) {
+			// Error decrypting the title key.
+			err = EIO;
+			goto end;
+		}
+		for (auto iter = aesw.begin(); iter != aesw.end(); ++iter) {
+			aesw_set_key(*iter, titleKey, sizeof(titleKey));
+		}
+
+		// Read the H3 table.
+		errno = 0;
+		lba_size = entry->reader->read(h3tbl, pte->lba_start + BYTES_TO_LBA(h3_offset),
+			BYTES_TO_LBA(sizeof(*h3tbl)));
+		if (lba_size != BYTES_TO_LBA(sizeof(*h3tbl))) {
+			// Read error.
+			err = errno;
+			if (err == 0) {
+				err = EIO;
+			}
+			ret = -err;
+			goto end;
+		}
+
+		// Check the H3 table against the TMD.
+		// NOTE: The first content entry is the partition data.
+		{
+			const RVL_Content_Entry *const content = reinterpret_cast<const RVL_Content_Entry*>(
+				&pthdr.u8[tmd_offset + sizeof(RVL_TMD_Header)]);
+			uint8_t digest[SHA1_DIGEST_SIZE];
+			struct sha1_ctx sha1;
+
+			sha1_init(&sha1);
+			sha1_update(&sha1, sizeof(*h3tbl), reinterpret_cast<const uint8_t*>(h3tbl));
+			sha1_digest(&sha1, sizeof(digest), digest);
+			if (memcmp(digest, content->sha1_hash, sizeof(digest)) != 0) {
+				errCount++;
+				memset(&error, 0, sizeof(error));
+				error.type = RVTH_VERIFY_ERROR_H4;
+				error.pt_idx = i;
+				error.lba = pte->lba_start + BYTES_TO_LBA(h3_offset);
+				if (errorCallback && !errorCallback(&error, userdata)) {
+					// Stop processing.
+					err = ECANCELED;
+					ret = -ECANCELED;
+					goto end;
+				}
+			}
+		}
+
+		// Calculate the data offset LBA and the encrypted data size.
+		// If the partition header has a data size, use it;
+		// otherwise, use the rest of the partition.
+		data_lba = pte->lba_start + BYTES_TO_LBA(data_offset);
+		lba_verify_len = pte->lba_len - BYTES_TO_LBA(data_offset);
+		data_size = (uint64_t)be32_to_cpu(pthdr.data_size) << 2;
+		if (data_size != 0 && BYTES_TO_LBA(data_size) < lba_verify_len) {
+			lba_verify_len = (uint32_t)BYTES_TO_LBA(data_size);
+		}
+		// Only whole sectors can be verified.
+		lba_verify_len &= ~(BYTES_TO_LBA(SECTOR_SIZE_ENC) - 1);
+		group_count = (lba_verify_len + LBA_COUNT_ENC - 1) / LBA_COUNT_ENC;
+		if (group_count > ARRAY_SIZE(h3tbl->h3)) {
+			// Too many groups for the H3 table.
+			err = EIO;
+			ret = RVTH_ERROR_PARTITION_HEADER_CORRUPTED;
+			goto end;
+		}
+
+		// Groups are read in order by a read-ahead queue.
+		// While a group's results are being reported,
+		// the worker threads verify the following groups.
+		delete readQueue;
+		readQueue = new ReadAheadQueue(entry->reader, data_lba, lba_verify_len,
+			LBA_COUNT_ENC, m_ioQueueDepth);
+		ret = readQueue->start();
+		if (ret != 0) {
+			// Unable to start the read-ahead queue.
+			err = -ret;
+			goto end;
+		}
+
+		group_next = 0;
+		for (;;) {
+			// Read groups into any free jobs.
+			while (group_next < group_count && (job = queue->acquire()) != nullptr) {
+				chunk = readQueue->next();
+				if (!chunk) {
+					// Read error.
+					ret = readQueue->finish();
+					if (ret == 0) {
+						ret = -EIO;
+					}
+					err = -ret;
+					goto end;
+				}
+				assert(chunk->lba_start == data_lba + (group_next * LBA_COUNT_ENC));
+
+				if (chunk->lba_len == LBA_COUNT_ENC && chunk->data != chunk->buf) {
+					// Zero-copy data from Reader::map().
+					// This remains valid after the chunk is released.
+					job->src = chunk->data;
+				} else {
+					// Leftover sectors are padded. The padding isn't verified.
+					memcpy(job->in, chunk->data, static_cast<size_t>(LBA_TO_BYTES(chunk->lba_len)));
+					if (chunk->lba_len < LBA_COUNT_ENC) {
+						memset(&job->in[LBA_TO_BYTES(chunk->lba_len)], 0,
+							static_cast<size_t>(LBA_TO_BYTES(LBA_COUNT_ENC - chunk->lba_len)));
+					}
+					job->src = job->in;
+				}
+				readQueue->release(chunk);
+
+				job->index = group_next++;
+				queue->submit(job);
+			}
+
+			// Get the next verified group.
+			job = queue->next();
+			if (!job) {
+				// All groups have been verified.
+				break;
+			}
+
+			if (callback) {
+				bool bRet;
+				state.lba_processed = lba_base + (job->index * LBA_COUNT_ENC);
+				bRet = callback(&state, userdata);
+				if (!bRet) {
+					// Stop processing.
+					err = ECANCELED;
+					ret = -ECANCELED;
+					goto end;
+				}
+			}
+
+			if (job->ret != 0) {
+				// Error verifying the group.
+				ret = job->ret;
+				err = -ret;
+				goto end;
+			}
+
+			// Report the errors for this group.
+			{
+				const uint32_t lba_left = lba_verify_len - (job->index * LBA_COUNT_ENC);
+				const unsigned int sectors = (lba_left >= LBA_COUNT_ENC
+					? 64 : lba_left / BYTES_TO_LBA(SECTOR_SIZE_ENC));
+
+				error.pt_idx = i;
+				error.group = job->index;
+				error.lba = data_lba + (job->index * LBA_COUNT_ENC);
+				if (!report_group_errors(reinterpret_cast<const verify_group_t*>(job->out),
+				    sectors, &error, errorCallback, userdata, &errCount))
+				{
+					// Stop processing.
+					err = ECANCELED;
+					ret = -ECANCELED;
+					goto end;
+				}
+			}
+			queue->release(job);
+		}
+
+		lba_base += pte->lba_len;
+	}
+
+	if (callback) {
+		bool bRet;
+		state.lba_processed = state.lba_total;
+		bRet = callback(&state, userdata);
+		if (!bRet) {
+			// Stop processing.
+			err = ECANCELED;
+			ret = -ECANCELED;
+			goto end;
+		}
+	}
+
+	if (errCount > 0) {
+		// At least one hash is invalid.
+		err = EIO;
+		ret = RVTH_ERROR_VERIFY_FAILED;
+	}
+
+end:
+	// NOTE: Deleting the queues stops the worker threads.
+	delete readQueue;
+	delete queue;
+	free(h3tbl);
+	for (auto iter = aesw.begin(); iter != aesw.end(); ++iter) {
+		aesw_free(*iter);
+	}
+	if (err != 0) {
+		errno = err;
+	}
+	return ret;
+}
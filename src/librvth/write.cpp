@@ -14,6 +14,8 @@
 
 // Disc image reader.
 #include "reader/Reader.hpp"
+#include "reader/CisoWriter.hpp"
+#include "reader/WbfsWriter.hpp"
 
 // C includes.
 #include <stdlib.h>
@@ -32,15 +34,20 @@
  *
  * @param filename	[in] Filename.
  * @param lba_len	[in] LBA length. (Will NOT be allocated initially.)
+ * @param flags		[in] Flags. (See RvtH_Extract_Flags; only the output format flags are used.)
  * @param pErr		[out,opt] Error code. (If negative, POSIX error; otherwise, see RvtH_Errors.)
  */
-RvtH::RvtH(const TCHAR *filename, uint32_t lba_len, int *pErr)
+RvtH::RvtH(const TCHAR *filename, uint32_t lba_len, unsigned int flags, int *pErr)
 	: m_file(nullptr)
 	, m_bankCount(0)
 	, m_imageType(RVTH_ImageType_Unknown)
 	, m_NHCD_status(NHCD_STATUS_UNKNOWN)
+	, m_ioQueueDepth(RVTH_IO_QUEUE_DEPTH_DEFAULT)
 	, m_entries(nullptr)
+	, m_bankEntryLoaded(0)
+	, m_bankEntryInitErr(false)
 {
+	memset(m_nhcdHash, 0, sizeof(m_nhcdHash));
 	RvtH_BankEntry *entry;
 
 	if (!filename || filename[0] == 0 || lba_len == 0) {
@@ -67,20 +74,36 @@ RvtH::RvtH(const TCHAR *filename, uint32_t lba_len, int *pErr)
 		goto fail;
 	};
 
-	// Attempt to create the file.
-	m_file = new RefFile(filename, true);
-	if (!m_file->isOpen()) {
-		// Error creating the file.
-		err = m_file->lastError();
-		if (err == 0) {
-			err = EIO;
+	if (flags & RVTH_EXTRACT_WBFS_APPEND) {
+		// Open the existing WBFS image.
+		m_file = new RefFile(filename);
+		if (m_file->isOpen()) {
+			err = -m_file->makeWritable();
+		} else {
+			err = m_file->lastError();
+			if (err == 0) {
+				err = EIO;
+			}
 		}
+	} else {
+		// Attempt to create the file.
+		m_file = new RefFile(filename, true);
+		if (!m_file->isOpen()) {
+			err = m_file->lastError();
+			if (err == 0) {
+				err = EIO;
+			}
+		}
+	}
+	if (err != 0) {
+		// Error opening or creating the file.
 		goto fail;
 	}
 
 	// Initialize the bank entry.
 	// NOTE: Not using rvth_init_BankEntry() here.
 	entry = &m_entries[0];
+	setBankEntryLoaded(0);
 	entry->lba_start = 0;
 	entry->lba_len = lba_len;
 	entry->type = RVTH_BankType_Empty;
@@ -91,7 +114,23 @@ RvtH::RvtH(const TCHAR *filename, uint32_t lba_len, int *pErr)
 	entry->timestamp = time(nullptr);
 
 	// Initialize the disc image reader.
-	entry->reader = Reader::open(m_file, entry->lba_start, entry->lba_len);
+	if (flags & (RVTH_EXTRACT_CISO | RVTH_EXTRACT_WBFS | RVTH_EXTRACT_WBFS_APPEND)) {
+		// CISO and WBFS blocks are allocated as they're written.
+		if (flags & RVTH_EXTRACT_CISO) {
+			entry->reader = new CisoWriter(m_file, entry->lba_len);
+		} else {
+			entry->reader = new WbfsWriter(m_file, entry->lba_len,
+				!!(flags & RVTH_EXTRACT_WBFS_APPEND));
+		}
+		if (!entry->reader->isOpen()) {
+			// NOTE: Deleting the writer doesn't close m_file,
+			// so errno is preserved.
+			delete entry->reader;
+			entry->reader = nullptr;
+		}
+	} else {
+		entry->reader = Reader::open(m_file, entry->lba_start, entry->lba_len);
+	}
 	if (!entry->reader) {
 		// Error creating the disc image reader.
 		err = errno;
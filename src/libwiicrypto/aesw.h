@@ -33,6 +33,19 @@ extern "C" {
 struct _AesCtx;
 typedef struct _AesCtx AesCtx;
 
+/**
+ * AES implementations.
+ * The fastest implementation supported by the CPU is selected
+ * by aesw_new(), but it can be overridden using aesw_set_impl().
+ */
+typedef enum {
+	AESW_IMPL_NETTLE	= 0,	// GNU Nettle
+	AESW_IMPL_AESNI		= 1,	// AES-NI
+	AESW_IMPL_VAES		= 2,	// AES-NI for encryption; VAES for decryption
+
+	AESW_IMPL_MAX
+} AesImpl_e;
+
 /**
  * Create an AES context.
  * @return AES context, or NULL on error.
@@ -45,8 +58,34 @@ AesCtx *aesw_new(void);
  */
 void aesw_free(AesCtx *aesw);
 
+/**
+ * Get the AES implementation used by an AES context.
+ * @param aesw	[in] AES context.
+ * @return AES implementation. (See AesImpl_e.)
+ */
+AesImpl_e aesw_get_impl(const AesCtx *aesw);
+
+/**
+ * Set the AES implementation used by an AES context.
+ * This is mostly useful for testing and benchmarking.
+ * The key and IV are retained.
+ * @param aesw	[in] AES context.
+ * @param impl	[in] AES implementation. (See AesImpl_e.)
+ * @return 0 on success; -ENOTSUP if the implementation isn't supported on this system.
+ */
+int aesw_set_impl(AesCtx *aesw, AesImpl_e impl);
+
+/**
+ * Get the name of an AES implementation.
+ * @param impl	[in] AES implementation. (See AesImpl_e.)
+ * @return Implementation name, or NULL if invalid.
+ */
+const char *aesw_get_impl_name(AesImpl_e impl);
+
 /**
  * Set the AES key.
+ * The key schedules are expanded here, so changing
+ * the IV between calls doesn't require re-expanding them.
  * @param aesw	[in] AES context.
  * @param pKey	[in] Key data.
  * @param size	[in] Size of pKey, in bytes.
@@ -0,0 +1,189 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * aesw_aesni.c: AES wrapper functions. (AES-NI implementation)            *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// NOTE: This file must be compiled with AES-NI enabled. (-maes on gcc)
+// The caller must check that the CPU supports AES-NI before
+// calling any of these functions.
+
+#include "aesw_aesni.h"
+
+#include <assert.h>
+
+// AES-NI intrinsics.
+#include <wmmintrin.h>
+
+/**
+ * AES-128 key expansion step.
+ * @param key Previous round key.
+ * @param keygened Result of _mm_aeskeygenassist_si128() on the previous round key.
+ * @return Next round key.
+ */
+static inline __m128i aes128_keyexp_step(__m128i key, __m128i keygened)
+{
+	keygened = _mm_shuffle_epi32(keygened, _MM_SHUFFLE(3,3,3,3));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	return _mm_xor_si128(key, keygened);
+}
+
+// NOTE: _mm_aeskeygenassist_si128() requires an immediate rcon value.
+#define AES128_KEYEXP(key, rcon) \
+	aes128_keyexp_step((key), _mm_aeskeygenassist_si128((key), (rcon)))
+
+/**
+ * Expand an AES-128 key using AES-NI.
+ * @param pKey		[in] Key. (16 bytes)
+ * @param enc_ks	[out] Encryption key schedule. (AESNI_KS_SIZE bytes)
+ * @param dec_ks	[out] Decryption key schedule. (AESNI_KS_SIZE bytes)
+ */
+void aesw_aesni_expand_key(const uint8_t *pKey, uint8_t *enc_ks, uint8_t *dec_ks)
+{
+	__m128i rk[11];
+	unsigned int i;
+
+	rk[0]  = _mm_loadu_si128((const __m128i*)pKey);
+	rk[1]  = AES128_KEYEXP(rk[0], 0x01);
+	rk[2]  = AES128_KEYEXP(rk[1], 0x02);
+	rk[3]  = AES128_KEYEXP(rk[2], 0x04);
+	rk[4]  = AES128_KEYEXP(rk[3], 0x08);
+	rk[5]  = AES128_KEYEXP(rk[4], 0x10);
+	rk[6]  = AES128_KEYEXP(rk[5], 0x20);
+	rk[7]  = AES128_KEYEXP(rk[6], 0x40);
+	rk[8]  = AES128_KEYEXP(rk[7], 0x80);
+	rk[9]  = AES128_KEYEXP(rk[8], 0x1B);
+	rk[10] = AES128_KEYEXP(rk[9], 0x36);
+
+	// Encryption key schedule.
+	for (i = 0; i < 11; i++) {
+		_mm_storeu_si128((__m128i*)&enc_ks[i*16], rk[i]);
+	}
+
+	// Decryption key schedule. (Equivalent Inverse Cipher)
+	_mm_storeu_si128((__m128i*)&dec_ks[0], rk[10]);
+	for (i = 1; i < 10; i++) {
+		_mm_storeu_si128((__m128i*)&dec_ks[i*16], _mm_aesimc_si128(rk[10-i]));
+	}
+	_mm_storeu_si128((__m128i*)&dec_ks[10*16], rk[0]);
+}
+
+/**
+ * Encrypt data using AES-128-CBC with AES-NI.
+ * @param enc_ks	[in] Encryption key schedule.
+ * @param iv		[in/out] IV. (updated for the next call)
+ * @param pData		[in/out] Data.
+ * @param size		[in] Size of pData. (Must be a multiple of 16.)
+ */
+void aesw_aesni_cbc_encrypt(const uint8_t *enc_ks, uint8_t *iv, uint8_t *pData, size_t size)
+{
+	__m128i rk[11];
+	__m128i fb;
+	unsigned int i;
+
+	assert(size % 16 == 0);
+	for (i = 0; i < 11; i++) {
+		rk[i] = _mm_loadu_si128((const __m128i*)&enc_ks[i*16]);
+	}
+
+	// NOTE: CBC encryption is serial, since each block
+	// depends on the previous block's ciphertext.
+	fb = _mm_loadu_si128((const __m128i*)iv);
+	for (; size > 0; size -= 16, pData += 16) {
+		__m128i b = _mm_loadu_si128((const __m128i*)pData);
+		b = _mm_xor_si128(b, fb);
+		b = _mm_xor_si128(b, rk[0]);
+		b = _mm_aesenc_si128(b, rk[1]);
+		b = _mm_aesenc_si128(b, rk[2]);
+		b = _mm_aesenc_si128(b, rk[3]);
+		b = _mm_aesenc_si128(b, rk[4]);
+		b = _mm_aesenc_si128(b, rk[5]);
+		b = _mm_aesenc_si128(b, rk[6]);
+		b = _mm_aesenc_si128(b, rk[7]);
+		b = _mm_aesenc_si128(b, rk[8]);
+		b = _mm_aesenc_si128(b, rk[9]);
+		fb = _mm_aesenclast_si128(b, rk[10]);
+		_mm_storeu_si128((__m128i*)pData, fb);
+	}
+	_mm_storeu_si128((__m128i*)iv, fb);
+}
+
+/**
+ * Decrypt data using AES-128-CBC with AES-NI.
+ * @param dec_ks	[in] Decryption key schedule.
+ * @param iv		[in/out] IV. (updated for the next call)
+ * @param pData		[in/out] Data.
+ * @param size		[in] Size of pData. (Must be a multiple of 16.)
+ */
+void aesw_aesni_cbc_decrypt(const uint8_t *dec_ks, uint8_t *iv, uint8_t *pData, size_t size)
+{
+	__m128i rk[11];
+	__m128i fb;
+	unsigned int i;
+
+	assert(size % 16 == 0);
+	for (i = 0; i < 11; i++) {
+		rk[i] = _mm_loadu_si128((const __m128i*)&dec_ks[i*16]);
+	}
+
+	// CBC decryption can be done in parallel, so decrypt
+	// 8 blocks at a time to hide the AESDEC latency.
+	fb = _mm_loadu_si128((const __m128i*)iv);
+	for (; size >= 8*16; size -= 8*16, pData += 8*16) {
+		// NOTE: The blocks are processed using separate variables
+		// instead of arrays so they stay in registers.
+		const __m128i c0 = _mm_loadu_si128((const __m128i*)&pData[0*16]);
+		const __m128i c1 = _mm_loadu_si128((const __m128i*)&pData[1*16]);
+		const __m128i c2 = _mm_loadu_si128((const __m128i*)&pData[2*16]);
+		const __m128i c3 = _mm_loadu_si128((const __m128i*)&pData[3*16]);
+		const __m128i c4 = _mm_loadu_si128((const __m128i*)&pData[4*16]);
+		const __m128i c5 = _mm_loadu_si128((const __m128i*)&pData[5*16]);
+		const __m128i c6 = _mm_loadu_si128((const __m128i*)&pData[6*16]);
+		const __m128i c7 = _mm_loadu_si128((const __m128i*)&pData[7*16]);
+		__m128i b0 = _mm_xor_si128(c0, rk[0]);
+		__m128i b1 = _mm_xor_si128(c1, rk[0]);
+		__m128i b2 = _mm_xor_si128(c2, rk[0]);
+		__m128i b3 = _mm_xor_si128(c3, rk[0]);
+		__m128i b4 = _mm_xor_si128(c4, rk[0]);
+		__m128i b5 = _mm_xor_si128(c5, rk[0]);
+		__m128i b6 = _mm_xor_si128(c6, rk[0]);
+		__m128i b7 = _mm_xor_si128(c7, rk[0]);
+		for (i = 1; i < 10; i++) {
+			const __m128i k = rk[i];
+			b0 = _mm_aesdec_si128(b0, k);
+			b1 = _mm_aesdec_si128(b1, k);
+			b2 = _mm_aesdec_si128(b2, k);
+			b3 = _mm_aesdec_si128(b3, k);
+			b4 = _mm_aesdec_si128(b4, k);
+			b5 = _mm_aesdec_si128(b5, k);
+			b6 = _mm_aesdec_si128(b6, k);
+			b7 = _mm_aesdec_si128(b7, k);
+		}
+		_mm_storeu_si128((__m128i*)&pData[0*16], _mm_xor_si128(_mm_aesdeclast_si128(b0, rk[10]), fb));
+		_mm_storeu_si128((__m128i*)&pData[1*16], _mm_xor_si128(_mm_aesdeclast_si128(b1, rk[10]), c0));
+		_mm_storeu_si128((__m128i*)&pData[2*16], _mm_xor_si128(_mm_aesdeclast_si128(b2, rk[10]), c1));
+		_mm_storeu_si128((__m128i*)&pData[3*16], _mm_xor_si128(_mm_aesdeclast_si128(b3, rk[10]), c2));
+		_mm_storeu_si128((__m128i*)&pData[4*16], _mm_xor_si128(_mm_aesdeclast_si128(b4, rk[10]), c3));
+		_mm_storeu_si128((__m128i*)&pData[5*16], _mm_xor_si128(_mm_aesdeclast_si128(b5, rk[10]), c4));
+		_mm_storeu_si128((__m128i*)&pData[6*16], _mm_xor_si128(_mm_aesdeclast_si128(b6, rk[10]), c5));
+		_mm_storeu_si128((__m128i*)&pData[7*16], _mm_xor_si128(_mm_aesdeclast_si128(b7, rk[10]), c6));
+		fb = c7;
+	}
+
+	// Remaining blocks.
+	for (; size > 0; size -= 16, pData += 16) {
+		const __m128i c = _mm_loadu_si128((const __m128i*)pData);
+		__m128i b = _mm_xor_si128(c, rk[0]);
+		for (i = 1; i < 10; i++) {
+			b = _mm_aesdec_si128(b, rk[i]);
+		}
+		b = _mm_xor_si128(_mm_aesdeclast_si128(b, rk[10]), fb);
+		_mm_storeu_si128((__m128i*)pData, b);
+		fb = c;
+	}
+	_mm_storeu_si128((__m128i*)iv, fb);
+}
@@ -0,0 +1,73 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * aesw_aesni.h: AES wrapper functions. (AES-NI and VAES implementations)  *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// NOTE: These functions are internal to libwiicrypto.
+// Use the aesw.h functions instead.
+
+#ifndef __RVTHTOOL_LIBWIICRYPTO_AESW_AESNI_H__
+#define __RVTHTOOL_LIBWIICRYPTO_AESW_AESNI_H__
+
+#include "config.libwiicrypto.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef HAVE_AESNI
+
+// AES-128 key schedule size: 11 round keys.
+#define AESNI_KS_SIZE (11*16)
+
+/**
+ * Expand an AES-128 key using AES-NI.
+ * @param pKey		[in] Key. (16 bytes)
+ * @param enc_ks	[out] Encryption key schedule. (AESNI_KS_SIZE bytes)
+ * @param dec_ks	[out] Decryption key schedule. (AESNI_KS_SIZE bytes)
+ */
+void aesw_aesni_expand_key(const uint8_t *pKey, uint8_t *enc_ks, uint8_t *dec_ks);
+
+/**
+ * Encrypt data using AES-128-CBC with AES-NI.
+ * @param enc_ks	[in] Encryption key schedule.
+ * @param iv		[in/out] IV. (updated for the next call)
+ * @param pData		[in/out] Data.
+ * @param size		[in] Size of pData. (Must be a multiple of 16.)
+ */
+void aesw_aesni_cbc_encrypt(const uint8_t *enc_ks, uint8_t *iv, uint8_t *pData, size_t size);
+
+/**
+ * Decrypt data using AES-128-CBC with AES-NI.
+ * @param dec_ks	[in] Decryption key schedule.
+ * @param iv		[in/out] IV. (updated for the next call)
+ * @param pData		[in/out] Data.
+ * @param size		[in] Size of pData. (Must be a multiple of 16.)
+ */
+void aesw_aesni_cbc_decrypt(const uint8_t *dec_ks, uint8_t *iv, uint8_t *pData, size_t size);
+
+#endif /* HAVE_AESNI */
+
+#ifdef HAVE_VAES
+/**
+ * Decrypt data using AES-128-CBC with VAES. (256-bit)
+ * CBC encryption is serial, so there's no VAES version of it.
+ * @param dec_ks	[in] Decryption key schedule. (from aesw_aesni_expand_key())
+ * @param iv		[in/out] IV. (updated for the next call)
+ * @param pData		[in/out] Data.
+ * @param size		[in] Size of pData. (Must be a multiple of 16.)
+ */
+void aesw_vaes_cbc_decrypt(const uint8_t *dec_ks, uint8_t *iv, uint8_t *pData, size_t size);
+#endif /* HAVE_VAES */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RVTHTOOL_LIBWIICRYPTO_AESW_AESNI_H__ */
@@ -19,8 +19,11 @@
  ***************************************************************************/
 
 #include "config.nettle.h"
+#include "config.libwiicrypto.h"
 
 #include "aesw.h"
+#include "aesw_aesni.h"
+#include "cpuflags_x86.h"
 
 #include <assert.h>
 #include <errno.h>
@@ -33,18 +36,53 @@
 
 // AES context. (GNU Nettle version.)
 struct _AesCtx {
+	// Key schedules.
+	// These are expanded by aesw_set_key().
 #ifdef HAVE_NETTLE_3
-	struct aes128_ctx ctx;
+	struct aes128_ctx enc_ctx;
+	struct aes128_ctx dec_ctx;
 #else /* !HAVE_NETTLE_3 */
-	struct aes_ctx ctx;
+	struct aes_ctx enc_ctx;
+	struct aes_ctx dec_ctx;
 #endif /* HAVE_NETTLE_3 */
+#ifdef HAVE_AESNI
+	uint8_t aesni_enc_ks[AESNI_KS_SIZE];
+	uint8_t aesni_dec_ks[AESNI_KS_SIZE];
+#endif /* HAVE_AESNI */
 
 	// Encryption key.
 	uint8_t key[16];
 	// Initialization vector.
 	uint8_t iv[16];
+
+	// AES implementation. (See AesImpl_e.)
+	AesImpl_e impl;
 };
 
+/**
+ * Get the fastest AES implementation supported by the CPU.
+ * @return AES implementation. (See AesImpl_e.)
+ */
+static AesImpl_e aesw_detect_impl(void)
+{
+#ifdef HAVE_AESNI
+	const unsigned int flags = cpuflags_x86();
+	if (!(flags & CPUFLAG_AES)) {
+		// AES-NI is not supported.
+		return AESW_IMPL_NETTLE;
+	}
+# ifdef HAVE_VAES
+	if (flags & CPUFLAG_VAES) {
+		// VAES is supported. (This implies AVX2.)
+		return AESW_IMPL_VAES;
+	}
+# endif /* HAVE_VAES */
+	return AESW_IMPL_AESNI;
+#else /* !HAVE_AESNI */
+	return AESW_IMPL_NETTLE;
+#endif /* HAVE_AESNI */
+}
+
 /**
  * Create an AES context.
  * @return AES context, or NULL on error.
@@ -59,6 +97,9 @@ AesCtx *aesw_new(void)
 		return NULL;
 	}
 
+	// Use the fastest implementation supported by the CPU.
+	aesw->impl = aesw_detect_impl();
+
 	// AES context has been initialized.
 	return aesw;
 }
@@ -72,8 +113,85 @@ void aesw_free(AesCtx *aesw)
 	free(aesw);
 }
 
+/**
+ * Expand the key schedules for the current key.
+ * @param aesw	[in] AES context.
+ */
+static void aesw_expand_key(AesCtx *aesw)
+{
+#ifdef HAVE_AESNI
+	if (aesw->impl != AESW_IMPL_NETTLE) {
+		aesw_aesni_expand_key(aesw->key, aesw->aesni_enc_ks, aesw->aesni_dec_ks);
+		return;
+	}
+#endif /* HAVE_AESNI */
+
+#ifdef HAVE_NETTLE_3
+	aes128_set_encrypt_key(&aesw->enc_ctx, aesw->key);
+	aes128_set_decrypt_key(&aesw->dec_ctx, aesw->key);
+#else /* !HAVE_NETTLE_3 */
+	aes_set_encrypt_key(&aesw->enc_ctx, sizeof(aesw->key), aesw->key);
+	aes_set_decrypt_key(&aesw->dec_ctx, sizeof(aesw->key), aesw->key);
+#endif /* HAVE_NETTLE_3 */
+}
+
+/**
+ * Get the AES implementation used by an AES context.
+ * @param aesw	[in] AES context.
+ * @return AES implementation. (See AesImpl_e.)
+ */
+AesImpl_e aesw_get_impl(const AesCtx *aesw)
+{
+	assert(aesw != NULL);
+	return aesw->impl;
+}
+
+/**
+ * Set the AES implementation used by an AES context.
+ * This is mostly useful for testing and benchmarking.
+ * The key and IV are retained.
+ * @param aesw	[in] AES context.
+ * @param impl	[in] AES implementation. (See AesImpl_e.)
+ * @return 0 on success; -ENOTSUP if the implementation isn't supported on this system.
+ */
+int aesw_set_impl(AesCtx *aesw, AesImpl_e impl)
+{
+	if (!aesw || impl < AESW_IMPL_NETTLE || impl >= AESW_IMPL_MAX) {
+		return -EINVAL;
+	}
+
+	// Implementations are ordered, so if a faster implementation
+	// is supported, all of the slower ones are supported, too.
+	if (impl > aesw_detect_impl()) {
+		return -ENOTSUP;
+	}
+
+	aesw->impl = impl;
+	aesw_expand_key(aesw);
+	return 0;
+}
+
+/**
+ * Get the name of an AES implementation.
+ * @param impl	[in] AES implementation. (See AesImpl_e.)
+ * @return Implementation name, or NULL if invalid.
+ */
+const char *aesw_get_impl_name(AesImpl_e impl)
+{
+	static const char *const impl_names[AESW_IMPL_MAX] = {
+		"Nettle", "AES-NI", "VAES",
+	};
+
+	if (impl < AESW_IMPL_NETTLE || impl >= AESW_IMPL_MAX) {
+		return NULL;
+	}
+	return impl_names[impl];
+}
+
 /**
  * Set the AES key.
+ * The key schedules are expanded here, so changing
+ * the IV between calls doesn't require re-expanding them.
  * @param aesw	[in] AES context.
  * @param pKey	[in] Key data.
  * @param size	[in] Size of pKey, in bytes.
@@ -86,6 +204,7 @@ int aesw_set_key(AesCtx *aesw, const uint8_t *pKey, size_t size)
 	}
 
 	memcpy(aesw->key, pKey, size);
+	aesw_expand_key(aesw);
 	return 0;
 }
 
@@ -121,14 +240,19 @@ size_t aesw_encrypt(AesCtx *aesw, uint8_t *pData, size_t size)
 		return 0;
 	}
 
-	// TODO: Only set encrypt key if switching modes?
+#ifdef HAVE_AESNI
+	if (aesw->impl != AESW_IMPL_NETTLE) {
+		// NOTE: VAES doesn't help with CBC encryption.
+		aesw_aesni_cbc_encrypt(aesw->aesni_enc_ks, aesw->iv, pData, size);
+		return size;
+	}
+#endif /* HAVE_AESNI */
+
 #ifdef HAVE_NETTLE_3
-	aes128_set_encrypt_key(&aesw->ctx, aesw->key);
-	cbc_encrypt(&aesw->ctx, (nettle_cipher_func*)aes128_encrypt,
+	cbc_encrypt(&aesw->enc_ctx, (nettle_cipher_func*)aes128_encrypt,
 		AES_BLOCK_SIZE, aesw->iv, size, pData, pData);
 #else /* !HAVE_NETTLE_3 */
-	aes_set_encrypt_key(&aesw->ctx, sizeof(aesw->key), aesw->key);
-	cbc_encrypt(&aesw->ctx, (nettle_crypt_func*)aes_encrypt,
+	cbc_encrypt(&aesw->enc_ctx, (nettle_crypt_func*)aes_encrypt,
 		AES_BLOCK_SIZE, aesw->iv, size, pData, pData);
 #endif /* HAVE_NETTLE_3 */
 
@@ -150,14 +274,26 @@ size_t aesw_decrypt(AesCtx *aesw, uint8_t *pData, size_t size)
 		return 0;
 	}
 
-	// TODO: Only set decrypt key if switching modes?
+	switch (aesw->impl) {
+#ifdef HAVE_VAES
+		case AESW_IMPL_VAES:
+			aesw_vaes_cbc_decrypt(aesw->aesni_dec_ks, aesw->iv, pData, size);
+			return size;
+#endif /* HAVE_VAES */
+#ifdef HAVE_AESNI
+		case AESW_IMPL_AESNI:
+			aesw_aesni_cbc_decrypt(aesw->aesni_dec_ks, aesw->iv, pData, size);
+			return size;
+#endif /* HAVE_AESNI */
+		default:
+			break;
+	}
+
 #ifdef HAVE_NETTLE_3
-	aes128_set_decrypt_key(&aesw->ctx, aesw->key);
-	cbc_decrypt(&aesw->ctx, (nettle_cipher_func*)aes128_decrypt,
+	cbc_decrypt(&aesw->dec_ctx, (nettle_cipher_func*)aes128_decrypt,
 		AES_BLOCK_SIZE, aesw->iv, size, pData, pData);
 #else /* !HAVE_NETTLE_3 */
-	aes_set_decrypt_key(&aesw->ctx, sizeof(aesw->key), aesw->key);
-	cbc_decrypt(&aesw->ctx, (nettle_crypt_func*)aes_decrypt,
+	cbc_decrypt(&aesw->dec_ctx, (nettle_crypt_func*)aes_decrypt,
 		AES_BLOCK_SIZE, aesw->iv, size, pData, pData);
 #endif /* HAVE_NETTLE_3 */
 
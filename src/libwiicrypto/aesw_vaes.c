@@ -0,0 +1,77 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * aesw_vaes.c: AES wrapper functions. (VAES implementation)               *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// NOTE: This file must be compiled with VAES and AVX2 enabled.
+// (-mvaes -mavx2 on gcc) The caller must check that the CPU and OS
+// support VAES and AVX2 before calling any of these functions.
+
+#include "aesw_aesni.h"
+
+#include <assert.h>
+
+// AVX2 and VAES intrinsics.
+#include <immintrin.h>
+
+/**
+ * Decrypt data using AES-128-CBC with VAES. (256-bit)
+ * CBC encryption is serial, so there's no VAES version of it.
+ * @param dec_ks	[in] Decryption key schedule. (from aesw_aesni_expand_key())
+ * @param iv		[in/out] IV. (updated for the next call)
+ * @param pData		[in/out] Data.
+ * @param size		[in] Size of pData. (Must be a multiple of 16.)
+ */
+void aesw_vaes_cbc_decrypt(const uint8_t *dec_ks, uint8_t *iv, uint8_t *pData, size_t size)
+{
+	__m256i rk[11];
+	unsigned int i;
+
+	assert(size % 16 == 0);
+	for (i = 0; i < 11; i++) {
+		rk[i] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)&dec_ks[i*16]));
+	}
+
+	// Decrypt 8 blocks at a time, two blocks per register.
+	// NOTE: The blocks are processed using separate variables
+	// instead of arrays so they stay in registers.
+	for (; size >= 8*16; size -= 8*16, pData += 8*16) {
+		// Load the ciphertext and the previous ciphertext blocks
+		// before writing anything, since decryption is in-place.
+		const __m256i p0 = _mm256_inserti128_si256(
+			_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)iv)),
+			_mm_loadu_si128((const __m128i*)pData), 1);
+		const __m256i p1 = _mm256_loadu_si256((const __m256i*)&pData[1*32 - 16]);
+		const __m256i p2 = _mm256_loadu_si256((const __m256i*)&pData[2*32 - 16]);
+		const __m256i p3 = _mm256_loadu_si256((const __m256i*)&pData[3*32 - 16]);
+		__m256i b0 = _mm256_loadu_si256((const __m256i*)&pData[0*32]);
+		__m256i b1 = _mm256_loadu_si256((const __m256i*)&pData[1*32]);
+		__m256i b2 = _mm256_loadu_si256((const __m256i*)&pData[2*32]);
+		__m256i b3 = _mm256_loadu_si256((const __m256i*)&pData[3*32]);
+		_mm_storeu_si128((__m128i*)iv, _mm256_extracti128_si256(b3, 1));
+
+		b0 = _mm256_xor_si256(b0, rk[0]);
+		b1 = _mm256_xor_si256(b1, rk[0]);
+		b2 = _mm256_xor_si256(b2, rk[0]);
+		b3 = _mm256_xor_si256(b3, rk[0]);
+		for (i = 1; i < 10; i++) {
+			const __m256i k = rk[i];
+			b0 = _mm256_aesdec_epi128(b0, k);
+			b1 = _mm256_aesdec_epi128(b1, k);
+			b2 = _mm256_aesdec_epi128(b2, k);
+			b3 = _mm256_aesdec_epi128(b3, k);
+		}
+		_mm256_storeu_si256((__m256i*)&pData[0*32], _mm256_xor_si256(_mm256_aesdeclast_epi128(b0, rk[10]), p0));
+		_mm256_storeu_si256((__m256i*)&pData[1*32], _mm256_xor_si256(_mm256_aesdeclast_epi128(b1, rk[10]), p1));
+		_mm256_storeu_si256((__m256i*)&pData[2*32], _mm256_xor_si256(_mm256_aesdeclast_epi128(b2, rk[10]), p2));
+		_mm256_storeu_si256((__m256i*)&pData[3*32], _mm256_xor_si256(_mm256_aesdeclast_epi128(b3, rk[10]), p3));
+	}
+
+	// Remaining blocks.
+	if (size > 0) {
+		aesw_aesni_cbc_decrypt(dec_ks, iv, pData, size);
+	}
+}
@@ -26,10 +26,12 @@
 
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 // RSA and SHA-1 functions
 #include "rsaw.h"
+#include "sha1w.h"
 #include <nettle/sha1.h>
 
 /**
@@ -293,6 +295,92 @@ int cert_verify(const uint8_t *data, size_t size)
 	return ret;
 }
 
+// Number of fakesign candidates hashed at a time.
+// This is a multiple of the number of lanes in each
+// batched SHA-1 implementation.
+#define FAKESIGN_BATCH 16
+
+/**
+ * Brute-force a 32-bit field so the SHA-1 hash of the signed area
+ * starts with 0x00, which is accepted by the signature check bug
+ * in early IOS versions.
+ *
+ * The hash state for the whole 64-byte blocks before the field is
+ * calculated once, and only the rest of the data is hashed for each
+ * candidate. This only helps if the field is at least 64 bytes into
+ * the signed area, i.e. for tickets; for TMDs, the field is in the
+ * first block, so each candidate is hashed in full.
+ * FAKESIGN_BATCH candidates are hashed at a time using sha1w.
+ * The lowest matching value is used.
+ *
+ * NOTE: Brute-forcing is done using HOST-endian.
+ *
+ * @param pData		[in/out] Signed area. (starting at the issuer)
+ * @param size		[in] Size of the signed area.
+ * @param fake_offset	[in] Offset of the 32-bit field in the signed area.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int cert_fakesign_search(uint8_t *pData, size_t size, size_t fake_offset)
+{
+	Sha1wMidstate ms;
+	const uint8_t *ptrs[FAKESIGN_BATCH];
+	uint8_t digests[FAKESIGN_BATCH][SHA1W_DIGEST_SIZE];
+	uint8_t *buf;
+	size_t prefix_size, suffix_size, fake_pos;
+	uint64_t base;
+	unsigned int i;
+	int ret = -EIO;
+
+	if (fake_offset + sizeof(uint32_t) > size) {
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	// Hash the whole blocks before the fake field.
+	// (May be 0 bytes if the field is in the first block.)
+	prefix_size = sha1w_midstate_init(&ms, pData, fake_offset);
+	suffix_size = size - prefix_size;
+	fake_pos = fake_offset - prefix_size;
+
+	// Each candidate gets a copy of the rest of the data.
+	buf = malloc(suffix_size * FAKESIGN_BATCH);
+	if (!buf) {
+		errno = ENOMEM;
+		return -ENOMEM;
+	}
+	for (i = 0; i < FAKESIGN_BATCH; i++) {
+		ptrs[i] = &buf[i * suffix_size];
+		memcpy(&buf[i * suffix_size], &pData[prefix_size], suffix_size);
+	}
+
+	for (base = 0; base <= UINT32_MAX; base += FAKESIGN_BATCH) {
+		for (i = 0; i < FAKESIGN_BATCH; i++) {
+			const uint32_t fake = (uint32_t)(base + i);
+			memcpy(&buf[(i * suffix_size) + fake_pos], &fake, sizeof(fake));
+		}
+		sha1w_hash_multi_midstate(&ms, ptrs, suffix_size, FAKESIGN_BATCH, &digests[0][0]);
+
+		for (i = 0; i < FAKESIGN_BATCH; i++) {
+			if (digests[i][0] == 0) {
+				// Found a match.
+				const uint32_t fake = (uint32_t)(base + i);
+				memcpy(&pData[fake_offset], &fake, sizeof(fake));
+				ret = 0;
+				break;
+			}
+		}
+		if (ret == 0)
+			break;
+	}
+
+	free(buf);
+	if (ret != 0) {
+		// No value results in a valid fakesignature.
+		errno = -ret;
+	}
+	return ret;
+}
+
 /**
  * Fakesign a ticket.
  *
@@ -305,12 +393,9 @@ int cert_verify(const uint8_t *data, size_t size)
  */
 int cert_fakesign_ticket(uint8_t *ticket_u8, size_t size)
 {
-	struct sha1_ctx sha1;
-	uint8_t digest[SHA1_DIGEST_SIZE];
-	uint32_t *fake;
 	RVL_Ticket *const ticket = (RVL_Ticket*)ticket_u8;
 
-	if (!ticket) {
+	if (!ticket || size < sizeof(RVL_Ticket)) {
 		errno = EINVAL;
 		return -EINVAL;
 	}
@@ -324,20 +409,9 @@ int cert_fakesign_ticket(uint8_t *ticket_u8, size_t size)
 	// This area is part of the content access permissions.
 	// Disc partitions only have one content, so the rest is unused.
 	// (Wiimm's ISO Tools uses 0x24C.)
-	// NOTE: Brute-forcing is done using HOST-endian.
-	fake = (uint32_t*)&ticket->content_access_perm[0x3A];
-	*fake = 0;
-	sha1_init(&sha1);
-	do {
-		// Calculate the SHA-1 of the ticket.
-		// If the first byte is 0, we're done.
-		static const unsigned int signing_offset = offsetof(RVL_Ticket, issuer);
-		sha1_update(&sha1, size - signing_offset, (const uint8_t*)(&ticket_u8[signing_offset]));
-		sha1_digest(&sha1, sizeof(digest), digest);
-	} while (digest[0] != 0 && ++(*fake) != 0);
-
-	// TODO: If the first byte of the hash is not 0, failed.
-	return 0;
+	return cert_fakesign_search(&ticket_u8[offsetof(RVL_Ticket, issuer)],
+		size - offsetof(RVL_Ticket, issuer),
+		offsetof(RVL_Ticket, content_access_perm[0x3A]) - offsetof(RVL_Ticket, issuer));
 }
 
 /**
@@ -390,10 +464,7 @@ int cert_realsign_ticket(uint8_t *ticket_u8, size_t size, const RSA2048PrivateKe
  */
 int cert_fakesign_tmd(uint8_t *tmd, size_t size)
 {
-	struct sha1_ctx sha1;
-	uint8_t digest[SHA1_DIGEST_SIZE];
 	RVL_TMD_Header *const tmdHeader = (RVL_TMD_Header*)tmd;
-	uint32_t *fake;
 
 	if (!tmd || size < sizeof(RVL_TMD_Header)) {
 		errno = EINVAL;
@@ -408,20 +479,11 @@ int cert_fakesign_tmd(uint8_t *tmd, size_t size)
 	// Using 0x19C for brute-forcing the SHA-1 hash.
 	// This area is "reserved" and is otherwise unused.
 	// (Wiimm's ISO Tools uses 0x19A.)
-	// NOTE: Brute-forcing is done using HOST-endian.
-	fake = (uint32_t*)&tmdHeader->reserved[2];
-	*fake = 0;
-	sha1_init(&sha1);
-	do {
-		// Calculate the SHA-1 of the TMD.
-		// If the first byte is 0, we're done.
-		sha1_update(&sha1, size - offsetof(RVL_TMD_Header, issuer),
-			&tmd[offsetof(RVL_TMD_Header, issuer)]);
-		sha1_digest(&sha1, sizeof(digest), digest);
-	} while (digest[0] != 0 && ++(*fake) != 0);
-
-	// TODO: If the first byte of the hash is not 0, failed.
-	return 0;
+	// NOTE: This is 0x5C bytes into the signed area, which is within
+	// the first SHA-1 block, so there's no midstate to reuse here.
+	return cert_fakesign_search(&tmd[offsetof(RVL_TMD_Header, issuer)],
+		size - offsetof(RVL_TMD_Header, issuer),
+		offsetof(RVL_TMD_Header, reserved[2]) - offsetof(RVL_TMD_Header, issuer));
 }
 
 /**
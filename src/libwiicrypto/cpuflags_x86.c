@@ -0,0 +1,102 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * cpuflags_x86.c: x86 CPU feature detection.                              *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "cpuflags_x86.h"
+
+#ifdef _MSC_VER
+# include <intrin.h>
+#else /* !_MSC_VER */
+# include <cpuid.h>
+#endif /* _MSC_VER */
+
+/**
+ * Run the CPUID instruction.
+ * @param leaf		[in] Leaf.
+ * @param subleaf	[in] Subleaf.
+ * @param regs		[out] EAX, EBX, ECX, EDX.
+ */
+static inline void cpuid(unsigned int leaf, unsigned int subleaf, unsigned int regs[4])
+{
+#ifdef _MSC_VER
+	__cpuidex((int*)regs, (int)leaf, (int)subleaf);
+#else /* !_MSC_VER */
+	__cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif /* _MSC_VER */
+}
+
+/**
+ * Read XCR0.
+ * This must only be called if CPUID.1:ECX.OSXSAVE is set.
+ * @return Low 32 bits of XCR0.
+ */
+static inline unsigned int xgetbv0(void)
+{
+#ifdef _MSC_VER
+	return (unsigned int)_xgetbv(0);
+#else /* !_MSC_VER */
+	unsigned int xcr0_lo, xcr0_hi;
+	__asm__ ("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+	((void)xcr0_hi);
+	return xcr0_lo;
+#endif /* _MSC_VER */
+}
+
+/**
+ * Get the CPU feature flags.
+ * @return CPU feature flags. (CPUFLAG_*)
+ */
+unsigned int cpuflags_x86(void)
+{
+	unsigned int regs[4];	// EAX, EBX, ECX, EDX
+	unsigned int max_leaf;
+	unsigned int flags = 0;
+
+	cpuid(0, 0, regs);
+	max_leaf = regs[0];
+	if (max_leaf < 1) {
+		return 0;
+	}
+
+	cpuid(1, 0, regs);
+	if (regs[3] & (1U << 26)) {
+		flags |= CPUFLAG_SSE2;
+	}
+	if (regs[2] & (1U << 9)) {
+		flags |= CPUFLAG_SSSE3;
+	}
+	if (regs[2] & (1U << 19)) {
+		flags |= CPUFLAG_SSE41;
+	}
+	if (regs[2] & (1U << 25)) {
+		flags |= CPUFLAG_AES;
+	}
+
+	// AVX requires OS support for the YMM registers.
+	// CPUID.1:ECX.OSXSAVE[bit 27], CPUID.1:ECX.AVX[bit 28]
+	if ((regs[2] & (3U << 27)) == (3U << 27)) {
+		// XCR0 must have the XMM and YMM state bits set.
+		if ((xgetbv0() & 6) == 6) {
+			flags |= CPUFLAG_AVX;
+		}
+	}
+
+	if (max_leaf >= 7) {
+		cpuid(7, 0, regs);
+		if ((flags & CPUFLAG_AVX) && (regs[1] & (1U << 5))) {
+			flags |= CPUFLAG_AVX2;
+			if (regs[2] & (1U << 9)) {
+				flags |= CPUFLAG_VAES;
+			}
+		}
+		if (regs[1] & (1U << 29)) {
+			flags |= CPUFLAG_SHA;
+		}
+	}
+
+	return flags;
+}
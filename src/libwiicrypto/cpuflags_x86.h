@@ -0,0 +1,48 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * cpuflags_x86.h: x86 CPU feature detection.                              *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// NOTE: These functions are internal to libwiicrypto.
+
+#ifndef __RVTHTOOL_LIBWIICRYPTO_CPUFLAGS_X86_H__
+#define __RVTHTOOL_LIBWIICRYPTO_CPUFLAGS_X86_H__
+
+#include "config.libwiicrypto.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// CPU feature flags.
+// NOTE: AVX and AVX2 are only reported if the OS saves the YMM registers.
+#define CPUFLAG_SSE2	(1U << 0)
+#define CPUFLAG_SSSE3	(1U << 1)
+#define CPUFLAG_SSE41	(1U << 2)
+#define CPUFLAG_AES	(1U << 3)
+#define CPUFLAG_AVX	(1U << 4)
+#define CPUFLAG_AVX2	(1U << 5)
+#define CPUFLAG_VAES	(1U << 6)
+#define CPUFLAG_SHA	(1U << 7)
+
+#ifdef HAVE_CPUFLAGS_X86
+/**
+ * Get the CPU feature flags.
+ * @return CPU feature flags. (CPUFLAG_*)
+ */
+unsigned int cpuflags_x86(void);
+#else /* !HAVE_CPUFLAGS_X86 */
+static inline unsigned int cpuflags_x86(void)
+{
+	return 0;
+}
+#endif /* HAVE_CPUFLAGS_X86 */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RVTHTOOL_LIBWIICRYPTO_CPUFLAGS_X86_H__ */
@@ -148,6 +148,31 @@ typedef struct PACKED _DOL_Header {
 } DOL_Header;
 ASSERT_STRUCT(DOL_Header, 256);
 
+/**
+ * FST entry.
+ * Reference: http://hitmen.c02.at/files/yagcd/yagcd/chap13.html#sec13.4
+ *
+ * The first entry is the root directory. Its size field
+ * is the total number of entries, and the string table
+ * immediately follows the last entry.
+ *
+ * All fields are big-endian.
+ */
+typedef struct PACKED _GCN_FST_Entry {
+	uint32_t file_type_name_offset;	// MSB = type; low 24 bits = name offset
+	union {
+		struct {
+			uint32_t offset;	// File offset. (NOTE: 34-bit RSH2 on Wii.)
+			uint32_t size;		// File size.
+		} file;
+		struct {
+			uint32_t parent_dir_idx;	// Parent directory index.
+			uint32_t last_entry_idx;	// Index of the first entry after this directory.
+		} dir;
+	};
+} GCN_FST_Entry;
+ASSERT_STRUCT(GCN_FST_Entry, 12);
+
 /**
  * AppLoader errors.
  *
@@ -0,0 +1,361 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * sha1w.c: Batched SHA-1 functions.                                       *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "sha1w.h"
+#include "sha1w_p.h"
+#include "cpuflags_x86.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+
+// Nettle
+#include <nettle/sha1.h>
+
+// Midstate for an empty prefix.
+const Sha1wMidstate sha1w_midstate_empty = {
+	{SHA1W_H0, SHA1W_H1, SHA1W_H2, SHA1W_H3, SHA1W_H4}, 0
+};
+
+// Cached SHA-1 implementation.
+// -1 if it hasn't been detected yet.
+// NOTE: Detection is idempotent, so a race here is harmless.
+static volatile int sha1w_impl = -1;
+
+/**
+ * Get the fastest SHA-1 implementation supported by the CPU.
+ *
+ * The order is based on Sha1Test's throughput benchmark (1 KB H0 buffers,
+ * Release build): AVX2 was slightly faster than SHA-NI, and both were
+ * faster than Nettle. SSE2 was slower than Nettle, so it's never selected
+ * here; use sha1w_set_impl() to select it.
+ *
+ * @return SHA-1 implementation. (See Sha1Impl_e.)
+ */
+static Sha1Impl_e sha1w_detect_impl(void)
+{
+#ifdef HAVE_CPUFLAGS_X86
+	const unsigned int flags = cpuflags_x86();
+	((void)flags);
+# ifdef HAVE_SHA1_AVX2
+	if (flags & CPUFLAG_AVX2) {
+		return SHA1W_IMPL_AVX2;
+	}
+# endif /* HAVE_SHA1_AVX2 */
+# ifdef HAVE_SHA1_SHANI
+	if ((flags & (CPUFLAG_SHA | CPUFLAG_SSE41 | CPUFLAG_SSSE3)) ==
+	    (CPUFLAG_SHA | CPUFLAG_SSE41 | CPUFLAG_SSSE3))
+	{
+		return SHA1W_IMPL_SHANI;
+	}
+# endif /* HAVE_SHA1_SHANI */
+#endif /* HAVE_CPUFLAGS_X86 */
+	return SHA1W_IMPL_NETTLE;
+}
+
+/**
+ * Get the fastest SHA-1 implementation supported by the CPU.
+ * @return SHA-1 implementation. (See Sha1Impl_e.)
+ */
+Sha1Impl_e sha1w_get_impl(void)
+{
+	int impl = sha1w_impl;
+	if (impl < 0) {
+		impl = (int)sha1w_detect_impl();
+		sha1w_impl = impl;
+	}
+	return (Sha1Impl_e)impl;
+}
+
+/**
+ * Set the SHA-1 implementation used by the functions that
+ * don't take an implementation parameter.
+ * This is mostly useful for testing and benchmarking.
+ * @param impl	[in] SHA-1 implementation. (See Sha1Impl_e.)
+ * @return 0 on success; -EINVAL if invalid; -ENOTSUP if the implementation isn't supported on this system.
+ */
+int sha1w_set_impl(Sha1Impl_e impl)
+{
+	if ((unsigned int)impl >= SHA1W_IMPL_MAX) {
+		return -EINVAL;
+	} else if (!sha1w_is_impl_supported(impl)) {
+		return -ENOTSUP;
+	}
+	sha1w_impl = (int)impl;
+	return 0;
+}
+
+/**
+ * Check if a SHA-1 implementation is supported by the CPU.
+ * @param impl	[in] SHA-1 implementation. (See Sha1Impl_e.)
+ * @return Non-zero if supported; 0 if not.
+ */
+int sha1w_is_impl_supported(Sha1Impl_e impl)
+{
+#ifdef HAVE_CPUFLAGS_X86
+	const unsigned int flags = cpuflags_x86();
+	((void)flags);
+#endif /* HAVE_CPUFLAGS_X86 */
+
+	switch (impl) {
+		case SHA1W_IMPL_NETTLE:
+			return 1;
+#ifdef HAVE_SHA1_SSE2
+		case SHA1W_IMPL_SSE2:
+			return !!(flags & CPUFLAG_SSE2);
+#endif /* HAVE_SHA1_SSE2 */
+#ifdef HAVE_SHA1_AVX2
+		case SHA1W_IMPL_AVX2:
+			return !!(flags & CPUFLAG_AVX2);
+#endif /* HAVE_SHA1_AVX2 */
+#ifdef HAVE_SHA1_SHANI
+		case SHA1W_IMPL_SHANI:
+			return (flags & (CPUFLAG_SHA | CPUFLAG_SSE41 | CPUFLAG_SSSE3)) ==
+			       (CPUFLAG_SHA | CPUFLAG_SSE41 | CPUFLAG_SSSE3);
+#endif /* HAVE_SHA1_SHANI */
+		default:
+			break;
+	}
+	return 0;
+}
+
+/**
+ * Get the name of a SHA-1 implementation.
+ * @param impl	[in] SHA-1 implementation. (See Sha1Impl_e.)
+ * @return Implementation name, or NULL if invalid.
+ */
+const char *sha1w_get_impl_name(Sha1Impl_e impl)
+{
+	static const char *const impl_names[SHA1W_IMPL_MAX] = {
+		"Nettle", "SSE2", "AVX2", "SHA-NI"
+	};
+
+	if ((unsigned int)impl >= SHA1W_IMPL_MAX)
+		return NULL;
+	return impl_names[impl];
+}
+
+/**
+ * Hash buffers of the same length using Nettle.
+ * @param ms		[in] Midstate.
+ * @param ppData	[in] Array of `count` buffer pointers.
+ * @param size		[in] Size of each buffer, in bytes.
+ * @param count		[in] Number of buffers.
+ * @param pDigest	[out] Output buffer for `count` digests.
+ */
+static void sha1w_nettle_hash(const Sha1wMidstate *ms, const uint8_t *const *ppData,
+	size_t size, unsigned int count, uint8_t *pDigest)
+{
+	if (ms == &sha1w_midstate_empty) {
+		// No prefix. Use the regular Nettle functions.
+		struct sha1_ctx sha1;
+		for (; count > 0; count--, ppData++, pDigest += SHA1W_DIGEST_SIZE) {
+			sha1_init(&sha1);
+			sha1_update(&sha1, size, *ppData);
+			sha1_digest(&sha1, SHA1W_DIGEST_SIZE, pDigest);
+		}
+		return;
+	}
+
+	// Nettle can't start from a midstate, so use the
+	// compression function directly.
+	for (; count > 0; count--, ppData++, pDigest += SHA1W_DIGEST_SIZE) {
+		uint8_t tail[SHA1W_BLOCK_SIZE * 2];
+		uint32_t h[5];
+		const uint8_t *p = *ppData;
+		size_t i;
+		const size_t full_blocks = size / SHA1W_BLOCK_SIZE;
+		const unsigned int tail_blocks = sha1w_make_tail(p, size, ms->size, tail);
+
+		memcpy(h, ms->h, sizeof(h));
+		for (i = 0; i < full_blocks; i++, p += SHA1W_BLOCK_SIZE) {
+			nettle_sha1_compress(h, p);
+		}
+		for (i = 0; i < tail_blocks; i++) {
+			nettle_sha1_compress(h, &tail[i * SHA1W_BLOCK_SIZE]);
+		}
+		sha1w_store_digest(h, pDigest);
+	}
+}
+
+/**
+ * Hash buffers using the specified implementation.
+ * The implementation must be supported by the CPU.
+ * @param impl		[in] SHA-1 implementation.
+ * @param ms		[in] Midstate.
+ * @param ppData	[in] Array of `count` buffer pointers.
+ * @param size		[in] Size of each buffer, in bytes.
+ * @param count		[in] Number of buffers.
+ * @param pDigest	[out] Output buffer for `count` digests.
+ */
+static void sha1w_dispatch(Sha1Impl_e impl, const Sha1wMidstate *ms,
+	const uint8_t *const *ppData, size_t size, unsigned int count, uint8_t *pDigest)
+{
+	switch (impl) {
+#ifdef HAVE_SHA1_SHANI
+		case SHA1W_IMPL_SHANI:
+			sha1w_shani_hash(ms, ppData, size, count, pDigest);
+			return;
+#endif /* HAVE_SHA1_SHANI */
+#ifdef HAVE_SHA1_AVX2
+		case SHA1W_IMPL_AVX2:
+			for (; count > 0; ) {
+				const unsigned int n = (count > SHA1W_AVX2_LANES ? SHA1W_AVX2_LANES : count);
+				sha1w_avx2_hash(ms, ppData, size, n, pDigest);
+				ppData += n;
+				pDigest += n * SHA1W_DIGEST_SIZE;
+				count -= n;
+			}
+			return;
+#endif /* HAVE_SHA1_AVX2 */
+#ifdef HAVE_SHA1_SSE2
+		case SHA1W_IMPL_SSE2:
+			for (; count > 0; ) {
+				const unsigned int n = (count > SHA1W_SSE2_LANES ? SHA1W_SSE2_LANES : count);
+				sha1w_sse2_hash(ms, ppData, size, n, pDigest);
+				ppData += n;
+				pDigest += n * SHA1W_DIGEST_SIZE;
+				count -= n;
+			}
+			return;
+#endif /* HAVE_SHA1_SSE2 */
+		default:
+			sha1w_nettle_hash(ms, ppData, size, count, pDigest);
+			return;
+	}
+}
+
+/**
+ * Hash multiple independent buffers of the same length.
+ * @param ppData	[in] Array of `count` buffer pointers.
+ * @param size		[in] Size of each buffer, in bytes.
+ * @param count		[in] Number of buffers.
+ * @param pDigest	[out] Output buffer for `count` digests. (count * SHA1W_DIGEST_SIZE bytes)
+ */
+void sha1w_hash_multi(const uint8_t *const *ppData, size_t size,
+	unsigned int count, uint8_t *pDigest)
+{
+	assert(ppData != NULL || count == 0);
+	assert(pDigest != NULL || count == 0);
+	sha1w_dispatch(sha1w_get_impl(), &sha1w_midstate_empty, ppData, size, count, pDigest);
+}
+
+/**
+ * Hash multiple independent buffers of the same length
+ * using a specific implementation.
+ * This is mostly useful for testing and benchmarking.
+ * @param impl		[in] SHA-1 implementation. (Must be supported by the CPU.)
+ * @param ppData	[in] Array of `count` buffer pointers.
+ * @param size		[in] Size of each buffer, in bytes.
+ * @param count		[in] Number of buffers.
+ * @param pDigest	[out] Output buffer for `count` digests. (count * SHA1W_DIGEST_SIZE bytes)
+ * @return 0 on success; -ENOTSUP if the implementation isn't supported.
+ */
+int sha1w_hash_multi_impl(Sha1Impl_e impl, const uint8_t *const *ppData,
+	size_t size, unsigned int count, uint8_t *pDigest)
+{
+	if (!sha1w_is_impl_supported(impl)) {
+		return -ENOTSUP;
+	}
+	sha1w_dispatch(impl, &sha1w_midstate_empty, ppData, size, count, pDigest);
+	return 0;
+}
+
+/**
+ * Hash multiple independent buffers of the same length, spaced
+ * at a fixed stride. The digests are stored contiguously.
+ * @param pData		[in] First buffer.
+ * @param size		[in] Size of each buffer, in bytes.
+ * @param stride	[in] Distance between the start of each buffer, in bytes.
+ * @param count		[in] Number of buffers.
+ * @param pDigest	[out] Output buffer for `count` digests. (count * SHA1W_DIGEST_SIZE bytes)
+ */
+void sha1w_hash_strided(const uint8_t *pData, size_t size, size_t stride,
+	unsigned int count, uint8_t *pDigest)
+{
+	// Build the pointer array in small batches.
+	const uint8_t *ptrs[64];
+	const Sha1Impl_e impl = sha1w_get_impl();
+
+	while (count > 0) {
+		const unsigned int n = (count > 64 ? 64 : count);
+		unsigned int i;
+		for (i = 0; i < n; i++, pData += stride) {
+			ptrs[i] = pData;
+		}
+		sha1w_dispatch(impl, &sha1w_midstate_empty, ptrs, size, n, pDigest);
+		pDigest += n * SHA1W_DIGEST_SIZE;
+		count -= n;
+	}
+}
+
+/**
+ * Initialize a SHA-1 midstate by hashing a prefix.
+ * Only whole blocks are hashed; if size is not a multiple of
+ * SHA1W_BLOCK_SIZE, the remaining bytes are not included.
+ * @param ms		[out] Midstate.
+ * @param pData		[in] Prefix.
+ * @param size		[in] Size of the prefix, in bytes.
+ * @return Number of bytes included in the midstate.
+ */
+size_t sha1w_midstate_init(Sha1wMidstate *ms, const uint8_t *pData, size_t size)
+{
+	const size_t full_blocks = size / SHA1W_BLOCK_SIZE;
+	size_t i;
+
+	assert(ms != NULL);
+	assert(pData != NULL || size == 0);
+
+	*ms = sha1w_midstate_empty;
+	for (i = 0; i < full_blocks; i++, pData += SHA1W_BLOCK_SIZE) {
+		nettle_sha1_compress(ms->h, pData);
+	}
+	ms->size = (uint64_t)full_blocks * SHA1W_BLOCK_SIZE;
+	return (size_t)ms->size;
+}
+
+/**
+ * Hash multiple independent buffers of the same length,
+ * each of which follows the prefix in the midstate.
+ * @param ms		[in] Midstate.
+ * @param ppData	[in] Array of `count` buffer pointers.
+ * @param size		[in] Size of each buffer, in bytes. (not including the prefix)
+ * @param count		[in] Number of buffers.
+ * @param pDigest	[out] Output buffer for `count` digests. (count * SHA1W_DIGEST_SIZE bytes)
+ */
+void sha1w_hash_multi_midstate(const Sha1wMidstate *ms, const uint8_t *const *ppData,
+	size_t size, unsigned int count, uint8_t *pDigest)
+{
+	assert(ms != NULL);
+	assert(ppData != NULL || count == 0);
+	assert(pDigest != NULL || count == 0);
+	sha1w_dispatch(sha1w_get_impl(), ms, ppData, size, count, pDigest);
+}
+
+/**
+ * Hash multiple independent buffers of the same length,
+ * each of which follows the prefix in the midstate,
+ * using a specific implementation.
+ * This is mostly useful for testing and benchmarking.
+ * @param impl		[in] SHA-1 implementation. (Must be supported by the CPU.)
+ * @param ms		[in] Midstate.
+ * @param ppData	[in] Array of `count` buffer pointers.
+ * @param size		[in] Size of each buffer, in bytes. (not including the prefix)
+ * @param count		[in] Number of buffers.
+ * @param pDigest	[out] Output buffer for `count` digests. (count * SHA1W_DIGEST_SIZE bytes)
+ * @return 0 on success; -ENOTSUP if the implementation isn't supported.
+ */
+int sha1w_hash_multi_midstate_impl(Sha1Impl_e impl, const Sha1wMidstate *ms,
+	const uint8_t *const *ppData, size_t size, unsigned int count, uint8_t *pDigest)
+{
+	if (!sha1w_is_impl_supported(impl)) {
+		return -ENOTSUP;
+	}
+	sha1w_dispatch(impl, ms, ppData, size, count, pDigest);
+	return 0;
+}
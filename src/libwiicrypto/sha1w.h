@@ -0,0 +1,166 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * sha1w.h: Batched SHA-1 functions.                                       *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// NOTE: This is for hashing many small, independent buffers, e.g. the
+// Wii disc H0/H1/H2 hash tables. For a single large buffer, use nettle.
+
+#ifndef __RVTHTOOL_LIBWIICRYPTO_SHA1W_H__
+#define __RVTHTOOL_LIBWIICRYPTO_SHA1W_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// SHA-1 digest size.
+#define SHA1W_DIGEST_SIZE 20
+// SHA-1 block size.
+#define SHA1W_BLOCK_SIZE 64
+
+/**
+ * SHA-1 midstate.
+ * This is the hash state after processing a common prefix,
+ * which must be a multiple of SHA1W_BLOCK_SIZE bytes.
+ * Buffers that share the prefix can then be hashed without
+ * processing the prefix again.
+ */
+typedef struct _Sha1wMidstate {
+	uint32_t h[5];		// Hash state.
+	uint64_t size;		// Size of the prefix, in bytes.
+} Sha1wMidstate;
+
+/**
+ * SHA-1 implementations.
+ * The fastest implementation supported by the CPU is used by
+ * sha1w_hash_multi(). Use sha1w_hash_multi_impl() to select
+ * a specific implementation for a single call, or sha1w_set_impl()
+ * to override the default.
+ *
+ * NOTE: SSE2 is slower than Nettle for Wii hash tables, so it's
+ * never selected by default.
+ */
+typedef enum {
+	SHA1W_IMPL_NETTLE	= 0,	// GNU Nettle (one buffer at a time)
+	SHA1W_IMPL_SSE2		= 1,	// SSE2 (4 buffers at a time)
+	SHA1W_IMPL_AVX2		= 2,	// AVX2 (8 buffers at a time)
+	SHA1W_IMPL_SHANI	= 3,	// SHA-NI (2 buffers interleaved)
+
+	SHA1W_IMPL_MAX
+} Sha1Impl_e;
+
+/**
+ * Get the fastest SHA-1 implementation supported by the CPU.
+ * @return SHA-1 implementation. (See Sha1Impl_e.)
+ */
+Sha1Impl_e sha1w_get_impl(void);
+
+/**
+ * Set the SHA-1 implementation used by the functions that
+ * don't take an implementation parameter.
+ * This is mostly useful for testing and benchmarking.
+ * @param impl	[in] SHA-1 implementation. (See Sha1Impl_e.)
+ * @return 0 on success; -EINVAL if invalid; -ENOTSUP if the implementation isn't supported on this system.
+ */
+int sha1w_set_impl(Sha1Impl_e impl);
+
+/**
+ * Check if a SHA-1 implementation is supported by the CPU.
+ * @param impl	[in] SHA-1 implementation. (See Sha1Impl_e.)
+ * @return Non-zero if supported; 0 if not.
+ */
+int sha1w_is_impl_supported(Sha1Impl_e impl);
+
+/**
+ * Get the name of a SHA-1 implementation.
+ * @param impl	[in] SHA-1 implementation. (See Sha1Impl_e.)
+ * @return Implementation name, or NULL if invalid.
+ */
+const char *sha1w_get_impl_name(Sha1Impl_e impl);
+
+/**
+ * Hash multiple independent buffers of the same length.
+ * @param ppData	[in] Array of `count` buffer pointers.
+ * @param size		[in] Size of each buffer, in bytes.
+ * @param count		[in] Number of buffers.
+ * @param pDigest	[out] Output buffer for `count` digests. (count * SHA1W_DIGEST_SIZE bytes)
+ */
+void sha1w_hash_multi(const uint8_t *const *ppData, size_t size,
+	unsigned int count, uint8_t *pDigest);
+
+/**
+ * Hash multiple independent buffers of the same length
+ * using a specific implementation.
+ * This is mostly useful for testing and benchmarking.
+ * @param impl		[in] SHA-1 implementation. (Must be supported by the CPU.)
+ * @param ppData	[in] Array of `count` buffer pointers.
+ * @param size		[in] Size of each buffer, in bytes.
+ * @param count		[in] Number of buffers.
+ * @param pDigest	[out] Output buffer for `count` digests. (count * SHA1W_DIGEST_SIZE bytes)
+ * @return 0 on success; -ENOTSUP if the implementation isn't supported.
+ */
+int sha1w_hash_multi_impl(Sha1Impl_e impl, const uint8_t *const *ppData,
+	size_t size, unsigned int count, uint8_t *pDigest);
+
+/**
+ * Hash multiple independent buffers of the same length, spaced
+ * at a fixed stride. The digests are stored contiguously.
+ * @param pData		[in] First buffer.
+ * @param size		[in] Size of each buffer, in bytes.
+ * @param stride	[in] Distance between the start of each buffer, in bytes.
+ * @param count		[in] Number of buffers.
+ * @param pDigest	[out] Output buffer for `count` digests. (count * SHA1W_DIGEST_SIZE bytes)
+ */
+void sha1w_hash_strided(const uint8_t *pData, size_t size, size_t stride,
+	unsigned int count, uint8_t *pDigest);
+
+/**
+ * Initialize a SHA-1 midstate by hashing a prefix.
+ * Only whole blocks are hashed; if size is not a multiple of
+ * SHA1W_BLOCK_SIZE, the remaining bytes are not included.
+ * @param ms		[out] Midstate.
+ * @param pData		[in] Prefix.
+ * @param size		[in] Size of the prefix, in bytes.
+ * @return Number of bytes included in the midstate.
+ */
+size_t sha1w_midstate_init(Sha1wMidstate *ms, const uint8_t *pData, size_t size);
+
+/**
+ * Hash multiple independent buffers of the same length,
+ * each of which follows the prefix in the midstate.
+ * @param ms		[in] Midstate.
+ * @param ppData	[in] Array of `count` buffer pointers.
+ * @param size		[in] Size of each buffer, in bytes. (not including the prefix)
+ * @param count		[in] Number of buffers.
+ * @param pDigest	[out] Output buffer for `count` digests. (count * SHA1W_DIGEST_SIZE bytes)
+ */
+void sha1w_hash_multi_midstate(const Sha1wMidstate *ms, const uint8_t *const *ppData,
+	size_t size, unsigned int count, uint8_t *pDigest);
+
+/**
+ * Hash multiple independent buffers of the same length,
+ * each of which follows the prefix in the midstate,
+ * using a specific implementation.
+ * This is mostly useful for testing and benchmarking.
+ * @param impl		[in] SHA-1 implementation. (Must be supported by the CPU.)
+ * @param ms		[in] Midstate.
+ * @param ppData	[in] Array of `count` buffer pointers.
+ * @param size		[in] Size of each buffer, in bytes. (not including the prefix)
+ * @param count		[in] Number of buffers.
+ * @param pDigest	[out] Output buffer for `count` digests. (count * SHA1W_DIGEST_SIZE bytes)
+ * @return 0 on success; -ENOTSUP if the implementation isn't supported.
+ */
+int sha1w_hash_multi_midstate_impl(Sha1Impl_e impl, const Sha1wMidstate *ms,
+	const uint8_t *const *ppData, size_t size, unsigned int count, uint8_t *pDigest);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RVTHTOOL_LIBWIICRYPTO_SHA1W_H__ */
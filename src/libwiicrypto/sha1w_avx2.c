@@ -0,0 +1,30 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * sha1w_avx2.c: Batched SHA-1 functions. (AVX2 implementation)            *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// NOTE: This file must be compiled with AVX2 enabled. (-mavx2 on gcc)
+// The caller must check that the CPU and OS support AVX2.
+
+#include "sha1w_p.h"
+
+// AVX2 intrinsics.
+#include <immintrin.h>
+
+#define SHA1W_SIMD_FN		sha1w_avx2_hash
+#define SHA1W_SIMD_LANES	SHA1W_AVX2_LANES
+typedef __m256i vec_t;
+#define V_ADD(a, b)	_mm256_add_epi32((a), (b))
+#define V_XOR(a, b)	_mm256_xor_si256((a), (b))
+#define V_AND(a, b)	_mm256_and_si256((a), (b))
+#define V_OR(a, b)	_mm256_or_si256((a), (b))
+#define V_SLLI(a, n)	_mm256_slli_epi32((a), (n))
+#define V_SRLI(a, n)	_mm256_srli_epi32((a), (n))
+#define V_SET1(x)	_mm256_set1_epi32((int)(x))
+#define V_LOAD(p)	_mm256_loadu_si256((const __m256i*)(p))
+#define V_STORE(p, v)	_mm256_storeu_si256((__m256i*)(p), (v))
+
+#include "sha1w_simd.h"
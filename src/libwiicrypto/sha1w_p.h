@@ -0,0 +1,131 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * sha1w_p.h: Batched SHA-1 functions. (private)                           *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// NOTE: These functions are internal to libwiicrypto.
+// Use the sha1w.h functions instead.
+
+#ifndef __RVTHTOOL_LIBWIICRYPTO_SHA1W_P_H__
+#define __RVTHTOOL_LIBWIICRYPTO_SHA1W_P_H__
+
+#include "config.libwiicrypto.h"
+#include "sha1w.h"
+
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// SHA-1 initial state.
+#define SHA1W_H0 0x67452301U
+#define SHA1W_H1 0xEFCDAB89U
+#define SHA1W_H2 0x98BADCFEU
+#define SHA1W_H3 0x10325476U
+#define SHA1W_H4 0xC3D2E1F0U
+
+// Midstate for an empty prefix. (defined in sha1w.c)
+extern const Sha1wMidstate sha1w_midstate_empty;
+
+/**
+ * Build the final (padded) block(s) for a buffer.
+ *
+ * All buffers in a batch have the same length, so they all have
+ * the same number of full blocks, followed by the same number of
+ * tail blocks.
+ *
+ * @param pData		[in] Buffer.
+ * @param size		[in] Size of the buffer, in bytes.
+ * @param prefix_size	[in] Size of the prefix in the midstate, in bytes.
+ * @param tail		[out] Tail blocks. (2 * SHA1W_BLOCK_SIZE bytes)
+ * @return Number of tail blocks. (1 or 2)
+ */
+static inline unsigned int sha1w_make_tail(const uint8_t *pData, size_t size,
+	uint64_t prefix_size, uint8_t *tail)
+{
+	const size_t full = size & ~(size_t)(SHA1W_BLOCK_SIZE - 1);
+	const size_t rem = size - full;
+	const unsigned int tail_blocks = (rem + 1 + 8 > SHA1W_BLOCK_SIZE ? 2 : 1);
+	const uint64_t bits = (prefix_size + size) * 8;
+	uint8_t *const pLen = &tail[(tail_blocks * SHA1W_BLOCK_SIZE) - 8];
+	unsigned int i;
+
+	memcpy(tail, &pData[full], rem);
+	tail[rem] = 0x80;
+	memset(&tail[rem + 1], 0, (tail_blocks * SHA1W_BLOCK_SIZE) - rem - 1);
+	for (i = 0; i < 8; i++) {
+		pLen[i] = (uint8_t)(bits >> (56 - (i * 8)));
+	}
+	return tail_blocks;
+}
+
+/**
+ * Store a SHA-1 state as a digest.
+ * @param state		[in] State.
+ * @param pDigest	[out] Digest. (SHA1W_DIGEST_SIZE bytes)
+ */
+static inline void sha1w_store_digest(const uint32_t state[5], uint8_t *pDigest)
+{
+	unsigned int i;
+	for (i = 0; i < 5; i++) {
+		pDigest[(i * 4) + 0] = (uint8_t)(state[i] >> 24);
+		pDigest[(i * 4) + 1] = (uint8_t)(state[i] >> 16);
+		pDigest[(i * 4) + 2] = (uint8_t)(state[i] >> 8);
+		pDigest[(i * 4) + 3] = (uint8_t)(state[i]);
+	}
+}
+
+#ifdef HAVE_SHA1_SSE2
+// Number of buffers hashed at a time by sha1w_sse2_hash().
+#define SHA1W_SSE2_LANES 4
+
+/**
+ * Hash up to 4 buffers of the same length using SSE2.
+ * @param ms		[in] Midstate.
+ * @param ppData	[in] Array of `count` buffer pointers.
+ * @param size		[in] Size of each buffer, in bytes.
+ * @param count		[in] Number of buffers. (1-4)
+ * @param pDigest	[out] Output buffer for `count` digests.
+ */
+void sha1w_sse2_hash(const Sha1wMidstate *ms, const uint8_t *const *ppData,
+	size_t size, unsigned int count, uint8_t *pDigest);
+#endif /* HAVE_SHA1_SSE2 */
+
+#ifdef HAVE_SHA1_AVX2
+// Number of buffers hashed at a time by sha1w_avx2_hash().
+#define SHA1W_AVX2_LANES 8
+
+/**
+ * Hash up to 8 buffers of the same length using AVX2.
+ * @param ms		[in] Midstate.
+ * @param ppData	[in] Array of `count` buffer pointers.
+ * @param size		[in] Size of each buffer, in bytes.
+ * @param count		[in] Number of buffers. (1-8)
+ * @param pDigest	[out] Output buffer for `count` digests.
+ */
+void sha1w_avx2_hash(const Sha1wMidstate *ms, const uint8_t *const *ppData,
+	size_t size, unsigned int count, uint8_t *pDigest);
+#endif /* HAVE_SHA1_AVX2 */
+
+#ifdef HAVE_SHA1_SHANI
+/**
+ * Hash buffers of the same length using SHA-NI.
+ * @param ms		[in] Midstate.
+ * @param ppData	[in] Array of `count` buffer pointers.
+ * @param size		[in] Size of each buffer, in bytes.
+ * @param count		[in] Number of buffers.
+ * @param pDigest	[out] Output buffer for `count` digests.
+ */
+void sha1w_shani_hash(const Sha1wMidstate *ms, const uint8_t *const *ppData,
+	size_t size, unsigned int count, uint8_t *pDigest);
+#endif /* HAVE_SHA1_SHANI */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RVTHTOOL_LIBWIICRYPTO_SHA1W_P_H__ */
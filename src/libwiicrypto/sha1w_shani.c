@@ -0,0 +1,261 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * sha1w_shani.c: Batched SHA-1 functions. (SHA-NI implementation)         *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// NOTE: This file must be compiled with SHA-NI, SSE4.1, and SSSE3 enabled.
+// (-msha -msse4.1 -mssse3 on gcc) The caller must check that the CPU
+// supports all three before calling any of these functions.
+
+#include "sha1w_p.h"
+
+// SHA-NI, SSE4.1, and SSSE3 intrinsics.
+#include <immintrin.h>
+
+// Byte swap mask for the message words.
+#define SHA1W_BSWAP_MASK _mm_set_epi64x(0x0001020304050607ULL, 0x08090A0B0C0D0E0FULL)
+
+// SHA-1 compression steps for one stream.
+// Variables are suffixed with the stream name so two streams can be
+// interleaved; sha1rnds4 has a long latency, and the streams are independent.
+#define LOAD(x, m, p, off) \
+	m##x = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)&(p)[off]), mask)
+#define SAVE(x) do { \
+		ABCD_SAVE##x = ABCD##x; \
+		E0_SAVE##x = E0##x; \
+	} while (0)
+#define RNDS_0_3(x) do { \
+		E0##x = _mm_add_epi32(E0##x, MSG0##x); \
+		E1##x = ABCD##x; \
+		ABCD##x = _mm_sha1rnds4_epu32(ABCD##x, E0##x, 0); \
+	} while (0)
+#define RNDS_4_7(x) do { \
+		E1##x = _mm_sha1nexte_epu32(E1##x, MSG1##x); \
+		E0##x = ABCD##x; \
+		ABCD##x = _mm_sha1rnds4_epu32(ABCD##x, E1##x, 0); \
+		MSG0##x = _mm_sha1msg1_epu32(MSG0##x, MSG1##x); \
+	} while (0)
+#define RNDS_8_11(x) do { \
+		E0##x = _mm_sha1nexte_epu32(E0##x, MSG2##x); \
+		E1##x = ABCD##x; \
+		ABCD##x = _mm_sha1rnds4_epu32(ABCD##x, E0##x, 0); \
+		MSG1##x = _mm_sha1msg1_epu32(MSG1##x, MSG2##x); \
+		MSG0##x = _mm_xor_si128(MSG0##x, MSG2##x); \
+	} while (0)
+// Four rounds with the full message schedule. (rounds 12-67)
+// ea/eb alternate between E0 and E1; m0 is the current message vector.
+#define RNDS4(x, ea, eb, m0, m1, m2, m3, fn) do { \
+		ea##x = _mm_sha1nexte_epu32(ea##x, m0##x); \
+		eb##x = ABCD##x; \
+		m1##x = _mm_sha1msg2_epu32(m1##x, m0##x); \
+		ABCD##x = _mm_sha1rnds4_epu32(ABCD##x, ea##x, fn); \
+		m3##x = _mm_sha1msg1_epu32(m3##x, m0##x); \
+		m2##x = _mm_xor_si128(m2##x, m0##x); \
+	} while (0)
+#define RNDS_68_71(x) do { \
+		E1##x = _mm_sha1nexte_epu32(E1##x, MSG1##x); \
+		E0##x = ABCD##x; \
+		MSG2##x = _mm_sha1msg2_epu32(MSG2##x, MSG1##x); \
+		ABCD##x = _mm_sha1rnds4_epu32(ABCD##x, E1##x, 3); \
+		MSG3##x = _mm_xor_si128(MSG3##x, MSG1##x); \
+	} while (0)
+#define RNDS_72_75(x) do { \
+		E0##x = _mm_sha1nexte_epu32(E0##x, MSG2##x); \
+		E1##x = ABCD##x; \
+		MSG3##x = _mm_sha1msg2_epu32(MSG3##x, MSG2##x); \
+		ABCD##x = _mm_sha1rnds4_epu32(ABCD##x, E0##x, 3); \
+	} while (0)
+#define RNDS_76_79(x) do { \
+		E1##x = _mm_sha1nexte_epu32(E1##x, MSG3##x); \
+		E0##x = ABCD##x; \
+		ABCD##x = _mm_sha1rnds4_epu32(ABCD##x, E1##x, 3); \
+		E0##x = _mm_sha1nexte_epu32(E0##x, E0_SAVE##x); \
+		ABCD##x = _mm_add_epi32(ABCD##x, ABCD_SAVE##x); \
+	} while (0)
+
+// Apply a step to both streams.
+#define BOTH(step) do { step(_a); step(_b); } while (0)
+#define BOTH_RNDS4(ea, eb, m0, m1, m2, m3, fn) do { \
+		RNDS4(_a, ea, eb, m0, m1, m2, m3, fn); \
+		RNDS4(_b, ea, eb, m0, m1, m2, m3, fn); \
+	} while (0)
+
+/**
+ * SHA-1 state for one buffer, in SHA-NI order.
+ */
+typedef struct _sha1w_shani_state {
+	__m128i ABCD;
+	__m128i E;
+} sha1w_shani_state;
+
+/**
+ * Initialize a SHA-1 state from a midstate.
+ * @param st	[out] State.
+ * @param ms	[in] Midstate.
+ */
+static inline void sha1w_shani_init(sha1w_shani_state *st, const Sha1wMidstate *ms)
+{
+	st->ABCD = _mm_set_epi32((int)ms->h[0], (int)ms->h[1], (int)ms->h[2], (int)ms->h[3]);
+	st->E = _mm_set_epi32((int)ms->h[4], 0, 0, 0);
+}
+
+/**
+ * Store a SHA-1 state as a digest.
+ * @param st		[in] State.
+ * @param pDigest	[out] Digest.
+ */
+static inline void sha1w_shani_store(const sha1w_shani_state *st, uint8_t *pDigest)
+{
+	uint32_t h[5];
+	h[0] = (uint32_t)_mm_extract_epi32(st->ABCD, 3);
+	h[1] = (uint32_t)_mm_extract_epi32(st->ABCD, 2);
+	h[2] = (uint32_t)_mm_extract_epi32(st->ABCD, 1);
+	h[3] = (uint32_t)_mm_extract_epi32(st->ABCD, 0);
+	h[4] = (uint32_t)_mm_extract_epi32(st->E, 3);
+	sha1w_store_digest(h, pDigest);
+}
+
+/**
+ * Process 64-byte blocks from a single buffer.
+ * @param st	[in/out] State.
+ * @param pData	[in] Data.
+ * @param blocks [in] Number of 64-byte blocks.
+ */
+static void sha1w_shani_compress(sha1w_shani_state *st, const uint8_t *pData, size_t blocks)
+{
+	const __m128i mask = SHA1W_BSWAP_MASK;
+	__m128i ABCD_a = st->ABCD;
+	__m128i E0_a = st->E;
+	__m128i E1_a, ABCD_SAVE_a, E0_SAVE_a;
+	__m128i MSG0_a, MSG1_a, MSG2_a, MSG3_a;
+
+	for (; blocks > 0; blocks--, pData += SHA1W_BLOCK_SIZE) {
+		SAVE(_a);
+		LOAD(_a, MSG0, pData, 0);
+		RNDS_0_3(_a);
+		LOAD(_a, MSG1, pData, 16);
+		RNDS_4_7(_a);
+		LOAD(_a, MSG2, pData, 32);
+		RNDS_8_11(_a);
+		LOAD(_a, MSG3, pData, 48);
+		RNDS4(_a, E1, E0, MSG3, MSG0, MSG1, MSG2, 0);	// 12-15
+		RNDS4(_a, E0, E1, MSG0, MSG1, MSG2, MSG3, 0);	// 16-19
+		RNDS4(_a, E1, E0, MSG1, MSG2, MSG3, MSG0, 1);	// 20-23
+		RNDS4(_a, E0, E1, MSG2, MSG3, MSG0, MSG1, 1);	// 24-27
+		RNDS4(_a, E1, E0, MSG3, MSG0, MSG1, MSG2, 1);	// 28-31
+		RNDS4(_a, E0, E1, MSG0, MSG1, MSG2, MSG3, 1);	// 32-35
+		RNDS4(_a, E1, E0, MSG1, MSG2, MSG3, MSG0, 1);	// 36-39
+		RNDS4(_a, E0, E1, MSG2, MSG3, MSG0, MSG1, 2);	// 40-43
+		RNDS4(_a, E1, E0, MSG3, MSG0, MSG1, MSG2, 2);	// 44-47
+		RNDS4(_a, E0, E1, MSG0, MSG1, MSG2, MSG3, 2);	// 48-51
+		RNDS4(_a, E1, E0, MSG1, MSG2, MSG3, MSG0, 2);	// 52-55
+		RNDS4(_a, E0, E1, MSG2, MSG3, MSG0, MSG1, 2);	// 56-59
+		RNDS4(_a, E1, E0, MSG3, MSG0, MSG1, MSG2, 3);	// 60-63
+		RNDS4(_a, E0, E1, MSG0, MSG1, MSG2, MSG3, 3);	// 64-67
+		RNDS_68_71(_a);
+		RNDS_72_75(_a);
+		RNDS_76_79(_a);
+	}
+
+	st->ABCD = ABCD_a;
+	st->E = E0_a;
+}
+
+/**
+ * Process 64-byte blocks from two buffers at the same time.
+ * @param st_a		[in/out] State for the first buffer.
+ * @param pData_a	[in] Data for the first buffer.
+ * @param st_b		[in/out] State for the second buffer.
+ * @param pData_b	[in] Data for the second buffer.
+ * @param blocks	[in] Number of 64-byte blocks.
+ */
+static void sha1w_shani_compress2(sha1w_shani_state *st_a, const uint8_t *pData_a,
+	sha1w_shani_state *st_b, const uint8_t *pData_b, size_t blocks)
+{
+	const __m128i mask = SHA1W_BSWAP_MASK;
+	__m128i ABCD_a = st_a->ABCD, ABCD_b = st_b->ABCD;
+	__m128i E0_a = st_a->E, E0_b = st_b->E;
+	__m128i E1_a, ABCD_SAVE_a, E0_SAVE_a;
+	__m128i E1_b, ABCD_SAVE_b, E0_SAVE_b;
+	__m128i MSG0_a, MSG1_a, MSG2_a, MSG3_a;
+	__m128i MSG0_b, MSG1_b, MSG2_b, MSG3_b;
+
+	for (; blocks > 0; blocks--, pData_a += SHA1W_BLOCK_SIZE, pData_b += SHA1W_BLOCK_SIZE) {
+		BOTH(SAVE);
+		LOAD(_a, MSG0, pData_a, 0);
+		LOAD(_b, MSG0, pData_b, 0);
+		BOTH(RNDS_0_3);
+		LOAD(_a, MSG1, pData_a, 16);
+		LOAD(_b, MSG1, pData_b, 16);
+		BOTH(RNDS_4_7);
+		LOAD(_a, MSG2, pData_a, 32);
+		LOAD(_b, MSG2, pData_b, 32);
+		BOTH(RNDS_8_11);
+		LOAD(_a, MSG3, pData_a, 48);
+		LOAD(_b, MSG3, pData_b, 48);
+		BOTH_RNDS4(E1, E0, MSG3, MSG0, MSG1, MSG2, 0);	// 12-15
+		BOTH_RNDS4(E0, E1, MSG0, MSG1, MSG2, MSG3, 0);	// 16-19
+		BOTH_RNDS4(E1, E0, MSG1, MSG2, MSG3, MSG0, 1);	// 20-23
+		BOTH_RNDS4(E0, E1, MSG2, MSG3, MSG0, MSG1, 1);	// 24-27
+		BOTH_RNDS4(E1, E0, MSG3, MSG0, MSG1, MSG2, 1);	// 28-31
+		BOTH_RNDS4(E0, E1, MSG0, MSG1, MSG2, MSG3, 1);	// 32-35
+		BOTH_RNDS4(E1, E0, MSG1, MSG2, MSG3, MSG0, 1);	// 36-39
+		BOTH_RNDS4(E0, E1, MSG2, MSG3, MSG0, MSG1, 2);	// 40-43
+		BOTH_RNDS4(E1, E0, MSG3, MSG0, MSG1, MSG2, 2);	// 44-47
+		BOTH_RNDS4(E0, E1, MSG0, MSG1, MSG2, MSG3, 2);	// 48-51
+		BOTH_RNDS4(E1, E0, MSG1, MSG2, MSG3, MSG0, 2);	// 52-55
+		BOTH_RNDS4(E0, E1, MSG2, MSG3, MSG0, MSG1, 2);	// 56-59
+		BOTH_RNDS4(E1, E0, MSG3, MSG0, MSG1, MSG2, 3);	// 60-63
+		BOTH_RNDS4(E0, E1, MSG0, MSG1, MSG2, MSG3, 3);	// 64-67
+		BOTH(RNDS_68_71);
+		BOTH(RNDS_72_75);
+		BOTH(RNDS_76_79);
+	}
+
+	st_a->ABCD = ABCD_a;
+	st_a->E = E0_a;
+	st_b->ABCD = ABCD_b;
+	st_b->E = E0_b;
+}
+
+/**
+ * Hash buffers of the same length using SHA-NI.
+ * Buffers are processed two at a time.
+ * @param ms		[in] Midstate.
+ * @param ppData	[in] Array of `count` buffer pointers.
+ * @param size		[in] Size of each buffer, in bytes.
+ * @param count		[in] Number of buffers.
+ * @param pDigest	[out] Output buffer for `count` digests.
+ */
+void sha1w_shani_hash(const Sha1wMidstate *ms, const uint8_t *const *ppData,
+	size_t size, unsigned int count, uint8_t *pDigest)
+{
+	uint8_t tail_a[SHA1W_BLOCK_SIZE * 2];
+	uint8_t tail_b[SHA1W_BLOCK_SIZE * 2];
+	const size_t full_blocks = size / SHA1W_BLOCK_SIZE;
+	sha1w_shani_state st_a, st_b;
+	unsigned int tail_blocks;
+
+	for (; count >= 2; count -= 2, ppData += 2, pDigest += SHA1W_DIGEST_SIZE * 2) {
+		tail_blocks = sha1w_make_tail(ppData[0], size, ms->size, tail_a);
+		sha1w_make_tail(ppData[1], size, ms->size, tail_b);
+		sha1w_shani_init(&st_a, ms);
+		sha1w_shani_init(&st_b, ms);
+		sha1w_shani_compress2(&st_a, ppData[0], &st_b, ppData[1], full_blocks);
+		sha1w_shani_compress2(&st_a, tail_a, &st_b, tail_b, tail_blocks);
+		sha1w_shani_store(&st_a, pDigest);
+		sha1w_shani_store(&st_b, pDigest + SHA1W_DIGEST_SIZE);
+	}
+
+	if (count > 0) {
+		// Odd buffer.
+		tail_blocks = sha1w_make_tail(ppData[0], size, ms->size, tail_a);
+		sha1w_shani_init(&st_a, ms);
+		sha1w_shani_compress(&st_a, ppData[0], full_blocks);
+		sha1w_shani_compress(&st_a, tail_a, tail_blocks);
+		sha1w_shani_store(&st_a, pDigest);
+	}
+}
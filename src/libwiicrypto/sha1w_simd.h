@@ -0,0 +1,174 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * sha1w_simd.h: Batched SHA-1 functions. (generic multi-lane SIMD)        *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// NOTE: This file is a template for the multi-lane SIMD implementations.
+// Each lane of a vector register holds the state of a separate buffer,
+// so N buffers are hashed at the same time with the scalar algorithm.
+//
+// Define the following before including this file:
+// - SHA1W_SIMD_FN: Name of the hash function.
+// - SHA1W_SIMD_LANES: Number of 32-bit lanes per vector.
+// - vec_t: Vector type.
+// - V_ADD(a,b), V_XOR(a,b), V_AND(a,b), V_OR(a,b): Lane-wise operations.
+// - V_SLLI(a,n), V_SRLI(a,n): Lane-wise shifts by an immediate.
+// - V_SET1(x): Broadcast a 32-bit value.
+// - V_LOAD(p), V_STORE(p,v): Unaligned load/store.
+
+#include "sha1w_p.h"
+
+#include <assert.h>
+
+#define V_ROTL(x, n) V_OR(V_SLLI((x), (n)), V_SRLI((x), 32 - (n)))
+
+/**
+ * Load a big-endian 32-bit word.
+ * @param p Pointer.
+ * @return Word.
+ */
+static inline uint32_t sha1w_simd_load_be32(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+	       ((uint32_t)p[2] << 8)  |  (uint32_t)p[3];
+}
+
+/**
+ * Process one 64-byte block for each lane.
+ * @param state	[in/out] State. (5 vectors)
+ * @param blk	[in] Block pointers, one per lane.
+ */
+static void sha1w_simd_compress(vec_t state[5], const uint8_t *const blk[SHA1W_SIMD_LANES])
+{
+	// Transposed message words: w32[t][lane]
+	uint32_t w32[16][SHA1W_SIMD_LANES];
+	vec_t W[16];
+	vec_t a, b, c, d, e, f, tmp, k;
+	unsigned int t, l;
+
+	for (l = 0; l < SHA1W_SIMD_LANES; l++) {
+		const uint8_t *const p = blk[l];
+		for (t = 0; t < 16; t++) {
+			w32[t][l] = sha1w_simd_load_be32(&p[t * 4]);
+		}
+	}
+	for (t = 0; t < 16; t++) {
+		W[t] = V_LOAD(w32[t]);
+	}
+
+	a = state[0];
+	b = state[1];
+	c = state[2];
+	d = state[3];
+	e = state[4];
+
+// Message schedule for round t >= 16.
+#define SCHEDULE(t) \
+	(W[(t) & 15] = V_ROTL(V_XOR(V_XOR(W[((t) - 3) & 15], W[((t) - 8) & 15]), \
+		V_XOR(W[((t) - 14) & 15], W[(t) & 15])), 1))
+// One round.
+#define ROUND(fn, w) do { \
+		f = (fn); \
+		tmp = V_ADD(V_ADD(V_ROTL(a, 5), f), V_ADD(V_ADD(e, k), (w))); \
+		e = d; d = c; c = V_ROTL(b, 30); b = a; a = tmp; \
+	} while (0)
+#define F_CH	V_XOR(d, V_AND(b, V_XOR(c, d)))
+#define F_PAR	V_XOR(V_XOR(b, c), d)
+#define F_MAJ	V_OR(V_AND(b, c), V_AND(d, V_OR(b, c)))
+
+	k = V_SET1(0x5A827999U);
+	for (t = 0; t < 16; t++) {
+		ROUND(F_CH, W[t]);
+	}
+	for (; t < 20; t++) {
+		ROUND(F_CH, SCHEDULE(t));
+	}
+	k = V_SET1(0x6ED9EBA1U);
+	for (; t < 40; t++) {
+		ROUND(F_PAR, SCHEDULE(t));
+	}
+	k = V_SET1(0x8F1BBCDCU);
+	for (; t < 60; t++) {
+		ROUND(F_MAJ, SCHEDULE(t));
+	}
+	k = V_SET1(0xCA62C1D6U);
+	for (; t < 80; t++) {
+		ROUND(F_PAR, SCHEDULE(t));
+	}
+
+#undef F_MAJ
+#undef F_PAR
+#undef F_CH
+#undef ROUND
+#undef SCHEDULE
+
+	state[0] = V_ADD(state[0], a);
+	state[1] = V_ADD(state[1], b);
+	state[2] = V_ADD(state[2], c);
+	state[3] = V_ADD(state[3], d);
+	state[4] = V_ADD(state[4], e);
+}
+
+/**
+ * Hash up to SHA1W_SIMD_LANES buffers of the same length.
+ * @param ms		[in] Midstate.
+ * @param ppData	[in] Array of `count` buffer pointers.
+ * @param size		[in] Size of each buffer, in bytes.
+ * @param count		[in] Number of buffers. (1 to SHA1W_SIMD_LANES)
+ * @param pDigest	[out] Output buffer for `count` digests.
+ */
+void SHA1W_SIMD_FN(const Sha1wMidstate *ms, const uint8_t *const *ppData,
+	size_t size, unsigned int count, uint8_t *pDigest)
+{
+	uint8_t tail[SHA1W_SIMD_LANES][SHA1W_BLOCK_SIZE * 2];
+	uint32_t out[5][SHA1W_SIMD_LANES];
+	const uint8_t *blk[SHA1W_SIMD_LANES];
+	const size_t full_blocks = size / SHA1W_BLOCK_SIZE;
+	unsigned int tail_blocks = 0;
+	vec_t state[5];
+	size_t i;
+	unsigned int l;
+
+	assert(count >= 1 && count <= SHA1W_SIMD_LANES);
+
+	// Unused lanes hash the last buffer again.
+	// Their results are discarded.
+	for (l = 0; l < SHA1W_SIMD_LANES; l++) {
+		const uint8_t *const p = ppData[l < count ? l : count - 1];
+		blk[l] = p;
+		tail_blocks = sha1w_make_tail(p, size, ms->size, tail[l]);
+	}
+
+	for (i = 0; i < 5; i++) {
+		state[i] = V_SET1(ms->h[i]);
+	}
+
+	for (i = 0; i < full_blocks; i++) {
+		sha1w_simd_compress(state, blk);
+		for (l = 0; l < SHA1W_SIMD_LANES; l++) {
+			blk[l] += SHA1W_BLOCK_SIZE;
+		}
+	}
+	for (i = 0; i < tail_blocks; i++) {
+		for (l = 0; l < SHA1W_SIMD_LANES; l++) {
+			blk[l] = &tail[l][i * SHA1W_BLOCK_SIZE];
+		}
+		sha1w_simd_compress(state, blk);
+	}
+
+	for (i = 0; i < 5; i++) {
+		V_STORE(out[i], state[i]);
+	}
+	for (l = 0; l < count; l++, pDigest += SHA1W_DIGEST_SIZE) {
+		uint32_t h[5];
+		for (i = 0; i < 5; i++) {
+			h[i] = out[i][l];
+		}
+		sha1w_store_digest(h, pDigest);
+	}
+}
+
+#undef V_ROTL
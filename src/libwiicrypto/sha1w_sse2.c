@@ -0,0 +1,30 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto)                                               *
+ * sha1w_sse2.c: Batched SHA-1 functions. (SSE2 implementation)            *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// NOTE: This file must be compiled with SSE2 enabled. (-msse2 on gcc)
+// The caller must check that the CPU supports SSE2.
+
+#include "sha1w_p.h"
+
+// SSE2 intrinsics.
+#include <emmintrin.h>
+
+#define SHA1W_SIMD_FN		sha1w_sse2_hash
+#define SHA1W_SIMD_LANES	SHA1W_SSE2_LANES
+typedef __m128i vec_t;
+#define V_ADD(a, b)	_mm_add_epi32((a), (b))
+#define V_XOR(a, b)	_mm_xor_si128((a), (b))
+#define V_AND(a, b)	_mm_and_si128((a), (b))
+#define V_OR(a, b)	_mm_or_si128((a), (b))
+#define V_SLLI(a, n)	_mm_slli_epi32((a), (n))
+#define V_SRLI(a, n)	_mm_srli_epi32((a), (n))
+#define V_SET1(x)	_mm_set1_epi32((int)(x))
+#define V_LOAD(p)	_mm_loadu_si128((const __m128i*)(p))
+#define V_STORE(p, v)	_mm_storeu_si128((__m128i*)(p), (v))
+
+#include "sha1w_simd.h"
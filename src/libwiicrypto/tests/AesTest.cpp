@@ -0,0 +1,259 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto/tests)                                         *
+ * AesTest.cpp: AES wrapper test and throughput benchmark.                 *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// Google Test
+#include "gtest/gtest.h"
+
+#include "libwiicrypto/aesw.h"
+
+// C includes. (C++ namespace)
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+// C++ includes.
+#include <chrono>
+#include <vector>
+using std::vector;
+
+#if defined(_MSC_VER) && _MSC_VER < 1700
+# define final sealed
+#endif
+
+namespace LibWiiCrypto { namespace Tests {
+
+class AesTest : public ::testing::TestWithParam<AesImpl_e>
+{
+	protected:
+		AesTest()
+			: m_aesw(nullptr) { }
+
+		void SetUp(void) final;
+		void TearDown(void) final;
+
+	public:
+		/**
+		 * Measure the throughput of the current implementation.
+		 * @param decrypt True to decrypt; false to encrypt.
+		 * @return Throughput, in MiB/s.
+		 */
+		double measureThroughput(bool decrypt);
+
+	protected:
+		AesCtx *m_aesw;
+};
+
+// NIST SP 800-38A, F.2.1: CBC-AES128.Encrypt
+static const uint8_t nist_key[16] = {
+	0x2B,0x7E,0x15,0x16,0x28,0xAE,0xD2,0xA6,
+	0xAB,0xF7,0x15,0x88,0x09,0xCF,0x4F,0x3C,
+};
+static const uint8_t nist_iv[16] = {
+	0x00,0x01,0x02,0x03,0x04,0x05,0x06,0x07,
+	0x08,0x09,0x0A,0x0B,0x0C,0x0D,0x0E,0x0F,
+};
+static const uint8_t nist_plaintext[64] = {
+	0x6B,0xC1,0xBE,0xE2,0x2E,0x40,0x9F,0x96,0xE9,0x3D,0x7E,0x11,0x73,0x93,0x17,0x2A,
+	0xAE,0x2D,0x8A,0x57,0x1E,0x03,0xAC,0x9C,0x9E,0xB7,0x6F,0xAC,0x45,0xAF,0x8E,0x51,
+	0x30,0xC8,0x1C,0x46,0xA3,0x5C,0xE4,0x11,0xE5,0xFB,0xC1,0x19,0x1A,0x0A,0x52,0xEF,
+	0xF6,0x9F,0x24,0x45,0xDF,0x4F,0x9B,0x17,0xAD,0x2B,0x41,0x7B,0xE6,0x6C,0x37,0x10,
+};
+static const uint8_t nist_ciphertext[64] = {
+	0x76,0x49,0xAB,0xAC,0x81,0x19,0xB2,0x46,0xCE,0xE9,0x8E,0x9B,0x12,0xE9,0x19,0x7D,
+	0x50,0x86,0xCB,0x9B,0x50,0x72,0x19,0xEE,0x95,0xDB,0x11,0x3A,0x91,0x76,0x78,0xB2,
+	0x73,0xBE,0xD6,0xB8,0xE3,0xC1,0x74,0x3B,0x71,0x16,0xE6,0x9E,0x22,0x22,0x95,0x16,
+	0x3F,0xF1,0xCA,0xA1,0x68,0x1F,0xAC,0x09,0x12,0x0E,0xCA,0x30,0x75,0x86,0xE1,0xA7,
+};
+
+/**
+ * Create the AES context and select the implementation.
+ * The test is skipped if the implementation isn't supported.
+ */
+void AesTest::SetUp(void)
+{
+	m_aesw = aesw_new();
+	ASSERT_TRUE(m_aesw != nullptr);
+
+	const AesImpl_e impl = GetParam();
+	const int ret = aesw_set_impl(m_aesw, impl);
+	if (ret == -ENOTSUP) {
+		printf("%s is not supported on this system. Skipping test.\n",
+			aesw_get_impl_name(impl));
+		aesw_free(m_aesw);
+		m_aesw = nullptr;
+		return;
+	}
+	ASSERT_EQ(0, ret);
+	ASSERT_EQ(impl, aesw_get_impl(m_aesw));
+}
+
+void AesTest::TearDown(void)
+{
+	aesw_free(m_aesw);
+}
+
+/**
+ * Measure the throughput of the current implementation.
+ * Data is processed in 31 KB blocks, the size of
+ * an encrypted Wii sector's user data.
+ * @param decrypt True to decrypt; false to encrypt.
+ * @return Throughput, in MiB/s.
+ */
+double AesTest::measureThroughput(bool decrypt)
+{
+	static const size_t BLOCK_SIZE = 31*1024;
+	static const size_t TOTAL_SIZE = 64*BLOCK_SIZE*16;	// 16 Wii groups
+	vector<uint8_t> buf(TOTAL_SIZE, 0x5A);
+
+	aesw_set_key(m_aesw, nist_key, sizeof(nist_key));
+	const auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < TOTAL_SIZE; i += BLOCK_SIZE) {
+		aesw_set_iv(m_aesw, nist_iv, sizeof(nist_iv));
+		if (decrypt) {
+			aesw_decrypt(m_aesw, &buf[i], BLOCK_SIZE);
+		} else {
+			aesw_encrypt(m_aesw, &buf[i], BLOCK_SIZE);
+		}
+	}
+	const auto end = std::chrono::steady_clock::now();
+
+	const double secs = std::chrono::duration<double>(end - start).count();
+	return (static_cast<double>(TOTAL_SIZE) / (1024.0*1024.0)) / (secs > 0 ? secs : 1e-9);
+}
+
+/**
+ * Encrypt and decrypt the NIST test vectors.
+ */
+TEST_P(AesTest, nistVectors)
+{
+	if (!m_aesw)
+		return;
+
+	uint8_t buf[64];
+	ASSERT_EQ(0, aesw_set_key(m_aesw, nist_key, sizeof(nist_key)));
+
+	// Encrypt all at once.
+	memcpy(buf, nist_plaintext, sizeof(buf));
+	ASSERT_EQ(0, aesw_set_iv(m_aesw, nist_iv, sizeof(nist_iv)));
+	ASSERT_EQ(sizeof(buf), aesw_encrypt(m_aesw, buf, sizeof(buf)));
+	EXPECT_EQ(0, memcmp(nist_ciphertext, buf, sizeof(buf)));
+
+	// Decrypt all at once.
+	ASSERT_EQ(0, aesw_set_iv(m_aesw, nist_iv, sizeof(nist_iv)));
+	ASSERT_EQ(sizeof(buf), aesw_decrypt(m_aesw, buf, sizeof(buf)));
+	EXPECT_EQ(0, memcmp(nist_plaintext, buf, sizeof(buf)));
+
+	// Encrypt one block at a time.
+	// The IV must be chained between calls.
+	memcpy(buf, nist_plaintext, sizeof(buf));
+	ASSERT_EQ(0, aesw_set_iv(m_aesw, nist_iv, sizeof(nist_iv)));
+	for (unsigned int i = 0; i < sizeof(buf); i += 16) {
+		ASSERT_EQ(16U, aesw_encrypt(m_aesw, &buf[i], 16));
+	}
+	EXPECT_EQ(0, memcmp(nist_ciphertext, buf, sizeof(buf)));
+
+	// Decrypt one block at a time.
+	ASSERT_EQ(0, aesw_set_iv(m_aesw, nist_iv, sizeof(nist_iv)));
+	for (unsigned int i = 0; i < sizeof(buf); i += 16) {
+		ASSERT_EQ(16U, aesw_decrypt(m_aesw, &buf[i], 16));
+	}
+	EXPECT_EQ(0, memcmp(nist_plaintext, buf, sizeof(buf)));
+}
+
+/**
+ * Compare the implementation against Nettle using
+ * a Wii sector-sized buffer and a chained partial call.
+ */
+TEST_P(AesTest, compareNettle)
+{
+	if (!m_aesw)
+		return;
+
+	static const size_t SIZE = 31*1024 + 5*16;
+	vector<uint8_t> data(SIZE), expected(SIZE);
+	for (size_t i = 0; i < SIZE; i++) {
+		data[i] = static_cast<uint8_t>((i * 7) ^ (i >> 8));
+	}
+
+	AesCtx *const ref = aesw_new();
+	ASSERT_TRUE(ref != nullptr);
+	ASSERT_EQ(0, aesw_set_impl(ref, AESW_IMPL_NETTLE));
+	aesw_set_key(ref, nist_key, sizeof(nist_key));
+	aesw_set_key(m_aesw, nist_key, sizeof(nist_key));
+
+	// Encrypt.
+	expected = data;
+	aesw_set_iv(ref, nist_iv, sizeof(nist_iv));
+	aesw_encrypt(ref, expected.data(), SIZE);
+	vector<uint8_t> buf(data);
+	aesw_set_iv(m_aesw, nist_iv, sizeof(nist_iv));
+	aesw_encrypt(m_aesw, buf.data(), 1024);
+	aesw_encrypt(m_aesw, &buf[1024], SIZE - 1024);
+	EXPECT_EQ(expected, buf);
+
+	// Decrypt. (Odd split to test the multi-block tail handling.)
+	aesw_set_iv(m_aesw, nist_iv, sizeof(nist_iv));
+	aesw_decrypt(m_aesw, buf.data(), 3*16);
+	aesw_decrypt(m_aesw, &buf[3*16], SIZE - 3*16);
+	EXPECT_EQ(data, buf);
+
+	aesw_free(ref);
+}
+
+/**
+ * Measure the encryption and decryption throughput.
+ */
+TEST_P(AesTest, throughput)
+{
+	if (!m_aesw)
+		return;
+
+	const double enc = measureThroughput(false);
+	const double dec = measureThroughput(true);
+	printf("%s: encrypt %.1f MiB/s, decrypt %.1f MiB/s\n",
+		aesw_get_impl_name(GetParam()), enc, dec);
+	EXPECT_GT(enc, 0.0);
+	EXPECT_GT(dec, 0.0);
+}
+
+/**
+ * Unsupported implementations must be rejected.
+ */
+TEST(AesImplTest, invalidImpl)
+{
+	AesCtx *const aesw = aesw_new();
+	ASSERT_TRUE(aesw != nullptr);
+	EXPECT_EQ(-EINVAL, aesw_set_impl(aesw, AESW_IMPL_MAX));
+	EXPECT_EQ(nullptr, aesw_get_impl_name(AESW_IMPL_MAX));
+	EXPECT_EQ(0, aesw_set_impl(aesw, AESW_IMPL_NETTLE));
+	aesw_free(aesw);
+}
+
+INSTANTIATE_TEST_CASE_P(AesImpl, AesTest,
+	::testing::Values(AESW_IMPL_NETTLE, AESW_IMPL_AESNI, AESW_IMPL_VAES));
+
+} }
+
+#ifdef _MSC_VER
+# define RVTH_CDECL __cdecl
+#else
+# define RVTH_CDECL
+#endif
+
+/**
+ * Test suite main function.
+ */
+int RVTH_CDECL main(int argc, char *argv[])
+{
+	fprintf(stderr, "libwiicrypto test suite: AES tests.\n\n");
+	fflush(nullptr);
+
+	// coverity[fun_call_w_exception]: uncaught exceptions cause nonzero exit anyway, so don't warn.
+	::testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
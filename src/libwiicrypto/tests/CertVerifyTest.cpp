@@ -23,13 +23,22 @@
 
 #include "libwiicrypto/cert_store.h"
 #include "libwiicrypto/cert.h"
+#include "libwiicrypto/wii_structs.h"
+
+// Nettle
+#include <nettle/sha1.h>
 
 // C includes. (C++ namespace)
 #include <cassert>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
 
 // C++ includes.
 #include <string>
+#include <vector>
 using std::string;
+using std::vector;
 
 #if defined(_MSC_VER) && _MSC_VER < 1700
 # define final sealed
@@ -127,6 +136,77 @@ INSTANTIATE_TEST_CASE_P(certVerifyTest, CertVerifyTest,
 		RVL_CERT_ISSUER_RETAIL_TICKET,
 		RVL_CERT_ISSUER_RETAIL_TMD
 	), CertVerifyTest::test_case_suffix_generator);
+
+/** Fakesigning tests. **/
+
+/**
+ * Find the fakesign value using a simple sequential search.
+ * @param data Signed area.
+ * @param fake_offset Offset of the 32-bit field in the signed area.
+ * @return Lowest value that results in a SHA-1 hash starting with 0x00.
+ */
+static uint32_t fakesign_reference(vector<uint8_t> data, size_t fake_offset)
+{
+	struct sha1_ctx sha1;
+	uint8_t digest[SHA1_DIGEST_SIZE];
+	uint32_t fake = 0;
+
+	sha1_init(&sha1);
+	do {
+		memcpy(&data[fake_offset], &fake, sizeof(fake));
+		sha1_update(&sha1, data.size(), data.data());
+		sha1_digest(&sha1, sizeof(digest), digest);
+	} while (digest[0] != 0 && ++fake != 0);
+	return fake;
+}
+
+/**
+ * Fakesign a ticket. The result must match the sequential search.
+ */
+TEST(CertFakesignTest, ticket)
+{
+	vector<uint8_t> ticket(sizeof(RVL_Ticket));
+	for (size_t i = 0; i < ticket.size(); i++) {
+		ticket[i] = static_cast<uint8_t>(i * 7);
+	}
+	ASSERT_EQ(0, cert_fakesign_ticket(ticket.data(), ticket.size()));
+
+	static const size_t signing_offset = offsetof(RVL_Ticket, issuer);
+	static const size_t fake_offset = offsetof(RVL_Ticket, content_access_perm[0x3A]);
+	const vector<uint8_t> signed_area(ticket.begin() + signing_offset, ticket.end());
+	uint32_t fake;
+	memcpy(&fake, &ticket[fake_offset], sizeof(fake));
+	EXPECT_EQ(fakesign_reference(signed_area, fake_offset - signing_offset), fake);
+}
+
+/**
+ * Fakesign a TMD with many contents. The result must match the sequential search.
+ */
+TEST(CertFakesignTest, largeTmd)
+{
+	vector<uint8_t> tmd(sizeof(RVL_TMD_Header) + (512 * sizeof(RVL_Content_Entry)));
+	for (size_t i = 0; i < tmd.size(); i++) {
+		tmd[i] = static_cast<uint8_t>((i * 13) ^ (i >> 8));
+	}
+	ASSERT_EQ(0, cert_fakesign_tmd(tmd.data(), tmd.size()));
+
+	static const size_t signing_offset = offsetof(RVL_TMD_Header, issuer);
+	static const size_t fake_offset = offsetof(RVL_TMD_Header, reserved[2]);
+	const vector<uint8_t> signed_area(tmd.begin() + signing_offset, tmd.end());
+	uint32_t fake;
+	memcpy(&fake, &tmd[fake_offset], sizeof(fake));
+	EXPECT_EQ(fakesign_reference(signed_area, fake_offset - signing_offset), fake);
+}
+
+/**
+ * Buffers that are too small must be rejected.
+ */
+TEST(CertFakesignTest, tooSmall)
+{
+	vector<uint8_t> buf(sizeof(RVL_TMD_Header) - 1);
+	EXPECT_EQ(-EINVAL, cert_fakesign_ticket(buf.data(), buf.size()));
+	EXPECT_EQ(-EINVAL, cert_fakesign_tmd(buf.data(), buf.size()));
+}
 } }
 
 #ifdef _MSC_VER
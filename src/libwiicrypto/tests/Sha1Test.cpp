@@ -0,0 +1,300 @@
+/***************************************************************************
+ * RVT-H Tool (libwiicrypto/tests)                                         *
+ * Sha1Test.cpp: Batched SHA-1 test and throughput benchmark.              *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+// Google Test
+#include "gtest/gtest.h"
+
+#include "libwiicrypto/sha1w.h"
+
+// C includes. (C++ namespace)
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+// C++ includes.
+#include <chrono>
+#include <vector>
+using std::vector;
+
+#if defined(_MSC_VER) && _MSC_VER < 1700
+# define final sealed
+#endif
+
+namespace LibWiiCrypto { namespace Tests {
+
+class Sha1Test : public ::testing::TestWithParam<Sha1Impl_e>
+{
+	protected:
+		void SetUp(void) final;
+
+	public:
+		/**
+		 * Hash `count` buffers of `size` bytes with the current
+		 * implementation and compare the result to Nettle.
+		 * @param size Buffer size.
+		 * @param count Number of buffers.
+		 */
+		void compareNettle(size_t size, unsigned int count);
+
+	protected:
+		bool m_supported;
+};
+
+/**
+ * Check if the implementation is supported.
+ * The test is skipped if it isn't.
+ */
+void Sha1Test::SetUp(void)
+{
+	const Sha1Impl_e impl = GetParam();
+	m_supported = !!sha1w_is_impl_supported(impl);
+	if (!m_supported) {
+		printf("%s is not supported on this system. Skipping test.\n",
+			sha1w_get_impl_name(impl));
+	}
+}
+
+/**
+ * Hash `count` buffers of `size` bytes with the current
+ * implementation and compare the result to Nettle.
+ * @param size Buffer size.
+ * @param count Number of buffers.
+ */
+void Sha1Test::compareNettle(size_t size, unsigned int count)
+{
+	// Use distinct contents for each buffer so a lane mixup is detected.
+	vector<uint8_t> data(size * count + 1);
+	for (size_t i = 0; i < data.size(); i++) {
+		data[i] = static_cast<uint8_t>((i * 13) ^ (i >> 7));
+	}
+	vector<const uint8_t*> ptrs(count);
+	for (unsigned int i = 0; i < count; i++) {
+		ptrs[i] = &data[i * size];
+	}
+
+	vector<uint8_t> expected(count * SHA1W_DIGEST_SIZE);
+	vector<uint8_t> actual(count * SHA1W_DIGEST_SIZE, 0xFF);
+	ASSERT_EQ(0, sha1w_hash_multi_impl(SHA1W_IMPL_NETTLE, ptrs.data(), size, count, expected.data()));
+	ASSERT_EQ(0, sha1w_hash_multi_impl(GetParam(), ptrs.data(), size, count, actual.data()));
+	EXPECT_EQ(expected, actual) << "size == " << size << ", count == " << count;
+}
+
+/**
+ * Hash the FIPS 180-1 test vectors.
+ */
+TEST_P(Sha1Test, fipsVectors)
+{
+	if (!m_supported)
+		return;
+
+	static const uint8_t abc_digest[SHA1W_DIGEST_SIZE] = {
+		0xA9,0x99,0x3E,0x36,0x47,0x06,0x81,0x6A,0xBA,0x3E,
+		0x25,0x71,0x78,0x50,0xC2,0x6C,0x9C,0xD0,0xD8,0x9D,
+	};
+	static const uint8_t empty_digest[SHA1W_DIGEST_SIZE] = {
+		0xDA,0x39,0xA3,0xEE,0x5E,0x6B,0x4B,0x0D,0x32,0x55,
+		0xBF,0xEF,0x95,0x60,0x18,0x90,0xAF,0xD8,0x07,0x09,
+	};
+
+	const uint8_t *const abc = reinterpret_cast<const uint8_t*>("abc");
+	uint8_t digest[SHA1W_DIGEST_SIZE];
+	ASSERT_EQ(0, sha1w_hash_multi_impl(GetParam(), &abc, 3, 1, digest));
+	EXPECT_EQ(0, memcmp(abc_digest, digest, sizeof(digest)));
+	ASSERT_EQ(0, sha1w_hash_multi_impl(GetParam(), &abc, 0, 1, digest));
+	EXPECT_EQ(0, memcmp(empty_digest, digest, sizeof(digest)));
+}
+
+/**
+ * Compare the implementation against Nettle using sizes around
+ * the padding boundaries and the Wii hash table sizes.
+ */
+TEST_P(Sha1Test, compareNettle)
+{
+	if (!m_supported)
+		return;
+
+	static const size_t sizes[] = {0, 1, 55, 56, 63, 64, 65, 119, 120, 160, 620, 1024};
+	static const unsigned int counts[] = {1, 3, 4, 5, 8, 9, 31};
+	for (size_t size : sizes) {
+		for (unsigned int count : counts) {
+			compareNettle(size, count);
+		}
+	}
+}
+
+/**
+ * Hash buffers that follow a common prefix using a midstate,
+ * and compare the result to Nettle hashing the whole data.
+ */
+TEST_P(Sha1Test, midstate)
+{
+	if (!m_supported)
+		return;
+
+	static const size_t prefix_sizes[] = {0, 63, 64, 130, 320};
+	static const size_t sizes[] = {0, 1, 55, 56, 64, 100, 356};
+	static const unsigned int COUNT = 9;
+
+	for (size_t prefix_size : prefix_sizes) {
+		for (size_t size : sizes) {
+			// Each buffer is a copy of the prefix followed by distinct data.
+			const size_t total = prefix_size + size;
+			vector<uint8_t> data(total * COUNT + 1);
+			for (unsigned int i = 0; i < COUNT; i++) {
+				for (size_t j = 0; j < total; j++) {
+					data[(i * total) + j] = static_cast<uint8_t>(j < prefix_size
+						? (j * 7) : ((j * 13) ^ i));
+				}
+			}
+
+			Sha1wMidstate ms;
+			const size_t used = sha1w_midstate_init(&ms, data.data(), prefix_size);
+			EXPECT_EQ(prefix_size & ~static_cast<size_t>(SHA1W_BLOCK_SIZE - 1), used);
+
+			vector<const uint8_t*> ptrs(COUNT), ptrs_full(COUNT);
+			for (unsigned int i = 0; i < COUNT; i++) {
+				ptrs_full[i] = &data[i * total];
+				ptrs[i] = ptrs_full[i] + used;
+			}
+
+			vector<uint8_t> expected(COUNT * SHA1W_DIGEST_SIZE);
+			vector<uint8_t> actual(COUNT * SHA1W_DIGEST_SIZE, 0xFF);
+			ASSERT_EQ(0, sha1w_hash_multi_impl(SHA1W_IMPL_NETTLE,
+				ptrs_full.data(), total, COUNT, expected.data()));
+			ASSERT_EQ(0, sha1w_hash_multi_midstate_impl(GetParam(), &ms,
+				ptrs.data(), total - used, COUNT, actual.data()));
+			EXPECT_EQ(expected, actual) << "prefix_size == " << prefix_size << ", size == " << size;
+		}
+	}
+}
+
+/**
+ * Measure the throughput using H0 hash sized buffers.
+ */
+TEST_P(Sha1Test, throughput)
+{
+	if (!m_supported)
+		return;
+
+	// One Wii group: 64 sectors, 31 H0 hashes per sector.
+	// The group is hashed 16 times, since it's usually in cache.
+	static const unsigned int COUNT = 64*31;
+	static const unsigned int LOOPS = 16;
+	static const size_t SIZE = 1024;
+	vector<uint8_t> data(COUNT * SIZE, 0x5A);
+	vector<const uint8_t*> ptrs(COUNT);
+	for (unsigned int i = 0; i < COUNT; i++) {
+		ptrs[i] = &data[i * SIZE];
+	}
+	vector<uint8_t> digests(COUNT * SHA1W_DIGEST_SIZE);
+
+	const auto start = std::chrono::steady_clock::now();
+	for (unsigned int i = 0; i < LOOPS; i++) {
+		ASSERT_EQ(0, sha1w_hash_multi_impl(GetParam(), ptrs.data(), SIZE, COUNT, digests.data()));
+	}
+	const auto end = std::chrono::steady_clock::now();
+
+	double secs = std::chrono::duration<double>(end - start).count();
+	if (secs <= 0)
+		secs = 1e-9;
+	printf("%s: %.1f MiB/s\n", sha1w_get_impl_name(GetParam()),
+		(static_cast<double>(data.size() * LOOPS) / (1024.0*1024.0)) / secs);
+}
+
+/**
+ * Invalid implementations must be rejected.
+ */
+TEST(Sha1ImplTest, invalidImpl)
+{
+	uint8_t digest[SHA1W_DIGEST_SIZE] = {0};
+	const uint8_t *const p = digest;
+	Sha1wMidstate ms;
+	sha1w_midstate_init(&ms, digest, 0);
+	EXPECT_EQ(-ENOTSUP, sha1w_hash_multi_impl(SHA1W_IMPL_MAX, &p, 0, 1, digest));
+	EXPECT_EQ(-ENOTSUP, sha1w_hash_multi_midstate_impl(SHA1W_IMPL_MAX, &ms, &p, 0, 1, digest));
+	EXPECT_EQ(nullptr, sha1w_get_impl_name(SHA1W_IMPL_MAX));
+	EXPECT_TRUE(sha1w_is_impl_supported(SHA1W_IMPL_NETTLE) != 0);
+	EXPECT_TRUE(sha1w_is_impl_supported(sha1w_get_impl()) != 0);
+	EXPECT_EQ(-EINVAL, sha1w_set_impl(SHA1W_IMPL_MAX));
+}
+
+/**
+ * SSE2 is never selected by default, but it can be selected
+ * using sha1w_set_impl().
+ */
+TEST(Sha1ImplTest, setImpl)
+{
+	const Sha1Impl_e orig = sha1w_get_impl();
+	EXPECT_NE(SHA1W_IMPL_SSE2, orig);
+
+	static const uint8_t data[4] = {'a', 'b', 'c', 0};
+	const uint8_t *const p = data;
+	uint8_t expected[SHA1W_DIGEST_SIZE], actual[SHA1W_DIGEST_SIZE];
+	ASSERT_EQ(0, sha1w_hash_multi_impl(SHA1W_IMPL_NETTLE, &p, 3, 1, expected));
+
+	for (unsigned int i = 0; i < SHA1W_IMPL_MAX; i++) {
+		const Sha1Impl_e impl = static_cast<Sha1Impl_e>(i);
+		if (!sha1w_is_impl_supported(impl)) {
+			EXPECT_EQ(-ENOTSUP, sha1w_set_impl(impl));
+			continue;
+		}
+		ASSERT_EQ(0, sha1w_set_impl(impl));
+		EXPECT_EQ(impl, sha1w_get_impl());
+		memset(actual, 0, sizeof(actual));
+		sha1w_hash_multi(&p, 3, 1, actual);
+		EXPECT_EQ(0, memcmp(expected, actual, sizeof(actual))) << sha1w_get_impl_name(impl);
+	}
+	EXPECT_EQ(0, sha1w_set_impl(orig));
+}
+
+/**
+ * Strided hashing must match the pointer array version.
+ */
+TEST(Sha1ImplTest, strided)
+{
+	static const size_t STRIDE = 1024;
+	static const unsigned int COUNT = 100;
+	vector<uint8_t> data(STRIDE * COUNT);
+	for (size_t i = 0; i < data.size(); i++) {
+		data[i] = static_cast<uint8_t>(i * 31);
+	}
+	vector<const uint8_t*> ptrs(COUNT);
+	for (unsigned int i = 0; i < COUNT; i++) {
+		ptrs[i] = &data[i * STRIDE];
+	}
+
+	vector<uint8_t> expected(COUNT * SHA1W_DIGEST_SIZE);
+	vector<uint8_t> actual(COUNT * SHA1W_DIGEST_SIZE);
+	sha1w_hash_multi(ptrs.data(), 620, COUNT, expected.data());
+	sha1w_hash_strided(data.data(), 620, STRIDE, COUNT, actual.data());
+	EXPECT_EQ(expected, actual);
+}
+
+INSTANTIATE_TEST_CASE_P(Sha1Impl, Sha1Test,
+	::testing::Values(SHA1W_IMPL_NETTLE, SHA1W_IMPL_SSE2, SHA1W_IMPL_AVX2, SHA1W_IMPL_SHANI));
+
+} }
+
+#ifdef _MSC_VER
+# define RVTH_CDECL __cdecl
+#else
+# define RVTH_CDECL
+#endif
+
+/**
+ * Test suite main function.
+ */
+int RVTH_CDECL main(int argc, char *argv[])
+{
+	fprintf(stderr, "libwiicrypto test suite: SHA-1 tests.\n\n");
+	fflush(nullptr);
+
+	// coverity[fun_call_w_exception]: uncaught exceptions cause nonzero exit anyway, so don't warn.
+	::testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -591,6 +591,10 @@ void RvtHModel::setRvtH(RvtH *rvth)
 	}
 
 	if (rvth) {
+		// All bank entries are displayed, so load them all at once.
+		// This also updates the bank cache.
+		rvth->prefetchBankEntries();
+
 		// Notify the view that we're about to add rows.
 		const int bankCount = rvth->bankCount();
 		if (bankCount > 0) {
@@ -118,6 +118,12 @@ bool WorkerObjectPrivate::progress_callback(const RvtH_Progress_State *state, vo
 					.arg(state->lba_total / MEGABYTE);
 			}
 			break;
+		case RVTH_PROGRESS_DIGEST:
+			text = WorkerObject::tr("Hashing %1: %L2 MiB / %L3 MiB read...")
+				.arg(d->gcmFilenameOnly)
+				.arg(state->lba_processed / MEGABYTE)
+				.arg(state->lba_total / MEGABYTE);
+			break;
 		default:
 			// FIXME
 			assert(false);
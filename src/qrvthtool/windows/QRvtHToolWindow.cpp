@@ -473,6 +473,7 @@ void QRvtHToolWindowPrivate::initToolbar(void)
 	cboRecryptionKey->addItem(QString(), RVL_CryptoType_Retail);	// Retail (fakesigned)
 	cboRecryptionKey->addItem(QString(), RVL_CryptoType_Korean);	// Korean (fakesigned)
 	cboRecryptionKey->addItem(QString(), RVL_CryptoType_Debug);	// Debug (fakesigned)
+	cboRecryptionKey->addItem(QString(), RVL_CryptoType_None);	// Unencrypted
 	cboRecryptionKey->setCurrentIndex(0);
 	ui.toolBar->insertWidget(ui.actionAbout, cboRecryptionKey);
 
@@ -499,6 +500,7 @@ void QRvtHToolWindowPrivate::retranslateToolbar(void)
 	cboRecryptionKey->setItemText(1, QRvtHToolWindow::tr("Retail (fakesigned)"));
 	cboRecryptionKey->setItemText(2, QRvtHToolWindow::tr("Korean (fakesigned)"));
 	cboRecryptionKey->setItemText(3, QRvtHToolWindow::tr("Debug (realsigned)"));
+	cboRecryptionKey->setItemText(4, QRvtHToolWindow::tr("Unencrypted"));
 	cboRecryptionKey->setCurrentIndex(0);
 }
 
@@ -0,0 +1,416 @@
+/***************************************************************************
+ * RVT-H Tool                                                              *
+ * main.cpp: Read-only FUSE file system for RVT-H banks.                   *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#define FUSE_USE_VERSION 31
+#include <fuse.h>
+
+#include "config.version.h"
+
+#include "librvth/rvth.hpp"
+#include "librvth/rvth_error.h"
+#include "librvth/FST.hpp"
+#include "librvth/reader/WiiPartitionReader.hpp"
+
+// C includes.
+#include <fcntl.h>
+#include <sys/stat.h>
+
+// C includes. (C++ namespace)
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+// C++ includes.
+#include <string>
+#include <vector>
+using std::string;
+using std::vector;
+
+/**
+ * Mounted bank.
+ *
+ * Each bank is shown as a raw disc image, "/bankN.gcm", and if
+ * the file system could be loaded, as a directory, "/bankN/".
+ */
+struct MountedBank {
+	string name;		// "bankN"
+	WiiPartitionReader *raw;	// Unencrypted reader for the raw disc image.
+	int64_t size;		// Size of the raw disc image, in bytes.
+	FST *fst;		// File system. (NULL if it couldn't be loaded)
+	time_t timestamp;	// Bank timestamp.
+};
+
+static RvtH *rvth = nullptr;
+static vector<MountedBank> banks;
+
+// File handle: high 32 bits == bank; low 32 bits == FST index + 1.
+// A low part of 0 indicates the raw disc image.
+#define MAKE_FH(bank, idx1)	(((uint64_t)(bank) << 32) | (uint32_t)(idx1))
+#define FH_BANK(fh)		((unsigned int)((fh) >> 32))
+#define FH_IDX1(fh)		((uint32_t)(fh))
+
+/**
+ * Look up a path.
+ * @param path	[in] Path, starting with '/'.
+ * @param pBank	[out] Bank index in banks[]. (-1 for the root directory)
+ * @param pIdx1	[out] FST index + 1, or 0 for the raw disc image.
+ * @return 0 on success; negative POSIX error code on error.
+ */
+static int lookup(const char *path, int *pBank, uint32_t *pIdx1)
+{
+	if (path[0] == '/') {
+		path++;
+	}
+	if (path[0] == '\0') {
+		// Root directory.
+		*pBank = -1;
+		*pIdx1 = 0;
+		return 0;
+	}
+
+	const char *slash = strchr(path, '/');
+	const size_t len = (slash ? (size_t)(slash - path) : strlen(path));
+	for (size_t i = 0; i < banks.size(); i++) {
+		const MountedBank &mb = banks[i];
+		const size_t name_len = mb.name.size();
+		if (len < name_len || strncmp(path, mb.name.data(), name_len) != 0) {
+			continue;
+		}
+
+		if (len == name_len + 4 && !slash && !strcmp(&path[name_len], ".gcm")) {
+			// Raw disc image.
+			*pBank = (int)i;
+			*pIdx1 = 0;
+			return 0;
+		} else if (len != name_len) {
+			continue;
+		}
+
+		// File system.
+		if (!mb.fst) {
+			return -ENOENT;
+		}
+		int idx = 0;
+		if (slash && slash[1] != '\0') {
+			idx = mb.fst->find(slash);
+			if (idx < 0) {
+				return idx;
+			}
+		}
+		*pBank = (int)i;
+		*pIdx1 = (uint32_t)idx + 1;
+		return 0;
+	}
+
+	return -ENOENT;
+}
+
+static void *rvthfuse_init(struct fuse_conn_info *conn, struct fuse_config *cfg)
+{
+	UNUSED(conn);
+
+	// The disc images can't change while mounted,
+	// so the kernel can keep the file contents cached.
+	cfg->kernel_cache = 1;
+	return nullptr;
+}
+
+static int rvthfuse_getattr(const char *path, struct stat *stbuf, struct fuse_file_info *fi)
+{
+	UNUSED(fi);
+
+	int bank;
+	uint32_t idx1;
+	int ret = lookup(path, &bank, &idx1);
+	if (ret != 0) {
+		return ret;
+	}
+
+	memset(stbuf, 0, sizeof(*stbuf));
+	if (bank < 0) {
+		// Root directory.
+		stbuf->st_mode = S_IFDIR | 0555;
+		stbuf->st_nlink = 2;
+		return 0;
+	}
+
+	const MountedBank &mb = banks[bank];
+	stbuf->st_mtime = mb.timestamp;
+	stbuf->st_atime = mb.timestamp;
+	stbuf->st_ctime = mb.timestamp;
+	if (idx1 == 0) {
+		// Raw disc image.
+		stbuf->st_mode = S_IFREG | 0444;
+		stbuf->st_nlink = 1;
+		stbuf->st_size = mb.size;
+	} else if (mb.fst->isDir(idx1 - 1)) {
+		stbuf->st_mode = S_IFDIR | 0555;
+		stbuf->st_nlink = 2;
+	} else {
+		stbuf->st_mode = S_IFREG | 0444;
+		stbuf->st_nlink = 1;
+		stbuf->st_size = mb.fst->fileSize(idx1 - 1);
+	}
+	return 0;
+}
+
+static int rvthfuse_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
+	off_t offset, struct fuse_file_info *fi, enum fuse_readdir_flags flags)
+{
+	UNUSED(offset);
+	UNUSED(fi);
+	UNUSED(flags);
+
+	int bank;
+	uint32_t idx1;
+	int ret = lookup(path, &bank, &idx1);
+	if (ret != 0) {
+		return ret;
+	}
+
+	if (bank < 0) {
+		// Root directory.
+		filler(buf, ".", nullptr, 0, (enum fuse_fill_dir_flags)0);
+		filler(buf, "..", nullptr, 0, (enum fuse_fill_dir_flags)0);
+		for (const MountedBank &mb : banks) {
+			filler(buf, (mb.name + ".gcm").c_str(), nullptr, 0, (enum fuse_fill_dir_flags)0);
+			if (mb.fst) {
+				filler(buf, mb.name.c_str(), nullptr, 0, (enum fuse_fill_dir_flags)0);
+			}
+		}
+		return 0;
+	}
+
+	const FST *const fst = banks[bank].fst;
+	if (idx1 == 0 || !fst->isDir(idx1 - 1)) {
+		return -ENOTDIR;
+	}
+
+	filler(buf, ".", nullptr, 0, (enum fuse_fill_dir_flags)0);
+	filler(buf, "..", nullptr, 0, (enum fuse_fill_dir_flags)0);
+	const unsigned int dir_idx = idx1 - 1;
+	for (unsigned int i = dir_idx + 1; i < fst->nextIndex(dir_idx); i = fst->nextIndex(i)) {
+		filler(buf, fst->name(i), nullptr, 0, (enum fuse_fill_dir_flags)0);
+	}
+	return 0;
+}
+
+static int rvthfuse_open(const char *path, struct fuse_file_info *fi)
+{
+	int bank;
+	uint32_t idx1;
+	int ret = lookup(path, &bank, &idx1);
+	if (ret != 0) {
+		return ret;
+	} else if (bank < 0 || (idx1 != 0 && banks[bank].fst->isDir(idx1 - 1))) {
+		return -EISDIR;
+	} else if ((fi->flags & O_ACCMODE) != O_RDONLY) {
+		// Read-only file system.
+		return -EROFS;
+	}
+
+	fi->fh = MAKE_FH(bank, idx1);
+	fi->keep_cache = 1;
+	return 0;
+}
+
+static int rvthfuse_read(const char *path, char *buf, size_t size, off_t offset,
+	struct fuse_file_info *fi)
+{
+	UNUSED(path);
+
+	const unsigned int bank = FH_BANK(fi->fh);
+	const uint32_t idx1 = FH_IDX1(fi->fh);
+	if (bank >= banks.size() || offset < 0) {
+		return -EINVAL;
+	}
+
+	MountedBank &mb = banks[bank];
+	size_t ret;
+	errno = 0;
+	if (idx1 == 0) {
+		// Raw disc image.
+		if (offset >= mb.size) {
+			return 0;
+		}
+		if ((int64_t)size > mb.size - offset) {
+			size = (size_t)(mb.size - offset);
+		}
+		ret = mb.raw->pread(buf, size, offset);
+	} else {
+		ret = mb.fst->readFile(idx1 - 1, buf, size, offset);
+	}
+
+	if (ret == 0 && size != 0 && errno != 0) {
+		return -errno;
+	}
+	return (int)ret;
+}
+
+/**
+ * Open the banks of an RVT-H Reader or disc image.
+ * @param filename	[in] RVT-H device or disk image filename.
+ * @return 0 on success; non-zero on error.
+ */
+static int open_banks(const char *filename)
+{
+	int ret;
+	rvth = new RvtH(filename, &ret);
+	if (ret != 0 || !rvth->isOpen()) {
+		fprintf(stderr, "*** ERROR opening RVT-H device '%s': %s\n", filename, rvth_error(ret));
+		delete rvth;
+		rvth = nullptr;
+		return (ret != 0 ? ret : -EIO);
+	}
+
+	const unsigned int bankCount = rvth->bankCount();
+	banks.reserve(bankCount);
+	for (unsigned int bank = 0; bank < bankCount; bank++) {
+		const RvtH_BankEntry *const entry = rvth->bankEntry(bank);
+		if (!entry) {
+			continue;
+		}
+		switch (entry->type) {
+			case RVTH_BankType_GCN:
+			case RVTH_BankType_Wii_SL:
+			case RVTH_BankType_Wii_DL:
+				break;
+			default:
+				// Empty, unknown, or the second bank of a dual-layer image.
+				continue;
+		}
+
+		const uint32_t lba_len = entry->reader->lba_len();
+		MountedBank mb;
+		char name[16];
+		snprintf(name, sizeof(name), "bank%u", bank+1);
+		mb.name = name;
+		mb.raw = new WiiPartitionReader(entry->reader, 0, lba_len, nullptr);
+		mb.raw->setPrefetch(false);
+		mb.size = LBA_TO_BYTES((int64_t)lba_len);
+		mb.timestamp = (entry->timestamp != -1 ? entry->timestamp : time(nullptr));
+
+		int err;
+		mb.fst = rvth->openFST(bank, &err);
+		if (mb.fst) {
+			// Files within the partition are usually read sequentially.
+			mb.fst->reader()->setPrefetch(true);
+		} else {
+			fprintf(stderr, "*** WARNING: Unable to load the file system of Bank %u: %s\n",
+				bank+1, rvth_error(err));
+		}
+		banks.push_back(mb);
+	}
+
+	if (banks.empty()) {
+		fprintf(stderr, "*** ERROR: '%s' doesn't have any banks that can be mounted.\n", filename);
+		delete rvth;
+		rvth = nullptr;
+		return RVTH_ERROR_BANK_EMPTY;
+	}
+	return 0;
+}
+
+/**
+ * Close all banks.
+ * The FSTs and readers must be deleted before the RvtH object.
+ */
+static void close_banks(void)
+{
+	for (MountedBank &mb : banks) {
+		delete mb.fst;
+		delete mb.raw;
+	}
+	banks.clear();
+	delete rvth;
+	rvth = nullptr;
+}
+
+// Command line options.
+struct rvthfuse_options {
+	const char *filename;
+	int show_help;
+};
+static struct rvthfuse_options options;
+
+#define OPTION(t, p) { t, offsetof(struct rvthfuse_options, p), 1 }
+static const struct fuse_opt option_spec[] = {
+	OPTION("-h", show_help),
+	OPTION("--help", show_help),
+	FUSE_OPT_END
+};
+
+static int opt_proc(void *data, const char *arg, int key, struct fuse_args *outargs)
+{
+	UNUSED(data);
+	UNUSED(outargs);
+
+	if (key == FUSE_OPT_KEY_NONOPT && !options.filename) {
+		// The first non-option argument is the RVT-H device or disk image.
+		options.filename = arg;
+		return 0;
+	}
+	return 1;
+}
+
+static void print_help(const char *argv0)
+{
+	puts("RVT-H Tool FUSE v" VERSION_STRING "\n"
+		"Copyright (c) 2018-2020 by David Korth.\n"
+		"This program is NOT licensed or endorsed by Nintendo Co, Ltd.\n");
+	printf("Usage: %s [options] rvth_device_or_image mountpoint\n\n"
+		"Mounts the banks of an RVT-H Reader or disc image as a read-only file system.\n"
+		"Each bank is available as a disc image (bankN.gcm) and, if its file\n"
+		"system can be read, as a directory (bankN/). Encrypted Wii partitions\n"
+		"are decrypted on the fly.\n\n", argv0);
+}
+
+int main(int argc, char *argv[])
+{
+	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+	if (fuse_opt_parse(&args, &options, option_spec, opt_proc) != 0) {
+		return EXIT_FAILURE;
+	}
+
+	if (options.show_help) {
+		// Let fuse_main() print its own options, too.
+		print_help(argv[0]);
+		fuse_opt_add_arg(&args, "--help");
+		args.argv[0][0] = '\0';
+	} else if (!options.filename) {
+		fprintf(stderr, "%s: no RVT-H device or disk image specified\n", argv[0]);
+		fprintf(stderr, "Try '%s --help' for more information.\n", argv[0]);
+		fuse_opt_free_args(&args);
+		return EXIT_FAILURE;
+	} else {
+		// Open the banks before daemonizing so errors can be shown.
+		// NOTE: No threads are created until the first read.
+		if (open_banks(options.filename) != 0) {
+			fuse_opt_free_args(&args);
+			return EXIT_FAILURE;
+		}
+		fuse_opt_add_arg(&args, "-oro");
+		fuse_opt_add_arg(&args, "-osubtype=rvth");
+	}
+
+	struct fuse_operations ops;
+	memset(&ops, 0, sizeof(ops));
+	ops.init = rvthfuse_init;
+	ops.getattr = rvthfuse_getattr;
+	ops.readdir = rvthfuse_readdir;
+	ops.open = rvthfuse_open;
+	ops.read = rvthfuse_read;
+
+	int ret = fuse_main(args.argc, args.argv, &ops, nullptr);
+	fuse_opt_free_args(&args);
+	close_banks();
+	return ret;
+}
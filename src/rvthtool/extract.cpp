@@ -28,8 +28,28 @@
 // C includes. (C++ namespace)
 #include <cassert>
 #include <cerrno>
+#include <cinttypes>
 #include <cstdlib>
 
+/**
+ * Print the digests of a disc image.
+ * @param digests	[in] Digests.
+ */
+static void print_digests(const RvtH_Digests *digests)
+{
+	printf("Size:  %" PRIu64 " bytes\n", digests->size);
+	printf("CRC32: %08x\n", digests->crc32);
+	fputs("MD5:   ", stdout);
+	for (unsigned int i = 0; i < sizeof(digests->md5); i++) {
+		printf("%02x", digests->md5[i]);
+	}
+	fputs("\nSHA-1: ", stdout);
+	for (unsigned int i = 0; i < sizeof(digests->sha1); i++) {
+		printf("%02x", digests->sha1[i]);
+	}
+	putchar('\n');
+}
+
 /**
  * RVT-H progress callback.
  * @param state		[in] Current progress.
@@ -65,6 +85,11 @@ static bool progress_callback(const RvtH_Progress_State *state, void *userdata)
 					state->lba_total / MEGABYTE);
 			}
 			break;
+		case RVTH_PROGRESS_DIGEST:
+			printf("\rHashing: %4u MiB / %4u MiB read...",
+				state->lba_processed / MEGABYTE,
+				state->lba_total / MEGABYTE);
+			break;
 		default:
 			// FIXME
 			assert(false);
@@ -74,21 +99,41 @@ static bool progress_callback(const RvtH_Progress_State *state, void *userdata)
 	if (state->lba_processed == state->lba_total) {
 		// Finished processing.
 		putchar('\n');
+		if (state->digests) {
+			print_digests(state->digests);
+		}
 	}
 	fflush(stdout);
 	return true;
 }
 
+/**
+ * Enable direct I/O for an RVT-H Reader.
+ * A warning is printed if direct I/O can't be enabled;
+ * buffered I/O will be used in that case.
+ * @param rvth	[in] RvtH object.
+ */
+static void enable_direct_io(RvtH *rvth)
+{
+	int ret = rvth->setDirectIO(true);
+	if (ret != 0) {
+		fprintf(stderr, "*** WARNING: Unable to enable direct I/O: %s\n", rvth_error(ret));
+		fputs("*** Buffered I/O will be used instead.\n\n", stderr);
+	}
+}
+
 /**
  * 'extract' command.
  * @param rvth_filename	[in] RVT-H device or disk image filename.
  * @param s_bank	[in] Bank number (as a string). (If NULL, assumes bank 1.)
  * @param gcm_filename	[in] Filename for the extracted GCM image.
- * @param recrypt_key	[in] Key for recryption. (-1 for default)
+ * @param recrypt_key	[in] Key for recryption. (-1 for default; RVL_CryptoType_None to decrypt)
  * @param flags		[in] Flags. (See RvtH_Extract_Flags.)
+ * @param direct_io	[in] If true, use direct I/O for RVT-H Reader devices.
+ * @param queue_depth	[in] I/O queue depth. (0 for default)
  * @return 0 on success; non-zero on error.
  */
-int extract(const TCHAR *rvth_filename, const TCHAR *s_bank, const TCHAR *gcm_filename, int recrypt_key, unsigned int flags)
+int extract(const TCHAR *rvth_filename, const TCHAR *s_bank, const TCHAR *gcm_filename, int recrypt_key, unsigned int flags, bool direct_io, unsigned int queue_depth)
 {
 	// Open the RVT-H device or disk image.
 	int ret;
@@ -101,6 +146,15 @@ int extract(const TCHAR *rvth_filename, const TCHAR *s_bank, const TCHAR *gcm_fi
 		return ret;
 	}
 
+	if (direct_io) {
+		// Use direct I/O for the RVT-H Reader.
+		enable_direct_io(rvth);
+	}
+	if (queue_depth != 0) {
+		// NOTE: The queue depth was validated by main().
+		rvth->setIoQueueDepth(queue_depth);
+	}
+
 	unsigned int bank;
 	if (s_bank) {
 		// Validate the bank number.
@@ -138,7 +192,13 @@ int extract(const TCHAR *rvth_filename, const TCHAR *s_bank, const TCHAR *gcm_fi
 	if (ret == 0) {
 		printf("Bank %u extracted to '", bank+1);
 		_fputts(gcm_filename, stdout);
-		fputs("' successfully.\n\n", stdout);
+		fputs("' successfully.\n", stdout);
+		if (flags & RVTH_EXTRACT_DIGESTS) {
+			fputs("Digests written to '", stdout);
+			_fputts(gcm_filename, stdout);
+			fputs(".digests'.\n", stdout);
+		}
+		putchar('\n');
 	} else {
 		// TODO: Delete the gcm file?
 		fprintf(stderr, "*** ERROR: rvth_extract() failed: %s\n", rvth_error(ret));
@@ -154,9 +214,12 @@ int extract(const TCHAR *rvth_filename, const TCHAR *s_bank, const TCHAR *gcm_fi
  * @param s_bank	Bank number (as a string).
  * @param gcm_filename	Filename of the GCM image to import.
  * @param ios_force	IOS version to force. (-1 to use the existing IOS)
+ * @param direct_io	If true, use direct I/O for RVT-H Reader devices.
+ * @param queue_depth	I/O queue depth. (0 for default)
+ * @param digests	If true, compute the digests of the GCM image while importing.
  * @return 0 on success; non-zero on error.
  */
-int import(const TCHAR *rvth_filename, const TCHAR *s_bank, const TCHAR *gcm_filename, int ios_force)
+int import(const TCHAR *rvth_filename, const TCHAR *s_bank, const TCHAR *gcm_filename, int ios_force, bool direct_io, unsigned int queue_depth, bool digests)
 {
 	// TODO: Verification for overwriting images.
 
@@ -171,6 +234,15 @@ int import(const TCHAR *rvth_filename, const TCHAR *s_bank, const TCHAR *gcm_fil
 		return ret;
 	}
 
+	if (direct_io) {
+		// Use direct I/O for the RVT-H Reader.
+		enable_direct_io(rvth);
+	}
+	if (queue_depth != 0) {
+		// NOTE: The queue depth was validated by main().
+		rvth->setIoQueueDepth(queue_depth);
+	}
+
 	// Validate the bank number.
 	TCHAR *endptr;
 	unsigned int bank = (unsigned int)_tcstoul(s_bank, &endptr, 10) - 1;
@@ -221,7 +293,9 @@ int import(const TCHAR *rvth_filename, const TCHAR *s_bank, const TCHAR *gcm_fil
 	fputs("Importing '", stdout);
 	_fputts(gcm_filename, stdout);
 	printf("' into Bank %u...\n", bank+1);
-	ret = rvth->import(bank, gcm_filename, progress_callback, nullptr, ios_force);
+	RvtH_Digests gcm_digests;
+	ret = rvth->import(bank, gcm_filename, progress_callback, nullptr, ios_force,
+		(digests ? &gcm_digests : nullptr));
 	if (ret == 0) {
 		fputc('\'', stdout);
 		_fputts(gcm_filename, stdout);
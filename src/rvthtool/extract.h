@@ -32,11 +32,13 @@ extern "C" {
  * @param rvth_filename	RVT-H device or disk image filename.
  * @param s_bank	Bank number (as a string). (If NULL, assumes bank 1.)
  * @param gcm_filename	Filename for the extracted GCM image.
- * @param recrypt_key	[in] Key for recryption. (-1 for default)
+ * @param recrypt_key	[in] Key for recryption. (-1 for default; RVL_CryptoType_None to decrypt)
  * @param flags		[in] Flags. (See RvtH_Extract_Flags.)
+ * @param direct_io	[in] If true, use direct I/O for RVT-H Reader devices.
+ * @param queue_depth	[in] I/O queue depth. (0 for default)
  * @return 0 on success; non-zero on error.
  */
-int extract(const TCHAR *rvth_filename, const TCHAR *s_bank, const TCHAR *gcm_filename, int recrypt_key, unsigned int flags);
+int extract(const TCHAR *rvth_filename, const TCHAR *s_bank, const TCHAR *gcm_filename, int recrypt_key, unsigned int flags, bool direct_io, unsigned int queue_depth);
 
 /**
  * 'import' command.
@@ -44,9 +46,12 @@ int extract(const TCHAR *rvth_filename, const TCHAR *s_bank, const TCHAR *gcm_fi
  * @param s_bank	Bank number (as a string).
  * @param gcm_filename	Filename of the GCM image to import.
  * @param ios_force	IOS version to force. (-1 to use the existing IOS)
+ * @param direct_io	If true, use direct I/O for RVT-H Reader devices.
+ * @param queue_depth	I/O queue depth. (0 for default)
+ * @param digests	If true, compute the digests of the GCM image while importing.
  * @return 0 on success; non-zero on error.
  */
-int import(const TCHAR *rvth_filename, const TCHAR *s_bank, const TCHAR *gcm_filename, int ios_force);
+int import(const TCHAR *rvth_filename, const TCHAR *s_bank, const TCHAR *gcm_filename, int ios_force, bool direct_io, unsigned int queue_depth, bool digests);
 
 #ifdef __cplusplus
 }
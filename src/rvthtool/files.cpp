@@ -0,0 +1,221 @@
+/***************************************************************************
+ * RVT-H Tool                                                              *
+ * files.cpp: List and extract files from a bank's file system.           *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "files.h"
+#include "list-banks.hpp"
+
+#include "librvth/rvth.hpp"
+#include "librvth/rvth_error.h"
+#include "librvth/nhcd_structs.h"
+#include "librvth/FST.hpp"
+
+// C includes. (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdlib>
+
+// C++ includes.
+#include <string>
+using std::string;
+
+#ifdef _UNICODE
+# include <windows.h>
+#endif /* _UNICODE */
+
+/**
+ * RVT-H progress callback.
+ * @param state		[in] Current progress.
+ * @param userdata	[in] User data specified when calling the RVT-H function.
+ * @return True to continue; false to abort.
+ */
+static bool progress_callback(const RvtH_Progress_State *state, void *userdata)
+{
+	UNUSED(userdata);
+	assert(state->type == RVTH_PROGRESS_EXTRACT);
+
+	#define KILOBYTE (1024 / LBA_SIZE)
+	printf("\rExtracting: %7u KiB / %7u KiB copied...",
+		state->lba_processed / KILOBYTE,
+		state->lba_total / KILOBYTE);
+
+	if (state->lba_processed == state->lba_total) {
+		// Finished processing.
+		putchar('\n');
+	}
+	fflush(stdout);
+	return true;
+}
+
+/**
+ * Open an RVT-H device or disk image and parse the bank number.
+ * @param rvth_filename	[in] RVT-H device or disk image filename.
+ * @param s_bank	[in] Bank number (as a string). (If NULL, assumes bank 1.)
+ * @param direct_io	[in] If true, use direct I/O for RVT-H Reader devices.
+ * @param pBank		[out] Bank number. (0-7)
+ * @param pErr		[out] Error code.
+ * @return RvtH object, or nullptr on error.
+ */
+static RvtH *open_bank(const TCHAR *rvth_filename, const TCHAR *s_bank, bool direct_io,
+	unsigned int *pBank, int *pErr)
+{
+	// Open the RVT-H device or disk image.
+	int ret;
+	RvtH *const rvth = new RvtH(rvth_filename, &ret);
+	if (ret != 0 || !rvth->isOpen()) {
+		fputs("*** ERROR opening RVT-H device '", stderr);
+		_fputts(rvth_filename, stderr);
+		fprintf(stderr, "': %s\n", rvth_error(ret));
+		delete rvth;
+		*pErr = ret;
+		return nullptr;
+	}
+
+	if (direct_io) {
+		// Use direct I/O for the RVT-H Reader.
+		ret = rvth->setDirectIO(true);
+		if (ret != 0) {
+			fprintf(stderr, "*** WARNING: Unable to enable direct I/O: %s\n", rvth_error(ret));
+			fputs("*** Buffered I/O will be used instead.\n\n", stderr);
+		}
+	}
+
+	unsigned int bank;
+	if (s_bank) {
+		// Validate the bank number.
+		TCHAR *endptr;
+		bank = (unsigned int)_tcstoul(s_bank, &endptr, 10) - 1;
+		if (*endptr != 0 || bank >= rvth->bankCount()) {
+			fputs("*** ERROR: Invalid bank number '", stderr);
+			_fputts(s_bank, stderr);
+			fputs("'.\n", stderr);
+			delete rvth;
+			*pErr = -EINVAL;
+			return nullptr;
+		}
+	} else {
+		// No bank number specified.
+		// Assume 1 bank if this is a standalone disc image.
+		// For HDD images or RVT-H Readers, this is an error.
+		if (rvth->bankCount() != 1) {
+			fprintf(stderr, "*** ERROR: Must specify a bank number for this RVT-H Reader%s.\n",
+				rvth->isHDD() ? "" : " disk image");
+			delete rvth;
+			*pErr = -EINVAL;
+			return nullptr;
+		}
+		bank = 0;
+	}
+
+	*pBank = bank;
+	*pErr = 0;
+	return rvth;
+}
+
+/**
+ * 'ls-files' command.
+ * @param rvth_filename	RVT-H device or disk image filename.
+ * @param s_bank	Bank number (as a string). (If NULL, assumes bank 1.)
+ * @return 0 on success; non-zero on error.
+ */
+int ls_files(const TCHAR *rvth_filename, const TCHAR *s_bank)
+{
+	unsigned int bank;
+	int ret;
+	RvtH *const rvth = open_bank(rvth_filename, s_bank, false, &bank, &ret);
+	if (!rvth) {
+		return ret;
+	}
+
+	// Print the bank information.
+	print_bank(rvth, bank);
+	putchar('\n');
+
+	FST *const fst = rvth->openFST(bank, &ret);
+	if (!fst) {
+		fprintf(stderr, "*** ERROR: Unable to load the file system of Bank %u: %s\n",
+			bank+1, rvth_error(ret));
+		delete rvth;
+		return ret;
+	}
+
+	printf("Files in Bank %u:\n", bank+1);
+	unsigned int file_count = 0, dir_count = 0;
+	uint64_t total_size = 0;
+	for (unsigned int i = 1; i < fst->count(); i++) {
+		const string path = fst->path(i);
+		if (fst->isDir(i)) {
+			printf("%12s  %s\n", "<DIR>", path.c_str());
+			dir_count++;
+		} else {
+			printf("%12u  %s\n", fst->fileSize(i), path.c_str());
+			file_count++;
+			total_size += fst->fileSize(i);
+		}
+	}
+	printf("%u file%s, %u director%s, %" PRIu64 " bytes\n\n",
+		file_count, (file_count != 1 ? "s" : ""),
+		dir_count, (dir_count != 1 ? "ies" : "y"),
+		total_size);
+
+	delete fst;
+	delete rvth;
+	return 0;
+}
+
+/**
+ * 'extract-file' command.
+ * @param rvth_filename	RVT-H device or disk image filename.
+ * @param s_bank	Bank number (as a string). (If NULL, assumes bank 1.)
+ * @param path		Path of the file within the bank's file system.
+ * @param out_filename	Filename for the extracted file.
+ * @param direct_io	If true, use direct I/O for RVT-H Reader devices.
+ * @return 0 on success; non-zero on error.
+ */
+int extract_file(const TCHAR *rvth_filename, const TCHAR *s_bank,
+	const TCHAR *path, const TCHAR *out_filename, bool direct_io)
+{
+	unsigned int bank;
+	int ret;
+	RvtH *const rvth = open_bank(rvth_filename, s_bank, direct_io, &bank, &ret);
+	if (!rvth) {
+		return ret;
+	}
+
+#ifdef _UNICODE
+	// FST names are stored using the ANSI code page.
+	char path_a[1024];
+	if (WideCharToMultiByte(CP_ACP, 0, path, -1, path_a, sizeof(path_a), nullptr, nullptr) <= 0) {
+		fputs("*** ERROR: Invalid path '", stderr);
+		_fputts(path, stderr);
+		fputs("'.\n", stderr);
+		delete rvth;
+		return -EINVAL;
+	}
+#else /* !_UNICODE */
+	const char *const path_a = path;
+#endif /* _UNICODE */
+
+	// Print the bank information.
+	print_bank(rvth, bank);
+	putchar('\n');
+
+	printf("Extracting '%s' from Bank %u into '", path_a, bank+1);
+	_fputts(out_filename, stdout);
+	fputs("'...\n", stdout);
+	ret = rvth->extractFile(bank, path_a, out_filename, progress_callback);
+	if (ret == 0) {
+		printf("File extracted successfully.\n\n");
+	} else {
+		fputc('\n', stderr);
+		fprintf(stderr, "*** ERROR: rvth->extractFile() failed: %s\n", rvth_error(ret));
+	}
+
+	delete rvth;
+	return ret;
+}
@@ -0,0 +1,42 @@
+/***************************************************************************
+ * RVT-H Tool                                                              *
+ * files.h: List and extract files from a bank's file system.             *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_RVTHTOOL_FILES_H__
+#define __RVTHTOOL_RVTHTOOL_FILES_H__
+
+#include "librvth/tcharx.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * 'ls-files' command.
+ * @param rvth_filename	RVT-H device or disk image filename.
+ * @param s_bank	Bank number (as a string). (If NULL, assumes bank 1.)
+ * @return 0 on success; non-zero on error.
+ */
+int ls_files(const TCHAR *rvth_filename, const TCHAR *s_bank);
+
+/**
+ * 'extract-file' command.
+ * @param rvth_filename	RVT-H device or disk image filename.
+ * @param s_bank	Bank number (as a string). (If NULL, assumes bank 1.)
+ * @param path		Path of the file within the bank's file system.
+ * @param out_filename	Filename for the extracted file.
+ * @param direct_io	If true, use direct I/O for RVT-H Reader devices.
+ * @return 0 on success; non-zero on error.
+ */
+int extract_file(const TCHAR *rvth_filename, const TCHAR *s_bank,
+	const TCHAR *path, const TCHAR *out_filename, bool direct_io);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RVTHTOOL_RVTHTOOL_FILES_H__ */
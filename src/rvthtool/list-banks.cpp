@@ -382,6 +382,9 @@ int list_banks(const TCHAR *rvth_filename)
 		putchar('\n');
 	}
 
+	// Load all of the bank entries at once.
+	// This also updates the bank cache.
+	rvth->prefetchBankEntries();
 	print_bank_table(rvth);
 	delete rvth;
 	return 0;
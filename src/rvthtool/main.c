@@ -28,6 +28,8 @@
 #include "list-banks.hpp"
 #include "extract.h"
 #include "undelete.h"
+#include "verify.h"
+#include "files.h"
 #include "query.h"
 
 #ifdef _MSC_VER
@@ -109,6 +111,18 @@ static void print_help(const TCHAR *argv0)
 		"- Undelete the specified bank number from the specified RVT-H device.\n"
 		"  [This command only works with RVT-H Readers, not disk images.]\n"
 		"\n"
+		"verify " DEVICE_NAME_EXAMPLE " bank#\n"
+		"- Verify the hash tables of all partitions in the specified bank.\n"
+		"  [This command only works with encrypted Wii disc images.]\n"
+		"\n"
+		"ls-files " DEVICE_NAME_EXAMPLE " bank#\n"
+		"- List the files in the specified bank's file system.\n"
+		"  For Wii disc images, the game partition is listed.\n"
+		"\n"
+		"extract-file " DEVICE_NAME_EXAMPLE " bank# /path/in/disc file.bin\n"
+		"- Extract a single file from the specified bank's file system.\n"
+		"  Only the parts of the disc containing the file are read.\n"
+		"\n"
 		"query\n"
 		"- Query all available RVT-H Reader devices and list them.\n"
 #ifndef HAVE_QUERY
@@ -121,11 +135,31 @@ static void print_help(const TCHAR *argv0)
 		"Options:\n"
 		"\n"
 		"  -k, --recrypt=KEY         Recrypt the image using the specified KEY:\n"
-		"                            default, retail, korean, debug\n"
+		"                            default, retail, korean, debug, none\n"
 		"                            Recrypting to retail will use fakesigning.\n"
+		"                            'none' decrypts the image, removing the\n"
+		"                            hash tables. (extract only)\n"
 		"                            Importing to RVT-H will always use debug keys.\n"
 		"  -N, --ndev                Prepend extracted images with a 32 KB header\n"
 		"                            required by official SDK tools.\n"
+		"  -C, --ciso                Extract images in CISO format. Empty blocks\n"
+		"                            are not stored. Cannot be used with recryption.\n"
+		"  -W, --wbfs                Extract images in WBFS format. Empty blocks\n"
+		"                            are not stored. Cannot be used with recryption.\n"
+		"  -A, --wbfs-append         Add extracted images to an existing WBFS file\n"
+		"                            or partition instead of creating a new file.\n"
+		"  -S, --scrub               Only extract the parts of the disc used by the\n"
+		"                            headers, partitions, and file systems. Unused\n"
+		"                            areas are left sparse. Cannot be used with\n"
+		"                            recryption.\n"
+		"  -H, --hash                Compute the CRC32, MD5, and SHA-1 of the disc\n"
+		"                            image while extracting or importing. Extracted\n"
+		"                            images also get a '.digests' file.\n"
+		"  -D, --direct-io           Use direct I/O when reading from or writing to\n"
+		"                            an RVT-H Reader. This bypasses the OS page cache.\n"
+		"  -Q, --queue-depth=N       Number of 1 MB requests to keep in flight when\n"
+		"                            extracting or importing. (2-64; default is 4)\n"
+		"                            io_uring is used on Linux if it's available.\n"
 #ifdef SHOW_HIDDEN_OPTIONS
 		"  -I, --ios=xx              Force IOSxx when importing a disc image to\n"
 		"                            an RVT-H Reader."
@@ -149,6 +183,13 @@ int RVTH_CDECL _tmain(int argc, TCHAR *argv[])
 	// Default is -1, or "use existing IOS".
 	int ios_force = -1;
 
+	// Use direct I/O for RVT-H Reader devices.
+	bool direct_io = false;
+
+	// I/O queue depth for extracting and importing.
+	// 0 == default
+	unsigned int queue_depth = 0;
+
 #ifdef _WIN32
 	// Set Win32 security options.
 	secoptions_init();
@@ -177,13 +218,20 @@ int RVTH_CDECL _tmain(int argc, TCHAR *argv[])
 		static const struct option long_options[] = {
 			{_T("recrypt"),	required_argument,	0, _T('k')},
 			{_T("ndev"),	no_argument,		0, _T('N')},
+			{_T("ciso"),	no_argument,		0, _T('C')},
+			{_T("wbfs"),	no_argument,		0, _T('W')},
+			{_T("wbfs-append"), no_argument,	0, _T('A')},
+			{_T("scrub"),	no_argument,		0, _T('S')},
+			{_T("hash"),	no_argument,		0, _T('H')},
+			{_T("direct-io"), no_argument,		0, _T('D')},
+			{_T("queue-depth"), required_argument,	0, _T('Q')},
 			{_T("ios"),	required_argument,	0, _T('I')},
 			{_T("help"),	no_argument,		0, _T('h')},
 
 			{NULL, 0, 0, 0}
 		};
 
-		int c = getopt_long(argc, argv, _T("k:NI:h"), long_options, NULL);
+		int c = getopt_long(argc, argv, _T("k:NCWASHDQ:I:h"), long_options, NULL);
 		if (c == -1)
 			break;
 
@@ -203,6 +251,8 @@ int RVTH_CDECL _tmain(int argc, TCHAR *argv[])
 					recrypt_key = RVL_CryptoType_Retail;
 				} else if (!_tcsicmp(optarg, _T("korean"))) {
 					recrypt_key = RVL_CryptoType_Korean;
+				} else if (!_tcsicmp(optarg, _T("none"))) {
+					recrypt_key = RVL_CryptoType_None;
 				} else {
 					print_error(argv[0], _T("unknown encryption key '%s'"), optarg);
 					return EXIT_FAILURE;
@@ -215,6 +265,51 @@ int RVTH_CDECL _tmain(int argc, TCHAR *argv[])
 				flags |= RVTH_EXTRACT_PREPEND_SDK_HEADER;
 				break;
 
+			case 'C':
+				// Extract in CISO format.
+				flags |= RVTH_EXTRACT_CISO;
+				break;
+
+			case 'W':
+				// Extract in WBFS format.
+				flags |= RVTH_EXTRACT_WBFS;
+				break;
+
+			case 'A':
+				// Add to an existing WBFS image.
+				flags |= RVTH_EXTRACT_WBFS | RVTH_EXTRACT_WBFS_APPEND;
+				break;
+
+			case 'S':
+				// Only extract the used data.
+				flags |= RVTH_EXTRACT_SCRUB;
+				break;
+
+			case 'H':
+				// Compute digests while copying.
+				flags |= RVTH_EXTRACT_DIGESTS;
+				break;
+
+			case 'D':
+				// Use direct I/O for RVT-H Reader devices.
+				direct_io = true;
+				break;
+
+			case 'Q': {
+				// I/O queue depth.
+				char *endptr;
+				long queue_depth_tmp = strtol(optarg, &endptr, 0);
+				if (*endptr != '\0') {
+					print_error(argv[0], _T("unable to parse '%s' as a queue depth"), optarg);
+					return EXIT_FAILURE;
+				} else if (queue_depth_tmp < 2 || queue_depth_tmp > RVTH_IO_QUEUE_DEPTH_MAX) {
+					print_error(argv[0], _T("queue depth %ld is out of range"), queue_depth_tmp);
+					return EXIT_FAILURE;
+				}
+				queue_depth = (unsigned int)queue_depth_tmp;
+				break;
+			}
+
 			case 'I': {
 				// Force an IOS version.
 				char *endptr;
@@ -270,10 +365,10 @@ int RVTH_CDECL _tmain(int argc, TCHAR *argv[])
 			// Pass NULL as the bank number, which will be
 			// interpreted as bank 1 for single-disc images
 			// and an error for HDD images.
-			ret = extract(argv[optind+1], NULL, argv[optind+2], recrypt_key, flags);
+			ret = extract(argv[optind+1], NULL, argv[optind+2], recrypt_key, flags, direct_io, queue_depth);
 		} else {
 			// Three or more parameters specified.
-			ret = extract(argv[optind+1], argv[optind+2], argv[optind+3], recrypt_key, flags);
+			ret = extract(argv[optind+1], argv[optind+2], argv[optind+3], recrypt_key, flags, direct_io, queue_depth);
 		}
 	} else if (!_tcscmp(argv[optind], _T("import"))) {
 		// Import a bank.
@@ -281,7 +376,8 @@ int RVTH_CDECL _tmain(int argc, TCHAR *argv[])
 			print_error(argv[0], _T("missing parameters for 'import'"));
 			return EXIT_FAILURE;
 		}
-		ret = import(argv[optind+1], argv[optind+2], argv[optind+3], ios_force);
+		ret = import(argv[optind+1], argv[optind+2], argv[optind+3], ios_force, direct_io, queue_depth,
+			(flags & RVTH_EXTRACT_DIGESTS) != 0);
 	} else if (!_tcscmp(argv[optind], _T("delete"))) {
 		// Delete a bank.
 		if (argc < 3) {
@@ -296,6 +392,51 @@ int RVTH_CDECL _tmain(int argc, TCHAR *argv[])
 			return EXIT_FAILURE;
 		}
 		ret = undelete_bank(argv[optind+1], argv[optind+2]);
+	} else if (!_tcscmp(argv[optind], _T("verify"))) {
+		// Verify a bank.
+		if (argc < optind+2) {
+			print_error(argv[0], _T("missing parameters for 'verify'"));
+			return EXIT_FAILURE;
+		} else if (argc == optind+2) {
+			// One parameter specified.
+			// Pass NULL as the bank number, which will be
+			// interpreted as bank 1 for single-disc images
+			// and an error for HDD images.
+			ret = verify(argv[optind+1], NULL, direct_io);
+		} else {
+			// Two or more parameters specified.
+			ret = verify(argv[optind+1], argv[optind+2], direct_io);
+		}
+	} else if (!_tcscmp(argv[optind], _T("ls-files"))) {
+		// List files in a bank.
+		if (argc < optind+2) {
+			print_error(argv[0], _T("missing parameters for 'ls-files'"));
+			return EXIT_FAILURE;
+		} else if (argc == optind+2) {
+			// One parameter specified.
+			// Pass NULL as the bank number, which will be
+			// interpreted as bank 1 for single-disc images
+			// and an error for HDD images.
+			ret = ls_files(argv[optind+1], NULL);
+		} else {
+			// Two or more parameters specified.
+			ret = ls_files(argv[optind+1], argv[optind+2]);
+		}
+	} else if (!_tcscmp(argv[optind], _T("extract-file"))) {
+		// Extract a file from a bank.
+		if (argc < optind+4) {
+			print_error(argv[0], _T("missing parameters for 'extract-file'"));
+			return EXIT_FAILURE;
+		} else if (argc == optind+4) {
+			// Three parameters specified.
+			// Pass NULL as the bank number, which will be
+			// interpreted as bank 1 for single-disc images
+			// and an error for HDD images.
+			ret = extract_file(argv[optind+1], NULL, argv[optind+2], argv[optind+3], direct_io);
+		} else {
+			// Four or more parameters specified.
+			ret = extract_file(argv[optind+1], argv[optind+2], argv[optind+3], argv[optind+4], direct_io);
+		}
 	} else if (!_tcscmp(argv[optind], _T("query"))) {
 		// Query RVT-H Reader devices.
 		// NOTE: Not checking HAVE_QUERY. If querying isn't available,
@@ -0,0 +1,143 @@
+/***************************************************************************
+ * RVT-H Tool                                                              *
+ * verify.cpp: Verify the hash tree of a Wii disc image.                   *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#include "verify.h"
+#include "list-banks.hpp"
+
+#include "librvth/rvth.hpp"
+#include "librvth/rvth_error.h"
+#include "librvth/nhcd_structs.h"
+
+// C includes. (C++ namespace)
+#include <cassert>
+#include <cerrno>
+#include <cstdlib>
+
+/**
+ * RVT-H progress callback.
+ * @param state		[in] Current progress.
+ * @param userdata	[in] User data specified when calling the RVT-H function.
+ * @return True to continue; false to abort.
+ */
+static bool progress_callback(const RvtH_Progress_State *state, void *userdata)
+{
+	UNUSED(userdata);
+	assert(state->type == RVTH_PROGRESS_VERIFY);
+
+	#define MEGABYTE (1048576 / LBA_SIZE)
+	printf("\rVerifying: %4u MiB / %4u MiB checked...",
+		state->lba_processed / MEGABYTE,
+		state->lba_total / MEGABYTE);
+
+	if (state->lba_processed == state->lba_total) {
+		// Finished processing.
+		putchar('\n');
+	}
+	fflush(stdout);
+	return true;
+}
+
+/**
+ * RVT-H verification error callback.
+ * @param error		[in] Verification error.
+ * @param userdata	[in] User data specified when calling the RVT-H function.
+ * @return True to continue; false to abort.
+ */
+static bool verify_error_callback(const RvtH_Verify_Error *error, void *userdata)
+{
+	UNUSED(userdata);
+
+	// Overwrite the progress line.
+	// NOTE: Error messages are longer than the progress line.
+	putchar('\r');
+
+	if (error->type == RVTH_VERIFY_ERROR_H4) {
+		printf("*** Partition %u: H3 table at LBA 0x%08X doesn't match the TMD content hash.\n",
+			error->pt_idx, error->lba);
+	} else if (error->type == RVTH_VERIFY_ERROR_H0) {
+		printf("*** Partition %u: Group %u, sector %u (LBA 0x%08X): H0 hash mismatch for block %u.\n",
+			error->pt_idx, error->group, error->sector, error->lba, error->block);
+	} else {
+		printf("*** Partition %u: Group %u, sector %u (LBA 0x%08X): H%d hash mismatch.\n",
+			error->pt_idx, error->group, error->sector, error->lba,
+			static_cast<int>(error->type - RVTH_VERIFY_ERROR_H0));
+	}
+	fflush(stdout);
+	return true;
+}
+
+/**
+ * 'verify' command.
+ * @param rvth_filename	RVT-H device or disk image filename.
+ * @param s_bank	Bank number (as a string). (If NULL, assumes bank 1.)
+ * @param direct_io	If true, use direct I/O for RVT-H Reader devices.
+ * @return 0 on success; non-zero on error.
+ */
+int verify(const TCHAR *rvth_filename, const TCHAR *s_bank, bool direct_io)
+{
+	// Open the RVT-H device or disk image.
+	int ret;
+	RvtH *const rvth = new RvtH(rvth_filename, &ret);
+	if (ret != 0 || !rvth->isOpen()) {
+		fputs("*** ERROR opening RVT-H device '", stderr);
+		_fputts(rvth_filename, stderr);
+		fprintf(stderr, "': %s\n", rvth_error(ret));
+		delete rvth;
+		return ret;
+	}
+
+	if (direct_io) {
+		// Use direct I/O for the RVT-H Reader.
+		ret = rvth->setDirectIO(true);
+		if (ret != 0) {
+			fprintf(stderr, "*** WARNING: Unable to enable direct I/O: %s\n", rvth_error(ret));
+			fputs("*** Buffered I/O will be used instead.\n\n", stderr);
+		}
+	}
+
+	unsigned int bank;
+	if (s_bank) {
+		// Validate the bank number.
+		TCHAR *endptr;
+		bank = (unsigned int)_tcstoul(s_bank, &endptr, 10) - 1;
+		if (*endptr != 0 || bank >= rvth->bankCount()) {
+			fputs("*** ERROR: Invalid bank number '", stderr);
+			_fputts(s_bank, stderr);
+			fputs("'.\n", stderr);
+			delete rvth;
+			return -EINVAL;
+		}
+	} else {
+		// No bank number specified.
+		// Assume 1 bank if this is a standalone disc image.
+		// For HDD images or RVT-H Readers, this is an error.
+		if (rvth->bankCount() != 1) {
+			fprintf(stderr, "*** ERROR: Must specify a bank number for this RVT-H Reader%s.\n",
+				rvth->isHDD() ? "" : " disk image");
+			delete rvth;
+			return -EINVAL;
+		}
+		bank = 0;
+	}
+
+	// Print the bank information.
+	// TODO: Make sure the bank type is valid before printing the newline.
+	print_bank(rvth, bank);
+	putchar('\n');
+
+	printf("Verifying Bank %u...\n", bank+1);
+	ret = rvth->verifyWiiPartitions(bank, verify_error_callback, progress_callback);
+	if (ret == 0) {
+		printf("Bank %u verified successfully. All hashes are valid.\n\n", bank+1);
+	} else {
+		fprintf(stderr, "*** ERROR: rvth->verifyWiiPartitions() failed: %s\n", rvth_error(ret));
+	}
+
+	delete rvth;
+	return ret;
+}
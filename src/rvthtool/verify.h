@@ -0,0 +1,31 @@
+/***************************************************************************
+ * RVT-H Tool                                                              *
+ * verify.h: Verify the hash tree of a Wii disc image.                     *
+ *                                                                         *
+ * Copyright (c) 2018-2020 by David Korth.                                 *
+ * SPDX-License-Identifier: GPL-2.0-or-later                               *
+ ***************************************************************************/
+
+#ifndef __RVTHTOOL_RVTHTOOL_VERIFY_H__
+#define __RVTHTOOL_RVTHTOOL_VERIFY_H__
+
+#include "librvth/tcharx.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * 'verify' command.
+ * @param rvth_filename	RVT-H device or disk image filename.
+ * @param s_bank	Bank number (as a string). (If NULL, assumes bank 1.)
+ * @param direct_io	If true, use direct I/O for RVT-H Reader devices.
+ * @return 0 on success; non-zero on error.
+ */
+int verify(const TCHAR *rvth_filename, const TCHAR *s_bank, bool direct_io);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RVTHTOOL_RVTHTOOL_VERIFY_H__ */